@@ -0,0 +1,158 @@
+// blobstream.cpp -- send large blobs as a sequence of chunk messages
+//
+// A blob that is too large to send as one message (or so large that
+// sending it would hold up other messages on the connection for a long
+// time) is sent in chunks. Each chunk is a separate TCP message, and a
+// chunk is only sent when o2_can_send() reports that the connection has
+// no pending output, so a stream never builds up a queue of chunks and
+// other messages can be sent between chunks. At most
+// STREAM_CHUNKS_PER_POLL chunks of each stream are sent per o2_poll().
+
+#include "o2internal.h"
+#include "blobstream.h"
+
+#define STREAM_CHUNKS_PER_POLL 4
+#define STREAM_DEFAULT_CHUNK_SIZE 32768
+
+class Blob_stream : public O2obj {
+  public:
+    int id;
+    char *address;     // where to send chunks (owned)
+    char *service;     // service part of address, for o2_can_send (owned)
+    const char *data;  // blob data (owned by the caller)
+    int64_t size;      // total size of the blob
+    int64_t sent;      // how many bytes have been sent
+    int32_t chunk_size;
+    o2_stream_callback callback;
+    void *rock;
+};
+
+static Vec<Blob_stream *> streams;
+static int next_stream_id = 1;
+
+
+// remove stream at index from streams, call the callback, and free it
+static void stream_end(int index, O2err status)
+{
+    Blob_stream *bs = streams[index];
+    streams.erase(index);  // keep order so streams take turns
+    if (bs->callback) {
+        (*bs->callback)(bs->id, status, bs->rock);
+    }
+    O2_FREE(bs->address);
+    O2_FREE(bs->service);
+    delete bs;
+}
+
+
+int o2_blob_stream(const char *address, const void *data, int64_t size,
+                   int32_t chunk_size, o2_stream_callback callback,
+                   void *rock)
+{
+    if (!o2_ensemble_name) {
+        return O2_NOT_INITIALIZED;
+    }
+    if (!address || (address[0] != '/' && address[0] != '!') ||
+        !address[1]) {
+        return O2_BAD_NAME;
+    }
+    if (size < 0 || (size > 0 && !data) || chunk_size < 0) {
+        return O2_BAD_ARGS;
+    }
+    if (chunk_size == 0) {
+        chunk_size = STREAM_DEFAULT_CHUNK_SIZE;
+    }
+    // find the service name, which is address up to the next '/'
+    const char *slash = strchr(address + 1, '/');
+    int service_len = (int) (slash ? slash - (address + 1)
+                                   : strlen(address + 1));
+    if (service_len == 0 || service_len >= NAME_BUF_LEN) {
+        return O2_BAD_NAME;
+    }
+    Blob_stream *bs = new Blob_stream;
+    bs->id = next_stream_id++;
+    bs->address = (char *) o2_heapify(address);
+    bs->service = O2_MALLOCNT(service_len + 1, char);
+    memcpy(bs->service, address + 1, service_len);
+    bs->service[service_len] = 0;
+    bs->data = (const char *) data;
+    bs->size = size;
+    bs->sent = 0;
+    bs->chunk_size = chunk_size;
+    bs->callback = callback;
+    bs->rock = rock;
+    streams.push_back(bs);
+    return bs->id;
+}
+
+
+O2err o2_blob_stream_cancel(int stream_id)
+{
+    for (int i = 0; i < streams.size(); i++) {
+        if (streams[i]->id == stream_id) {
+            stream_end(i, O2_FAIL);
+            return O2_SUCCESS;
+        }
+    }
+    return O2_FAIL;
+}
+
+
+// send one chunk of bs. Returns O2_SUCCESS or an error from sending
+static O2err stream_send_chunk(Blob_stream *bs)
+{
+    int64_t len = bs->size - bs->sent;
+    if (len > bs->chunk_size) len = bs->chunk_size;
+    RETURN_IF_ERROR(o2_send_start());
+    o2_add_int32(bs->id);
+    o2_add_int64(bs->sent);
+    o2_add_int64(bs->size);
+    o2_add_blob_data((uint32_t) len, (void *) (bs->data + bs->sent));
+    O2err err = o2_send_finish(0.0, bs->address, true);
+    if (err == O2_SUCCESS) {
+        bs->sent += len;
+    }
+    return err;
+}
+
+
+void o2_stream_poll()
+{
+    int i = 0;
+    while (i < streams.size()) {
+        Blob_stream *bs = streams[i];
+        O2err status = O2_SUCCESS;
+        for (int n = 0; n < STREAM_CHUNKS_PER_POLL; n++) {
+            status = o2_can_send(bs->service);
+            if (status != O2_SUCCESS) {
+                break;  // O2_BLOCKED or no such service
+            }
+            status = stream_send_chunk(bs);
+            // sending zero bytes still sends one (empty) chunk
+            if (status != O2_SUCCESS || bs->sent >= bs->size) {
+                break;
+            }
+        }
+        if (status == O2_BLOCKED) {
+            i++;  // try again on the next poll
+        } else if (status != O2_SUCCESS) {
+            stream_end(i, status);  // removes streams[i]
+        } else if (bs->sent >= bs->size) {
+            stream_end(i, O2_SUCCESS);  // removes streams[i]
+        } else {
+            i++;
+        }
+        if (!o2_ensemble_name) { // a callback called o2_finish()
+            return;
+        }
+    }
+}
+
+
+void o2_stream_finish()
+{
+    while (streams.size() > 0) {
+        stream_end(0, O2_FAIL);
+    }
+    streams.finish();
+}
@@ -0,0 +1,14 @@
+// blobstream.h -- send large blobs as a sequence of chunk messages
+//
+// See o2_blob_stream() in o2.h for the message format.
+
+#ifndef BLOBSTREAM_H
+#define BLOBSTREAM_H
+
+// send the next chunks of active streams; called by o2_poll()
+void o2_stream_poll();
+
+// cancel all streams (their callbacks get O2_FAIL); called by o2_finish()
+void o2_stream_finish();
+
+#endif
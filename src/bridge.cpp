@@ -137,10 +137,24 @@ O2err Bridge_protocol::remove_services(Bridge_info *bi)
 }
 
 
+// index of the first protocol for o2_poll_bridges() to poll (see
+// o2_poll_budget())
+static int next_bridge = 0;
+
 int o2_poll_bridges()
 {
     if (!bridges_initialized) return O2_FAIL;
-    for (int i = 0; i < bridges.size(); i++) {
+    // poll protocols round-robin, starting where the poll budget (if
+    // any) stopped the previous call:
+    int n = bridges.size();
+    int start = (next_bridge < n ? next_bridge : 0);
+    int msgs = o2_poll_msgs;
+    for (int k = 0; k < n; k++) {
+        int i = (start + k) % n;
+        if (o2_poll_msgs > msgs && O2_POLL_BUDGET_EXHAUSTED()) {
+            next_bridge = i;  // start here in the next poll
+            break;
+        }
         Bridge_protocol *proto = bridges[i];
         proto->bridge_poll();
     }
@@ -436,6 +450,7 @@ public:
         return O2_FAIL;
     }
     O2err connected() { return O2_FAIL; } // we are not a TCP client
+    bool thread_io() { return true; }  // only sends with Fds_info methods
 };
 
 
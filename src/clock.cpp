@@ -3,6 +3,8 @@
 // Roger Dannenberg, 2016
 
 #include <ctype.h>
+#include <math.h>
+#include <atomic>
 #include "o2internal.h"
 #include "services.h"
 #include "message.h"
@@ -36,21 +38,123 @@ static o2_time_jump_callback time_jump_callback = NULL;
 static void *time_callback_data = NULL;
 static int clock_rate_id = 0;
 // data for clock sync. Each reply results in the computation of the
-// round-trip time and the reference-vs-local offset. These results are
-// stored at ping_reply_count % CLOCK_SYNC_HISTORY_LEN
+// round-trip time and the reference-vs-local offset. These results
+// (and samples from beacons, see below) are stored in clock_samples at
+// sample_count % CLOCK_FILTER_LEN. Round trip times are also stored in
+// ping_rtt at ping_reply_count % CLOCK_SYNC_HISTORY_LEN. Clock sync is
+// obtained after CLOCK_SYNC_HISTORY_LEN replies, and o2_roundtrip()
+// reports on the last CLOCK_SYNC_HISTORY_LEN replies.
 #define CLOCK_SYNC_HISTORY_LEN 5
+// The offset and drift (rate difference) of the reference clock are
+// estimated by a least squares fit to the samples in clock_samples
+// whose round trip time is close to the minimum (see clock_estimate()):
+#define CLOCK_FILTER_LEN 16
+// samples with round trip time above min * CLOCK_RTT_FACTOR +
+// CLOCK_RTT_SLACK are delayed by queueing, so they are not used:
+#define CLOCK_RTT_FACTOR 1.5
+#define CLOCK_RTT_SLACK 20e-6
+// drift is not estimated until used samples span this many seconds:
+#define CLOCK_DRIFT_MIN_SPAN 2.0
+#define CLOCK_DRIFT_MAX 1e-3   // assume clock rates differ by < 1000 ppm
+// after the first 5s, pings are sent every ping_interval seconds. The
+// interval grows while measured errors are below half the tolerance,
+// which is CLOCK_ERROR_TARGET or 3 times the jitter of the samples if
+// that is larger. It shrinks when errors exceed the tolerance (e.g.
+// the drift changed) or when replies are delayed twice in a row
+// (jitter is rising):
+#define CLOCK_ERROR_TARGET 100e-6
+#define CLOCK_PING_MIN 0.5
+#define CLOCK_PING_START 1.0
+#define CLOCK_PING_MAX 30.0
+typedef struct Clock_sample {
+    O2time local;   // local time when the reply was received
+    O2time offset;  // reference minus local time
+    O2time rtt;     // round trip time
+} Clock_sample;
 static int ping_reply_count = 0;
-static O2time round_trip_time[CLOCK_SYNC_HISTORY_LEN];
-static O2time ref_minus_local[CLOCK_SYNC_HISTORY_LEN];
+static O2time ping_rtt[CLOCK_SYNC_HISTORY_LEN];
+static int sample_count = 0;
+static Clock_sample clock_samples[CLOCK_FILTER_LEN];
+static double drift_rate = 0;  // estimated reference rate / local rate - 1
+static O2time ping_interval = CLOCK_PING_START;
+static O2time offset_jitter = 0;  // std. deviation of used samples from fit
+static int delayed_replies = 0;   // consecutive replies above rtt limit
+// statistics for o2_clock_stats():
+static O2time last_correction = 0;  // last new_ref minus our estimate
+static int64_t clock_jumps = 0;
+static int64_t clock_slews = 0;
+static int64_t samples_total = 0;
+static int64_t samples_delayed = 0;
+static O2time last_good_time = -1;  // local time of last undelayed sample
+
+// Clock beacons (see o2_clock_beacons()): every beacon_period, the
+// reference sends !_o2/cs/bc "ssift" with the ensemble name, its process
+// name, a sequence number, beacon_period and its time to the UDP ports
+// of the processes it is connected to, by broadcast and to localhost.
+// These are discovery ports, so there are at most a few of them no
+// matter how many processes there are. Other processes turn each beacon
+// into a clock sample by adding the path delay, beacon_delay, and ping
+// only every CLOCK_BEACON_PING seconds. Each ping reply gives an offset
+// that is compared to the least delayed recent beacon to update
+// beacon_delay. (Until then, half the minimum round trip time is used.)
+#define CLOCK_BEACON_PING 60.0
+static double beacon_period = 0;   // 0 means do not send beacons
+static int beacon_send_id = 0;     // cancels previously scheduled sends
+static int beacon_seq = 0;         // sequence number of next beacon
+static bool beacon_broadcast = true;  // false after broadcast fails
+static int beacon_last_seq = -1;   // last beacon received (duplicates
+                                   // arrive by broadcast and localhost)
+static O2time beacon_last_time = -1;  // local time of last beacon received
+static double beacon_rcv_period = 0;  // period of received beacons
+// reference minus local time for the last CLOCK_SYNC_HISTORY_LEN beacons
+// received, without adding the path delay:
+static O2time beacon_raw[CLOCK_SYNC_HISTORY_LEN];
+static int beacon_count = 0;
+static O2time beacon_delay = -1;  // estimated path delay, -1 if unknown
 
 static O2time time_offset = 0.0; // added to time_callback()
 
+// Time sources for o2_local_time() (see o2_time_source()). Each has a
+// fast reader, used by o2_local_time(), and a precise reader on the same
+// time line, used to measure clock sync round trips: O2_TIME_POLL
+// reads o2_native_time() once per o2_poll() (in o2_clock_poll()), and
+// O2_TIME_COARSE reads CLOCK_MONOTONIC_COARSE, which is CLOCK_MONOTONIC
+// rounded down to the last kernel tick. O2_TIME_TSC reads the x86 time
+// stamp counter, converted to CLOCK_MONOTONIC seconds with a rate that
+// is measured over TSC_CALIBRATE_MS when selected and refined every
+// TSC_REFINE_PERIOD by o2_clock_poll().
+static O2time_source time_source = O2_TIME_NATIVE;
+static O2time poll_time = 0;  // o2_native_time() at start of o2_poll()
+
+#if defined(__linux__) && (defined(__x86_64__) || defined(__i386__)) && \
+    defined(__GNUC__)
+#define O2_TSC 1
+#include <x86intrin.h>
+#include <cpuid.h>
+#define TSC_CALIBRATE_MS 10
+#define TSC_REFINE_PERIOD 1.0
+static uint64_t tsc_start;   // counter when calibration started
+static double mono_start;    // CLOCK_MONOTONIC when calibration started
+// tsc_time() may be called from other threads (e.g. a shared memory
+// process) while o2_clock_poll() recalibrates, so each calibration is
+// written to the unused slot of tsc_cals and then published as a whole
+// by swapping tsc_cal:
+typedef struct Tsc_cal {
+    uint64_t base;       // counter at base_time
+    double base_time;
+    double period;       // seconds per count
+} Tsc_cal;
+static Tsc_cal tsc_cals[2];
+static std::atomic<Tsc_cal *> tsc_cal(&tsc_cals[0]);
+#endif
+
 #ifdef __APPLE__
 #include "sys/time.h"
 #include "CoreAudio/HostTime.h"
 static uint64_t start_time;
 #elif __linux__
 #include "sys/time.h"
+#include <time.h>
 static long start_time;
 #elif WIN32
 static long start_time;
@@ -103,7 +207,7 @@ static void catch_up_handler(O2msg_data_ptr msg, const char *types,
     // assume the scheduler sets local_now and global_now
     global_time_base = LOCAL_TO_GLOBAL(msg->timestamp);
     local_time_base = msg->timestamp;
-    clock_rate = 1.0;
+    clock_rate = 1.0 + drift_rate;
 }
 
 
@@ -126,35 +230,42 @@ static void set_clock(double local_time, double new_ref)
     O2_DBk(hdprintf("set_clock: using %.3f, should be %.3f\n",
                     global_time_base, new_ref));
      double clock_advance = new_ref - global_time_base; // how far to catch up
+    last_correction = clock_advance;
     clock_rate_id++; // cancel any previous calls to catch_up_handler()
     // compute when we will catch up: estimate will increase at clock_rate
-    // while (we assume) reference increases at rate 1, so at what t will
+    // while (we assume) reference increases at rate r = 1 + drift_rate,
+    // so at what t will
     //   global_time_base + (t - local_time_base) * clock_rate ==
-    //   new_ref + (t - local_time_base)
+    //   new_ref + (t - local_time_base) * r
     // =>
     //   new_ref - global_time_base ==
-    //       (t - local_time_base) * clock_rate - (t - local_time_base)
+    //       (t - local_time_base) * clock_rate - (t - local_time_base) * r
     // =>
-    //   clock_advance == (clock_rate - 1) * (t - local_time_base)
+    //   clock_advance == (clock_rate - r) * (t - local_time_base)
     // =>
-    //   t == local_time_base + clock_advance / (clock_rate - 1)
+    //   t == local_time_base + clock_advance / (clock_rate - r)
+    double rate = 1.0 + drift_rate;
     if (clock_advance > 1) {
         if ((!time_jump_callback) ||
             (!(*time_jump_callback)
                     (local_time_base, global_time_base, new_ref))) {
-            clock_rate = 1.0;
+            clock_rate = rate;
             global_time_base = new_ref;  // we are way behind: jump ahead
+            clock_jumps++;
         }
     } else if (clock_advance > 0) { // we are a little behind,
-        clock_rate = 1.1;           // go faster to catch up
+        clock_rate = rate + 0.1;    // go faster to catch up
         will_catch_up_after(clock_advance * 10);
+        clock_slews++;
     } else if (clock_advance > -1) { // we are a little ahead
-        clock_rate = 0.9; // go slower until the reference clock catches up
+        clock_rate = rate - 0.1; // go slower until the reference catches up
         will_catch_up_after(clock_advance * -10);
+        clock_slews++;
     } else { // clock_advance <= -1
         if ((!time_jump_callback) ||
             (!(*time_jump_callback)
                     (local_time_base, global_time_base, new_ref))) {
+            clock_jumps++;
             clock_rate = 0; // we're way ahead: stop until next clock sync
             // maybe we should try to run clock sync soon since we are
             // way out of sync and do not know if reference time is running
@@ -371,6 +482,167 @@ void o2_clockrt_handler(O2msg_data_ptr msg, const char *types,
 }
 
 
+// the largest of the recent beacon_raw values. Delays only make raw
+// values smaller, so this is from the least delayed beacon.
+//
+static O2time beacon_raw_max()
+{
+    int n = beacon_count < CLOCK_SYNC_HISTORY_LEN ?
+            beacon_count : CLOCK_SYNC_HISTORY_LEN;
+    O2time raw_max = beacon_raw[0];
+    for (int i = 1; i < n; i++) {
+        if (beacon_raw[i] > raw_max) raw_max = beacon_raw[i];
+    }
+    return raw_max;
+}
+
+
+// estimate the reference minus local time at local time now and the
+// drift rate from clock_samples: Samples with round trip times near
+// the minimum have the least queueing delay, so they are the most
+// accurate. Fit a line to them by least squares, giving offset and
+// drift, and set offset_jitter to the standard deviation of the
+// samples from the line. If they span less than CLOCK_DRIFT_MIN_SPAN,
+// use the offset of the sample with minimum round trip time and a
+// drift of zero. Returns the limit on round trip times of samples that
+// were used.
+//
+static O2time clock_estimate(O2time now, O2time *offset, double *drift)
+{
+    int n = sample_count < CLOCK_FILTER_LEN ? sample_count : CLOCK_FILTER_LEN;
+    int best_i = 0;
+    for (int i = 1; i < n; i++) {
+        if (clock_samples[i].rtt < clock_samples[best_i].rtt) {
+            best_i = i;
+        }
+    }
+    O2time limit = clock_samples[best_i].rtt * CLOCK_RTT_FACTOR +
+                   CLOCK_RTT_SLACK;
+    int count = 0;
+    O2time t_min = now, t_max = 0, t_sum = 0, o_sum = 0;
+    for (int i = 0; i < n; i++) {
+        Clock_sample *cs = &clock_samples[i];
+        if (cs->rtt <= limit) {
+            count++;
+            t_sum += cs->local;
+            o_sum += cs->offset;
+            if (cs->local < t_min) t_min = cs->local;
+            if (cs->local > t_max) t_max = cs->local;
+        }
+    }
+    *offset = clock_samples[best_i].offset;
+    *drift = 0;
+    if (count < 3 || t_max - t_min < CLOCK_DRIFT_MIN_SPAN) {
+        return limit;
+    }
+    O2time t_mean = t_sum / count;
+    O2time o_mean = o_sum / count;
+    double stt = 0, sto = 0;
+    for (int i = 0; i < n; i++) {
+        Clock_sample *cs = &clock_samples[i];
+        if (cs->rtt <= limit) {
+            double dt = cs->local - t_mean;
+            stt += dt * dt;
+            sto += dt * (cs->offset - o_mean);
+        }
+    }
+    double b = sto / stt;  // stt > 0 because the samples span > 0s
+    // residuals measure the jitter of the samples and the uncertainty
+    // of b. Ignore drift that is not clearly larger than its uncertainty,
+    // e.g. because jitter is large compared to the span:
+    double srr = 0;
+    for (int i = 0; i < n; i++) {
+        Clock_sample *cs = &clock_samples[i];
+        if (cs->rtt <= limit) {
+            double r = cs->offset - o_mean - b * (cs->local - t_mean);
+            srr += r * r;
+        }
+    }
+    offset_jitter = sqrt(srr / (count - 2));
+    if (fabs(b) < 2 * offset_jitter / sqrt(stt)) {
+        b = 0;
+    }
+    if (b > CLOCK_DRIFT_MAX) b = CLOCK_DRIFT_MAX;
+    if (b < -CLOCK_DRIFT_MAX) b = -CLOCK_DRIFT_MAX;
+    *drift = b;
+    *offset = o_mean + b * (now - t_mean);
+    return limit;
+}
+
+
+// add a sample of reference minus local time (offset) measured at
+// local time now with round trip time rtt, update the estimates and
+// the ping interval, and set the clock
+//
+static void clock_sample_add(O2time now, O2time offset, O2time rtt)
+{
+    // how far is our clock from this measurement?
+    O2time error = o2_clock_is_synchronized ?
+                   offset - (LOCAL_TO_GLOBAL(now) - now) : 0;
+    if (error > 1 || error < -1) {
+        // the reference clock jumped: earlier samples are useless
+        sample_count = 0;
+        beacon_count = 0;
+        drift_rate = 0;
+        ping_interval = CLOCK_PING_MIN;
+    }
+    Clock_sample *cs = &clock_samples[sample_count % CLOCK_FILTER_LEN];
+    cs->local = now;
+    cs->offset = offset;
+    cs->rtt = rtt;
+    sample_count++;
+    samples_total++;
+    O2_DBk(hdprintf("clock sample offset %g, rtt %g, count %d, error %g\n",
+                    offset, rtt, sample_count, error));
+    if (ping_reply_count < CLOCK_SYNC_HISTORY_LEN) {
+        return;  // wait for enough replies to pings
+    }
+    O2time limit = clock_estimate(now, &offset, &drift_rate);
+    // adapt the ping interval: ping more often if replies are
+    // delayed or we are off by more than the tolerance, less often
+    // if the clock is doing well
+    O2time tolerance = 3 * offset_jitter;
+    if (tolerance < CLOCK_ERROR_TARGET) tolerance = CLOCK_ERROR_TARGET;
+    delayed_replies = (rtt > limit) ? delayed_replies + 1 : 0;
+    if (delayed_replies) {
+        samples_delayed++;
+    } else {
+        last_good_time = now;
+    }
+    if (now - start_sync_time < 5.0) {
+        ;  // ping_interval is not used until after 5s
+    } else if (delayed_replies >= 2 ||
+        (delayed_replies == 0 && fabs(error) > tolerance)) {
+        ping_interval *= 0.5;
+        if (ping_interval < CLOCK_PING_MIN) ping_interval = CLOCK_PING_MIN;
+    } else if (delayed_replies == 0 && fabs(error) < tolerance * 0.5) {
+        ping_interval *= 1.5;
+        if (ping_interval > CLOCK_PING_MAX) ping_interval = CLOCK_PING_MAX;
+    }
+    O2_DBk(hdprintf("clock estimate offset %g drift %g jitter %g ping "
+                    "interval %g\n", offset, drift_rate, offset_jitter,
+                    ping_interval));
+    O2time new_ref = now + offset;
+    if (!o2_clock_is_synchronized) {
+        o2_clock_synchronized(now, new_ref);
+    } else {
+        set_clock(now, new_ref);
+    }
+}
+
+
+// local time at which the message being handled was received. Where
+// the kernel timestamps UDP datagrams, this excludes the time spent
+// waiting for o2_poll() and dispatching, which would otherwise inflate
+// round trip times and add jitter when the application is busy:
+//
+static O2time clock_rcv_time()
+{
+    O2time t = o2n_rcv_time();
+    return t >= 0 ? t : o2_local_time_precise();
+}
+
+
 // handler for cs/put, which is a reply to cs/get:
 //
 static void cs_ping_reply_handler(O2msg_data_ptr msg, const char *types,
@@ -383,62 +655,174 @@ static void cs_ping_reply_handler(O2msg_data_ptr msg, const char *types,
     if (arg->i32 != clock_sync_id) return;
     if (!(arg = o2_get_next(O2_TIME))) return;
     O2time ref_time = arg->t;
-    O2time now = o2_local_time();
+    O2time now = clock_rcv_time();
     O2time rtt = now - clock_sync_send_time;
     // estimate current reference time by adding 1/2 round trip time:
     ref_time += rtt * 0.5;
-    int i = ping_reply_count % CLOCK_SYNC_HISTORY_LEN;
-    round_trip_time[i] = rtt;
-    ref_minus_local[i] = ref_time - now;
+    ping_rtt[ping_reply_count % CLOCK_SYNC_HISTORY_LEN] = rtt;
     ping_reply_count++;
     O2_DBk(hdprintf("got clock reply, ref_time %g, rtt %g, count %d\n",
                     ref_time, rtt, ping_reply_count));
-#ifndef O2_NO_DEBUG
-    if (o2_debug & O2_DBk_FLAG) {
-        int start, count;
-        if (ping_reply_count < CLOCK_SYNC_HISTORY_LEN) {
-            start = 0; count = ping_reply_count;
-        } else {
-            start = ping_reply_count % CLOCK_SYNC_HISTORY_LEN;
-            count = CLOCK_SYNC_HISTORY_LEN;
-        }
-        dbprintf("reference minus local:");
-        int k = start;
-        for (int j = 0; j < count; j++) {
-            dbprintf(" %g", ref_minus_local[k]);
-            k = (k + 1) % CLOCK_SYNC_HISTORY_LEN;
-        }
-        dbprintf("\n"); dbprintf("round trip:");
-        for (int j = 0; j < count; j++) {
-            dbprintf(" %g", round_trip_time[start]);
-            start = (start + 1) % CLOCK_SYNC_HISTORY_LEN;
+    int n = ping_reply_count < CLOCK_SYNC_HISTORY_LEN ?
+            ping_reply_count : CLOCK_SYNC_HISTORY_LEN;
+    // min and mean round trip time of the most recent replies
+    min_rtt = rtt;
+    mean_rtt = 0;
+    for (int i = 0; i < n; i++) {
+        mean_rtt += ping_rtt[i];
+        if (ping_rtt[i] < min_rtt) min_rtt = ping_rtt[i];
+    }
+    mean_rtt /= n;
+    if (beacon_count > 0 && rtt <= min_rtt * CLOCK_RTT_FACTOR +
+                                     CLOCK_RTT_SLACK) {
+        // calibrate the beacon path delay with this offset measurement
+        O2time delay = ref_time - now - beacon_raw_max();
+        beacon_delay = beacon_delay < 0 ? delay : (beacon_delay + delay) / 2;
+        if (beacon_delay < 0) beacon_delay = 0;
+    }
+    clock_sample_add(now, ref_time - now, rtt);
+}
+
+
+// handler for /_o2/cs/bc, a beacon from the reference (see above)
+//
+static void cs_beacon_handler(O2msg_data_ptr msg, const char *types,
+                              O2arg_ptr *argv, int argc,
+                              const void *user_data)
+{
+    O2time now = clock_rcv_time();
+    if (is_refclk || !clock_sync_reply_to ||
+        !streql(argv[0]->s, o2_ensemble_name)) {
+        return;  // not synchronizing to a reference
+    }
+    Services_entry *services;  // beacon must come from the reference:
+    O2node *ref = Services_entry::service_find("_cs", &services);
+    if (!ref || !ISA_PROC(ref) || !ref->key || !streql(ref->key, argv[1]->s)) {
+        return;
+    }
+    int seq = argv[2]->i32;
+    if (seq == beacon_last_seq) {
+        return;  // a duplicate
+    }
+    beacon_last_seq = seq;
+    beacon_last_time = now;
+    beacon_rcv_period = argv[3]->f;
+    O2time raw = argv[4]->t - now;
+    beacon_raw[beacon_count++ % CLOCK_SYNC_HISTORY_LEN] = raw;
+    if (ping_reply_count < CLOCK_SYNC_HISTORY_LEN) {
+        return;  // no round trip time yet
+    }
+    // a beacon delayed by d more than the least delayed one is like a
+    // ping with a round trip time 2 * d longer than the minimum:
+    clock_sample_add(now, raw + (beacon_delay < 0 ? min_rtt * 0.5
+                                                  : beacon_delay),
+                     min_rtt + 2 * (beacon_raw_max() - raw));
+}
+
+
+// are beacons arriving, so that pings are only needed to measure the
+// round trip time?
+//
+static bool beacons_active(O2time now)
+{
+    return beacon_last_time >= 0 &&
+           now - beacon_last_time < 3 * beacon_rcv_period;
+}
+
+
+// send a beacon to the UDP port of each connected process
+//
+static void clock_beacon_send()
+{
+    Vec<int> ports;
+    int my_port = o2_ctx->proc->udp_address.get_port();
+    for (int i = 0; i < o2n_fds_info.size(); i++) {
+        Proxy_info *proc = (Proxy_info *) o2n_fds_info[i]->owner;
+        if (proc && ISA_PROC(proc) && proc != o2_ctx->proc && proc->key &&
+            proc->fds_info == o2n_fds_info[i]) {
+            int port = ((Proc_info *) proc)->udp_address.get_port();
+            int j;
+            for (j = 0; j < ports.size() && ports[j] != port; j++) ;
+            if (port > 0 && j == ports.size()) {
+                ports.push_back(port);
+            }
         }
-        dbprintf("\n");
     }
+    if (ports.size() == 0 || o2_send_start()) {
+        return;
+    }
+    o2_add_string(o2_ensemble_name);
+    o2_add_string(o2_ctx->proc->key);
+    o2_add_int32(beacon_seq++);
+    o2_add_float((float) beacon_period);
+    o2_add_time(o2_local_time_precise());  // reference: local == global
+    O2message_ptr msg = o2_message_finish(0.0, "!_o2/cs/bc", false);
+    if (!msg) {
+        return;
+    }
+#if IS_LITTLE_ENDIAN
+    o2_msg_swap_endian(&msg->data, true);
 #endif
-    if (ping_reply_count >= CLOCK_SYNC_HISTORY_LEN) {
-        // find minimum round trip time
-        min_rtt = round_trip_time[0];
-        mean_rtt = min_rtt;
-        int best_i = 0;
-        for (i = 1; i < CLOCK_SYNC_HISTORY_LEN; i++) {
-            mean_rtt += round_trip_time[i];
-            if (round_trip_time[i] < min_rtt) {
-                min_rtt = round_trip_time[i];
-                best_i = i;
-            }
+    int32_t len = msg->data.length;
+    for (int i = 0; i < ports.size(); i++) {
+        // as with discovery, assume broadcasts are not received on this
+        // host, so send to localhost too (but not to ourselves):
+        if (ports[i] != my_port) {
+            O2message_ptr local = o2_message_new(len);
+            memcpy(O2_MSG_PAYLOAD(local), O2_MSG_PAYLOAD(msg), len);
+            o2n_send_udp_local(ports[i], (O2netmsg_ptr) local);
         }
-        mean_rtt /= CLOCK_SYNC_HISTORY_LEN;
-        // best estimate of ref_minus_local is stored at i
-        //dbprintf("*    time adjust %g\n",
-        //       now + ref_minus_local[best_i] - o2_time_get());
-        O2time new_ref = now + ref_minus_local[best_i];
-        if (!o2_clock_is_synchronized) {
-            o2_clock_synchronized(now, new_ref);
-        } else {
-            set_clock(now, new_ref);
+        if (o2n_network_found && beacon_broadcast &&
+            o2n_send_broadcast(ports[i], (O2netmsg_ptr) msg) < 0) {
+            beacon_broadcast = false;  // do not keep reporting errors
         }
     }
+    O2_FREE(msg);
+}
+
+
+static void clock_beacon_at(O2time when, int id)
+{
+    if (when < o2_ltsched.last_time) {  // see o2_clock_ping_at()
+        when = o2_ltsched.last_time;
+    }
+    if (o2_send_start() || o2_add_int32(id)) {
+        return;
+    }
+    o2_schedule_msg(&o2_ltsched, o2_message_finish(when, "!_o2/cs/bs",
+                                                   false));
+}
+
+
+// handler for /_o2/cs/bs: send a beacon and schedule the next one
+//
+static void cs_beacon_send_handler(O2msg_data_ptr msg, const char *types,
+                                   O2arg_ptr *argv, int argc,
+                                   const void *user_data)
+{
+    int id = argv[0]->i32;
+    if (id != beacon_send_id || !is_refclk || beacon_period <= 0) {
+        return;  // cancelled
+    }
+    clock_beacon_send();
+    clock_beacon_at(o2_local_time() + beacon_period, id);
+}
+
+
+O2err o2_clock_beacons(double period)
+{
+    if (!o2_ensemble_name) {
+        return O2_NOT_INITIALIZED;
+    }
+    if (period < 0) {
+        return O2_BAD_ARGS;
+    }
+    beacon_period = period;
+    beacon_send_id++;  // cancel any previously scheduled beacon
+    if (period > 0 && is_refclk) {
+        clock_beacon_at(o2_local_time(), beacon_send_id);
+    }
+    return O2_SUCCESS;
 }
 
 
@@ -451,6 +835,57 @@ int o2_roundtrip(double *mean, double *min)
 }
 
 
+O2err o2_clock_stats(O2clock_stats *stats, bool reset)
+{
+    if (!o2_ensemble_name) {
+        return O2_NOT_INITIALIZED;
+    }
+    if (stats) {
+        O2time now = o2_local_time();
+        bool synced = o2_clock_is_synchronized && !is_refclk;
+        stats->synchronized = o2_clock_is_synchronized;
+        stats->reference = is_refclk;
+        stats->offset = synced ? LOCAL_TO_GLOBAL(now) - now : 0;
+        stats->drift = synced ? drift_rate : 0;
+        stats->rate = is_refclk ? 1 : clock_rate;
+        stats->last_correction = last_correction;
+        stats->jumps = clock_jumps;
+        stats->slews = clock_slews;
+        stats->jitter = offset_jitter;
+        stats->since_good = is_refclk ? 0 : (last_good_time < 0 ? -1 :
+                                             now - last_good_time);
+        stats->mean_rtt = mean_rtt;
+        stats->min_rtt = min_rtt;
+        stats->ping_interval = ping_interval;
+        stats->samples = samples_total;
+        stats->delayed = samples_delayed;
+    }
+    if (reset) {
+        clock_jumps = 0;
+        clock_slews = 0;
+        samples_total = 0;
+        samples_delayed = 0;
+    }
+    return O2_SUCCESS;
+}
+
+
+// handler for /_o2/cs/st: reply with o2_clock_stats()
+//
+static void clock_stats_handler(O2msg_data_ptr msg, const char *types,
+                                O2arg_ptr *argv, int argc,
+                                const void *user_data)
+{
+    O2clock_stats st;
+    o2_clock_stats(&st, false);
+    o2_send(argv[0]->s, 0, "siiddddhhdddddhh", o2_ctx->proc->key,
+            st.synchronized, st.reference, st.offset, st.drift, st.rate,
+            st.last_correction, st.jumps, st.slews, st.jitter,
+            st.since_good, st.mean_rtt, st.min_rtt, st.ping_interval,
+            st.samples, st.delayed);
+}
+
+
 static int ping_process_id = 0;
 
 static void o2_clock_ping_at(O2time when, int id)
@@ -502,7 +937,7 @@ void o2_start_cs_pings()
 // o2_ping_send_handler -- handler for /_o2/cs/ps (short for "ping send")
 //   wait for clock sync service to be established,
 //   then send ping every 0.1s CLOCK_SYNC_HISTORY_LEN times, 
-//   then every 0.5s for 5s, then every 10s
+//   then every 0.5s for 5s, then every ping_interval (0.5 to 30s)
 //
 void o2_ping_send_handler(O2msg_data_ptr msg, const char *types,
                           O2arg_ptr *argv, int argc, const void *user_data)
@@ -518,7 +953,14 @@ void o2_ping_send_handler(O2msg_data_ptr msg, const char *types,
         o2_clock_is_synchronized = true;
         return; // no clock sync; we're the reference
     }
-    clock_sync_send_time = o2_local_time();
+    O2time now = o2_local_time_precise();
+    if (beacons_active(now) && now - start_sync_time > 5.0 &&
+        now - clock_sync_send_time < CLOCK_BEACON_PING) {
+        // beacons provide the samples, so skip this ping
+        o2_clock_ping_at(now + ping_interval, id);
+        return;
+    }
+    clock_sync_send_time = now;
     int status = o2_status("_cs");
     if (o2_status("_cs") < 0) {  // clock service disappeared
         return;  // resume protocol when o2_start_cs_pings() is called
@@ -534,7 +976,10 @@ void o2_ping_send_handler(O2msg_data_ptr msg, const char *types,
     //
     // run every 0.1 second until at least CLOCK_SYNC_HISTORY_LEN
     // pings have been sent to get a fast start, then ping every
-    // 0.5s until 5s, then every 10s.
+    // 0.5s until 5s, then every ping_interval, which adapts to how
+    // well the clock is tracking the reference (see
+    // clock_sample_add()), or every CLOCK_BEACON_PING while beacons
+    // arrive.
     //
     // This could be a problem if the round trip is >0.1s because
     // the first 5 pings will be time out and be ignored. But
@@ -542,7 +987,9 @@ void o2_ping_send_handler(O2msg_data_ptr msg, const char *types,
     // be enough to ping anywhere.
     O2time t1 = CLOCK_SYNC_HISTORY_LEN * 0.1 - 0.01;
     if (clock_sync_send_time - start_sync_time > t1) when += 0.4;
-    if (clock_sync_send_time - start_sync_time > 5.0) when += 9.5;
+    if (clock_sync_send_time - start_sync_time > 5.0) {
+        when = clock_sync_send_time + ping_interval;
+    }
     O2_DBk(hdprintf("clock request sent at %g\n", clock_sync_send_time));
     // schedule another call to o2_ping_send_handler
     o2_clock_ping_at(when, id);
@@ -580,9 +1027,33 @@ void o2_clock_initialize()
     time_callback = NULL;
     time_callback_data = NULL;
     ping_reply_count = 0;
+    sample_count = 0;
+    drift_rate = 0;
+    ping_interval = CLOCK_PING_START;
+    offset_jitter = 0;
+    delayed_replies = 0;
+    beacon_period = 0;
+    beacon_broadcast = true;
+    beacon_last_seq = -1;
+    beacon_last_time = -1;
+    beacon_count = 0;
+    beacon_delay = -1;
+    last_correction = 0;
+    clock_jumps = 0;
+    clock_slews = 0;
+    samples_total = 0;
+    samples_delayed = 0;
+    last_good_time = -1;
     time_offset = 0;
+    time_source = O2_TIME_NATIVE;
     o2_method_new_internal("/_o2/cs/cs", "s", &o2_clocksynced_handler,
                            NULL, false, true);
+    o2_method_new_internal("/_o2/cs/st", "s", &clock_stats_handler,
+                           NULL, false, true);
+    o2_method_new_internal("/_o2/cs/bc", "ssift", &cs_beacon_handler,
+                           NULL, false, true);
+    o2_method_new_internal("/_o2/cs/bs", "i", &cs_beacon_send_handler,
+                           NULL, false, true);
 }
 
 
@@ -601,7 +1072,11 @@ void o2_clock_finish()
 
 // cs_ping_handler -- handler for /_cs/get
 //   return the reference clock time. Arguments are serial_no and reply_to.
-//   send serial_no and current time to reply_to
+//   send serial_no and current time to reply_to. If the ping has a
+//   kernel receive time, the time sent is midway between receiving and
+//   replying: the client adds half the round trip time, which includes
+//   our delay in handling the ping, so this keeps that delay out of the
+//   client's offset estimate.
 static void cs_ping_handler(O2msg_data_ptr msg, const char *types,
                      O2arg_ptr *argv, int argc, const void *user_data)
 {
@@ -613,7 +1088,9 @@ static void cs_ping_handler(O2msg_data_ptr msg, const char *types,
     }
     int serial_no = serial_no_arg->i32;
     char *replyto = reply_to_arg->s;
-    o2_send(replyto, 0, "it", serial_no, o2_time_get());
+    O2time rcv = o2n_rcv_time();
+    O2time now = o2_local_time_precise();  // reference: local == global
+    o2_send(replyto, 0, "it", serial_no, rcv >= 0 ? (rcv + now) * 0.5 : now);
 }
 
 
@@ -629,11 +1106,11 @@ O2err o2_clock_set(o2_time_callback callback, void *data)
     // user to change the time source):
     //   new_local_time - new_time_offset == old_local_time - old_time_offset
     //   new_time_offset = new_local_time - (old_local_time - old_time_offset)
-    O2time old_local_time = o2_local_time(); // (includes -old_time_offset)
+    O2time old_local_time = o2_local_time_precise(); // (includes -offset)
     time_callback = callback;
     time_callback_data = data;
     time_offset = 0.0; // get the time without any offset
-    O2time new_local_time = o2_local_time();
+    O2time new_local_time = o2_local_time_precise();
     time_offset = new_local_time - old_local_time;
 
     // if we are already the reference, then there is nothing more to do.
@@ -648,6 +1125,9 @@ O2err o2_clock_set(o2_time_callback callback, void *data)
     Services_entry::service_new("_cs\000\000");
     o2_method_new_internal("/_cs/get", "is", &cs_ping_handler,
                            NULL, false, false);
+    if (beacon_period > 0) {  // o2_clock_beacons() was called first
+        o2_clock_beacons(beacon_period);
+    }
     O2_DBG(hdprintf("** reference clock established, time is now %g\n",
                     o2_local_time()));
 
@@ -688,17 +1168,192 @@ O2err o2_clock_jump(double local_time, double global_time, bool adjust)
     }
     local_time_base = local_time;
     global_time_base = global_time;
-    clock_rate = 1;
+    clock_rate = 1.0 + drift_rate;
+    clock_jumps++;
     return O2_SUCCESS;
 }
 
 
+#if defined(__linux__)
+static O2time monotonic_time(clockid_t id)
+{
+    struct timespec ts;
+    clock_gettime(id, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+#endif
+
+
+#ifdef O2_TSC
+// is there a time stamp counter that runs at a constant rate in all
+// power states and on all cores?
+static bool tsc_invariant()
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) ||
+        eax < 0x80000007) {
+        return false;
+    }
+    __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+    return (edx >> 8) & 1;  // "invariant TSC" bit
+}
+
+
+static O2time tsc_time()
+{
+    Tsc_cal *cal = tsc_cal.load(std::memory_order_acquire);
+    return cal->base_time + (__rdtsc() - cal->base) * cal->period;
+}
+
+
+// read the counter and CLOCK_MONOTONIC at the same time, as nearly as
+// possible: reading the clock can be slow (e.g. in virtual machines),
+// so take the closest of a few tries
+static void tsc_pair(uint64_t *tsc, O2time *mono)
+{
+    O2time best = 1;
+    for (int i = 0; i < 5; i++) {
+        O2time before = monotonic_time(CLOCK_MONOTONIC);
+        uint64_t t = __rdtsc();
+        O2time after = monotonic_time(CLOCK_MONOTONIC);
+        if (after - before < best) {
+            best = after - before;
+            *tsc = t;
+            *mono = (before + after) * 0.5;
+        }
+    }
+}
+
+
+// measure the counter rate over the time since calibration started.
+// Unless starting, continue from the current tsc_time() so that time
+// does not jump.
+static void tsc_calibrate(bool start)
+{
+    uint64_t tsc;
+    O2time mono;
+    tsc_pair(&tsc, &mono);
+    O2time now = start ? mono : tsc_time();
+    Tsc_cal *cal = tsc_cal.load(std::memory_order_relaxed);
+    cal = (cal == &tsc_cals[0] ? &tsc_cals[1] : &tsc_cals[0]);
+    cal->period = (mono - mono_start) / (tsc - tsc_start);
+    cal->base = tsc;
+    cal->base_time = now;
+    tsc_cal.store(cal, std::memory_order_release);
+}
+#endif
+
+
+// time from the current source, without time_offset, read quickly
+//
+static O2time source_time()
+{
+    switch (time_source) {
+      case O2_TIME_POLL: return poll_time;
+#ifdef __linux__
+      case O2_TIME_COARSE: return monotonic_time(CLOCK_MONOTONIC_COARSE);
+#endif
+#ifdef O2_TSC
+      case O2_TIME_TSC: return tsc_time();
+#endif
+      default: return o2_native_time();
+    }
+}
+
+
 O2time o2_local_time()
 {
     if (time_callback) {
         return (*time_callback)(time_callback_data) - time_offset;
     }
-    return o2_native_time() - time_offset;
+    return source_time() - time_offset;
+}
+
+
+// like o2_local_time() but never from a value that was read earlier
+// or rounded to a kernel tick, for measuring round trip times
+//
+O2time o2_local_time_precise()
+{
+    if (time_callback) {
+        return (*time_callback)(time_callback_data) - time_offset;
+    }
+    switch (time_source) {
+#ifdef __linux__
+      case O2_TIME_COARSE:
+        return monotonic_time(CLOCK_MONOTONIC) - time_offset;
+#endif
+#ifdef O2_TSC
+      case O2_TIME_TSC: return tsc_time() - time_offset;
+#endif
+      default: return o2_native_time() - time_offset;  // including POLL
+    }
+}
+
+
+// called at the start of o2_poll() to update the time source
+//
+void o2_clock_poll()
+{
+    if (time_source == O2_TIME_POLL) {
+        poll_time = o2_native_time();
+#ifdef O2_TSC
+    } else if (time_source == O2_TIME_TSC &&
+               monotonic_time(CLOCK_MONOTONIC_COARSE) -
+               tsc_cal.load(std::memory_order_relaxed)->base_time >
+               TSC_REFINE_PERIOD) {
+        tsc_calibrate(false);
+#endif
+    }
+}
+
+
+O2err o2_time_source(O2time_source source)
+{
+    if (!o2_ensemble_name) {
+        return O2_NOT_INITIALIZED;
+    }
+    O2err rslt = O2_SUCCESS;
+    switch (source) {
+      case O2_TIME_NATIVE:
+      case O2_TIME_POLL:
+        break;
+      case O2_TIME_COARSE:
+#ifdef __linux__
+        struct timespec res;
+        if (clock_getres(CLOCK_MONOTONIC_COARSE, &res) == 0) {
+            break;
+        }
+#endif
+        source = O2_TIME_NATIVE;
+        rslt = O2_FAIL;
+        break;
+      case O2_TIME_TSC:
+#ifdef O2_TSC
+        if (tsc_invariant()) {
+            tsc_pair(&tsc_start, &mono_start);
+            o2_sleep(TSC_CALIBRATE_MS);
+            tsc_calibrate(true);  // now tsc_time() follows CLOCK_MONOTONIC
+            break;
+        }
+#endif
+        source = O2_TIME_NATIVE;
+        rslt = O2_FAIL;
+        break;
+      default:
+        return O2_BAD_ARGS;
+    }
+    // keep o2_local_time() continuous as in o2_clock_set(). Sources that
+    // lag (POLL and COARSE) might go backward if the precise times were
+    // matched, so match o2_local_time() itself:
+    O2time old_local_time = o2_local_time();
+    time_source = source;
+    poll_time = o2_native_time();
+    if (!time_callback) {
+        time_offset = 0.0;
+        time_offset = o2_local_time() - old_local_time;
+    }
+    return rslt;
 }
 
 
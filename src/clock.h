@@ -19,6 +19,13 @@ void o2_clock_finish(void); // used when shutting down O2
 
 O2time o2_local_to_global(O2time local);
 
+// o2_local_time() read precisely even if the time source is cached or
+// coarse (see o2_time_source()), for clock sync measurements
+O2time o2_local_time_precise();
+
+// update the time source, called at the start of o2_poll()
+void o2_clock_poll();
+
 O2err o2_send_clocksync_proc(Proxy_info *proc);
 
 void o2_clock_status_change(Proxy_info *info);
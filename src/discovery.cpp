@@ -13,6 +13,10 @@
 #include "discovery.h"
 #include "o2sched.h"
 #include "pathtree.h"
+#include "shmring.h"
+#include "svdelta.h"
+#include "hubmesh.h"
+#include "peercache.h"
 
 #ifdef O2_NO_O2DISCOVERY
 #include "o2zcdisc.h"
@@ -182,17 +186,28 @@ void o2_discovery_init_phase2()
         snprintf(o2_hub_addr, O2_MAX_PROCNAME_LEN, "@%s:%s:%04x%c%c%c%c",
                  hub_pip, hub_iip, hub_tcp_port, 0, 0, 0, 0);
         o2_discovered_a_remote_process(hub_version, hub_pip, hub_iip,
-                             hub_tcp_port, hub_udp_port, O2_DY_INFO);
+                             hub_tcp_port, hub_udp_port, O2_DY_INFO, NULL);
         hub_needs_public_ip = false;  // unlock o2_hub() for additional calls
     }
     o2_method_new_internal("/_o2/hub", "", &o2_hub_handler,
                            NULL, false, false);
+    o2_method_new_internal("/_o2/hpm", "", &o2_hub_handler,
+                           (const void *) 1, false, false);
 #endif
+#endif
+#ifndef O2_NO_HUB
+    o2_hub_mesh_initialize();
+#endif
+#ifndef O2_NO_PEERCACHE
+    o2_peer_cache_contact();
 #endif
     o2_method_new_internal("/_o2/sv", NULL, &o2_services_handler,
                            NULL, false, false);
-    o2_method_new_internal("/_o2/dy", "sissiii", &o2_discovery_handler,
+    // types are "sissiii" with an optional host id string:
+    o2_method_new_internal("/_o2/dy", NULL, &o2_discovery_handler,
                            NULL, false, false);
+    o2_method_new_internal("/_o2/mx", "i", &o2_max_msg_len_handler,
+                           NULL, false, true);
 }
 
 
@@ -206,7 +221,7 @@ O2err o2_discovery_finish()
  * Make /_o2/dy message, if swap_flag, switch to network byte order
  */
 O2message_ptr o2_make_dy_msg(Proc_info *proc, bool tcp_flag, bool swap_flag,
-                             int dy_flag)
+                             int dy_flag, bool host_flag)
 {
     char public_ip_buff[O2N_IP_LEN];
     char internal_ip_buff[O2N_IP_LEN];
@@ -236,6 +251,11 @@ O2message_ptr o2_make_dy_msg(Proc_info *proc, bool tcp_flag, bool swap_flag,
         o2_add_string(public_ip) || o2_add_string(internal_ip) ||
         o2_add_int32(tcp_port) || o2_add_int32(udp_port) ||
         o2_add_int32(dy_flag);
+#ifndef O2_NO_UNIXSOCK
+    if (host_flag && !err) {
+        err = o2_add_string(o2n_host_id);
+    }
+#endif
     if (err) return NULL;
     O2message_ptr msg = o2_message_finish(0.0, "!_o2/dy", tcp_flag);
     if (!msg) return NULL;
@@ -268,30 +288,45 @@ static O2err o2_broadcast_message(int port, int local_remote)
         return O2_FAIL;
     }
     
+    // assume that broadcast messages are not received on the local machine
+    // so we have to send separately to localhost using the same port;
+    // If the port is our own o2_discovery_port, local flag will be 0,
+    // and we skip the local send (no sense sending to ourselves).
+    if (local_remote & 1) {
+        O2message_ptr local_m;
+#ifndef O2_NO_UNIXSOCK
+        // processes on this host also get a copy with our host id (see
+        // o2_make_dy_msg()). Older versions drop it and use the usual
+        // form, which newer versions ignore (see o2_discovery_handler()).
+        if (o2_unix_stream_server) {
+            local_m = o2_make_dy_msg(o2_ctx->proc, false, true,
+                                     O2_DY_INFO, true);
+            if (local_m) {
+                o2n_send_udp_local(port, (O2netmsg_ptr) local_m);
+            }
+        }
+#endif
+        local_m = o2_make_dy_msg(o2_ctx->proc, false, true, O2_DY_INFO);
+        if (local_m) {
+            o2n_send_udp_local(port, (O2netmsg_ptr) local_m); // frees local_m
+        }
+    }
     // broadcast the message remotely if remote flag is set
     if (o2n_network_found && (local_remote & 2)) {
         O2_DBd(hdprintf("broadcasting discovery msg to port %d\n", port));
         if (o2n_send_broadcast(port, (O2netmsg_ptr) m) < 0) {
             O2_FREE(m);
-            return O2_SEND_FAIL; // skips local send, but that's OK because
-            // next time, remote flag will be cleared and we'll do local send.
+            return O2_SEND_FAIL;
         }
     }
-    // assume that broadcast messages are not received on the local machine
-    // so we have to send separately to localhost using the same port;
-    // If the port is our own o2_discovery_port, local flag will be 0,
-    // and we skip the local send (no sense sending to ourselves).
-    if (local_remote & 1) {
-        o2n_send_udp_local(port, (O2netmsg_ptr) m); // frees m
-    } else {
-        O2_FREE(m);
-    }
+    O2_FREE(m);
     return O2_SUCCESS;
 }
 #endif
 
 // /_o2/dy handler, parameters are:
 //     ensemble name, public_ip, internal_ip, tcp_port, udp_port, dy_type
+// and optionally host_id (only from processes on this host)
 //
 // If we are the server, send discovery message to client and we are done.
 // If we are the client, o2_send_services()
@@ -320,6 +355,8 @@ void o2_discovery_handler(O2msg_data_ptr msg, const char *types,
     int tcp_port = tcp_arg->i32;
     int udp_port = udp_arg->i32;
     int dy = dy_arg->i32;
+    O2arg_ptr host_arg = o2_get_next(O2_STRING);  // optional
+    const char *host_id = host_arg ? host_arg->s : NULL;
     
     if (!streql(ens, o2_ensemble_name)) {
         O2_DBd(dbprintf("    Ignored: ensemble name %s is not %s\n", 
@@ -327,8 +364,26 @@ void o2_discovery_handler(O2msg_data_ptr msg, const char *types,
         return;
     }
     O2_DBF(return);  // force-MQTT flag blocks peer-to-peer discovery
+#ifndef O2_NO_UNIXSOCK
+    // A process on this host with version O2_HOST_ID_VERSION or later
+    // that can use Unix-domain sockets also sends us a copy with its host
+    // id, so ignore the usual copy (without host id) to avoid racing to
+    // connect by TCP. If the sender cannot use Unix-domain sockets, it
+    // will still find us from our messages and connect (or ask us to
+    // connect) by TCP. Older versions never send a host id, so their
+    // messages are handled as usual, and so are introductions relayed by
+    // a hub (from a connected process), which are the only copy we get.
+    if (dy == O2_DY_INFO && !host_id && o2_unix_stream_server &&
+        version >= O2_HOST_ID_VERSION &&
+        !(o2_message_source && ISA_REMOTE_PROC(o2_message_source)) &&
+        streql(internal_ip, o2n_internal_ip) &&
+        streql(public_ip, o2n_public_ip)) {
+        O2_DBd(dbprintf("    Ignored: same host but no host id\n"));
+        return;
+    }
+#endif
     o2_discovered_a_remote_process(version, public_ip, internal_ip, tcp_port,
-                                   udp_port, dy);
+                                   udp_port, dy, host_id);
 }
 
 
@@ -343,7 +398,8 @@ void o2_discovery_handler(O2msg_data_ptr msg, const char *types,
 //
 // public_ip and internal_ip are in hex notation
 O2err o2_discovered_a_remote_process(int version, const char *public_ip, 
-        const char *internal_ip, int tcp_port, int udp_port, int dy)
+        const char *internal_ip, int tcp_port, int udp_port, int dy,
+        const char *host_id)
 {
     // note: in the case of o2_hub(), there may be no incoming discovery
     // message and so remote will be bogus, but since o2_hug() passes
@@ -367,12 +423,23 @@ O2err o2_discovered_a_remote_process(int version, const char *public_ip,
     O2_DBd(dbprintf("    o2_discovery_handler: remote %s local %s\n",
                     name, o2_ctx->proc->key));
     return o2_discovered_a_remote_process_name(name, version, internal_ip,
-                                               tcp_port, udp_port, dy);
+                                               tcp_port, udp_port, dy, host_id);
 }
 
 
+#ifndef O2_NO_HUB
+// address of the request for a remote process with version to be our hub
+static const char *hub_request(int version)
+{
+    return (o2_hub_mesh_enabled && version >= O2_HUB_MESH_VERSION) ?
+           "!_o2/hpm" : "!_o2/hub";
+}
+#endif
+
+
 O2err o2_discovered_a_remote_process_name(const char *name, int version,
-        const char *internal_ip, int tcp_port, int udp_port, int dy)
+        const char *internal_ip, int tcp_port, int udp_port, int dy,
+        const char *host_id)
 {
     Proc_info *proc = NULL;
     O2message_ptr reply_msg = NULL;
@@ -396,10 +463,21 @@ O2err o2_discovered_a_remote_process_name(const char *name, int version,
             return O2_SUCCESS;
         }
         // process is unknown, make a proc_info for it and start connecting...
-        char ipdot[O2N_IP_LEN];
-        o2_hex_to_dot(internal_ip, ipdot);
-        proc = Proc_info::create_tcp_proc(O2TAG_PROC_TEMP,
-                                          (const char *) ipdot, &tcp_port);
+#ifndef O2_NO_UNIXSOCK
+        // a process on this host is connected with a Unix-domain socket
+        // if possible. Otherwise, we fall back to TCP.
+        if (host_id && streql(host_id, o2n_host_id) &&
+            streql(internal_ip, o2n_internal_ip)) {
+            proc = Proc_info::create_unix_proc(O2TAG_PROC_TEMP, tcp_port);
+        }
+        if (!proc)
+#endif
+        {
+            char ipdot[O2N_IP_LEN];
+            o2_hex_to_dot(internal_ip, ipdot);
+            proc = Proc_info::create_tcp_proc(O2TAG_PROC_TEMP,
+                                              (const char *) ipdot, &tcp_port);
+        }
         O2_DBc(proc->co_info(proc->fds_info,
                          "created temp proc to connect to discovered proc"));
         // proc name is NULL
@@ -408,9 +486,16 @@ O2err o2_discovered_a_remote_process_name(const char *name, int version,
             if (!proc) {
                 return O2_FAIL;
             }
-            // send /dy by TCP
+            // send /dy by TCP. Over a Unix-domain socket, include our host
+            // id so that the remote process connects the same way (it sent
+            // us its host id, so it accepts ours)
+            bool host_flag = false;
+#ifndef O2_NO_UNIXSOCK
+            host_flag = proc->fds_info->unix_domain &&
+                        version >= O2_HOST_ID_VERSION;
+#endif
             o2_prepare_to_deliver(o2_make_dy_msg(o2_ctx->proc, true, false,
-                                                 O2_DY_CALLBACK));
+                                                 O2_DY_CALLBACK, host_flag));
             if (proc->send(false) != O2_SUCCESS) {
                 proc->o2_delete(); // error recovery: don't leak memory
             } else {
@@ -425,6 +510,7 @@ O2err o2_discovered_a_remote_process_name(const char *name, int version,
         proc->tag = O2TAG_PROC;
         assert(proc->key == NULL);  // make sure we don't leak memory
         proc->key = o2_heapify(name);
+        o2_udp_seq_named(proc);
 #ifndef O2_NO_HUB
         int dy_flag = (streql(name, o2_hub_addr) ? O2_DY_HUB : O2_DY_CONNECT);
 #else
@@ -446,6 +532,7 @@ O2err o2_discovered_a_remote_process_name(const char *name, int version,
         }
         proc = TO_PROC_INFO(o2_message_source);
         proc->key = o2_heapify(name);
+        o2_udp_seq_named(proc);
         Services_entry::service_provider_new(proc->key, NULL, proc, proc);
         if (dy == O2_DY_HUB) { // this is the hub, this is the server side
             hdprintf("######## This is the hub server side #######\n");
@@ -463,7 +550,7 @@ O2err o2_discovered_a_remote_process_name(const char *name, int version,
             hdprintf("####### This is the hub client side #######\n");
             proc->uses_hub = O2_HUB_REMOTE;
             o2_send_start();
-            reply_msg = o2_message_finish(0.0, "!_o2/hub", true);
+            reply_msg = o2_message_finish(0.0, hub_request(version), true);
             O2_DBd(hdprintf("** discovery got REPLY sending !_o2/hub %s\n",
                             name));
 #endif
@@ -477,7 +564,8 @@ O2err o2_discovered_a_remote_process_name(const char *name, int version,
                 O2_DBd(hdprintf("** discovery got CONNECT from hub, %s %s\n",
                                 "sending !_o2/hub to", name));
                 o2_send_start();
-                reply_msg = o2_message_finish(0.0, "!_o2/hub", true);
+                reply_msg = o2_message_finish(0.0, hub_request(version),
+                                              true);
             }
 #endif
         } else {
@@ -487,13 +575,32 @@ O2err o2_discovered_a_remote_process_name(const char *name, int version,
         }
     }
     O2err err = O2_SUCCESS;
+    proc->version = version;
     if (reply_msg) {
         o2_prepare_to_deliver(reply_msg);
         err = proc->send(false);
     }
     if (!err) err = o2_send_clocksync_proc(proc);
+#ifndef O2_NO_SVDELTA
+    if (!err) err = o2_svdelta_connected(proc, version);
+#else
     if (!err) err = o2_send_services(proc);
+#endif
+    if (!err) err = o2_send_max_msg_len(proc);
     if (!err) err = proc->udp_address.init_hex(internal_ip, udp_port, false);
+#ifndef O2_NO_UNIXSOCK
+    // a process connected by a Unix-domain socket also receives UDP
+    // messages with one:
+    if (!err && proc->fds_info->unix_domain) {
+        proc->set_unix_udp(tcp_port);
+    }
+#endif
+#ifndef O2_NO_SHMRING
+    // the connecting process (client) offers shared memory rings:
+    if (!err && dy == O2_DY_INFO && proc->fds_info->unix_domain) {
+        Shm_link::offer(proc);
+    }
+#endif
     O2_DBd(hdprintf("UDP port %d for remote proc %s set to %d avail as %d\n",
                     udp_port, internal_ip, ntohs(proc->udp_address.sa.sin_port),
                     proc->udp_address.get_port()));
@@ -520,7 +627,20 @@ O2err o2_send_services(Proxy_info *proc)
     o2_send_start();
     assert(o2_ctx->proc->key);
     o2_add_string(o2_ctx->proc->key);
-    O2string dest = proc->key;
+    o2_add_services(proc->key);
+    O2message_ptr msg = o2_message_finish(0.0, "!_o2/sv", true);
+    if (!msg) return O2_FAIL;
+    o2_prepare_to_deliver(msg);
+    proc->send(false);
+    return O2_SUCCESS;
+}
+
+
+// add the local services and taps to the message being built as in
+// o2_send_services(). dest is only used for debugging output.
+//
+void o2_add_services(O2string dest)
+{
     Enumerate enumerator(&o2_ctx->path_tree);
     O2node *entry;
     while ((entry = enumerator.next())) {
@@ -556,13 +676,76 @@ O2err o2_send_services(Proxy_info *proc)
             }
         }
     }
-    O2message_ptr msg = o2_message_finish(0.0, "!_o2/sv", true);
+}
+
+// tell remote process the largest TCP message we will accept. This is
+// only sent if o2_set_max_message_size() raised the limit; otherwise, the
+// remote process assumes O2N_DEFAULT_MAX_MSG_LEN. The address is !_o2/mx
+// and the parameter is the maximum length in bytes.
+//
+O2err o2_send_max_msg_len(Proxy_info *proc)
+{
+    if (o2n_max_msg_len == O2N_DEFAULT_MAX_MSG_LEN) {
+        return O2_SUCCESS;
+    }
+    if (o2_send_start()) return O2_FAIL;
+    o2_add_int32(o2n_max_msg_len);
+    O2message_ptr msg = o2_message_finish(0.0, "!_o2/mx", true);
     if (!msg) return O2_FAIL;
     o2_prepare_to_deliver(msg);
     proc->send(false);
     return O2_SUCCESS;
 }
 
+
+// /_o2/mx handler: remote process tells us the largest TCP message it
+// will accept. Proc_info::send() will not send anything larger.
+//
+void o2_max_msg_len_handler(O2msg_data_ptr msg, const char *types,
+                            O2arg_ptr *argv, int argc, const void *user_data)
+{
+    if (o2_message_source && ISA_PROC(o2_message_source)) {
+        int32_t len = argv[0]->i32;
+        if (len < O2N_DEFAULT_MAX_MSG_LEN) {
+            len = O2N_DEFAULT_MAX_MSG_LEN;  // every process accepts this
+        }
+        TO_PROC_INFO(o2_message_source)->max_msg_len = len;
+        O2_DBd(hdprintf("%s accepts messages up to %d bytes\n",
+                        o2_message_source->key, len));
+    }
+}
+
+
+O2err o2_set_max_message_size(int32_t max_size)
+{
+    if (max_size < O2N_DEFAULT_MAX_MSG_LEN ||
+        max_size > O2_MAX_LARGE_MSG_SIZE) {
+        return O2_BAD_ARGS;
+    }
+    o2n_max_msg_len = max_size;
+    if (!o2_ensemble_name) {  // not initialized, so no connections yet
+        return O2_SUCCESS;
+    }
+    // tell every connected process about the new limit
+    for (int i = 0; i < o2n_fds_info.size(); i++) {
+        Fds_info *info = o2n_fds_info[i];
+        Proc_info *proc = (Proc_info *) (info->owner);
+        if (proc && ISA_PROC(proc) && proc != o2_ctx->proc &&
+            (info->net_tag & (NET_TCP_CLIENT | NET_TCP_CONNECTION))) {
+            // send even if the new limit is the default so that
+            // processes learn that the limit was reduced
+            o2_send_start();
+            o2_add_int32(o2n_max_msg_len);
+            O2message_ptr msg = o2_message_finish(0.0, "!_o2/mx", true);
+            if (!msg) return O2_FAIL;
+            o2_prepare_to_deliver(msg);
+            proc->send(false);
+        }
+    }
+    return O2_SUCCESS;
+}
+
+
 #ifndef O2_NO_HUB
 // send a discovery message to introduce every remote proc to new client
 //
@@ -573,12 +756,17 @@ O2err o2_send_services(Proxy_info *proc)
 // Also, to make things go faster, we send discovery message to the client
 // side of the pair, so whichever name is lower gets the message.
 //
+// Partial mesh clients are not introduced to each other (see
+// hubmesh.cpp).
+//
 static void hub_has_new_client(Proc_info *nc)
 {
     for (int i = 0; i < o2n_fds_info.size(); i++) {
         Fds_info *info = o2n_fds_info[i];
         Proc_info *proc = (Proc_info *) (info->owner);
-        if (ISA_PROC(proc)) {  // TODO: is this the right condition?
+        // skip procs that are still connecting and have no name yet:
+        if (ISA_PROC(proc) && proc->key &&
+            !(proc->hub_partial && nc->hub_partial)) {
             Proc_info *client_info, *server_info;
             // figure out which is the client
             int compare = strcmp(proc->key, nc->key);
@@ -609,16 +797,22 @@ static void hub_has_new_client(Proc_info *nc)
 }
 
 
-// /_o2/hub handler: makes this the hub of the sender
+// /_o2/hub handler: makes this the hub of the sender. Also handles
+// /_o2/hpm (user_data is non-NULL), a request for a partial mesh.
 //
 void o2_hub_handler(O2msg_data_ptr msg, const char *types,
                     O2arg_ptr *argv, int argc, const void *user_data)
 {
-    assert(o2_message_source);
-    if (ISA_REMOTE_PROC(o2_message_source)) {
+    // sending messages changes o2_message_source, so save it:
+    Proxy_info *source = o2_message_source;
+    assert(source);
+    if (ISA_REMOTE_PROC(source)) {
         o2_ctx->proc->uses_hub = O2_I_AM_HUB;
         hdprintf("####### I am the hub #########\n");
-        hub_has_new_client(TO_PROC_INFO(o2_message_source));
+        if (user_data && ISA_PROC(source)) {
+            o2_hub_mesh_new_client(TO_PROC_INFO(source));
+        }
+        hub_has_new_client(TO_PROC_INFO(source));
     }
 }
 #endif
@@ -662,7 +856,21 @@ void o2_services_handler(O2msg_data_ptr msg, const char *types,
     // is_connected flag causes a an /_o2/si status info to be sent when
     // the Proc_info is deleted due to a socket closing the connection:
     proc->is_connected = true;
-    
+#ifndef O2_NO_SVDELTA
+    if (ISA_PROC(proc)) {  // each /_o2/sv is one change to proc's services
+        o2_svdelta_received(TO_PROC_INFO(proc));
+    }
+#endif
+    o2_services_apply(proc);
+}
+
+
+// apply the service and tap descriptions in the rest of the message
+// being extracted (see o2_services_handler()) to services of proc
+//
+void o2_services_apply(Proxy_info *proc)
+{
+    O2arg_ptr arg;
     O2arg_ptr addarg;     // boolean - adding a service or deleting one?
     O2arg_ptr isservicearg; // boolean - service (true) or tap (false)?
     O2arg_ptr prop_tap_arg;  // string - properties string or tappee name
@@ -685,17 +893,26 @@ void o2_services_handler(O2msg_data_ptr msg, const char *types,
             if (isservicearg->B) {
                 Services_entry::service_provider_new(service, prop_tap,
                                                      proc, proc);
+#ifndef O2_NO_HUB
+                o2_hub_mesh_note(proc, service, true);
+#endif
             } else {
                 o2_tap_new(service, proc, prop_tap, send_mode);
             }
         } else { // remove a service - it is no longer offered by proc
             if (isservicearg->B) {
                 Services_entry::proc_service_remove(service, proc, NULL, -1);
+#ifndef O2_NO_HUB
+                o2_hub_mesh_note(proc, service, false);
+#endif
             } else {
                 o2_tap_remove(service, proc, prop_tap);
             }
         }
     }
+#ifndef O2_NO_HUB
+    o2_hub_mesh_flush(proc);  // relay changes to partial mesh clients
+#endif
 }
 
 #ifndef O2_NO_O2DISCOVERY
@@ -811,7 +1028,7 @@ O2err o2_hub(int version, const char *public_ip, const char *internal_ip,
         snprintf(o2_hub_addr, O2_MAX_PROCNAME_LEN, "@%s:%s:%04x%c%c%c%c",
                  pip, iip, tcp_port, 0, 0, 0, 0);
         return o2_discovered_a_remote_process(version, pip, iip, tcp_port,
-                                              udp_port, O2_DY_INFO);
+                                              udp_port, O2_DY_INFO, NULL);
     } else {
         o2_strcpy(hub_pip, pip, O2N_IP_LEN);
         o2_strcpy(hub_iip, iip, O2N_IP_LEN);
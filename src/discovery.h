@@ -13,6 +13,9 @@
 #define O2_DY_CALLBACK 53
 #define O2_DY_CONNECT 54
 
+// processes with at least this version accept a host id in /_o2/dy:
+#define O2_HOST_ID_VERSION 0x020100
+
 // we need to successfully allocate one port from the list. This number is
 // how many ports to search.
 #define PORT_MAX  16
@@ -52,6 +55,15 @@ void o2_send_discovery_at(O2time when);
 
 O2err o2_send_services(Proxy_info *proc);
 
+void o2_add_services(O2string dest);
+
+void o2_services_apply(Proxy_info *proc);
+
+O2err o2_send_max_msg_len(Proxy_info *proc);
+
+void o2_max_msg_len_handler(O2msg_data_ptr msg, const char *types,
+                            O2arg_ptr *argv, int argc, const void *user_data);
+
 void o2_discovery_handler(O2msg_data_ptr msg, const char *types,
                O2arg_ptr *argv, int argc, const void *user_data);
 
@@ -66,15 +78,23 @@ void o2_services_handler(O2msg_data_ptr msg, const char *types,
               O2arg_ptr *argv, int argc, const void *user_data);
 
 // call this if you have a (padded) O2string for name:
+// host_id is the o2n_host_id of the remote process if known, else NULL
 O2err o2_discovered_a_remote_process_name(const char *name, int version,
-        const char *internal_ip, int tcp_port, int udp_port, int dy);
+        const char *internal_ip, int tcp_port, int udp_port, int dy,
+        const char *host_id);
 
 // call this if you have just individual address components OR if
 // dy is O2_CALLBACK:
 O2err o2_discovered_a_remote_process(int version, const char *public_ip,
-        const char *internal_ip, int tcp_port, int udp_port, int dy);
-
+        const char *internal_ip, int tcp_port, int udp_port, int dy,
+        const char *host_id);
+
+// if host_flag, o2n_host_id is appended so that a receiver on the same
+// host can connect with a Unix-domain socket. Processes with versions
+// before O2_HOST_ID_VERSION drop this form (its types do not match), so
+// it is only sent to processes known to accept it, or along with the
+// usual form.
 O2message_ptr o2_make_dy_msg(Proc_info *proc, bool tcp_flag, bool swap_flag,
-                             int dy_flag);
+                             int dy_flag, bool host_flag = false);
 
 #endif /* DISCOVERY_H */
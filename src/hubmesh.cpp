@@ -0,0 +1,372 @@
+// hubmesh.cpp -- partial mesh of processes using a hub
+//
+// Normally, every process connects to every other process. A hub
+// (see o2_hub()) introduces each new client to every other process
+// with /_o2/dy messages, so with N processes there are N * (N - 1) / 2
+// connections and every service change is sent to every process.
+//
+// After o2_hub_partial_mesh(true), a process asks its hub for
+// /_o2/hpm instead of /_o2/hub. The hub does not introduce it to other
+// partial mesh clients. Instead, the hub sends it a directory: for
+// each process the hub is connected to, one !_o2/hd "siiB..." message
+// with the process name, its O2 version and UDP port, true, and
+// service name, add-flag pairs. As the hub learns of service changes
+// (through /_o2/sv and /_o2/sr), it relays them with more /_o2/hd
+// messages, and when a process is removed it sends /_o2/hd with false
+// (and no services).
+//
+// A partial mesh client keeps the directory in mesh_dir, a hash table
+// from service name to the processes that offer it. When the client
+// looks up a service it does not have (o2_status(), sending a message,
+// or o2_tap()), it connects to the processes offering the service
+// as if they were discovered. The services then become available in
+// the usual way, so the first messages to a service are dropped
+// (O2_NO_SERVICE) as they would be before discovery completes.
+//
+// Clients that use o2_hub() without a partial mesh are introduced to
+// every process as before, including partial mesh clients, so they
+// still see every service.
+
+#include "o2internal.h"
+#ifndef O2_NO_HUB
+#include "services.h"
+#include "message.h"
+#include "msgsend.h"
+#include "discovery.h"
+#include "pathtree.h"
+#include "hubmesh.h"
+
+#define MESH_RETRY 2.0  // seconds before asking a process to connect again
+
+bool o2_hub_mesh_enabled = false;
+
+// a process known from the hub's directory
+typedef struct Mesh_peer {
+    O2string name;  // process name (owned)
+    int32_t version;
+    int udp_port;
+    O2time requested;  // when we last tried to connect, or -1
+    Vec<O2string> services;  // services it offers (owned)
+} Mesh_peer;
+
+// an entry in mesh_dir: processes offering the service named by key
+class Mesh_service : public O2node {
+public:
+    Vec<Mesh_peer *> peers;
+    Mesh_service(const char *key) : O2node(key, O2TAG_EMPTY) { }
+};
+
+// a service change noted by the hub to be relayed
+typedef struct Mesh_note {
+    Proxy_info *proc;
+    O2string service;  // not owned
+    bool added;
+} Mesh_note;
+
+static Hash_node mesh_dir;  // client: service name -> Mesh_service
+static Vec<Mesh_peer *> mesh_peers;  // client: processes in directory
+static int mesh_clients = 0;  // hub: number of partial mesh clients
+static Vec<Mesh_note> mesh_notes;  // hub: changes not yet relayed
+
+
+O2err o2_hub_partial_mesh(bool enable)
+{
+    if (!o2_ensemble_name) {
+        return O2_NOT_INITIALIZED;
+    }
+    o2_hub_mesh_enabled = enable;
+    return O2_SUCCESS;
+}
+
+
+/************ hub side ************/
+
+// send one /_o2/hd message describing proc to client
+static void mesh_send_entry(Proc_info *client, Proxy_info *proc,
+                            bool exists, Mesh_note *notes, int n)
+{
+    o2_send_start();
+    o2_add_string(proc->key);
+    if (ISA_PROC(proc)) {
+        o2_add_int32(TO_PROC_INFO(proc)->version);
+        o2_add_int32(TO_PROC_INFO(proc)->udp_address.get_port());
+    } else {
+        o2_add_int32(0);
+        o2_add_int32(0);
+    }
+    o2_add_tf(exists);
+    for (int i = 0; i < n; i++) {
+        o2_add_string(notes[i].service);
+        o2_add_tf(notes[i].added);
+    }
+    O2message_ptr msg = o2_message_finish(0.0, "!_o2/hd", true);
+    if (!msg) return;
+    o2_prepare_to_deliver(msg);
+    client->send(false);
+}
+
+
+// send /_o2/hd describing proc to every partial mesh client except proc
+static void mesh_relay(Proxy_info *proc, bool exists, Mesh_note *notes,
+                       int n)
+{
+    for (int i = 0; i < o2n_fds_info.size(); i++) {
+        Proc_info *client = (Proc_info *) (o2n_fds_info[i]->owner);
+        if (client && ISA_PROC(client) && client->hub_partial &&
+            client != proc) {
+            mesh_send_entry(client, proc, exists, notes, n);
+        }
+    }
+}
+
+
+static int mesh_note_compare(const void *a, const void *b)
+{
+    uintptr_t pa = (uintptr_t) ((const Mesh_note *) a)->proc;
+    uintptr_t pb = (uintptr_t) ((const Mesh_note *) b)->proc;
+    return (pa < pb) ? -1 : (pa > pb);
+}
+
+
+void o2_hub_mesh_new_client(Proc_info *nc)
+{
+    if (!nc->hub_partial) {
+        nc->hub_partial = true;
+        mesh_clients++;
+    }
+    // list (process, service) for every service of a remote process
+    // other than nc, then sort by process so that each process is
+    // described by one message:
+    Vec<Mesh_note> notes;
+    Enumerate enumerator(&o2_ctx->path_tree);
+    O2node *entry;
+    while ((entry = enumerator.next())) {
+        Services_entry *services = TO_SERVICES_ENTRY(entry);
+        for (int i = 0; i < services->services.size(); i++) {
+            O2node *service = services->services[i].service;
+            if (ISA_PROC(service) && service != nc &&
+                service != o2_ctx->proc && ((Proc_info *) service)->key) {
+                Mesh_note *note = notes.append_space(1);
+                note->proc = (Proc_info *) service;
+                note->service = entry->key;
+                note->added = true;
+            }
+        }
+    }
+    Mesh_note *array = notes.get_array();
+    qsort(array, notes.size(), sizeof(Mesh_note), &mesh_note_compare);
+    int start = 0;
+    for (int i = 1; i <= notes.size(); i++) {
+        if (i == notes.size() || array[i].proc != array[start].proc) {
+            mesh_send_entry(nc, array[start].proc, true, &array[start],
+                            i - start);
+            start = i;
+        }
+    }
+    O2_DBh(hdprintf("hub sent directory of %d services to partial mesh "
+                    "client %s\n", notes.size(), nc->key));
+}
+
+
+void o2_hub_mesh_note(Proxy_info *proc, const char *service, bool added)
+{
+    if (mesh_clients == 0 || !ISA_PROC(proc)) {
+        return;
+    }
+    Mesh_note *note = mesh_notes.append_space(1);
+    note->proc = proc;
+    note->service = service;  // only used until o2_hub_mesh_flush()
+    note->added = added;
+}
+
+
+void o2_hub_mesh_flush(Proxy_info *proc)
+{
+    if (mesh_notes.size() > 0) {
+        mesh_relay(proc, true, mesh_notes.get_array(), mesh_notes.size());
+        mesh_notes.clear();
+    }
+}
+
+
+void o2_hub_mesh_removed(Proc_info *proc)
+{
+    if (proc->hub_partial) {
+        proc->hub_partial = false;
+        mesh_clients--;
+    }
+    if (mesh_clients > 0 && proc->key && !o2_ctx->finishing) {
+        mesh_relay(proc, false, NULL, 0);
+    }
+}
+
+
+/************ client side ************/
+
+static Mesh_peer *mesh_peer_find(const char *name)
+{
+    for (int i = 0; i < mesh_peers.size(); i++) {
+        if (streql(mesh_peers[i]->name, name)) {
+            return mesh_peers[i];
+        }
+    }
+    return NULL;
+}
+
+
+// add (or remove) peer to the providers of service in mesh_dir
+static void mesh_dir_update(Mesh_peer *peer, const char *service,
+                            bool added)
+{
+    O2node **ptr = mesh_dir.lookup(service);
+    Mesh_service *ms = (Mesh_service *) *ptr;
+    int i;
+    if (added) {
+        if (!ms) {
+            ms = new Mesh_service(service);
+            mesh_dir.entry_insert_at(ptr, ms);
+        }
+        for (i = 0; i < ms->peers.size(); i++) {
+            if (ms->peers[i] == peer) return;  // already known
+        }
+        ms->peers.push_back(peer);
+        peer->services.push_back(o2_heapify(service));
+        return;
+    }
+    if (ms) {
+        for (i = 0; i < ms->peers.size(); i++) {
+            if (ms->peers[i] == peer) {
+                ms->peers.remove(i);
+                break;
+            }
+        }
+        if (ms->peers.size() == 0) {
+            mesh_dir.entry_remove(ptr, true);
+        }
+    }
+    for (i = 0; i < peer->services.size(); i++) {
+        if (streql(peer->services[i], service)) {
+            O2_FREE((char *) peer->services[i]);
+            peer->services.remove(i);
+            break;
+        }
+    }
+}
+
+
+static void mesh_peer_free(Mesh_peer *peer, bool update_dir)
+{
+    while (peer->services.size() > 0) {
+        O2string service = peer->services.last();
+        if (update_dir) {  // also removes and frees service
+            mesh_dir_update(peer, service, false);
+        } else {
+            O2_FREE((char *) service);
+            peer->services.pop_back();
+        }
+    }
+    peer->services.finish();
+    O2_FREE((char *) peer->name);
+    O2_FREE(peer);
+}
+
+
+// handler for /_o2/hd "siiB..." from a hub: update the directory
+//
+static void mesh_dir_handler(O2msg_data_ptr msg, const char *types,
+                             O2arg_ptr *argv, int argc, const void *user_data)
+{
+    o2_extract_start(msg);
+    O2arg_ptr name_arg = o2_get_next(O2_STRING);
+    O2arg_ptr version_arg = o2_get_next(O2_INT32);
+    O2arg_ptr udp_port_arg = o2_get_next(O2_INT32);
+    O2arg_ptr exists_arg = o2_get_next(O2_BOOL);
+    if (!name_arg || !version_arg || !udp_port_arg || !exists_arg) return;
+    const char *name = name_arg->s;
+    if (o2_ctx->proc->key && streql(name, o2_ctx->proc->key)) {
+        return;  // we know our own services
+    }
+    Mesh_peer *peer = mesh_peer_find(name);
+    if (!exists_arg->B) {
+        if (peer) {
+            for (int i = 0; i < mesh_peers.size(); i++) {
+                if (mesh_peers[i] == peer) {
+                    mesh_peers.remove(i);
+                    break;
+                }
+            }
+            mesh_peer_free(peer, true);
+        }
+        return;
+    }
+    if (!peer) {
+        peer = O2_MALLOCT(Mesh_peer);
+        peer->name = o2_heapify(name);
+        peer->requested = -1;
+        peer->services.init(0);
+        mesh_peers.push_back(peer);
+    }
+    peer->version = version_arg->i32;
+    peer->udp_port = udp_port_arg->i32;
+    O2arg_ptr service_arg;
+    O2arg_ptr added_arg;
+    while ((service_arg = o2_get_next(O2_STRING)) &&
+           (added_arg = o2_get_next(O2_BOOL))) {
+        mesh_dir_update(peer, service_arg->s, added_arg->B);
+    }
+}
+
+
+void o2_hub_mesh_want(const char *name)
+{
+    if (!o2_hub_mesh_enabled || mesh_peers.size() == 0 ||
+        !o2_ctx->proc->key) {
+        return;
+    }
+    char service[NAME_BUF_LEN];
+    memset(service, 0, NAME_BUF_LEN);  // lookup() needs zero padding
+    for (int i = 0; name[i] && name[i] != '/' && i < MAX_SERVICE_LEN; i++) {
+        service[i] = name[i];
+    }
+    Mesh_service *ms = (Mesh_service *) *mesh_dir.lookup(service);
+    if (!ms) return;
+    O2time now = o2_local_time();
+    for (int i = 0; i < ms->peers.size(); i++) {
+        Mesh_peer *peer = ms->peers[i];
+        if (*o2_ctx->path_tree.lookup(peer->name) ||  // connected
+            (peer->requested >= 0 && now - peer->requested < MESH_RETRY)) {
+            continue;
+        }
+        peer->requested = now;
+        // name is @public:internal:port; connect as if discovered:
+        char internal_ip[O2N_IP_LEN];
+        o2_strcpy(internal_ip, peer->name + 10, 9);
+        int tcp_port = (int) strtol(peer->name + 19, NULL, 16);
+        O2_DBh(hdprintf("partial mesh connecting to %s for %s\n",
+                        peer->name, service));
+        o2_discovered_a_remote_process_name(peer->name, peer->version,
+                internal_ip, tcp_port, peer->udp_port, O2_DY_INFO, NULL);
+    }
+}
+
+
+void o2_hub_mesh_initialize()
+{
+    o2_method_new_internal("/_o2/hd", NULL, &mesh_dir_handler,
+                           NULL, false, false);
+}
+
+
+void o2_hub_mesh_finish()
+{
+    for (int i = 0; i < mesh_peers.size(); i++) {
+        mesh_peer_free(mesh_peers[i], false);
+    }
+    mesh_peers.finish();
+    mesh_dir.finish();
+    mesh_notes.finish();
+    mesh_clients = 0;
+    o2_hub_mesh_enabled = false;
+}
+
+#endif
@@ -0,0 +1,39 @@
+// hubmesh.h -- partial mesh of processes using a hub
+//
+// See hubmesh.cpp for a description.
+
+#ifndef HUBMESH_H
+#define HUBMESH_H
+
+#ifndef O2_NO_HUB
+
+// hubs with at least this version support o2_hub_partial_mesh():
+#define O2_HUB_MESH_VERSION 0x020100
+
+// true after o2_hub_partial_mesh(true): ask hubs for /_o2/hpm
+extern bool o2_hub_mesh_enabled;
+
+// install the /_o2/hd handler, called by o2_discovery_init_phase2()
+void o2_hub_mesh_initialize();
+
+// free the directory of processes, called by o2_finish()
+void o2_hub_mesh_finish();
+
+// (at the hub) nc has asked for a partial mesh: send the directory
+void o2_hub_mesh_new_client(Proc_info *nc);
+
+// (at the hub) proc added or removed service; call o2_hub_mesh_flush()
+// to tell partial mesh clients after each /_o2/sv message
+void o2_hub_mesh_note(Proxy_info *proc, const char *service, bool added);
+
+void o2_hub_mesh_flush(Proxy_info *proc);
+
+// (at the hub) proc is being removed, called by ~Proc_info()
+void o2_hub_mesh_removed(Proc_info *proc);
+
+// the service name (possibly followed by "/" and more of an address)
+// was not found; connect to the processes that offer it, if any
+void o2_hub_mesh_want(const char *name);
+
+#endif
+#endif
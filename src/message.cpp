@@ -125,6 +125,10 @@ static void need_argv(int argv_needed, int arg_needed)
 static bool is_bundle = false;
 static bool is_normal = false;
 #endif
+// deadline and O2_EXPIRE_FLAG or O2_EXPIRE_LOCAL_FLAG from
+// o2_add_deadline(), or 0 if none:
+static O2time msg_deadline = 0;
+static int32_t msg_deadline_flag = 0;
 
 static const char zeros[4] = {0, 0, 0, 0};
 #define ADD_PADDING(data) { int size = (int) (data).size(); \
@@ -145,10 +149,34 @@ O2err o2_send_start()
     is_bundle = false;
     is_normal = false;
 #endif
+    msg_deadline_flag = 0;
     add_type((O2type) ',');
     return O2_SUCCESS;
 }
 
+
+O2err o2_add_deadline(O2time deadline, bool relative)
+{
+    if (!o2_ctx->building_message_lock) {
+        return O2_FAIL;
+    }
+    if (relative) {
+        if (o2_clock_is_synchronized) {
+            msg_deadline = o2_time_get() + deadline;
+            msg_deadline_flag = O2_EXPIRE_FLAG;
+        } else {  // without a clock, other processes ignore the deadline
+            msg_deadline = o2_local_time() + deadline;
+            msg_deadline_flag = O2_EXPIRE_LOCAL_FLAG;
+        }
+    } else if (o2_clock_is_synchronized) {
+        msg_deadline = deadline;
+        msg_deadline_flag = O2_EXPIRE_FLAG;
+    } else {
+        return O2_NO_CLOCK;
+    }
+    return O2_SUCCESS;
+}
+
 O2err o2_add_float(float f)
 {
 #ifndef O2_NO_BUNDLES
@@ -286,7 +314,7 @@ O2err o2_add_message(O2message_ptr msg)
 
 
 O2message_ptr o2_message_finish(O2time time, const char *address,
-                                 bool tcp_flag)
+                                 int tcp_flag)
 {
     return o2_service_message_finish(time, NULL, address, tcp_flag);
 }
@@ -296,7 +324,7 @@ O2message_ptr o2_message_finish(O2time time, const char *address,
 // to create a bundle, o2_service_message_finish(time, service, "", flags)
 //
 O2message_ptr o2_service_message_finish(
-        O2time time, const char *service, const char *address, bool tcp_flag)
+        O2time time, const char *service, const char *address, int tcp_flag)
 {
     if (!o2_ctx->building_message_lock) {
         return NULL;  // not message was even started
@@ -317,13 +345,21 @@ O2message_ptr o2_service_message_finish(
     int prefix = (is_bundle ? '#' : '/');
 #endif
     O2message_ptr msg = NULL;
+    int32_t deadline_flag = msg_deadline_flag;
+#ifndef O2_NO_BUNDLES
+    if (is_bundle) {
+        deadline_flag = 0;  // a bundle ends with its last embedded message
+    }
+#endif
     int msg_size = offsetof(O2msg_data, address) - sizeof(msg->data.length) +
-                   addr_size + types_size + o2_ctx->msg_data.size();
+                   addr_size + types_size + o2_ctx->msg_data.size() +
+                   (deadline_flag ? sizeof(O2time) : 0);
      msg = o2_message_new(msg_size); // sets length for us
     if (!msg) return NULL;
 
     msg->next = NULL;
-    msg->data.misc = (tcp_flag ? O2_TCP_FLAG : O2_UDP_FLAG);;
+    msg->data.misc = (tcp_flag == O2_RELIABLE_UDP ? O2_RUDP_FLAG :
+                      (tcp_flag ? O2_TCP_FLAG : O2_UDP_FLAG)) | deadline_flag;
     msg->data.timestamp = time;
     char *dst = msg->data.address;
     int32_t *end = (int32_t *) (dst + addr_size);
@@ -348,11 +384,107 @@ O2message_ptr o2_service_message_finish(
         o2_ctx->msg_types.copy_to(dst);
     }
     o2_ctx->msg_data.copy_to((char *) end);
+    if (deadline_flag) {  // the deadline follows the data in network order
+        int64_t deadline = *(int64_t *) &msg_deadline;
+#if IS_LITTLE_ENDIAN
+        deadline = swap64(deadline);
+#endif
+        memcpy(O2_MSG_DATA_END(&msg->data) - sizeof deadline, &deadline,
+               sizeof deadline);
+    }
     o2_mem_check(msg);
     return msg;
 }
 
 
+// ------- MESSAGE DEADLINES -------
+// Messages with deadlines (see o2_add_deadline()) are dropped, without
+// looking up the service or calling handlers, by o2_message_send(),
+// o2_msg_deliver(), and when they reach the front of a queue of
+// messages waiting for a TCP connection, a shared memory ring or an
+// o2sm thread. Drops are counted per service (except in the o2sm
+// thread) and reported by o2_expired().
+
+typedef struct Expired_count {
+    char *service;  // owned
+    int64_t count;
+} Expired_count;
+
+static Vec<Expired_count> expired_counts;
+
+
+bool o2_msg_expired(O2msg_data_ptr msg, int32_t misc)
+{
+    if (!(misc & O2_EXPIRE_FLAGS)) {
+        return false;
+    }
+    O2time now = o2_local_time();
+    if (misc & O2_EXPIRE_FLAG) {
+        if (!o2_clock_is_synchronized) {
+            return false;  // cannot tell, so deliver it
+        }
+        now += o2_global_offset;
+    }
+    int64_t deadline;
+    memcpy(&deadline, O2_MSG_DATA_END(msg) - sizeof deadline,
+           sizeof deadline);
+#if IS_LITTLE_ENDIAN
+    deadline = swap64(deadline);
+#endif
+    return now > *(O2time *) &deadline;
+}
+
+
+void o2_expired_drop(O2message_ptr msg)
+{
+    // the service name follows '/' or '!' and ends with '/' or EOS:
+    const char *service = msg->data.address + 1;
+    const char *slash = strchr(service, '/');
+    int len = (int) (slash ? slash - service : strlen(service));
+    O2_DBl(hdprintf("expired message to %s dropped\n", msg->data.address));
+    int i;
+    for (i = 0; i < expired_counts.size(); i++) {
+        const char *s = expired_counts[i].service;
+        if (strncmp(s, service, len) == 0 && s[len] == 0) {
+            break;
+        }
+    }
+    if (i == expired_counts.size()) {
+        Expired_count *ec = expired_counts.append_space(1);
+        ec->service = O2_MALLOCNT(len + 1, char);
+        memcpy(ec->service, service, len);
+        ec->service[len] = 0;
+        ec->count = 0;
+    }
+    expired_counts[i].count++;
+    O2_FREE(msg);
+}
+
+
+int64_t o2_expired(const char *service, bool reset)
+{
+    int64_t count = 0;
+    for (int i = 0; i < expired_counts.size(); i++) {
+        if (!service || streql(service, expired_counts[i].service)) {
+            count += expired_counts[i].count;
+            if (reset) {
+                expired_counts[i].count = 0;
+            }
+        }
+    }
+    return count;
+}
+
+
+void o2_expired_finish()
+{
+    for (int i = 0; i < expired_counts.size(); i++) {
+        O2_FREE(expired_counts[i].service);
+    }
+    expired_counts.finish();
+}
+
+
 // ------- ADDENDUM: FUNCTIONS TO BUILD OSC BUNDLE FROM O2 BUNDLE ----
 #ifndef O2_NO_BUNDLES
 int o2_add_bundle_head(int64_t time)
@@ -749,7 +881,7 @@ O2err o2_msg_swap_endian(O2msg_data_ptr msg, int is_host_order)
 
 O2err o2_message_build(O2message_ptr *msg, O2time timestamp,
                           const char *service_name, const char *path,
-                          const char *typestring, bool tcp_flag, va_list ap)
+                          const char *typestring, int tcp_flag, va_list ap)
 {
     o2_send_start();
     
@@ -853,7 +985,7 @@ O2err o2_message_build(O2message_ptr *msg, O2time timestamp,
 }
 
 
-O2err o2_send_finish(O2time time, const char *address, bool tcp_flag)
+O2err o2_send_finish(O2time time, const char *address, int tcp_flag)
 {
     O2message_ptr msg = o2_message_finish(time, address, tcp_flag);
     if (!msg) return O2_FAIL;
@@ -23,6 +23,35 @@ extern thread_local O2_context *o2_ctx;
 #define O2_UDP_FLAG 0   // UDP, not TCP
 #define O2_TCP_FLAG 1   // TCP, not UDP
 #define O2_TAP_FLAG 2   // this is a message to a tap
+#define O2_RUDP_FLAG 4  // reliable UDP (see rudp.cpp), not TCP
+// O2_RUDP_FLAG in misc of a message in network order:
+#if IS_LITTLE_ENDIAN
+#define O2_RUDP_FLAG_NET (O2_RUDP_FLAG << 24)
+#else
+#define O2_RUDP_FLAG_NET O2_RUDP_FLAG
+#endif
+#define O2_SEQ_FLAG 8   // UDP datagram ends with a sequence number (see
+                        // o2_udp_sequence()); set only while in transit
+#if IS_LITTLE_ENDIAN
+#define O2_SEQ_FLAG_NET (O2_SEQ_FLAG << 24)
+#else
+#define O2_SEQ_FLAG_NET O2_SEQ_FLAG
+#endif
+// a message with a deadline (see o2_add_deadline()) ends with the
+// deadline, an 8-byte O2time in network order regardless of the order
+// of the message. The flag tells whether it is global or local time:
+#define O2_EXPIRE_FLAG 16        // deadline is in global time
+#define O2_EXPIRE_LOCAL_FLAG 32  // deadline is in local time, so it is
+                                 // ignored when received from another
+                                 // process
+#define O2_EXPIRE_FLAGS (O2_EXPIRE_FLAG | O2_EXPIRE_LOCAL_FLAG)
+#if IS_LITTLE_ENDIAN
+#define O2_EXPIRE_FLAGS_NET (O2_EXPIRE_FLAGS << 24)
+#define O2_EXPIRE_LOCAL_FLAG_NET (O2_EXPIRE_LOCAL_FLAG << 24)
+#else
+#define O2_EXPIRE_FLAGS_NET O2_EXPIRE_FLAGS
+#define O2_EXPIRE_LOCAL_FLAG_NET O2_EXPIRE_LOCAL_FLAG
+#endif
 
 #define MAX_SERVICE_LEN 64
 
@@ -85,6 +114,28 @@ O2err o2_msg_swap_endian(O2msg_data_ptr msg, int is_host_order);
 O2err o2_message_build(O2message_ptr *msg, O2time timestamp,
                        const char *service_name,
                        const char *path, const char *typestring,
-                       bool tcp_flag, va_list ap);
+                       int tcp_flag, va_list ap);
+
+// true if the deadline of msg has passed. misc is msg->misc in host
+// order, so this works for messages in either byte order.
+bool o2_msg_expired(O2msg_data_ptr msg, int32_t misc);
+
+// test for an expired message in host order without a function call
+// unless it has a deadline
+#define O2_MSG_EXPIRED(msg) \
+        (((msg)->misc & O2_EXPIRE_FLAGS) && o2_msg_expired(msg, (msg)->misc))
+
+// same for an O2netmsg_ptr to a message in network order
+#define O2_NETMSG_EXPIRED(msg) \
+        ((((O2message_ptr) (msg))->data.misc & O2_EXPIRE_FLAGS_NET) && \
+         o2_msg_expired(&((O2message_ptr) (msg))->data, \
+                        ntohl(((O2message_ptr) (msg))->data.misc)))
+
+// count msg as expired for its service and free it. Must be called
+// from the O2 thread.
+void o2_expired_drop(O2message_ptr msg);
+
+// free the expired message counts, called by o2_finish()
+void o2_expired_finish();
 
 #endif /* message_h */
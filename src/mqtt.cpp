@@ -475,14 +475,14 @@ void O2_MQTTcomm::disc_handler(char *payload, int payload_len)
             O2_DBq(hdprintf("o2_mqtt_disc_handler public_ip = internal_ip, "
                             "we are the 'client'\n"));
             o2_discovered_a_remote_process_name(name, version, internal_ip,
-                                  tcp_port, udp_port, O2_DY_INFO);
+                                  tcp_port, udp_port, O2_DY_INFO, NULL);
         } else { // (cmp > 0) -- CASE 1B: we are the server
             // CASE 1B1: we can receive a connection request
             if (streql(o2n_public_ip, o2n_internal_ip)) {
                 O2_DBq(hdprintf("o2_mqtt_disc_handler public_ip = internal_"
                                 "ip, we are the server\n"));
                 o2_discovered_a_remote_process_name(name, version, internal_ip,
-                                      tcp_port, udp_port, O2_DY_INFO);
+                                      tcp_port, udp_port, O2_DY_INFO, NULL);
                 proc_discovered = false;  // waiting for them to connect
             } else {  // CASE 1B2: must create an MQTT connection
                 O2_DBq(hdprintf("o2_mqtt_disc_handler public_ip = internal_ip,"
@@ -504,7 +504,7 @@ void O2_MQTTcomm::disc_handler(char *payload, int payload_len)
             O2_DBq(hdprintf("o2_mqtt_disc_handler same public_ip, we are the "
                             "client\n"));
             o2_discovered_a_remote_process_name(name, version, internal_ip,
-                                  tcp_port, udp_port, O2_DY_INFO);
+                                  tcp_port, udp_port, O2_DY_INFO, NULL);
         }
         goto wrap_up;
     }
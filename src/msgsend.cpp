@@ -121,6 +121,7 @@
 #include "message.h"
 #include "pathtree.h"
 #include "o2osc.h"
+#include "hubmesh.h"
 //#include "discovery.h"
 #include "o2sched.h"
 
@@ -427,6 +428,10 @@ void o2_msg_deliver(O2node *service, Services_entry *ss)
     const char *types;
     // STEP 0: If message is a bundle, send each embedded message separately
     O2message_ptr msg = o2_current_message();
+    if (O2_MSG_EXPIRED(&msg->data)) {
+        o2_expired_drop(o2_postpone_delivery());
+        return;
+    }
 #ifndef O2_NO_BUNDLES
     if (IS_BUNDLE(&msg->data)) {
         o2_embedded_msgs_deliver(&msg->data);
@@ -542,7 +547,7 @@ void o2_send_to_taps(O2message_ptr msg, Services_entry *ss)
 
 // This function is invoked by macros o2_send and o2_send_cmd.
 // It expects arguments to end with O2_MARKER_A and O2_MARKER_B
-O2err o2_send_marker(const char *path, double time, bool tcp_flag,
+O2err o2_send_marker(const char *path, double time, int tcp_flag,
                           const char *typestring, ...)
 {
     va_list ap;
@@ -553,7 +558,8 @@ O2err o2_send_marker(const char *path, double time, bool tcp_flag,
 
     O2_DB((msg->data.address[1] == '_' || msg->data.address[1] == '@') ?
           O2_DBS_FLAG : O2_DBs_FLAG,  // either non-system (s) or system (S)
-          hdprintf("sending%s (%p) ", (tcp_flag ? " cmd" : ""), msg);
+          hdprintf("sending%s (%p) ", (tcp_flag == O2_RELIABLE_UDP ?
+                   " reliable" : (tcp_flag ? " cmd" : "")), msg);
           o2_msg_data_print(&msg->data);
           dbprintf("\n"));
     return o2_message_send(msg);
@@ -581,10 +587,19 @@ O2err o2_service_msg_send(O2node *service, Services_entry *services)
 // Assume that msg is schedulable
 O2err o2_message_send(O2message_ptr msg)
 {
+    if (O2_MSG_EXPIRED(&msg->data)) {
+        o2_expired_drop(msg);  // too late to send or deliver
+        return O2_SUCCESS;
+    }
     o2_prepare_to_deliver(msg);
     // Find the remote service, note that we skip over the leading '/':
     Services_entry *services;
     O2node *service = o2_msg_service(&msg->data, &services);
+#ifndef O2_NO_HUB
+    if (!service) {  // connect if a hub knows the service
+        o2_hub_mesh_want(msg->data.address + 1);
+    }
+#endif
     if (service) {
         if (ISA_PROXY(service)) {
             Proxy_info *ri = (Proxy_info *) service;
@@ -0,0 +1,610 @@
+// netthread.cpp -- optional thread for network I/O
+//
+// Normally, o2_poll() calls poll() and then reads and writes sockets in
+// the application's thread (the "O2 thread"). After o2_network_thread(true),
+// a network thread does this work for the sockets of O2 processes and
+// o2lite clients: it waits for socket events, receives and frames
+// messages, accepts connections and sends TCP and UDP messages. The O2
+// thread only exchanges Net_items with the network thread through two
+// lock-free queues (O2queue, see o2atomic.h), so a GUI or audio callback
+// that calls o2_poll() does not make socket system calls. Handlers still
+// run in the O2 thread, and byte swapping is still done by the receiving
+// Proxy_info's deliver() method.
+//
+// Ownership: an Fds_info is handed over by o2n_thread_poll() when its
+// owner allows it (Net_interface::thread_io()) and it is not in the middle
+// of receiving a message. From then on (thread_owned is true), only the
+// network thread touches in_* and out_* fields. The O2 thread sends by
+// queueing NT_SEND items, counted in thread_tx, and closes by queueing
+// NT_CLOSE. The network thread closes the socket and replies with
+// NT_CLOSED, and only then is the Fds_info deleted by the O2 thread.
+// Sockets with custom I/O (OSC, MQTT, websockets, ZeroConf, files) stay
+// in the O2 thread, which still polls them in o2n_recv().
+//
+// O2queue is a stack, so each side grabs the whole stack and reverses it
+// to process items in FIFO order. The network thread blocks in poll(), so
+// the O2 thread writes a byte to a pipe to wake it, at most once per
+// wake-up. The O2 thread does not need to be woken: it picks up events
+// on its next call to o2_poll().
+
+#ifndef O2_NO_NETTHREAD
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/poll.h>
+#include <sys/socket.h>
+#include "o2internal.h"
+#include "o2atomic.h"
+#include "netthread.h"
+
+// Net_item kinds, from O2 thread to network thread:
+#define NT_ADD 1       // take over socket sock described by info
+#define NT_SEND 2      // send msg on info's TCP socket
+#define NT_CLOSE 3     // close info's socket (after pending output if !now)
+#define NT_UDP 4       // send msg by UDP to addr
+#define NT_QUIT 5      // process remaining items and exit
+// from network thread to O2 thread:
+#define NT_MESSAGE 6   // msg was received on info's socket
+#define NT_ACCEPTED 7  // TCP server info accepted connection sock
+#define NT_ERROR 8     // info's socket failed, so the O2 thread closes it
+#define NT_CLOSED 9    // info's socket is closed and info can be deleted
+
+class Net_item : public O2obj {
+  public:
+    Net_item *next;  // must be first: Net_items are O2list_elems in queues
+    int kind;
+    bool now;        // for NT_CLOSE
+    SOCKET sock;     // for NT_ADD and NT_ACCEPTED
+    Fds_info *info;
+    O2netmsg_ptr msg;
+    Net_address addr;  // for NT_UDP
+    double stamp;      // for NT_MESSAGE, kernel receive timestamp or -1
+};
+
+bool o2n_thread_active = false;
+thread_local bool o2n_on_net_thread = false;
+
+static pthread_t nt_pthread;
+static O2queue nt_commands;  // O2 thread -> network thread
+static O2queue nt_events;    // network thread -> O2 thread
+static std::atomic<bool> nt_wake_pending;
+static int nt_wake[2] = {-1, -1};  // pipe to wake up the network thread
+// events grabbed by the O2 thread but not processed yet:
+static Net_item *nt_pending = NULL;
+
+// state of a socket in the network thread. nt_fds and nt_socks are
+// parallel arrays like o2n_fds and o2n_fds_info. Index 0 is the pipe.
+typedef struct Nt_socket {
+    Fds_info *info;  // NULL after the socket is closed
+    SOCKET sock;
+    int net_tag;     // copied because the O2 thread can change info's
+    bool closing;    // close when out_message is sent
+    bool failed;     // NT_ERROR was sent; waiting for NT_CLOSE
+    bool dirty;      // new output was queued
+} Nt_socket;
+
+static Vec<struct pollfd> nt_fds;
+static Vec<Nt_socket> nt_socks;
+
+
+static Net_item *nt_item(int kind, Fds_info *info, O2netmsg_ptr msg)
+{
+    Net_item *item = new Net_item;
+    item->kind = kind;
+    item->now = false;
+    item->sock = INVALID_SOCKET;
+    item->info = info;
+    item->msg = msg;
+    item->stamp = -1;
+    return item;
+}
+
+
+// remove all items from queue atomically and return them in the order
+// they were pushed
+static Net_item *nt_grab(O2queue *queue)
+{
+    Net_item *all = (Net_item *) queue->grab();
+    Net_item *items = NULL;
+    while (all) {
+        Net_item *next = all->next;
+        all->next = items;
+        items = all;
+        all = next;
+    }
+    return items;
+}
+
+
+// O2 thread: pass item to the network thread
+static void nt_command(Net_item *item)
+{
+    nt_commands.push((O2list_elem *) item);
+    if (!nt_wake_pending.exchange(true)) {
+        char c = 0;
+        if (write(nt_wake[1], &c, 1) < 0) {
+            O2_DBo(hdprintf("network thread wake-up failed: %s\n",
+                            strerror(errno)));
+        }
+    }
+}
+
+
+// network thread: pass item to the O2 thread
+static void nt_event(Net_item *item)
+{
+    nt_events.push((O2list_elem *) item);
+}
+
+
+void o2n_thread_deliver(Fds_info *info, O2netmsg_ptr msg, double stamp)
+{
+    Net_item *item = nt_item(NT_MESSAGE, info, msg);
+    item->stamp = stamp;
+    nt_event(item);
+}
+
+
+/******* network thread *********/
+
+static void nt_add(Fds_info *info, SOCKET sock)
+{
+    info->thread_index = nt_fds.size();
+    struct pollfd *pfd = nt_fds.append_space(1);
+    pfd->fd = sock;
+    pfd->events = POLLIN | (info->out_message ? POLLOUT : 0);
+    pfd->revents = 0;
+    Nt_socket *ns = nt_socks.append_space(1);
+    ns->info = info;
+    ns->sock = sock;
+    ns->net_tag = info->net_tag;
+    ns->closing = false;
+    ns->failed = false;
+    ns->dirty = false;
+}
+
+
+// the socket at index i failed: free its messages, stop polling it and
+// ask the O2 thread to close it
+static void nt_fail(int i)
+{
+    Nt_socket *ns = &nt_socks[i];
+    if (ns->failed) return;
+    ns->failed = true;
+    ns->info->reset();  // frees pending output and updates thread_tx
+    ns->info->message_cleanup();
+    nt_fds[i].fd = -1;  // poll() ignores negative descriptors
+    nt_event(nt_item(NT_ERROR, ns->info, NULL));
+}
+
+
+// close the socket at index i and give its Fds_info back to the O2 thread.
+// The entry is removed later by nt_remove_closed().
+static void nt_close(int i)
+{
+    Nt_socket *ns = &nt_socks[i];
+    Fds_info *info = ns->info;
+    info->reset();
+    info->message_cleanup();
+#ifdef SHUT_WR
+    shutdown(ns->sock, SHUT_WR);
+#endif
+    closesocket(ns->sock);
+    info->thread_index = -1;
+    ns->info = NULL;
+    nt_fds[i].fd = -1;
+    nt_event(nt_item(NT_CLOSED, info, NULL));
+}
+
+
+static void nt_remove_closed()
+{
+    for (int i = nt_socks.size() - 1; i > 0; i--) {
+        if (!nt_socks[i].info) {
+            nt_socks.remove(i);
+            nt_fds.remove(i);
+            if (i < nt_socks.size()) {  // an entry moved to i
+                nt_socks[i].info->thread_index = i;
+            }
+        }
+    }
+}
+
+
+static void nt_write(int i)
+{
+    Nt_socket *ns = &nt_socks[i];
+    if (ns->failed) return;
+    O2err rslt = ns->info->write_pending(&nt_fds[i], false);
+    if (rslt == O2_SUCCESS) {
+        nt_fds[i].events &= ~POLLOUT;
+        if (ns->closing) {
+            nt_close(i);
+        }
+    } else if (rslt == O2_SOCKET_ERROR) {
+        nt_fail(i);
+    }
+}
+
+
+// process items from the O2 thread. Returns false after NT_QUIT.
+static bool nt_do_commands()
+{
+    Net_item *items = nt_grab(&nt_commands);
+    bool running = true;
+    o2n_udp_batch_begin();
+    while (items) {
+        Net_item *item = items;
+        items = item->next;
+        Fds_info *info = item->info;
+        int i = info ? info->thread_index : -1;
+        switch (item->kind) {
+          case NT_ADD:
+            nt_add(info, item->sock);
+            break;
+          case NT_SEND:
+            if (i <= 0 || nt_socks[i].failed || nt_socks[i].closing) {
+                O2_FREE(item->msg);
+                info->thread_tx--;
+            } else {
+                O2netmsg_ptr *pending = &info->out_message;
+                while (*pending) pending = &(*pending)->next;
+                item->msg->next = NULL;
+                *pending = item->msg;
+                nt_socks[i].dirty = true;
+            }
+            break;
+          case NT_CLOSE:
+            if (i > 0) {
+                if (item->now || !info->out_message || nt_socks[i].failed) {
+                    nt_close(i);
+                } else {  // stop reading and close when output is sent
+                    nt_socks[i].closing = true;
+                    nt_fds[i].events = POLLOUT;
+                }
+            }
+            break;
+          case NT_UDP:
+            o2n_send_udp(&item->addr, item->msg);
+            break;
+          case NT_QUIT:
+            running = false;
+            break;
+        }
+        delete item;
+    }
+    o2n_udp_batch_flush();
+    // send new output, gathering all new messages for each socket
+    for (int i = 1; i < nt_socks.size(); i++) {
+        Nt_socket *ns = &nt_socks[i];
+        if (ns->dirty && ns->info) {
+            ns->dirty = false;
+            nt_write(i);
+        }
+    }
+    nt_remove_closed();
+    return running;
+}
+
+
+static void nt_socket_event(int i)
+{
+    struct pollfd *pfd = &nt_fds[i];
+    Nt_socket *ns = &nt_socks[i];
+    short revents = pfd->revents;
+    if (!revents || !ns->info || ns->failed) {
+        return;
+    }
+    if (revents & POLLERR) {
+    } else if (revents & POLLHUP) {
+        O2_DBo(hdprintf("network thread: POLLHUP on socket %ld\n",
+                        (long) ns->sock));
+        nt_fail(i);
+        return;
+    }
+    if (revents & POLLOUT) {
+        nt_write(i);
+        if (!ns->info || ns->failed) return;
+    }
+    if (revents & POLLIN) {
+        Fds_info *info = ns->info;
+        if (ns->net_tag & (NET_TCP_CLIENT | NET_TCP_CONNECTION)) {
+            if (info->read_buffered(ns->sock)) {
+                nt_fail(i);
+            }
+        } else if (ns->net_tag == NET_UDP_SERVER) {
+#ifdef O2N_MMSG
+            info->udp_recv_batch(ns->sock);
+#else
+            info->udp_recv(ns->sock);
+#endif
+        } else if (ns->net_tag == NET_TCP_SERVER) {
+            SOCKET connection = accept(ns->sock, NULL, NULL);
+            if (connection != INVALID_SOCKET) {
+                Net_item *item = nt_item(NT_ACCEPTED, info, NULL);
+                item->sock = connection;
+                nt_event(item);
+            }
+        }
+    }
+}
+
+
+static void *nt_main(void *arg)
+{
+    o2_ctx = new O2_context();  // only used for memory allocation
+    o2n_on_net_thread = true;
+    o2n_private_buffers(true);
+    nt_fds.init(8);
+    nt_socks.init(8);
+    struct pollfd *pfd = nt_fds.append_space(1);
+    pfd->fd = nt_wake[0];
+    pfd->events = POLLIN;
+    pfd->revents = 0;
+    Nt_socket *ns = nt_socks.append_space(1);
+    memset(ns, 0, sizeof *ns);
+
+    // clear nt_wake_pending before taking commands so that a command
+    // pushed after nt_grab() always writes to the pipe
+    nt_wake_pending = false;
+    while (nt_do_commands()) {
+        if (poll(nt_fds.get_array(), nt_fds.size(), -1) <= 0) {
+            continue;  // EINTR
+        }
+        if (nt_fds[0].revents & POLLIN) {
+            char buf[64];
+            while (read(nt_wake[0], buf, sizeof buf) > 0) ;
+            nt_wake_pending = false;
+        }
+        for (int i = 1; i < nt_fds.size(); i++) {
+            nt_socket_event(i);
+        }
+        nt_remove_closed();
+    }
+    // sockets waiting to finish output are closed now. Other sockets are
+    // returned to the O2 thread by o2n_thread_stop() with their state.
+    for (int i = 1; i < nt_socks.size(); i++) {
+        if (nt_socks[i].info && nt_socks[i].closing) {
+            nt_close(i);
+        }
+    }
+    nt_fds.finish();
+    nt_socks.finish();
+    o2n_private_buffers(false);
+    delete o2_ctx;
+    o2_ctx = NULL;
+    return NULL;
+}
+
+
+/******* O2 thread *********/
+
+// can the network thread take over info?
+static bool nt_eligible(Fds_info *info)
+{
+    if (info->delete_me || !info->owner || !info->owner->thread_io() ||
+        info->read_type != READ_O2 || info->write_type != WRITE_O2) {
+        return false;
+    }
+    if (info->net_tag & (NET_TCP_CLIENT | NET_TCP_CONNECTION)) {
+        // do not hand over a partially received message
+        return info->in_length_got == 0 && !info->in_message;
+    }
+    return info->net_tag == NET_UDP_SERVER || info->net_tag == NET_TCP_SERVER;
+}
+
+
+static void nt_hand_over(Fds_info *info)
+{
+    int n = 0;
+    for (O2netmsg_ptr msg = info->out_message; msg; msg = msg->next) {
+        n++;
+    }
+    info->thread_tx = n;
+    info->thread_owned = true;
+    info->set_events(0);  // poll() in o2n_recv() can skip this socket
+    Net_item *item = nt_item(NT_ADD, info, NULL);
+    item->sock = info->get_socket();
+    nt_command(item);
+    O2_DBo(hdprintf("socket %ld (%s) handed to network thread\n",
+                    (long) item->sock, Fds_info::tag_to_string(info->net_tag)));
+}
+
+
+// process events from the network thread. If deliver is false, received
+// messages are freed instead of delivered.
+static void nt_process_events(bool deliver)
+{
+    Net_item *items = nt_grab(&nt_events);
+    if (nt_pending) {  // a handler stopped an earlier pass; append items
+        Net_item *last = nt_pending;
+        while (last->next) last = last->next;
+        last->next = items;
+    } else {
+        nt_pending = items;
+    }
+    while (nt_pending) {
+        // copy and free item first: a handler might call o2_finish()
+        Net_item *item = nt_pending;
+        nt_pending = item->next;
+        int kind = item->kind;
+        Fds_info *info = item->info;
+        O2netmsg_ptr msg = item->msg;
+        SOCKET sock = item->sock;
+        double stamp = item->stamp;
+        delete item;
+        switch (kind) {
+          case NT_MESSAGE:
+            if (deliver) {
+                info->deliver_message(msg, stamp);  // frees msg if closing
+            } else {
+                O2_FREE(msg);
+            }
+            break;
+          case NT_ACCEPTED:
+            if (info->net_tag == NET_TCP_SERVER) {
+                info->add_connection(sock);
+            } else {
+                closesocket(sock);
+            }
+            break;
+          case NT_ERROR:
+            O2_DBo(hdprintf("network thread reports error on socket %ld\n",
+                            (long) info->get_socket()));
+            info->close_socket(true);
+            break;
+          case NT_CLOSED:
+            info->thread_closed();
+            break;
+        }
+        if (!o2_ensemble_name) {  // handler called o2_finish()
+            return;
+        }
+    }
+}
+
+
+int o2n_thread_poll()
+{
+    nt_process_events(true);
+    if (!o2_ensemble_name || !o2n_thread_active) {
+        return o2n_fds_info.size();  // the O2 thread polls all sockets
+    }
+    int remaining = 0;
+    for (int i = 0; i < o2n_fds_info.size(); i++) {
+        Fds_info *info = o2n_fds_info[i];
+        if (info->thread_owned) {
+            continue;
+        } else if (nt_eligible(info)) {
+            nt_hand_over(info);
+        } else if (info->delete_me != 2) {
+            remaining++;
+        }
+    }
+    return remaining;
+}
+
+
+void o2n_thread_stop(bool deliver)
+{
+    if (!o2n_thread_active) {
+        return;
+    }
+    nt_command(nt_item(NT_QUIT, NULL, NULL));
+    pthread_join(nt_pthread, NULL);
+    o2n_thread_active = false;
+    close(nt_wake[0]);
+    close(nt_wake[1]);
+    nt_wake[0] = nt_wake[1] = -1;
+    // take back sockets, including partial input and pending output
+    for (int i = 0; i < o2n_fds_info.size(); i++) {
+        Fds_info *info = o2n_fds_info[i];
+        if (info->thread_owned) {
+            info->thread_owned = false;
+            info->thread_tx = 0;
+            if (info->delete_me == 0) {
+                info->set_events(POLLIN |
+                                 (info->out_message ? POLLOUT : 0));
+            }
+        }
+    }
+    nt_process_events(deliver);
+}
+
+
+// wait until no more than limit messages are queued on info
+static O2err nt_wait(Fds_info *info, int32_t limit)
+{
+    int spins = 0;
+    while (info->thread_tx > limit) {
+        if (info->net_tag == NET_INFO_CLOSED) {
+            return O2_FAIL;
+        }
+        if (++spins < 1000) {
+            sched_yield();
+        } else {
+            o2_sleep(1);
+        }
+    }
+    return O2_SUCCESS;
+}
+
+
+O2err o2n_thread_send(Fds_info *info, bool block, O2netmsg_ptr msg)
+{
+    if (info->net_tag == NET_INFO_CLOSED) {
+        O2_FREE(msg);
+        return O2_FAIL;
+    }
+    if (block) {
+        O2err rslt = nt_wait(info, O2N_THREAD_TX_MAX - 1);
+        if (rslt != O2_SUCCESS) {
+            O2_FREE(msg);
+            return rslt;
+        }
+    }
+    info->thread_tx++;
+    nt_command(nt_item(NT_SEND, info, msg));
+    return O2_SUCCESS;
+}
+
+
+O2err o2n_thread_flush(Fds_info *info, bool block)
+{
+    if (block) {
+        return nt_wait(info, 0);
+    }
+    return info->thread_tx > 0 ? O2_BLOCKED : O2_SUCCESS;
+}
+
+
+void o2n_thread_close(Fds_info *info, bool now)
+{
+    Net_item *item = nt_item(NT_CLOSE, info, NULL);
+    item->now = now;
+    nt_command(item);
+}
+
+
+O2err o2n_thread_send_udp(Net_address *ua, O2netmsg_ptr msg)
+{
+    Net_item *item = nt_item(NT_UDP, NULL, msg);
+    item->addr = *ua;
+    nt_command(item);
+    return O2_SUCCESS;
+}
+
+
+O2err o2_network_thread(bool enable)
+{
+    if (!o2_ensemble_name) {
+        return O2_NOT_INITIALIZED;
+    }
+    if (enable == o2n_thread_active) {
+        return O2_SUCCESS;
+    }
+    if (!enable) {
+        o2n_thread_stop(true);
+        return O2_SUCCESS;
+    }
+    if (pipe(nt_wake) < 0) {
+        return O2_FAIL;
+    }
+    fcntl(nt_wake[0], F_SETFL, O_NONBLOCK);
+    fcntl(nt_wake[1], F_SETFL, O_NONBLOCK);
+    nt_wake_pending = false;
+    o2n_thread_active = true;
+    if (pthread_create(&nt_pthread, NULL, &nt_main, NULL) != 0) {
+        o2n_thread_active = false;
+        close(nt_wake[0]);
+        close(nt_wake[1]);
+        nt_wake[0] = nt_wake[1] = -1;
+        return O2_FAIL;
+    }
+    // sockets are handed over by the next o2_poll()
+    return O2_SUCCESS;
+}
+
+#endif
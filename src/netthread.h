@@ -0,0 +1,38 @@
+// netthread.h -- optional thread for network I/O
+//
+// See netthread.cpp for a description.
+
+#ifndef NETTHREAD_H
+#define NETTHREAD_H
+
+#ifndef O2_NO_NETTHREAD
+
+// a blocking send waits (and o2_can_send() reports O2_BLOCKED) while this
+// many messages are queued for the network thread to send on a socket:
+#define O2N_THREAD_TX_MAX 16
+
+extern bool o2n_thread_active;  // the network thread is running
+extern thread_local bool o2n_on_net_thread;  // true in the network thread
+
+// called by o2n_recv() in the O2 thread: deliver messages and process
+// events from the network thread and hand over new sockets. Returns the
+// number of sockets the O2 thread must still poll itself.
+int o2n_thread_poll();
+
+// stop the network thread and take back its sockets. If deliver is
+// true, messages already received by the network thread are delivered;
+// otherwise they are freed. Called by o2_finish().
+void o2n_thread_stop(bool deliver);
+
+// network thread: pass a received message (and its kernel receive
+// timestamp, or -1) to the O2 thread
+void o2n_thread_deliver(Fds_info *info, O2netmsg_ptr msg, double stamp);
+
+// O2 thread: operations on sockets owned by the network thread
+O2err o2n_thread_send(Fds_info *info, bool block, O2netmsg_ptr msg);
+O2err o2n_thread_flush(Fds_info *info, bool block);
+void o2n_thread_close(Fds_info *info, bool now);
+O2err o2n_thread_send_udp(Net_address *ua, O2netmsg_ptr msg);
+
+#endif
+#endif
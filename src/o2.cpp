@@ -374,11 +374,13 @@ proc_info_ptr). If equal, we use "_o2" instead of proc->key.
 
 Sockets
 -------
-o2_ctx->fds_info has state to receive messages. Since reads may not
-read the entire message, we collect incoming bytes into in_length for
-the length count, and then in_message for the data. When a message is
-completely received, there is a handler function that is called to 
-process the message.
+o2_ctx->fds_info has state to receive messages. Each TCP read gets
+as many bytes as are available (up to 64KB) in a buffer shared by all
+sockets, and every complete message in the buffer is copied out and
+delivered. Since reads may not read the entire message, we collect the
+remaining incoming bytes into in_length for the length count, and then
+in_message for the data. When a message is completely received, there
+is a handler function that is called to process the message.
     For outgoing O2 messages, we have an associated process to tell
 where to send.
     For incoming O2 messages, no extra info is needed; just deliver 
@@ -935,6 +937,13 @@ See ../doc/o2lite.txt for details.
 #include "properties.h"
 #include "pathtree.h"
 #include "o2zcdisc.h"
+#include "blobstream.h"
+#include "netthread.h"
+#include "shmring.h"
+#include "rudp.h"
+#include "svdelta.h"
+#include "hubmesh.h"
+#include "peercache.h"
 
 const char *o2_ensemble_name = NULL;
 char o2_hub_addr[O2_MAX_PROCNAME_LEN];
@@ -949,6 +958,15 @@ O2time o2_global_offset = 0.0;
 int o2_poll_count = 0;  // counter for testing things
 #endif
 
+// poll budget (see o2_poll_budget()):
+int o2_poll_msgs = 0;  // messages processed by the current o2_poll()
+bool o2_poll_budget_on = false;
+static int poll_max_msgs = 0;     // 0 means no limit
+static int poll_max_usec = 0;     // 0 means no limit
+static O2time poll_budget_end;    // o2_native_time() when budget runs out
+static bool poll_budget_hit = false;
+static O2poll_budget_stats poll_budget_stats;
+
 thread_local O2_context *o2_ctx = NULL;
 static O2_context main_context;
 bool o2_interrupt_requested = false;
@@ -1011,6 +1029,54 @@ O2err o2_network_enable(bool enable)
 }
 
 
+#ifndef O2_NO_UNIXSOCK
+O2err o2_unix_sockets_enable(bool enable)
+{
+    if (o2_ensemble_name) {
+        return O2_ALREADY_RUNNING;
+    }
+    o2n_unix_enabled = enable;
+    return O2_SUCCESS;
+}
+#endif
+
+
+#ifndef O2_NO_SHMRING
+O2err o2_shm_rings_enable(bool enable)
+{
+    if (o2_ensemble_name) {
+        return O2_ALREADY_RUNNING;
+    }
+    o2_shmring_enabled = enable;
+    return O2_SUCCESS;
+}
+#endif
+
+
+#ifndef O2_NO_BUNDLES
+O2err o2_udp_coalesce(int max_size)
+{
+    if (max_size < 0) {
+        return O2_BAD_ARGS;
+    }
+    if (max_size == 0) {  // disable, but first send what is held
+        o2_udp_coalesce_flush();
+    } else if (max_size > O2_MAX_MSG_SIZE) {
+        max_size = O2_MAX_MSG_SIZE;
+    }
+    o2_udp_coalesce_max = max_size;
+    return O2_SUCCESS;
+}
+#endif
+
+
+O2err o2_udp_sequence(bool enable)
+{
+    o2_udp_sequence_enabled = enable;
+    return O2_SUCCESS;
+}
+
+
 O2err o2_initialize(const char *ensemble_name)
 {
     O2err err;
@@ -1090,6 +1156,15 @@ O2err o2_initialize(const char *ensemble_name)
 void o2_init_phase2()
 {
     o2_processes_initialize();
+#ifndef O2_NO_SHMRING
+    o2_shmring_initialize();
+#endif
+#ifndef O2_NO_RUDP
+    o2_rudp_initialize();
+#endif
+#ifndef O2_NO_SVDELTA
+    o2_svdelta_initialize();
+#endif
     o2_discovery_init_phase2();
     // start the discovery and MQTT setup
 #ifndef O2_NO_O2DISCOVERY
@@ -1149,9 +1224,9 @@ static void send_one_sv_msg(Proxy_info *proc, const char *service_name,
     o2_add_string(service_name);
     o2_add_tf(added);
     // last field in message is either the tapper or properties
-    if (added && *tappee == 0) {
+    if (*tappee == 0) {
         o2_add_true();
-        o2_add_string(properties);
+        o2_add_string(added ? properties : "");
     } else {
         o2_add_false();
         o2_add_string(tappee);
@@ -1175,11 +1250,14 @@ static void send_one_sv_msg(Proxy_info *proc, const char *service_name,
 void o2_notify_others(const char *service_name, bool added, const char *tappee,
                       const char *properties, int send_mode)
 {
+    if (!tappee) tappee = ""; // Make sure we have a string to send.
+    if (!properties) properties = "";
+#ifndef O2_NO_SVDELTA
+    o2_svdelta_log(service_name, added, tappee, properties, send_mode);
+#endif
     if (!o2_ctx->proc->key) {
         return;  // no notifications until we have a name
     }
-    if (!tappee) tappee = ""; // Make sure we have a string to send.
-    if (!properties) properties = "";
     // when we add or remove a service, we must tell all other
     // processes about it. To find all other processes, use the
     // o2_ctx->fds_info table since all but a few of the
@@ -1315,6 +1393,10 @@ O2err o2_tap(const char *tappee, const char *tapper, O2tap_send_mode send_mode)
         return O2_BAD_NAME;
     }
     o2_string_pad(padded_tappee, tappee);
+#ifndef O2_NO_HUB
+    // the tappee's provider must know of the tap, so connect to it:
+    o2_hub_mesh_want(tappee);
+#endif
     O2err err = o2_tap_new(tapper, o2_ctx->proc, padded_tappee, send_mode);
     return err;
 }
@@ -1364,7 +1446,11 @@ O2err o2_poll()
     }
     o2_poll_in_progress = true;
     // DEBUGGING: check_messages();
+    o2_clock_poll();
     o2_local_now = o2_local_time();
+    o2_poll_msgs = 0;
+    poll_budget_hit = false;
+    poll_budget_end = o2_native_time() + poll_max_usec * 1e-6;
     if (o2_gtsched_started) {
         o2_global_now = o2_local_to_global(o2_local_now);
         // offset can be used by a shared memory process
@@ -1372,11 +1458,19 @@ O2err o2_poll()
     } else {
         o2_global_now = -1.0;
     }
+    o2n_udp_batch_begin(); // collect UDP sends to send them together
     o2_sched_poll(); // deal with the timestamped message
     o2n_recv(); // receive and dispatch messages
+#ifndef O2_NO_SHMRING
+    o2_shmring_poll(); // send and receive with shared memory rings
+#endif
+#ifndef O2_NO_RUDP
+    o2_rudp_poll(); // retransmit and acknowledge reliable UDP
+#endif
 #ifndef O2_NO_BRIDGES
     o2_poll_bridges();
 #endif
+    o2_stream_poll(); // send chunks of large blobs
 #ifndef O2_NO_ZEROCONF
 #ifdef __linux__
     o2_poll_avahi();  // linux uses AvahiSimplePoll instead of O2 sockets
@@ -1384,11 +1478,58 @@ O2err o2_poll()
 #endif
 #endif
     o2_deliver_pending();
+#ifndef O2_NO_BUNDLES
+    o2_udp_coalesce_flush(); // send coalesced UDP messages as bundles
+#endif
+    o2n_udp_batch_flush();
+    poll_budget_stats.polls++;
+    poll_budget_stats.messages += o2_poll_msgs;
+    if (o2_poll_msgs > poll_budget_stats.max_messages) {
+        poll_budget_stats.max_messages = o2_poll_msgs;
+    }
+    if (poll_budget_hit) {
+        poll_budget_stats.exhausted++;
+    }
     o2_poll_in_progress = false;
     return O2_SUCCESS;
 }
 
 
+O2err o2_poll_budget(int max_messages, int max_usec)
+{
+    if (max_messages < 0 || max_usec < 0) {
+        return O2_BAD_ARGS;
+    }
+    poll_max_msgs = max_messages;
+    poll_max_usec = max_usec;
+    o2_poll_budget_on = (max_messages || max_usec);
+    return O2_SUCCESS;
+}
+
+
+bool o2_poll_budget_check()
+{
+    if (!poll_budget_hit &&
+        ((poll_max_msgs && o2_poll_msgs >= poll_max_msgs) ||
+         (poll_max_usec && o2_native_time() >= poll_budget_end))) {
+        poll_budget_hit = true;
+    }
+    return poll_budget_hit;
+}
+
+
+O2err o2_poll_budget_stats(O2poll_budget_stats *stats, bool reset)
+{
+    if (stats) {
+        *stats = poll_budget_stats;
+    }
+    if (reset) {
+        memset(&poll_budget_stats, 0, sizeof poll_budget_stats);
+    }
+    return O2_SUCCESS;
+}
+
+
 O2err o2_reset_interrupt_request()
 {
     if (!o2_interrupt_requested) {
@@ -1428,6 +1569,11 @@ int o2_status(const char *service)
         return O2_BAD_NAME;
     Services_entry *services;
     O2node *entry = Services_entry::service_find(service, &services);
+#ifndef O2_NO_HUB
+    if (!entry) {
+        o2_hub_mesh_want(service);  // connect if a hub knows the service
+    }
+#endif
     return (entry ? entry->status(NULL) : O2_UNKNOWN);
 }
 
@@ -1443,6 +1589,12 @@ O2err o2_can_send(const char *service)
     O2node *entry = Services_entry::service_find(service, &services);
     if (entry && ISA_PROXY(entry)) {
         Fds_info *fds = ((Proxy_info *) entry)->fds_info;
+#ifndef O2_NO_SHMRING
+        if (ISA_PROC(entry) && TO_PROC_INFO(entry)->shm_link &&
+            TO_PROC_INFO(entry)->shm_link->tx_ready) {
+            return TO_PROC_INFO(entry)->shm_link->can_send();
+        }
+#endif
         if (fds) {
             return fds->can_send();
         } else {
@@ -1501,13 +1653,15 @@ static const char *error_strings[] = {
     "O2_NOT_INITIALIZED",
     "O2_BLOCKED",
     "O2_NO_PORT",
-    "O2_NO_NETWORK"
+    "O2_NO_NETWORK",
+    "O2_INTERRUPT_REQUESTED",
+    "O2_MSG_TOO_BIG"
 };
     
 
 const char *o2_error_to_string(O2err i)
 {
-    if (i < 1 && i >= O2_NO_NETWORK) {
+    if (i < 1 && i >= O2_MSG_TOO_BIG) {
         sprintf(o2_error_msg, "O2 error %s", error_strings[-i]);
     } else {
         sprintf(o2_error_msg, "O2 error, code is %d", i);
@@ -1544,6 +1698,13 @@ O2err o2_finish()
     if (!o2_ensemble_name) { // see if we're running
         return O2_NOT_INITIALIZED;
     }
+    o2_stream_finish();
+#ifndef O2_NO_BUNDLES
+    o2_udp_coalesce_flush(); // send any coalesced UDP messages
+#endif
+#ifndef O2_NO_NETTHREAD
+    o2n_thread_stop(false);
+#endif
 #ifndef O2_NO_MQTT
     o2_mqtt_disconnect();
 #endif
@@ -1563,8 +1724,24 @@ O2err o2_finish()
     // will try to delete o2_ctx->proc. There's no reference counting, so
     // remove one reference before proceeding:
     o2_udp_server->owner = NULL;
+#ifndef O2_NO_UNIXSOCK
+    o2_unix_finish();  // also owned by o2_ctx->proc
+#endif
 
     o2_discovery_finish();
+    o2_address_marks_finish();
+#ifndef O2_NO_SHMRING
+    o2_shmring_finish();  // before Proc_infos are deleted
+#endif
+#ifndef O2_NO_RUDP
+    o2_rudp_finish();
+#endif
+#ifndef O2_NO_SVDELTA
+    o2_svdelta_finish();  // before Proc_infos are deleted
+#endif
+#ifndef O2_NO_PEERCACHE
+    o2_peer_cache_finish();  // before Proc_infos are deleted
+#endif
     // Close all the sockets.
     if (o2_ctx) {
         for (int i = 0; i < o2n_fds_info.size(); i++) {
@@ -1584,10 +1761,16 @@ O2err o2_finish()
             info->close_socket(true);
         }
         o2n_free_deleted_sockets(); // deletes process_info structs
+#ifndef O2_NO_BUNDLES
+        o2_udp_coalesce_finish();
+#endif
         // now that there are no more sockets, we can free local process,
         // which multiple sockets had a reference to
         o2_ctx->proc = NULL;
     }
+#ifndef O2_NO_HUB
+    o2_hub_mesh_finish();  // after Proc_infos are deleted
+#endif
     o2n_finish();
 
     o2_sched_finish(&o2_gtsched);
@@ -1596,6 +1779,7 @@ O2err o2_finish()
     o2_clock_finish();
     o2_services_list_finish();
     o2_free_pending_msgs(); // free any undelivered messages
+    o2_expired_finish();
 
     O2_FREE((void *) o2_ensemble_name);
     o2_ensemble_name = NULL;
@@ -6,8 +6,8 @@
 #ifndef O2_H
 #define O2_H
 
-// Version is 2.0.1:
-#define O2_VERSION 0x020001
+// Version is 2.1.0:
+#define O2_VERSION 0x020100
 
 #ifdef O2_NO_O2DISCOVERY
 #define O2_NO_HUB 1
@@ -204,6 +204,17 @@ O2_DY_CONNECT, or O2_DY_O2LITE, depending on the expected response.
 
 `/_o2/hub ""` - requests the receiver to become the hub for the sender
 
+`/_o2/hpm ""` - like `/_o2/hub`, but the sender uses a partial mesh
+(see #o2_hub_partial_mesh), so the hub sends `/_o2/hd` messages
+instead of introducing the sender to other partial mesh clients.
+
+`/_o2/hd "siiB..."` *process-name* *version* *udp-port* *exists* ... -
+sent by a hub to a partial mesh client to describe a process: its
+name, O2 version, UDP port and true, followed by any number of
+*service-name* *add-flag* pairs ("sB") listing services that the
+process added or removed. If *exists* is false, the process was
+removed and no pairs follow.
+
 `/_o2/cs/cs ""` - announces when clock sync is obtained.
 
 `/_o2/cs/ps ""` - this message (short for "ping send") invokes the
@@ -228,7 +239,24 @@ there can be any number of services described in this message, each
 service consisting of another "sbbsi" (string, Boolean, Boolean,
 string, int32) sequence. Properties strings are sent with escaped
 values, a leading ';' and a trailing ';'. This is the first message
-sent when a process-to-process connection is made.
+sent when a process-to-process connection is made, unless both
+processes have version 2.1.0 or later (see `/_o2/sd`).
+
+`/_o2/sd "sii"` *process-name* *epoch* *version* - sent instead of
+`/_o2/sv` when a connection is made to a process with version 2.1.0 or
+later. It asks for the services of the receiver. *epoch* and *version*
+identify the receiver's service list as remembered by the sender from
+an earlier connection, or are zero.
+
+`/_o2/sr "siib..."` *process-name* *epoch* *version* *reset* ... -
+the reply to `/_o2/sd`, followed by service descriptions as in
+`/_o2/sv`. *epoch* and *version* identify the sender's current service
+list: *version* counts the changes (each sent as `/_o2/sv`) since the
+process started, and *epoch* is a random number that changes when the
+process restarts. If *reset* is false, the descriptions are only the
+changes since the epoch and version in `/_o2/sd`, and they are applied
+to the services remembered from the earlier connection. If *reset* is
+true, they are the complete list, as in the first `/_o2/sv` message.
 
 
 \subsection API Messages
@@ -381,7 +409,12 @@ typedef enum {
 
     /// \brief no operation because an interrupt (ctrl-C) occurred
     //
-    O2_INTERRUPT_REQUESTED = -21
+    O2_INTERRUPT_REQUESTED = -21,
+
+    /// \brief message is larger than the receiver accepts
+    //
+    /// See #o2_set_max_message_size.
+    O2_MSG_TOO_BIG = -22
 
 } O2err;
 
@@ -676,6 +709,46 @@ O2_EXPORT O2err o2_internet_enable(bool enable);
  */
 O2_EXPORT O2err o2_network_enable(bool enable);
 
+#if !defined(O2_NO_UNIXSOCK) && !defined(WIN32)
+/** \brief Disable (or Enable) Unix-domain sockets for local processes.
+ *
+ * By default, when O2 discovers another process on the same host,
+ * it connects to it with Unix-domain stream and datagram sockets
+ * instead of TCP and UDP, which avoids the overhead of the TCP/IP
+ * stack. Processes are on the same host if they have the same
+ * internal IP address and the same host id, which is sent with
+ * discovery messages to local processes. The sockets are created in
+ * /tmp. If they cannot be created or connected, TCP and UDP are
+ * used. This setting can only be changed before #o2_initialize or
+ * after #o2_finish.
+ *
+ * @param enable Use false to always use TCP and UDP.
+ *
+ * @return O2_SUCCESS if setting is accepted, otherwise O2 is already
+ * running and O2_ALREADY_RUNNING is returned.
+ */
+O2_EXPORT O2err o2_unix_sockets_enable(bool enable);
+#endif
+
+#if !defined(O2_NO_SHMRING) && !defined(O2_NO_UNIXSOCK) && !defined(WIN32)
+/** \brief Disable (or Enable) shared memory between local processes.
+ *
+ * By default, when O2 connects to another process on the same host
+ * with a Unix-domain socket (see #o2_unix_sockets_enable), the two
+ * processes also map a shared memory segment, and all messages between
+ * them are then copied through it without any system calls. The
+ * socket is still used to set up the connection and to detect when
+ * the other process exits. This setting can only be changed before
+ * #o2_initialize or after #o2_finish.
+ *
+ * @param enable Use false to send all messages with sockets.
+ *
+ * @return O2_SUCCESS if setting is accepted, otherwise O2 is already
+ * running and O2_ALREADY_RUNNING is returned.
+ */
+O2_EXPORT O2err o2_shm_rings_enable(bool enable);
+#endif
+
 /** \brief O2 timestamps are doubles representing seconds since the
  * approximate start time of the ensemble.
  */
@@ -1103,6 +1176,58 @@ O2_EXPORT O2time o2_set_discovery_period(O2time period);
  */
 O2_EXPORT O2err o2_hub(int version, const char *public_ip, const char *internal_ip,
              int tcp_port, int udp_port);
+
+/**
+ * \brief Connect only to the processes whose services are used.
+ *
+ * Normally, every O2 process connects to every other process, which
+ * does not scale well to hundreds of processes. If this is enabled
+ * before calling #o2_hub, the hub (if its version is 2.1.0 or later)
+ * does not introduce this process to other processes that use a
+ * partial mesh. Instead, it sends a directory of the services of all
+ * processes connected to the hub and relays changes to it. When this
+ * process looks up a service that it does not have, e.g. by calling
+ * #o2_status, sending a message to it, or tapping it with #o2_tap,
+ * it connects to the processes that offer the service. Until the
+ * connection is made, the service status is #O2_UNKNOWN and messages
+ * to it are dropped, as they are before discovery completes.
+ *
+ * Processes that call #o2_hub without enabling a partial mesh are
+ * still connected to every process known to the hub.
+ *
+ * @param enable true to request a partial mesh from hubs
+ *
+ * @return #O2_SUCCESS, or #O2_NOT_INITIALIZED if O2 is not initialized.
+ */
+O2_EXPORT O2err o2_hub_partial_mesh(bool enable);
+#endif
+
+#ifndef O2_NO_PEERCACHE
+/**
+ * \brief Remember peers in a file to reconnect faster in the next run.
+ *
+ * Normally, discovery starts from scratch when a process starts, and
+ * it can take seconds to find every process of a running ensemble.
+ * After this call, #o2_finish writes the processes this process was
+ * connected to (names, IP addresses, ports and versions) to the file
+ * at `path`. If the file exists, the processes of this ensemble in it
+ * that were connected within `max_age` seconds are contacted
+ * directly as soon as this process has a name, while discovery
+ * proceeds as usual. A cached process that cannot be reached is
+ * dropped from the file unless it connects some other way.
+ *
+ * Call this after #o2_initialize. Several processes on one host may
+ * share the file. Cached processes are not contacted after #o2_hub
+ * with a hub address, but they are after #o2_hub with NULL addresses,
+ * which only disables broadcasting.
+ *
+ * @param path the cache file, or NULL to stop using a cache
+ * @param max_age how long (in seconds) processes are remembered, or
+ *        0 for the default of one day
+ *
+ * @return #O2_SUCCESS, or #O2_NOT_INITIALIZED if O2 is not initialized.
+ */
+O2_EXPORT O2err o2_peer_cache(const char *path, double max_age);
 #endif
 
 
@@ -1378,6 +1503,35 @@ O2_EXPORT const char *o2_service_getprop(int i, const char *attr);
 O2_EXPORT int o2_service_search(int i, const char *attr, const char *value);
 
 
+/**
+ * \brief find services with an exact property value without a snapshot
+ *
+ * Unlike #o2_service_search, this does not use #o2_services_list.
+ * O2 keeps an index from each attribute and value to the active
+ * services with that property, so a call does not depend on the
+ * number of services. Only exact matches are found, so this is like
+ * searching for ":value;" with #o2_service_search.
+ *
+ * To get all matches, call with i = 0, 1, 2, ... until NULL is
+ * returned, without calling #o2_poll in between.
+ *
+ * @param attr the attribute to search
+ *
+ * @param value the value to match. Unlike #o2_service_search, do not
+ *        include escape characters in #value (as in
+ *        #o2_service_set_property).
+ *
+ * @param i the index of the match to return, starting with zero
+ *
+ * @return the name of the i-th matching service, or NULL if there are
+ *         not that many matches. Do not free the returned value. It is
+ *         valid only until services or properties change, e.g. in
+ *         #o2_poll. The order of matches can change at the same time.
+ */
+O2_EXPORT const char *o2_service_with_property(const char *attr,
+                                               const char *value, int i);
+
+
 /**
  * \brief set an attribute and value property for a service
  *
@@ -1663,6 +1817,62 @@ O2_EXPORT void o2_message_warnings(
  */
 O2_EXPORT O2err o2_poll(void);
 
+
+/**
+ *  \brief Limit the work done by each call to #o2_poll.
+ *
+ *  A burst of incoming messages can make one call to #o2_poll run
+ *  many handlers, delaying the caller, e.g. an audio or user
+ *  interface thread. With a budget, #o2_poll stops taking messages
+ *  from the scheduler, sockets, shared memory rings and bridges (e.g.
+ *  shared memory processes) once the budget is used up, and the
+ *  remaining messages wait for the next call. Each call delivers at
+ *  least one message from sockets and one from shared memory rings
+ *  (if any are ready), even if the budget is already used up. Once
+ *  the budget is used up, other ready sources wait for later calls,
+ *  which start with the first source not served, so sources take
+ *  turns in round-robin order and a flood from one source cannot
+ *  starve the others. The budget is checked between messages (for sockets,
+ *  between reads, each of which may deliver several messages), so it
+ *  can be exceeded slightly. Messages received by the network thread
+ *  (see #o2_network_thread) are not limited.
+ *
+ *  @param max_messages the number of messages to deliver per poll,
+ *         or 0 for no limit.
+ *  @param max_usec the time in microseconds to spend delivering
+ *         messages per poll, or 0 for no limit.
+ *
+ *  @return #O2_SUCCESS, or #O2_BAD_ARGS if a parameter is negative.
+ */
+O2_EXPORT O2err o2_poll_budget(int max_messages, int max_usec);
+
+
+/**
+ * \brief Counters describing the work done by #o2_poll.
+ *
+ * See #o2_poll_budget.
+ */
+typedef struct O2poll_budget_stats {
+    int64_t polls;         ///< number of calls to #o2_poll
+    int64_t exhausted;     ///< calls that stopped at the budget
+    int64_t messages;      ///< messages delivered from all sources
+    int32_t max_messages;  ///< largest number of messages in one call
+} O2poll_budget_stats;
+
+
+/**
+ *  \brief Get statistics about the work done by #o2_poll.
+ *
+ *  @param stats is either NULL or a pointer to a structure that will
+ *         receive a copy of the current counters.
+ *  @param reset if true, the counters are set to zero after they
+ *         are copied.
+ *
+ *  @return #O2_SUCCESS
+ */
+O2_EXPORT O2err o2_poll_budget_stats(O2poll_budget_stats *stats,
+                                     bool reset);
+
 /**
  * \brief Reset a pending interrupt to continue O2 operation.
  *
@@ -1830,6 +2040,391 @@ O2_EXPORT const char *o2_status_to_string(int status);
 O2_EXPORT O2err o2_can_send(const char *service);
 
 
+/**
+ * \brief Mark an address or service as conflatable.
+ *
+ * Commands (see #o2_send_cmd) that carry continuous control values,
+ * e.g. fader positions or meter levels, become stale while they wait
+ * behind a blocked connection. When the connection (or shared memory
+ * ring) to the receiving process is backed up, a message to a
+ * conflatable address replaces an earlier queued message to the same
+ * address, keeping its place in the queue, and the sender does not
+ * block. Thus the queue holds at most one message per conflatable
+ * address, and after a stall the receiver gets only the latest
+ * values. Messages are never conflated while the connection is
+ * writable. Use #o2_conflated to count replaced messages.
+ *
+ * Conflation is not performed when the network thread is enabled
+ * (see #o2_network_thread). Marks are removed by #o2_finish.
+ *
+ * @param address either a service name, e.g. "synth", to conflate
+ *        messages to every address of the service, or a full path,
+ *        e.g. "/synth/volume" or "!synth/volume", to conflate messages
+ *        to that address only. Patterns are not expanded.
+ * @param enable true to mark the address, false to remove the mark.
+ *
+ * @return #O2_SUCCESS, #O2_BAD_ARGS if the address is empty,
+ *         #O2_NOT_INITIALIZED if O2 is not running, or #O2_FAIL if
+ *         \p enable is false and the address is not marked.
+ */
+O2_EXPORT O2err o2_conflate(const char *address, bool enable);
+
+
+/**
+ * \brief Mark an address or service as high priority.
+ *
+ * Messages to a process that cannot be sent immediately wait in a
+ * queue, e.g. behind a large blob. O2 system messages (including clock
+ * synchronization) and messages to high-priority addresses wait in a
+ * separate lane: they are sent at the next message boundary, ahead of
+ * all other queued messages, in the order they were sent, and the
+ * sender does not block. This is useful for transport controls and
+ * other commands that must stay responsive during bulk transfers.
+ * Note that a high-priority message can therefore arrive before
+ * messages that were sent earlier.
+ *
+ * As with #o2_conflate, this has no effect when the network thread
+ * is enabled, and marks are removed by #o2_finish.
+ *
+ * @param address either a service name or a full path (see
+ *        #o2_conflate).
+ * @param enable true to mark the address, false to remove the mark.
+ *
+ * @return #O2_SUCCESS, #O2_BAD_ARGS if the address is empty,
+ *         #O2_NOT_INITIALIZED if O2 is not running, or #O2_FAIL if
+ *         \p enable is false and the address is not marked.
+ */
+O2_EXPORT O2err o2_high_priority(const char *address, bool enable);
+
+
+/**
+ * \brief Get the number of messages replaced by conflation.
+ *
+ * @param reset if true, the count is set to zero after it is read.
+ *
+ * @return the number of queued messages replaced by newer messages
+ *         to the same conflatable address (see #o2_conflate).
+ */
+O2_EXPORT int64_t o2_conflated(bool reset);
+
+
+/**
+ * \brief Get the number of messages dropped because of a deadline.
+ *
+ * Messages are dropped when they are still waiting to be sent or
+ * delivered after their deadline (see #o2_add_deadline). Messages are
+ * counted by the process that drops them, which may be the sender or
+ * the receiver, but messages dropped by a shared memory process are
+ * not counted.
+ *
+ * @param service the service the messages were addressed to, or NULL
+ *        for the total over all services.
+ * @param reset if true, the count(s) are set to zero after reading.
+ *
+ * @return the number of messages dropped.
+ */
+O2_EXPORT int64_t o2_expired(const char *service, bool reset);
+
+
+/// \brief largest value accepted by #o2_set_max_message_size
+#define O2_MAX_LARGE_MSG_SIZE 0x40000000
+
+
+/**
+ * \brief Set the largest TCP message this process will accept.
+ *
+ * By default, every O2 process accepts messages shorter than 64KB
+ * and closes any connection that sends a longer one. After calling
+ * this function, the process accepts messages up to `max_size`
+ * bytes. The limit is sent to every connected process (and to
+ * processes that connect later) in a `!_o2/mx` message, and those
+ * processes will then send messages up to the new limit. A process
+ * never sends a message longer than the receiver's limit; instead,
+ * the message is dropped and sending returns #O2_MSG_TOO_BIG.
+ *
+ * Large messages are received into a list of 64KB chunks that grows
+ * as data arrives and is joined into one message when it is complete.
+ * To send very large data without holding up other messages on the
+ * connection, see #o2_blob_stream.
+ *
+ * This may be called before or after #o2_initialize. Reducing the
+ * limit while a connected process is sending a large message can
+ * close the connection.
+ *
+ * @param max_size the maximum message length in bytes, which must
+ *        be from 0xFFFF (the default) to #O2_MAX_LARGE_MSG_SIZE.
+ *
+ * @return #O2_SUCCESS or #O2_BAD_ARGS if `max_size` is out of range.
+ */
+O2_EXPORT O2err o2_set_max_message_size(int32_t max_size);
+
+
+/// \brief signature for callback that reports the end of a blob stream
+typedef void (*o2_stream_callback)(int stream_id, O2err status, void *rock);
+
+
+/**
+ * \brief Send a large blob in chunks with flow control.
+ *
+ * The blob is sent to `address` as a sequence of messages, each
+ * sent by TCP, with the type string "ihhb": the stream id (the value
+ * returned by this function), the offset of the chunk in the blob,
+ * the total size of the blob, and the chunk data as a blob. Chunks
+ * arrive in order, and the chunk where offset plus chunk size equals
+ * the total size is the last one. A zero-length blob is sent as one
+ * empty chunk.
+ *
+ * Chunks are sent from #o2_poll, and only when the connection to
+ * the service has no pending output (see #o2_can_send), so a long
+ * transfer does not stall other messages to the same process.
+ *
+ * `data` is not copied and must remain valid until `callback` is
+ * called with `status` equal to #O2_SUCCESS after the last chunk
+ * is sent, or to an error code if the stream fails or is canceled.
+ *
+ * @param address the O2 address for chunk messages, starting with
+ *        '/' or '!'.
+ * @param data the blob data
+ * @param size the number of bytes in the blob
+ * @param chunk_size the number of data bytes per message, or 0 for
+ *        the default (32768). Chunk messages must not be bigger than
+ *        the receiver accepts (see #o2_set_max_message_size).
+ * @param callback function to call when the stream ends, or NULL
+ * @param rock value passed to `callback`
+ *
+ * @return a stream id (greater than 0) or an error code (less than 0).
+ */
+O2_EXPORT int o2_blob_stream(const char *address, const void *data,
+                             int64_t size, int32_t chunk_size,
+                             o2_stream_callback callback, void *rock);
+
+
+/**
+ * \brief Stop sending a blob stream.
+ *
+ * The stream's callback is called with #O2_FAIL.
+ *
+ * @param stream_id the value returned by #o2_blob_stream
+ *
+ * @return #O2_SUCCESS, or #O2_FAIL if the stream does not exist (it
+ *         may have ended already).
+ */
+O2_EXPORT O2err o2_blob_stream_cancel(int stream_id);
+
+
+#if !defined(O2_NO_NETTHREAD) && !defined(WIN32)
+/**
+ * \brief Move socket I/O to a separate network thread.
+ *
+ * After `o2_network_thread(true)`, a thread created by O2 waits for
+ * and performs reads and writes on the TCP and UDP sockets that
+ * connect to other O2 processes and O2lite clients. Received messages
+ * are queued and delivered to handlers by #o2_poll in the calling
+ * thread as usual, so handlers need no locking, but #o2_poll itself no
+ * longer makes socket system calls for these connections, and large
+ * messages can be sent and received while the application is busy.
+ * Sockets for OSC, MQTT, websockets and ZeroConf are still serviced by
+ * #o2_poll.
+ *
+ * With the network thread, a send is queued and returns immediately
+ * unless many messages are already queued for the connection, and
+ * #o2_can_send reports #O2_BLOCKED only when that limit is reached.
+ *
+ * Call after #o2_initialize. `o2_network_thread(false)` stops the
+ * thread and resumes I/O in #o2_poll. #o2_finish stops the thread.
+ *
+ * @param enable true to start the thread, false to stop it
+ *
+ * @return #O2_SUCCESS, #O2_NOT_INITIALIZED, or #O2_FAIL if the thread
+ *         could not be started.
+ */
+O2_EXPORT O2err o2_network_thread(bool enable);
+#endif
+
+
+/**
+ * \brief Counters describing UDP send and receive batching.
+ *
+ * On Linux, O2 receives UDP with `recvmmsg` and, within each call to
+ * #o2_poll, defers UDP sends so they can be sent together with
+ * `sendmmsg`. Each system call counts as one "call" and each datagram
+ * counts as one "msg", so `recv_msgs / recv_calls` is the average
+ * batch size achieved. On other systems, or if O2 is compiled with
+ * `O2_NO_MMSG`, every batch has size 1.
+ */
+typedef struct O2udp_batch_stats {
+    int64_t recv_calls;  ///< number of UDP receive system calls
+    int64_t recv_msgs;   ///< number of UDP datagrams received
+    int32_t recv_max;    ///< largest number of datagrams in one receive
+    int64_t send_calls;  ///< number of UDP send system calls
+    int64_t send_msgs;   ///< number of UDP datagrams sent
+    int32_t send_max;    ///< largest number of datagrams in one send
+} O2udp_batch_stats;
+
+
+/**
+ *  \brief Get UDP batching statistics.
+ *
+ *  @param stats is either NULL or a pointer to a structure that will
+ *         receive a copy of the current counters.
+ *  @param reset if true, the counters are set to zero after they
+ *         are copied.
+ *
+ *  @return #O2_SUCCESS
+ */
+O2_EXPORT O2err o2_udp_batch_stats(O2udp_batch_stats *stats, bool reset);
+
+
+/**
+ * \brief Traffic and queue statistics for one socket.
+ *
+ * See #o2_socket_stats. Messages are counted as they are delivered
+ * from the socket and as they are given to the socket to send, so
+ * "out" counts include messages still in the queue. UDP datagrams to
+ * other processes are sent through a shared socket that is not
+ * reported; datagrams received are counted on the UDP server socket.
+ */
+typedef struct O2socket_stats {
+    const char *kind;   ///< socket type, e.g. "NET_TCP_CLIENT"
+    const char *peer;   ///< name of the process or service using the
+                        ///< socket, or NULL. Valid until the next
+                        ///< call to #o2_poll.
+    int64_t messages_in;   ///< messages received
+    int64_t bytes_in;      ///< bytes received, not counting framing
+    int64_t messages_out;  ///< messages sent or queued to send
+    int64_t bytes_out;     ///< bytes sent or queued, not counting framing
+    int32_t queued_messages;  ///< messages waiting to be sent now
+    int64_t queued_bytes;  ///< bytes waiting to be sent now, or -1 if
+                           ///< unknown (socket served by the network
+                           ///< thread)
+    int64_t blocked;       ///< number of sends and #o2_can_send calls
+                           ///< that found the socket blocked
+    double blocked_time;   ///< total seconds the socket was blocked
+    O2time connect_time;   ///< local time (see #o2_local_time) when the
+                           ///< socket was created or connected, or -1
+                           ///< if it is still connecting
+} O2socket_stats;
+
+
+/**
+ *  \brief Get traffic and queue statistics for a socket.
+ *
+ *  Sockets are numbered from 0. To report every socket, call with
+ *  index 0, 1, 2, ... until the result is #O2_FAIL. Numbering changes
+ *  when sockets are closed, so do not call #o2_poll in between.
+ *
+ *  A TCP socket is blocked while a send would return #O2_BLOCKED (see
+ *  #o2_can_send), i.e. while earlier messages are waiting to be sent.
+ *  For sockets served by the network thread (see #o2_network_thread),
+ *  the end of a blocked interval is noticed only when O2 next sends
+ *  on the socket or when statistics are read, so blocked_time may be
+ *  a little long.
+ *
+ *  The same statistics for every socket can be obtained by sending a
+ *  message to `!_o2/ss` (or `!@<process name>/ss` for another
+ *  process) with one string parameter, an address to reply to. The
+ *  reply is one message per socket with the types "sisshhhhihhdd":
+ *  the name of the reporting process, the socket index, kind, peer
+ *  (empty if none), and the remaining fields of #O2socket_stats in
+ *  order.
+ *
+ *  @param index the socket number.
+ *  @param stats where to store the statistics (may be NULL).
+ *  @param reset if true, set the counts and blocked_time to zero
+ *         after they are read.
+ *
+ *  @return #O2_SUCCESS, #O2_NOT_INITIALIZED if O2 is not running, or
+ *          #O2_FAIL if there is no socket with this \p index.
+ */
+O2_EXPORT O2err o2_socket_stats(int index, O2socket_stats *stats,
+                                bool reset);
+
+
+#ifndef O2_NO_BUNDLES
+/**
+ *  \brief Coalesce small UDP messages to each process into bundles.
+ *
+ *  When enabled, messages sent by UDP to another process are held
+ *  and sent at the end of #o2_poll as one datagram containing a
+ *  bundle of all messages held for that process. A bundle is also
+ *  sent early when adding a message would make it larger than
+ *  \p max_size. Messages larger than \p max_size are sent
+ *  immediately. Receivers deliver the embedded messages as if they
+ *  had been sent separately, but they must support bundles (i.e.
+ *  O2 compiled without `O2_NO_BUNDLES`). Messages sent through the
+ *  shared memory rings or by TCP are not affected.
+ *
+ *  @param max_size the largest datagram to build, in bytes. A value
+ *         below the path MTU, e.g. 1400, avoids IP fragmentation. 0
+ *         sends any held messages and disables coalescing (the
+ *         default).
+ *
+ *  @return #O2_SUCCESS, or #O2_BAD_ARGS if \p max_size is negative.
+ */
+O2_EXPORT O2err o2_udp_coalesce(int max_size);
+#endif
+
+
+/**
+ *  \brief Add sequence numbers to UDP datagrams sent to other processes.
+ *
+ *  When enabled, each datagram sent to another process carries a
+ *  sequence number counting the datagrams sent to that process.
+ *  Receivers remove it and use it to count datagrams that were
+ *  received, lost (missing from the sequence) and reordered
+ *  (arriving after a later datagram). A datagram that arrives late
+ *  is counted as reordered rather than lost. Receivers must be
+ *  compiled with this version of O2, so enable this only if all
+ *  processes in the ensemble support it. Statistics are kept by the
+ *  receiver: see #o2_udp_peer_stats and the `/_o2/us` system service.
+ *  Messages sent by TCP or through shared memory are not counted.
+ *
+ *  @param enable true to add sequence numbers, false to stop.
+ *
+ *  @return #O2_SUCCESS
+ */
+O2_EXPORT O2err o2_udp_sequence(bool enable);
+
+
+/**
+ *  \brief Counts of UDP datagrams received from one process.
+ *
+ *  See #o2_udp_sequence and #o2_udp_peer_stats.
+ */
+typedef struct O2udp_peer_stats {
+    int64_t received;   ///< datagrams received
+    int64_t lost;       ///< datagrams missing from the sequence
+    int64_t reordered;  ///< datagrams that arrived after a later one
+} O2udp_peer_stats;
+
+
+/**
+ *  \brief Get counts of UDP datagrams received from another process.
+ *
+ *  Only datagrams sent by a process that called #o2_udp_sequence are
+ *  counted. The same counts for every process can be obtained by
+ *  sending a message to `!_o2/us` (or `!@<process name>/us` for another
+ *  process) with one string parameter, an address to reply to. For
+ *  each process that sent sequenced datagrams, the reply is sent to
+ *  that address with the types "sshhh": the name of the receiving
+ *  process, the name of the sending process, and the received, lost
+ *  and reordered counts.
+ *
+ *  Counts are lost when the connection to the process is closed.
+ *
+ *  @param process the name of the sending process, as in
+ *         #o2_service_provider_new or the `process` parameter of
+ *         #o2_status.
+ *  @param stats where to store the counts (may be NULL).
+ *  @param reset if true, set the counts to zero after they are read.
+ *
+ *  @return #O2_SUCCESS, #O2_NOT_INITIALIZED if O2 is not running, or
+ *          #O2_FAIL if \p process is not a connected remote process.
+ */
+O2_EXPORT O2err o2_udp_peer_stats(const char *process,
+                                  O2udp_peer_stats *stats, bool reset);
+
+
 /**
  * \brief A variable indicating that the clock is the reference or is
  *        synchronized to the reference.
@@ -1866,6 +2461,65 @@ O2_EXPORT bool o2_clock_is_synchronized;
 O2_EXPORT int o2_roundtrip(double *mean, double *min);
 
 
+/**
+ * \brief Clock synchronization quality, see #o2_clock_stats.
+ *
+ * A clock sample is a measurement of the reference time from a ping
+ * reply or a beacon (see #o2_clock_beacons). Samples whose round trip
+ * time is well above the recent minimum were delayed by queueing, so
+ * they are counted as delayed and do not affect the estimates.
+ */
+typedef struct O2clock_stats {
+    bool synchronized;  ///< #o2_clock_is_synchronized
+    bool reference;     ///< this process provides the reference clock
+    O2time offset;      ///< #o2_time_get minus #o2_local_time now
+    double drift;       ///< estimated reference clock rate divided by
+                        ///< local clock rate, minus 1
+    double rate;        ///< current rate of #o2_time_get relative to
+                        ///< #o2_local_time, which differs from 1 + drift
+                        ///< while the clock is slewing
+    O2time last_correction;  ///< the last sample's estimate of the
+                             ///< reference time minus #o2_time_get,
+                             ///< i.e. how far the clock was behind
+    int64_t jumps;      ///< corrections by jumping to the reference
+                        ///< time, including #o2_clock_jump calls
+    int64_t slews;      ///< corrections by speeding up or slowing down
+    O2time jitter;      ///< standard deviation of recent samples from
+                        ///< the estimated offset and drift
+    O2time since_good;  ///< seconds since the last sample that was not
+                        ///< delayed, or -1 if there has been none
+    O2time mean_rtt;    ///< see #o2_roundtrip
+    O2time min_rtt;     ///< see #o2_roundtrip
+    O2time ping_interval;  ///< current time between clock sync pings
+    int64_t samples;    ///< samples received
+    int64_t delayed;    ///< samples that were delayed
+} O2clock_stats;
+
+
+/**
+ *  \brief Get clock synchronization quality statistics.
+ *
+ *  A supervisor can watch these to detect degrading clock sync, e.g.
+ *  rising jitter or since_good, before timing errors are audible.
+ *  For the reference process, only synchronized, reference, rate
+ *  (1) and jumps (calls to #o2_clock_jump) are meaningful.
+ *
+ *  The same statistics can be obtained by sending a message to
+ *  `!_o2/cs/st` (or `!@<process name>/cs/st` for another process)
+ *  with one string parameter, an address to reply to. The reply has
+ *  the types "siiddddhhdddddhh": the name of the reporting process
+ *  and the fields of #O2clock_stats in order, with the bool fields
+ *  as 0 or 1.
+ *
+ *  @param stats where to store the statistics (may be NULL).
+ *  @param reset if true, set jumps, slews, samples and delayed to
+ *         zero after they are read.
+ *
+ *  @return #O2_SUCCESS, or #O2_NOT_INITIALIZED if O2 is not running.
+ */
+O2_EXPORT O2err o2_clock_stats(O2clock_stats *stats, bool reset);
+
+
 /** \brief signature for callback that defines the reference clock
  *
  * See #o2_clock_set for details.
@@ -1914,6 +2568,33 @@ typedef bool (*o2_time_jump_callback)(double local_time,
 O2_EXPORT O2err o2_clock_set(o2_time_callback gettime, void *rock);
 
 
+/**
+ *  \brief Send clock sync beacons from the reference clock.
+ *
+ *  Normally, every process pings the reference clock process
+ *  periodically to synchronize, so the load on the reference grows
+ *  with the number of processes. With beacons, the reference sends
+ *  its time every \p period seconds by UDP broadcast (and to
+ *  localhost) on the discovery ports used by the processes it is
+ *  connected to. Processes combine the beacons with a ping once a
+ *  minute that measures the round trip (path) delay, so the load on
+ *  the reference hardly depends on the number of processes. Processes
+ *  that do not receive beacons, e.g. because broadcast does not reach
+ *  them, continue to ping as usual.
+ *
+ *  Only the reference clock process sends beacons. This may be called
+ *  before or after #o2_clock_set. Beacons are accepted by processes
+ *  automatically.
+ *
+ *  @param period seconds between beacons, e.g. 1, or 0 to stop
+ *         sending beacons (the default).
+ *
+ *  @return #O2_SUCCESS, #O2_NOT_INITIALIZED, or #O2_BAD_ARGS if \p
+ *          period is negative.
+ */
+O2_EXPORT O2err o2_clock_beacons(double period);
+
+
 /**
  * \brief Override clock synchronization behavior.
  *
@@ -1996,7 +2677,7 @@ O2_EXPORT O2err o2_clock_jump(double local_time, double global_time,
                    __VA_ARGS__, O2_MARKER_A, O2_MARKER_B)
 
 /** \cond INTERNAL */ \
-O2_EXPORT O2err o2_send_marker(const char *path, double time, bool tcp_flag,
+O2_EXPORT O2err o2_send_marker(const char *path, double time, int tcp_flag,
                           const char *typestring, ...);
 /** \endcond */
 
@@ -2035,6 +2716,40 @@ O2_EXPORT O2err o2_send_marker(const char *path, double time, bool tcp_flag,
                    __VA_ARGS__, O2_MARKER_A, O2_MARKER_B)
 
 
+/**
+ * \brief value for the `tcp_flag` parameter of #o2_send_finish and
+ * #o2_message_finish that requests reliable UDP (see #o2_send_reliable)
+ */
+#define O2_RELIABLE_UDP 4
+
+/**
+ * \brief Construct and send an O2 message reliably over UDP.
+ *
+ *  This is like #o2_send_cmd, but a message to another process is sent
+ *  by UDP, with sequence numbers, acknowledgements and retransmission
+ *  to make delivery reliable. Unlike TCP, a lost message does not
+ *  delay messages to other addresses: messages are delivered in order
+ *  per address (more precisely, per group of addresses that hash to
+ *  the same one of 32 lanes), not per connection. This is intended for
+ *  independent streams of control messages.
+ *
+ *  Messages to processes reached through shared memory are sent as
+ *  with #o2_send_cmd, and messages to other destinations (e.g. OSC
+ *  servers) are sent as with #o2_send. The receiving process must
+ *  support reliable UDP (i.e. O2 compiled without `O2_NO_RUDP`).
+ *  Sending never blocks, but the sender holds each message until it
+ *  is acknowledged.
+ *
+ *  Parameters are as in #o2_send.
+ *
+ *  @return #O2_SUCCESS if success. See #o2_send_finish for details.
+ */
+/** \hideinitializer */ // turn off Doxygen report on #o2_send_marker
+#define o2_send_reliable(path, time, ...)        \
+    o2_send_marker(path, time, O2_RELIABLE_UDP,  \
+                   __VA_ARGS__, O2_MARKER_A, O2_MARKER_B)
+
+
 /**
  * \brief Send an O2 message. (See also macros #o2_send and #o2_send_cmd).
  *
@@ -2095,6 +2810,61 @@ O2_EXPORT O2time o2_local_time(void);
 O2_EXPORT O2time o2_native_time(void);
 
 
+/**
+ * \brief Sources of time for #o2_local_time, see #o2_time_source.
+ */
+typedef enum O2time_source {
+    /// #o2_native_time: microsecond resolution on Linux, follows
+    /// adjustments to the system time
+    O2_TIME_NATIVE,
+    /// the #o2_native_time when the current (or last) #o2_poll
+    /// started. Costs only a memory read, but time does not advance
+    /// within handlers or between calls to #o2_poll.
+    O2_TIME_POLL,
+    /// Linux CLOCK_MONOTONIC_COARSE: about 10 times faster than
+    /// O2_TIME_NATIVE, but advances only once per kernel tick (1 to
+    /// 10 ms, typically 4 ms).
+    O2_TIME_COARSE,
+    /// the time stamp counter of x86 processors on Linux, converted to
+    /// seconds with a rate measured against CLOCK_MONOTONIC:
+    /// nanosecond resolution, and faster than O2_TIME_NATIVE except
+    /// where reading the counter is trapped by a virtual machine. The
+    /// rate is measured over 10 ms when selected, so time can drift
+    /// from CLOCK_MONOTONIC by a few microseconds per second at
+    /// first. The rate is refined every second by #o2_poll, so drift
+    /// decreases as the process runs.
+    O2_TIME_TSC
+} O2time_source;
+
+
+/**
+ * \brief Select the source of time for #o2_local_time.
+ *
+ * #o2_local_time and #o2_time_get are called often, e.g. whenever a
+ * timestamped message is sent, so a faster source of time can be
+ * useful when approximate times are good enough. See #O2time_source
+ * for the accuracy of each source. #o2_local_time continues
+ * smoothly from the previous source. Clock synchronization always
+ * measures round trip times precisely: with O2_TIME_POLL it reads
+ * #o2_native_time, and with O2_TIME_COARSE it reads CLOCK_MONOTONIC.
+ * If #o2_clock_set provides a callback, that callback is the source
+ * of time, and the selected source is used again after a call to
+ * #o2_clock_set with a NULL callback.
+ *
+ * O2_TIME_TSC is only selected if the time stamp counter is
+ * invariant, i.e. it runs at a constant rate in all power states and
+ * on all cores. Selecting it takes about 10 ms to calibrate.
+ *
+ * @param source the time source.
+ *
+ * @return #O2_SUCCESS, #O2_NOT_INITIALIZED if O2 is not running,
+ *     #O2_BAD_ARGS if \p source is unknown, or #O2_FAIL if the source
+ *     is not available on this system, in which case O2_TIME_NATIVE
+ *     is used.
+ */
+O2_EXPORT O2err o2_time_source(O2time_source source);
+
+
 /**
  *  \brief release the memory and shut down O2.
  *
@@ -2525,12 +3295,40 @@ O2_EXPORT O2err o2_add_vector(O2type element_type,
 O2_EXPORT O2err o2_add_message(O2message_ptr msg);
 #endif
 
+/**
+ * \brief give the message being built a deadline
+ *
+ * @param deadline the time after which the message should be dropped
+ *        rather than sent or delivered.
+ * @param relative if true, \p deadline is relative to the current
+ *        time, e.g. 0.1 drops the message if it has not been delivered
+ *        within 100 ms. Otherwise, \p deadline is a global time.
+ *
+ * @return #O2_SUCCESS, #O2_FAIL if no message is being built (see
+ *         #o2_send_start), or #O2_NO_CLOCK if \p relative is false and
+ *         the clock is not synchronized.
+ *
+ * This function can be called after #o2_send_start and before
+ * #o2_message_finish or #o2_send_finish. It does not add a parameter.
+ * Messages that are still waiting when the deadline passes, e.g. in
+ * the queue of a blocked TCP connection, a shared memory ring, a
+ * shared memory process or messages waiting to be delivered, are
+ * dropped before the receiving service is looked up. A relative
+ * deadline is computed in global time if the clock is synchronized,
+ * and the deadline then also applies in the receiving process if its
+ * clock is synchronized. Otherwise, it is computed in local time and
+ * applies only in this process. Bundles have no deadline, but messages
+ * in a bundle may have their own. Drops are counted by #o2_expired.
+ */
+O2_EXPORT O2err o2_add_deadline(O2time deadline, bool relative);
+
 /**
  * \brief finish and return the message.
  *
  * @param time the timestamp for the message (0 for immediate)
  * @param address the O2 address pattern for the message
- * @param tcp_flag boolean if true, send message reliably
+ * @param tcp_flag boolean if true, send message reliably, or
+ *        #O2_RELIABLE_UDP to send reliably over UDP
  *
  * @return the address of the completed message, or NULL on error
  *
@@ -2540,7 +3338,7 @@ O2_EXPORT O2err o2_add_message(O2message_ptr msg);
  * followed by the service name, e.g. "#service1".
  */
 O2_EXPORT O2message_ptr o2_message_finish(O2time time, const char *address,
-                                 bool tcp_flag);
+                                 int tcp_flag);
 
 /**
  * \brief finish and return a message, prepending service name
@@ -2548,7 +3346,8 @@ O2_EXPORT O2message_ptr o2_message_finish(O2time time, const char *address,
  * @param time the timestamp for the message (0 for immediate)
  * @param service a string to prepend to address or NULL.
  * @param address the O2 address pattern for the message.
- * @param tcp_flag boolean if true, send message reliably
+ * @param tcp_flag boolean if true, send message reliably, or
+ *        #O2_RELIABLE_UDP to send reliably over UDP
  *
  * @return the address of the completed message, or NULL on error
  *
@@ -2558,7 +3357,7 @@ O2_EXPORT O2message_ptr o2_message_finish(O2time time, const char *address,
  * of #o2_message_finish, which simply passes NULL for service.
  */
 O2_EXPORT O2message_ptr o2_service_message_finish(O2time time,
-             const char *service, const char *address, bool tcp_flag);
+             const char *service, const char *address, int tcp_flag);
 
 
 /**
@@ -2574,6 +3373,8 @@ O2_EXPORT O2message_ptr o2_service_message_finish(O2time time,
  *        To send a bundle to a service named foo, use the address "#foo".
  * @param tcp_flag boolean that says to send the message reliably.
  *        Normally, true means use TCP, and false means use UDP.
+ *        #O2_RELIABLE_UDP means use reliable UDP (see
+ *        #o2_send_reliable).
  *
  * @return #O2_SUCCESS if success.
  *
@@ -2585,7 +3386,7 @@ O2_EXPORT O2message_ptr o2_service_message_finish(O2time time,
  * is returned if there is no established clock and the message has a
  * non-zero timestamp. For other situations, see #o2_message_warnings.
  */
-O2_EXPORT O2err o2_send_finish(O2time time, const char *address, bool tcp_flag);
+O2_EXPORT O2err o2_send_finish(O2time time, const char *address, int tcp_flag);
 
 
 /** @} */
@@ -100,6 +100,10 @@ public:
 
     Hash_node full_path_table;
     Hash_node path_tree;
+    // maps "attr:value" to services with that property (properties.cpp)
+    Hash_node prop_index;
+    // maps name hashes to remote processes (see o2_udp_sequence())
+    Hash_node udp_senders;
 
     // support for o2mem:
     char *chunk; // where to allocate bytes when freelist is empty
@@ -198,6 +202,8 @@ public:
         finishing = true;
         binst = NULL;
         path_tree.finish();
+        prop_index.finish();  // after path_tree, which refers to it
+        udp_senders.finish();
         full_path_table.finish();
         argv_data.finish();
         arg_data.finish();
@@ -316,6 +322,17 @@ extern O2time o2_global_now;
 extern O2time o2_global_offset; // o2_global_now - o2_local_now
 extern int o2_gtsched_started;
 
+// poll budget (see o2_poll_budget()). Sources of incoming messages
+// (scheduler, sockets, shared memory rings, bridges) add the messages
+// they deliver to o2_poll_msgs and, except for their first message
+// in each o2_poll(), leave the rest for the next poll when
+// O2_POLL_BUDGET_EXHAUSTED() is true.
+extern int o2_poll_msgs;
+extern bool o2_poll_budget_on;
+bool o2_poll_budget_check();
+#define O2_POLL_BUDGET_EXHAUSTED() \
+        (o2_poll_budget_on && o2_poll_budget_check())
+
 #define O2_ARGS_END O2_MARKER_A, O2_MARKER_B
 /** Default max send and recieve buffer. */
 #define MAX_BUFFER 1024
@@ -7,8 +7,12 @@
 #include <sys/types.h>
 #include <ctype.h>
 #include "o2internal.h"
+#include "netthread.h"
+#include "message.h"
+#include "clock.h"
 #include <errno.h>
 #include <string.h>
+#include <atomic>
 
 #ifdef WIN32
 #include <stdio.h> 
@@ -32,14 +36,19 @@ void print_socket_error(int err, const char *source)
 }
 #else
 #include <sys/socket.h>
+#include <sys/uio.h>   // struct iovec for sendmsg()
 #include <unistd.h>    // define close()
 #include <netdb.h>
 #include <sys/time.h>
+#include <time.h>      // clock_gettime() for receive timestamps
 
 #include "sys/ioctl.h"
 #include <ifaddrs.h>
 #include <sys/poll.h>
 #include <netinet/tcp.h>
+#ifndef O2_NO_UNIXSOCK
+#include <sys/un.h>
+#endif
 
 #define TERMINATING_SOCKET_ERROR (errno != EAGAIN && errno != EINTR)
 
@@ -73,6 +82,108 @@ static struct sockaddr_in local_to_addr;
 
 static bool o2n_socket_delete_flag = false;
 
+#ifndef O2_NO_UNIXSOCK
+bool o2n_unix_enabled = true;
+char o2n_host_id[O2N_IP_LEN] = "";
+// Unix-domain sockets are created in this directory:
+#ifndef O2N_UNIX_DIR
+#define O2N_UNIX_DIR "/tmp"
+#endif
+// a nonblocking socket for sending to Unix-domain datagram sockets:
+static SOCKET o2n_unix_send_sock = INVALID_SOCKET;
+#endif
+
+// On Linux, UDP is received with recvmmsg() and sent with sendmmsg() to
+// reduce the number of system calls when message rates are high. Define
+// O2_NO_MMSG to use one recvfrom()/sendto() per message everywhere.
+#if defined(__linux__) && !defined(O2_NO_MMSG)
+#define O2N_MMSG 1
+#ifndef O2N_UDP_BATCH
+#define O2N_UDP_BATCH 16  // max datagrams per recvmmsg()/sendmmsg() call
+#endif
+// each receive slot holds a whole datagram. This is static (bss) memory,
+// so pages are only committed as they are used by large datagrams. The
+// network thread gets its own slots from o2n_private_buffers():
+#define O2N_UDP_SLOT_SIZE 0x10000
+typedef char O2n_udp_slot[O2N_UDP_SLOT_SIZE];
+static O2n_udp_slot udp_in_storage[O2N_UDP_BATCH];
+static thread_local O2n_udp_slot *udp_in_slots = udp_in_storage;
+
+// outgoing UDP messages deferred during a poll cycle:
+typedef struct Udp_pending {
+    struct sockaddr_in sa;
+    O2netmsg_ptr msg;
+} Udp_pending;
+static Udp_pending udp_out[O2N_UDP_BATCH];
+static int udp_out_count = 0;
+static bool udp_out_batching = false;
+#endif
+
+// UDP is sent and received by the O2 thread and by the network thread
+// (if any), so the batch counters are atomic:
+typedef struct Udp_batch_counts {
+    std::atomic<int64_t> calls;
+    std::atomic<int64_t> msgs;
+    std::atomic<int32_t> max;
+} Udp_batch_counts;
+static Udp_batch_counts udp_recv_counts;
+static Udp_batch_counts udp_send_counts;
+
+// count one system call that sent or received n datagrams
+static void udp_batch_count(Udp_batch_counts *counts, int n)
+{
+    counts->calls.fetch_add(1, std::memory_order_relaxed);
+    counts->msgs.fetch_add(n, std::memory_order_relaxed);
+    int32_t max = counts->max.load(std::memory_order_relaxed);
+    while (n > max && !counts->max.compare_exchange_weak(max, n,
+                              std::memory_order_relaxed)) { }
+}
+
+// Where available, the kernel timestamps UDP datagrams as they arrive
+// (SO_TIMESTAMPNS), and the stamp of the datagram being delivered is
+// kept in o2n_rcv_stamp so that clock sync can measure round trips
+// without the delay of polling and dispatching (see o2n_rcv_time()).
+// Define O2_NO_RCV_STAMP to disable. Stamps are CLOCK_REALTIME seconds,
+// and -1 means no stamp.
+#if defined(SO_TIMESTAMPNS) && !defined(O2_NO_RCV_STAMP)
+#define O2N_RCV_STAMP 1
+#define O2N_RCV_CONTROL_SIZE CMSG_SPACE(sizeof(struct timespec))
+
+// get the receive timestamp from the control data of a received datagram
+static double rcv_stamp(struct msghdr *hdr)
+{
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(hdr); cm;
+         cm = CMSG_NXTHDR(hdr, cm)) {
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMPNS) {
+            struct timespec ts;
+            memcpy(&ts, CMSG_DATA(cm), sizeof ts);
+            return ts.tv_sec + ts.tv_nsec * 1e-9;
+        }
+    }
+    return -1;
+}
+#endif
+static double o2n_rcv_stamp = -1;
+
+// index of the first socket for o2n_recv() to visit (see o2_poll_budget())
+static int o2n_recv_next = 0;
+
+// Fds_info::send() writes up to this many queued messages per system call:
+#define O2N_SEND_IOV_MAX 64
+
+// TCP input is read into this buffer with one large recv() per poll event
+// and then split into messages (see Fds_info::read_buffered()). Sockets are
+// read one at a time by o2n_recv(), which is not reentrant, so one buffer
+// serves every socket. A message that is incomplete at the end of the
+// buffer is kept in the socket's in_length/in_message fields. The network
+// thread reads into its own buffer (see o2n_private_buffers()).
+#define O2N_TCP_RECV_SIZE 0x10000
+static char tcp_in_storage[O2N_TCP_RECV_SIZE];
+static thread_local char *tcp_in_buf = tcp_in_storage;
+
+// largest incoming TCP message we accept (see o2_set_max_message_size())
+int32_t o2n_max_msg_len = O2N_DEFAULT_MAX_MSG_LEN;
+
 // macOS does not always free ports, so to aid in debugging orphaned ports,
 // define CLOSE_SOCKET_DEBUG 1 and get a list of sockets that are opened
 // and closed
@@ -173,20 +284,213 @@ O2err o2n_send_udp_via_socket(SOCKET socket, Net_address *ua,
 }
 
 
-// send a udp message to an address, free the msg
+// send a udp message to an address, free the msg. Between
+// o2n_udp_batch_begin() and o2n_udp_batch_flush(), the message may
+// be deferred and sent with others in a single sendmmsg() call, in which
+// case a send error is only reported (by debug output) when flushing.
 O2err o2n_send_udp(Net_address *ua, O2netmsg_ptr msg)
 {
+#ifndef O2_NO_NETTHREAD
+    if (o2n_thread_active && !o2n_on_net_thread) {
+        return o2n_thread_send_udp(ua, msg);
+    }
+#endif
+#ifdef O2N_MMSG
+    if (udp_out_batching) {
+        if (udp_out_count >= O2N_UDP_BATCH) {
+            o2n_udp_batch_flush();
+            udp_out_batching = true;
+        }
+        Udp_pending *up = &udp_out[udp_out_count++];
+        up->sa = ua->sa;
+        up->msg = msg;
+        return O2_SUCCESS;
+    }
+#endif
+    udp_batch_count(&udp_send_counts, 1);
     return o2n_send_udp_via_socket(o2n_udp_send_sock, ua, msg);
 }
 
 
+// start deferring o2n_send_udp() messages so they can be sent together
+void o2n_udp_batch_begin()
+{
+#ifdef O2N_MMSG
+#ifndef O2_NO_NETTHREAD
+    if (o2n_thread_active && !o2n_on_net_thread) {
+        return;  // UDP is sent (and batched) by the network thread
+    }
+#endif
+    udp_out_batching = true;
+#endif
+}
+
+
+// send any deferred o2n_send_udp() messages and stop deferring sends
+void o2n_udp_batch_flush()
+{
+#ifdef O2N_MMSG
+#ifndef O2_NO_NETTHREAD
+    if (o2n_thread_active && !o2n_on_net_thread) {
+        return;  // UDP is sent (and batched) by the network thread
+    }
+#endif
+    udp_out_batching = false;
+    int count = udp_out_count;
+    if (count == 0) return;
+    udp_out_count = 0;
+    struct mmsghdr hdrs[O2N_UDP_BATCH];
+    struct iovec iovs[O2N_UDP_BATCH];
+    memset(hdrs, 0, sizeof(hdrs[0]) * count);
+    for (int i = 0; i < count; i++) {
+        Udp_pending *up = &udp_out[i];
+        iovs[i].iov_base = &up->msg->payload[0];
+        iovs[i].iov_len = up->msg->length;
+        hdrs[i].msg_hdr.msg_name = &up->sa;
+        hdrs[i].msg_hdr.msg_namelen = sizeof up->sa;
+        hdrs[i].msg_hdr.msg_iov = &iovs[i];
+        hdrs[i].msg_hdr.msg_iovlen = 1;
+    }
+    int sent = 0;
+    while (sent < count) {
+        int n = sendmmsg(o2n_udp_send_sock, hdrs + sent, count - sent, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            // like sendto() in o2n_send_udp_via_socket(), report and drop
+            // the message that failed, then continue with the rest
+            hdprintf("error sending udp to port %d ",
+                     ntohs(udp_out[sent].sa.sin_port));
+            dbprintf("o2n_udp_batch_flush: %s\n", strerror(errno));
+            n = 1;
+        } else {
+            udp_batch_count(&udp_send_counts, n);
+        }
+        sent += n;
+    }
+    for (int i = 0; i < count; i++) {
+        O2_FREE(udp_out[i].msg);
+    }
+#endif
+}
+
+
+// the O2 thread reads sockets into static buffers. Another thread that
+// reads sockets at the same time (the network thread) calls this with
+// alloc = true when it starts and alloc = false when it ends.
+void o2n_private_buffers(bool alloc)
+{
+    if (alloc) {
+        tcp_in_buf = O2_MALLOCNT(O2N_TCP_RECV_SIZE, char);
+#ifdef O2N_MMSG
+        udp_in_slots = O2_MALLOCNT(O2N_UDP_BATCH, O2n_udp_slot);
+#endif
+    } else {
+        O2_FREE(tcp_in_buf);
+        tcp_in_buf = tcp_in_storage;
+#ifdef O2N_MMSG
+        O2_FREE(udp_in_slots);
+        udp_in_slots = udp_in_storage;
+#endif
+    }
+}
+
+
+O2err o2_udp_batch_stats(O2udp_batch_stats *stats, bool reset)
+{
+    std::memory_order relaxed = std::memory_order_relaxed;
+    if (stats) {
+        stats->recv_calls = udp_recv_counts.calls.load(relaxed);
+        stats->recv_msgs = udp_recv_counts.msgs.load(relaxed);
+        stats->recv_max = udp_recv_counts.max.load(relaxed);
+        stats->send_calls = udp_send_counts.calls.load(relaxed);
+        stats->send_msgs = udp_send_counts.msgs.load(relaxed);
+        stats->send_max = udp_send_counts.max.load(relaxed);
+    }
+    if (reset) {
+        Udp_batch_counts *all[2] = { &udp_recv_counts, &udp_send_counts };
+        for (int i = 0; i < 2; i++) {
+            all[i]->calls.store(0, relaxed);
+            all[i]->msgs.store(0, relaxed);
+            all[i]->max.store(0, relaxed);
+        }
+    }
+    return O2_SUCCESS;
+}
+
+
+O2err o2_socket_stats(int index, O2socket_stats *stats, bool reset)
+{
+    if (!o2_ensemble_name) {
+        return O2_NOT_INITIALIZED;
+    }
+    if (index < 0 || index >= o2n_fds_info.size()) {
+        return O2_FAIL;
+    }
+    Fds_info *info = o2n_fds_info[index];
+    if (info->blocked_since >= 0) {  // end the interval if not blocked now
+        bool blocked;
+#ifndef O2_NO_NETTHREAD
+        if (info->thread_owned) {
+            blocked = info->thread_tx >= O2N_THREAD_TX_MAX;
+        } else
+#endif
+        blocked = (info->out_message != NULL);
+        if (!blocked) {
+            info->note_blocked(O2_SUCCESS);
+        }
+    }
+    O2time now = o2_local_time();
+    if (stats) {
+        Proxy_info *owner = (Proxy_info *) info->owner;
+        stats->kind = Fds_info::tag_to_string(info->net_tag);
+        stats->peer = owner ? owner->key : NULL;
+        stats->messages_in = info->msgs_in;
+        stats->bytes_in = info->bytes_in;
+        stats->messages_out = info->msgs_out;
+        stats->bytes_out = info->bytes_out;
+#ifndef O2_NO_NETTHREAD
+        if (info->thread_owned) {  // the network thread owns out_message
+            stats->queued_messages = info->thread_tx;
+            stats->queued_bytes = -1;
+        } else
+#endif
+        {
+            stats->queued_messages = 0;
+            stats->queued_bytes = -info->out_msg_sent;
+            for (O2netmsg_ptr m = info->out_message; m; m = m->next) {
+                stats->queued_messages++;
+                stats->queued_bytes += m->length;
+            }
+        }
+        stats->blocked = info->blocked_count;
+        stats->blocked_time = info->blocked_time;
+        if (info->blocked_since >= 0) {
+            stats->blocked_time += now - info->blocked_since;
+        }
+        stats->connect_time = info->connect_time;
+    }
+    if (reset) {
+        info->msgs_in = 0;
+        info->bytes_in = 0;
+        info->msgs_out = 0;
+        info->bytes_out = 0;
+        info->blocked_count = 0;
+        info->blocked_time = 0;
+        if (info->blocked_since >= 0) {
+            info->blocked_since = now;
+        }
+    }
+    return O2_SUCCESS;
+}
+
+
 // send udp message to local port. msg is owned/freed by this function.
 // msg must be in network byte order
 //
 void o2n_send_udp_local(int port, O2netmsg_ptr msg)
 {
-    local_to_addr.sin_port = port; // copy port number
-    O2_DBd(hdprintf("sending localhost msg to port %d\n", ntohs(port)));
+    local_to_addr.sin_port = htons(port); // copy port number
+    O2_DBd(hdprintf("sending localhost msg to port %d\n", port));
     if (sendto(o2n_udp_send_sock,
                ((char *) &msg->length) + sizeof msg->length,
                msg->length, 0, (struct sockaddr *) &local_to_addr,
@@ -198,12 +502,88 @@ void o2n_send_udp_local(int port, O2netmsg_ptr msg)
 }
 
 
+#ifndef O2_NO_UNIXSOCK
+void o2n_unix_path(char *path, int port, bool stream)
+{
+    snprintf(path, O2N_UNIX_PATH_LEN, "%s/o2-%s-%04x.%c", O2N_UNIX_DIR,
+             o2n_host_id, port, stream ? 's' : 'd');
+}
+
+
+static O2err unix_address(struct sockaddr_un *sa, const char *path)
+{
+    memset(sa, 0, sizeof *sa);
+    sa->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof sa->sun_path) {
+        return O2_FAIL;
+    }
+    strcpy(sa->sun_path, path);
+    return O2_SUCCESS;
+}
+
+
+// like o2n_send_udp(), but to a Unix-domain datagram socket. The send
+// socket is nonblocking, so if the receiver is not reading, the message
+// is dropped as it would be for UDP.
+O2err o2n_send_unix_udp(const char *path, O2netmsg_ptr msg)
+{
+    struct sockaddr_un sa;
+    ssize_t err = -1;
+    if (unix_address(&sa, path) == O2_SUCCESS) {
+        err = sendto(o2n_unix_send_sock, &msg->payload[0], msg->length, 0,
+                     (struct sockaddr *) &sa, sizeof sa);
+    }
+    O2_FREE(msg);
+    if (err < 0) {
+        O2_DBn(hdprintf("o2n_send_unix_udp to %s: %s\n", path,
+                        strerror(errno)));
+        return O2_FAIL;
+    }
+    return O2_SUCCESS;
+}
+
+
+// compute o2n_host_id from the host name and, on Linux, the boot id.
+// Containers on one host have different host names (and usually file
+// systems), so they do not try to share Unix-domain sockets.
+static void find_host_id()
+{
+    char buf[256 + 64];
+    if (gethostname(buf, 256) != 0) {
+        buf[0] = 0;
+    }
+    buf[255] = 0;
+    size_t len = strlen(buf);
+#ifdef __linux__
+    FILE *inf = fopen("/proc/sys/kernel/random/boot_id", "r");
+    if (inf) {
+        len += fread(buf + len, 1, 63, inf);
+        fclose(inf);
+    }
+#endif
+    uint32_t h = 2166136261u;  // FNV-1a hash
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (uint8_t) buf[i]) * 16777619u;
+    }
+    snprintf(o2n_host_id, O2N_IP_LEN, "%08x", h);
+}
+#endif
+
+
 O2err Fds_info::can_send()
 {
     // O2_SUCCESS if TCP socket and !out_message
     // otherwise O2_BLOCKED
+    O2err rslt;
     if ((net_tag & NET_TCP_MASK) != 0) {
-        return (out_message == NULL) ? O2_SUCCESS : O2_BLOCKED;
+#ifndef O2_NO_NETTHREAD
+        if (thread_owned) {
+            rslt = thread_tx < O2N_THREAD_TX_MAX ? O2_SUCCESS : O2_BLOCKED;
+        } else
+#endif
+        rslt = (out_message == NULL) ? O2_SUCCESS : O2_BLOCKED;
+        note_blocked(rslt);
+        return rslt;
     } else if (net_tag & NET_TCP_CONNECTING) {
         return O2_BLOCKED;
     }
@@ -214,9 +594,29 @@ O2err Fds_info::can_send()
 }
 
 
+void Fds_info::note_blocked(O2err rslt)
+{
+    if (rslt == O2_BLOCKED) {
+        blocked_count++;
+        if (blocked_since < 0) {
+            blocked_since = o2_local_time();
+        }
+    } else if (rslt == O2_SUCCESS && blocked_since >= 0) {
+        blocked_time += o2_local_time() - blocked_since;
+        blocked_since = -1;
+    }
+}
+
+
 // This function takes ownership of msg
 O2err Fds_info::send_tcp(bool block, O2netmsg_ptr msg)
 {
+#ifndef O2_NO_NETTHREAD
+    if (thread_owned) {
+        count_out(msg);
+        return o2n_thread_send(this, block, msg);
+    }
+#endif
     // if proc has a pending message, we must send with blocking
     if (out_message && block) {
         O2err rslt = send(true);
@@ -338,9 +738,25 @@ Fds_info::Fds_info(SOCKET sock, int net_tag_, int port_, Net_interface *own)
     port = port_;
     owner = own;
     description = NULL;  // used only in debug builds, describes the socket
+#ifndef O2_NO_UNIXSOCK
+    unix_domain = false;
+#endif
 #ifndef O2_NO_DEBUG
     trace_socket_flag = false;  // option to report when this closes
 #endif
+#ifndef O2_NO_NETTHREAD
+    thread_owned = false;
+    thread_index = -1;
+    thread_tx = 0;
+#endif
+    msgs_in = 0;
+    bytes_in = 0;
+    msgs_out = 0;
+    bytes_out = 0;
+    blocked_count = 0;
+    blocked_since = -1;
+    blocked_time = 0;
+    connect_time = (net_tag & NET_TCP_CONNECTING) ? -1 : o2_local_time();
     
     o2n_fds_info.push_back(this);
     struct pollfd *pfd = o2n_fds.append_space(1);
@@ -409,10 +825,83 @@ Fds_info *Fds_info::create_udp_server(int *port, bool reuse)
         o2_closesocket(sock, "bind failed in create_udp_server");
         return NULL;
     }
+#ifdef O2N_RCV_STAMP
+    int on = 1;  // without stamps, o2n_rcv_time() just returns -1:
+    if (setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof on) < 0) {
+        O2_DBo(hdprintf("create_udp_server SO_TIMESTAMPNS: %s\n",
+                        strerror(errno)));
+    }
+#endif
     return new Fds_info(sock, NET_UDP_SERVER, *port, NULL);
 }
 
 
+#ifndef O2_NO_UNIXSOCK
+Fds_info *Fds_info::create_unix_server(const char *path, bool stream,
+                                       int port, Net_interface *own)
+{
+    struct sockaddr_un sa;
+    if (unix_address(&sa, path) != O2_SUCCESS) {
+        return NULL;
+    }
+    SOCKET sock = o2_socket(AF_UNIX, stream ? SOCK_STREAM : SOCK_DGRAM, 0,
+                            "create_unix_server");
+    if (sock == INVALID_SOCKET) {
+        return NULL;
+    }
+    // the path contains our TCP server port, so a file already there
+    // was left by a process that did not exit normally:
+    unlink(path);
+    if (bind(sock, (struct sockaddr *) &sa, sizeof sa) ||
+        (stream && listen(sock, 10))) {
+        O2_DBo(hdprintf("create_unix_server %s: %s\n", path,
+                        strerror(errno)));
+        o2_closesocket(sock, "create_unix_server bind & listen");
+        return NULL;
+    }
+    if (stream) {
+        fcntl(sock, F_SETFL, O_NONBLOCK);
+    }
+    Fds_info *info = new Fds_info(sock, stream ? NET_TCP_SERVER :
+                                  NET_UDP_SERVER, port, own);
+    info->unix_domain = true;
+    return info;
+}
+
+
+Fds_info *Fds_info::create_unix_client(const char *path, Net_interface *own)
+{
+    struct sockaddr_un sa;
+    if (unix_address(&sa, path) != O2_SUCCESS) {
+        return NULL;
+    }
+    SOCKET sock = o2_socket(AF_UNIX, SOCK_STREAM, 0, "create_unix_client");
+    if (sock == INVALID_SOCKET) {
+        return NULL;
+    }
+    fcntl(sock, F_SETFL, O_NONBLOCK);
+    o2_disable_sigpipe(sock);
+    // connect() fails at once if there is no server (or its backlog is
+    // full), and the caller can fall back to TCP
+    if (::connect(sock, (struct sockaddr *) &sa, sizeof sa) == -1 &&
+        errno != EINPROGRESS) {
+        O2_DBo(hdprintf("create_unix_client %s: %s\n", path,
+                        strerror(errno)));
+        o2_closesocket(sock, "create_unix_client connect");
+        return NULL;
+    }
+    // even if connected, stay NET_TCP_CONNECTING so that o2n_recv() calls
+    // owner->connected() when the socket is writable, as for TCP
+    Fds_info *info = new Fds_info(sock, NET_TCP_CONNECTING, 0, own);
+    info->unix_domain = true;
+    o2n_fds[info->fds_index].events |= POLLOUT;
+    O2_DBo(hdprintf("connect to %s with socket %ld index %d\n", path,
+                    (long) sock, info->fds_index));
+    return info;
+}
+#endif
+
+
 SOCKET o2n_broadcast_socket_new()
 {
     // Set up a socket for broadcasting discovery messages
@@ -477,6 +966,16 @@ O2err o2n_initialize()
         o2n_finish();
         return O2_FAIL;
     }
+#ifndef O2_NO_UNIXSOCK
+    if (o2n_unix_enabled) {
+        find_host_id();
+        o2n_unix_send_sock = o2_socket(AF_UNIX, SOCK_DGRAM, 0,
+                                       "o2n_initialize (unix send)");
+        if (o2n_unix_send_sock != INVALID_SOCKET) {
+            fcntl(o2n_unix_send_sock, F_SETFL, O_NONBLOCK);
+        }
+    }
+#endif
 
     o2n_fds.init(5);
     o2n_fds_info.init(5);
@@ -495,6 +994,7 @@ void o2n_finish()
     // udp receive socket was removed already by o2_finish
     o2n_fds_info.finish();
     o2n_fds.finish();
+    o2n_udp_batch_flush();  // send (or at least free) deferred messages
     if (o2n_udp_send_sock != INVALID_SOCKET) {
         o2_closesocket(o2n_udp_send_sock, "o2n_finish (o2n_udp_send_sock)");
         o2n_udp_send_sock = INVALID_SOCKET;
@@ -503,6 +1003,12 @@ void o2n_finish()
         o2_closesocket(o2n_broadcast_sock, "o2n_finish (o2n_broadcast_sock)");
         o2n_broadcast_sock = INVALID_SOCKET;
     }
+#ifndef O2_NO_UNIXSOCK
+    if (o2n_unix_send_sock != INVALID_SOCKET) {
+        o2_closesocket(o2n_unix_send_sock, "o2n_finish (o2n_unix_send_sock)");
+        o2n_unix_send_sock = INVALID_SOCKET;
+    }
+#endif
     o2n_network_found = false;
 #ifdef WIN32
     WSACleanup();    
@@ -515,7 +1021,9 @@ void o2n_finish()
 O2netmsg_ptr O2netmsg_new(int size)
 {
     O2netmsg_ptr msg = O2N_MESSAGE_ALLOC(size);
-    msg->length = size;
+    if (msg) {
+        msg->length = size;
+    }
     return msg;
 }
 
@@ -674,7 +1182,8 @@ Fds_info *Fds_info::create_tcp_client(Net_address *remote_addr,
         // detect when we're connected by polling for writable
         pfd->events |= POLLOUT;
     } else { // wow, we're already connected, not sure this is possible
-        o2n_fds_info[info->fds_index]->net_tag = NET_TCP_CLIENT;
+        info->net_tag = NET_TCP_CLIENT;
+        info->connect_time = o2_local_time();
         o2_disable_sigpipe(sock);
         O2_DBdo(hdprintf("connected to %x:? index %d\n",
                     remote_addr->get_in_addr()->s_addr, o2n_fds.size() - 1));
@@ -694,14 +1203,16 @@ Fds_info *Fds_info::create_tcp_client(Net_address *remote_addr,
 //
 O2err Fds_info::send(bool block)
 {
-    int err;
-    int flags = 0;
-#if __linux__
-    flags = MSG_NOSIGNAL;
-#endif
     if (net_tag == NET_INFO_CLOSED) {
         return O2_FAIL;
     }
+#ifndef O2_NO_NETTHREAD
+    if (thread_owned) {
+        O2err rslt = o2n_thread_flush(this, block);
+        note_blocked(rslt);
+        return rslt;
+    }
+#endif
     struct pollfd *pfd = &o2n_fds[fds_index];
     if (net_tag == NET_TCP_CONNECTING && block) {
         O2_DBo(hdprintf("o2n_send - index %d tag is NET_TCP_CONNECTING, "
@@ -759,33 +1270,90 @@ O2err Fds_info::send(bool block)
         }
         // otherwise, socket is writable, thus connected now
         net_tag = NET_TCP_CLIENT;
+        connect_time = o2_local_time();
         if (owner) owner->connected();
     }
+    O2err rslt = write_pending(pfd, block);
+    if (rslt == O2_SOCKET_ERROR) {
+        O2_DBo(hdprintf("removing remote process after send error "
+                        "to socket %ld index %d\n", (long) (pfd->fd),
+                        fds_index));
+        close_socket(true);  // this will free any pending messages
+        return O2_FAIL;
+    }
+    note_blocked(rslt);
+    return rslt;
+}
+
+
+// write messages from out_message to the socket described by pfd. If
+// block is false, write what can be written without blocking, set POLLOUT
+// in pfd->events if anything remains, and return O2_BLOCKED. If block is
+// true, write everything. Returns O2_SOCKET_ERROR if the connection failed,
+// in which case the caller should close the socket. This is called by
+// send() in the O2 thread and by the network thread.
+//
+O2err Fds_info::write_pending(struct pollfd *pfd, bool block)
+{
+    int err;
+    int flags = 0;
+#if __linux__
+    flags = MSG_NOSIGNAL;
+#endif
 #ifndef WIN32
     if (!block) {
         flags |= MSG_DONTWAIT;
     }
 #endif
     O2netmsg_ptr msg;
-    while ((msg = out_message)) { // more messages to send
-        // Send the length of the message followed by the message.
+    while ((msg = drop_expired())) { // more messages to send
+        // Send the length of each message followed by the message.
         // We want to do this in one send; otherwise, we'll send 2
         // network packets due to the NODELAY socket option.
+        int n;  // how many bytes we are trying to send
+#ifndef WIN32
+        // Gather up to O2N_SEND_IOV_MAX queued messages into a single
+        // sendmsg() call. Length fields are converted to network order
+        // in place and restored after the call. The first message may
+        // already be partially sent (see out_msg_sent).
+        struct iovec iov[O2N_SEND_IOV_MAX];
+        int32_t lens[O2N_SEND_IOV_MAX];
+        int count = 0;
+        int offset = out_msg_sent;
+        n = 0;
+        for (O2netmsg_ptr m = msg; m && count < O2N_SEND_IOV_MAX;
+             m = m->next) {
+            int32_t len = m->length;
+            lens[count] = len;
+            if (read_type == READ_RAW) {
+                iov[count].iov_base = m->payload + offset;
+                iov[count].iov_len = len - offset;
+            } else {  // need to send length field in network byte order:
+                m->length = htonl(len);
+                iov[count].iov_base = ((char *) &m->length) + offset;
+                iov[count].iov_len = len + sizeof m->length - offset;
+            }
+            n += (int) iov[count].iov_len;
+            offset = 0;
+            count++;
+        }
+        struct msghdr mh;
+        memset(&mh, 0, sizeof mh);
+        mh.msg_iov = iov;
+        mh.msg_iovlen = count;
+        // sendmsg returns ssize_t, but a batch of messages is never near
+        // 2GB, so conversion to int will never overflow
+        err = (int) sendmsg(pfd->fd, &mh, flags);
+        // restore byte-swapped lengths (noop if READ_RAW)
+        count = 0;
+        for (O2netmsg_ptr m = msg; m && count < O2N_SEND_IOV_MAX;
+             m = m->next) {
+            m->length = lens[count++];
+        }
+#else
         int32_t len = msg->length;
-        int n;
         char *from;
         if (read_type == READ_RAW) {
-            /*
-            if (out_msg_sent == 0) {
-                hdprintf("READ_RAW info sending: ||");
-                for (int i = 0; i < msg->length; i++) {
-                    int c = msg->payload[i];
-                    if (isgraph(c)) dbprintf("%c", c);
-                    else dbprintf("X%02x", c & 0xff);
-                }
-                dbprintf("||\n");
-            }
-            */
             from = msg->payload + out_msg_sent;
             n  = len - out_msg_sent;
         } else {  // need to send length field in network byte order:
@@ -797,6 +1365,7 @@ O2err Fds_info::send(bool block)
         // conversion to int will never overflow
         err = (int) ::send(pfd->fd, from, n, flags);
         msg->length = len; // restore byte-swapped len (noop if READ_RAW)
+#endif
 
         if (err < 0) {
             O2_DBo(hdprintf("Net_interface::send sending a message: %s\n",
@@ -805,26 +1374,37 @@ O2err Fds_info::send(bool block)
                 pfd->events |= POLLOUT; // request event when it unblocks
                 return O2_BLOCKED;
             } else if (TERMINATING_SOCKET_ERROR) {
-                O2_DBo(hdprintf("removing remote process after send error "
-                                "%d err %d to socket %ld index %d\n",
-                                errno, err, (long) (pfd->fd), fds_index));
-                close_socket(true);  // this will free any pending messages
-                return O2_FAIL;
+                O2_DBo(hdprintf("send error %d on socket %ld\n",
+                                errno, (long) (pfd->fd)));
+                return O2_SOCKET_ERROR;
             } // else EINTR or EAGAIN, so try again
         } else {
-            // err >= 0, update how much we have sent
-            out_msg_sent += err;
-            if (err >= n) { // finished sending message
-                assert(err == n);
+            // err >= 0: free each message that is now completely sent
+            // and update how much of the next message has been sent
+            int sent = err;
+            int header = (read_type == READ_RAW ? 0 : sizeof msg->length);
+            while (out_message) {
+                O2netmsg_ptr m = out_message;
+                int remaining = m->length + header - out_msg_sent;
+                if (sent < remaining) {
+                    out_msg_sent += sent;
+                    break;
+                }
+                sent -= remaining;
                 out_msg_sent = 0;
-                O2netmsg_ptr next = msg->next;
-                O2_FREE(msg);
-                out_message = next;
-                // now, while loop will send the next message if any
-            } else if (!block) { // next send call would probably block
+                out_message = m->next;
+                O2_FREE(m);
+#ifndef O2_NO_NETTHREAD
+                if (thread_owned) {
+                    thread_tx--;
+                }
+#endif
+            }
+            if (err < n && !block) { // next send call would probably block
                 pfd->events |= POLLOUT; // request event when writable
                 return O2_BLOCKED;
-            } // else we're blocking, so loop and send more data
+            } // else loop to send the next messages, or if we're
+              // blocking, loop and send more data
         }
     }
     return O2_SUCCESS;
@@ -832,6 +1412,36 @@ O2err Fds_info::send(bool block)
 
 
 
+// remove expired messages (see o2_add_deadline()) from the messages
+// that write_pending() will send next, except one that is partially
+// sent. Returns out_message.
+//
+O2netmsg_ptr Fds_info::drop_expired()
+{
+    if (read_type != READ_O2
+#ifndef O2_NO_NETTHREAD
+        || thread_owned  // o2_expired_drop() must run in the O2 thread
+#endif
+       ) {
+        return out_message;
+    }
+    O2netmsg_ptr *ptr = &out_message;
+    if (out_msg_sent > 0 && *ptr) {
+        ptr = &(*ptr)->next;
+    }
+    for (int i = 0; *ptr && i < O2N_SEND_IOV_MAX; i++) {
+        O2netmsg_ptr m = *ptr;
+        if (O2_NETMSG_EXPIRED(m)) {
+            *ptr = m->next;
+            o2_expired_drop((O2message_ptr) m);
+        } else {
+            ptr = &m->next;
+        }
+    }
+    return out_message;
+}
+
+
 // Send a message. Named "enqueue" to emphasize that this is asynchronous.
 // Follow this call with o2n_send(interf, true) to force a blocking
 // (synchronous) send.
@@ -840,6 +1450,13 @@ O2err Fds_info::send(bool block)
 //
 void Fds_info::enqueue(O2netmsg_ptr msg)
 {
+    count_out(msg);
+#ifndef O2_NO_NETTHREAD
+    if (thread_owned) {
+        o2n_thread_send(this, false, msg);
+        return;
+    }
+#endif
     // if nothing pending yet, no send in progress;
     //    set up to send this message
     msg->next = NULL; // make sure this will be the end of list
@@ -871,17 +1488,50 @@ void Fds_info::reset()
         O2netmsg_ptr p = out_message;
         out_message = p->next;
         O2_FREE(p);
+#ifndef O2_NO_NETTHREAD
+        if (thread_owned) thread_tx--;
+#endif
     }
     out_message = NULL;
 }
 
 
+#ifndef O2_NO_NETTHREAD
+// the network thread has closed the socket after close_socket(): finish
+// what close_socket() does when there is no network thread
+void Fds_info::thread_closed()
+{
+    thread_owned = false;
+    thread_index = -1;
+    o2n_fds[fds_index].fd = INVALID_SOCKET;
+    delete_me = 2;
+    net_tag = NET_INFO_CLOSED;
+    o2n_socket_delete_flag = true;
+}
+#endif
+
+
 // if now, then close socket immediately. If !now, which happens when we
 // send an error response via HTTP (there may be other examples), then
 // wait for the pending messages to be sent; then close the socket
 // if read_type is READ_CUSTOM, we do not actually close the socket
 void Fds_info::close_socket(bool now)
 {
+#ifndef O2_NO_NETTHREAD
+    if (thread_owned) {
+        // the network thread owns the socket and message queues, so it
+        // closes the socket and then returns this Fds_info for deletion
+        if (net_tag != NET_INFO_CLOSED) {
+            O2_DBc(hdprintf("close_socket on fds_info %p (%s) passed to "
+                            "network thread\n", this,
+                            Fds_info::tag_to_string(net_tag)));
+            o2n_thread_close(this, now);
+            net_tag = NET_INFO_CLOSED;
+            delete_me = 3;  // network thread will report when it is closed
+        }
+        return;
+    }
+#endif
     reset();
     struct pollfd *pfd = &o2n_fds[fds_index];
     SOCKET sock = pfd->fd;
@@ -973,8 +1623,18 @@ O2err o2n_recv()
         in_o2n_recv = false;
         return O2_SUCCESS;
     }
-    for (int i = 0; i < socket_count; i++) {
+    int start = (o2n_recv_next < socket_count ? o2n_recv_next : 0);
+    int served = 0;  // sockets with events handled in this call
+    for (int k = 0; k < socket_count; k++) {
+        int i = (start + k) % socket_count;
         struct pollfd *pfd = &o2n_fds[i];
+        bool ready = FD_ISSET(pfd->fd, &o2_read_set) ||
+                     FD_ISSET(pfd->fd, &o2_write_set) ||
+                     FD_ISSET(pfd->fd, &o2_except_set);
+        if (ready && served++ > 0 && O2_POLL_BUDGET_EXHAUSTED()) {
+            o2n_recv_next = i;  // start here in the next poll
+            break;
+        }
         
         if (FD_ISSET(pfd->fd, &o2_except_set)) {
             Fds_info *fi = o2n_fds_info[i];
@@ -992,6 +1652,7 @@ O2err o2n_recv()
                 Fds_info *fi = o2n_fds_info[i];
                 if (fi->net_tag & NET_TCP_CONNECTING) { // connect completed
                     fi->net_tag = NET_TCP_CLIENT;
+                    fi->connect_time = o2_local_time();
                     O2_DBo(hdprintf("connection completed, socket %ld index "
                                     "%d\n", (long)pfd->fd, i));
                     // tell next layer up that connection is good, e.g. O2 sends
@@ -1036,11 +1697,41 @@ O2err o2n_recv()
     // if there are any bad socket descriptions, remove them now
     if (o2n_socket_delete_flag) o2n_free_deleted_sockets();
 
+#ifndef O2_NO_NETTHREAD
+    if (o2n_thread_active) {
+        // deliver what the network thread received and give it any new
+        // sockets. If it services every socket, there is nothing to poll.
+        int remaining = o2n_thread_poll();
+        if (!o2_ensemble_name) { // handler called o2_finish()
+            in_o2n_recv = false;
+            return O2_FAIL;
+        }
+        if (remaining == 0) {
+            if (o2n_socket_delete_flag) o2n_free_deleted_sockets();
+            in_o2n_recv = false;
+            return O2_SUCCESS;
+        }
+    }
+#endif
     poll(o2n_fds.get_array(), o2n_fds.size(), 0);
     int len = o2n_fds.size(); // length can grow while we're looping!
-    for (i = 0; i < len; i++) {
+    // visit sockets round-robin, starting where the poll budget (if
+    // any) stopped the previous call:
+    int start = (o2n_recv_next < len ? o2n_recv_next : 0);
+    int served = 0;  // sockets with events handled in this call
+    for (int k = 0; k < len; k++) {
         Fds_info *fi;
+        i = (start + k) % len;
         struct pollfd *pfd = &o2n_fds[i];
+#ifndef O2_NO_NETTHREAD
+        if (o2n_fds_info[i]->thread_owned) {
+            continue;  // the network thread handles this socket
+        }
+#endif
+        if (pfd->revents && served++ > 0 && O2_POLL_BUDGET_EXHAUSTED()) {
+            o2n_recv_next = i;  // start here in the next poll
+            break;
+        }
         // if (pfd->revents) hdprintf("%d:%p:%04x ", i, d, d->revents);
         if (pfd->revents & POLLERR) {
         } else if (pfd->revents & POLLHUP) {
@@ -1057,6 +1748,7 @@ O2err o2n_recv()
             fi = o2n_fds_info[i]; // find socket info
             if (fi->net_tag & NET_TCP_CONNECTING) { // connect() completed
                 fi->net_tag = NET_TCP_CLIENT;
+                fi->connect_time = o2_local_time();
                 O2_DBo(hdprintf("connection completed, socket %ld index %d\n",
                                 (long) (pfd->fd), i));
                 // tell next layer up that connection is good, e.g. O2 sends
@@ -1125,42 +1817,135 @@ void Fds_info::message_cleanup()
 }
 
 
-// returns O2_SUCCESS if whole message is read.
-//         O2_FAIL if whole message is not read yet.
-//         O2_TCP_HUP if socket is closed
+// local time (o2_local_time()) at which the message being delivered was
+// received, according to its kernel timestamp, or -1 if unknown. The
+// stamp is converted from its age, so this works with any time source.
 //
-O2err Fds_info::read_whole_message(SOCKET sock)
+O2time o2n_rcv_time()
 {
-    int n;
+#ifdef O2N_RCV_STAMP
+    if (o2n_rcv_stamp >= 0) {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        double age = now.tv_sec + now.tv_nsec * 1e-9 - o2n_rcv_stamp;
+        // the system clock could have been set back since the stamp:
+        return o2_local_time_precise() - (age > 0 ? age : 0);
+    }
+#endif
+    return -1;
+}
+
+
+// deliver a received message to the owner, or free it if there is no
+// owner or the socket is closing. stamp is the kernel receive timestamp,
+// or -1 if none (see o2n_rcv_time()). Returns true if the socket can
+// continue to deliver messages, false if it was closed (or O2 was shut
+// down).
+//
+bool Fds_info::deliver_message(O2netmsg_ptr msg, double stamp)
+{
+#ifndef O2_NO_NETTHREAD
+    if (o2n_on_net_thread) {  // pass msg to the O2 thread for delivery
+        o2n_thread_deliver(this, msg, stamp);
+        return true;
+    }
+#endif
+    O2err err = O2_FAIL;
+    o2_poll_msgs++;
+    msgs_in++;
+    if (msg) {  // NULL for READ_CUSTOM
+        bytes_in += msg->length;
+    }
+    O2_DBo(hdprintf("delivering message from net_tag %s socket %ld index %d "
+                    "to %p\n", tag_to_string(net_tag),
+                    (long) o2n_fds[fds_index].fd, fds_index, owner));
+    if (owner && !delete_me) {
+        // note that for READ_CUSTOM (e.g. asynchronous file read), msg is NULL
+        double prev_stamp = o2n_rcv_stamp;
+        o2n_rcv_stamp = stamp;
+        err = owner->deliver(msg);
+        o2n_rcv_stamp = prev_stamp;
+    } else if (msg) {
+        O2_FREE(msg);
+    }
+    if (!o2_ensemble_name) { // handler called o2_finish()
+        return false;        // so this Fds_info no longer exists
+    }
+    if (err != O2_SUCCESS &&
+        (net_tag == NET_TCP_CONNECTING ||
+         net_tag == NET_TCP_CLIENT ||
+         net_tag == NET_TCP_CONNECTION)) {
+         close_socket(true);
+    }
+    return !delete_me && net_tag != NET_INFO_CLOSED;
+}
+
+
+// read whatever is available (up to O2N_TCP_RECV_SIZE bytes) from a TCP
+// socket with one recv() and deliver every complete message. For READ_O2,
+// incoming bytes are a sequence of 4-byte lengths and message data. A
+// partial length is collected in in_length and a partial message in
+// in_message until the rest arrives. For READ_RAW, all of the bytes read
+// form one message.
+//
+// A message longer than O2N_TCP_RECV_SIZE (possible only when
+// o2_set_max_message_size() raised the limit) is also received directly
+// into in_message, which is allocated as soon as the length is known.
+// Handlers need contiguous message data, so collecting pieces and
+// copying them would only double the memory needed for the message. The
+// system commits the pages of a large allocation as they are written,
+// i.e. as data actually arrives.
+//
+// returns O2_SUCCESS if the socket is still open, even if no message was
+//         completed, or O2_TCP_HUP if socket is closed
+//
+int Fds_info::read_buffered(SOCKET sock)
+{
+    // coerce to int to avoid compiler warning; requested length is
+    // int, so int is ok for n
+    int n = (int) recvfrom(sock, tcp_in_buf, O2N_TCP_RECV_SIZE, 0,
+                           NULL, NULL);
+    if (n == 0) { /* socket was gracefully closed */
+        O2_DBo(hdprintf("recvfrom returned 0: deleting socket\n"));
+        reset();
+        message_cleanup();
+        return O2_TCP_HUP;
+    } else if (n < 0) { /* error: close the socket */
+        if (TERMINATING_SOCKET_ERROR) {
+            hdprintf("recvfrom in read_buffered: %s\n", strerror(errno));
+            reset();
+            message_cleanup();
+            return O2_TCP_HUP;
+        }
+        return O2_SUCCESS; // not finished reading
+    }
     if (read_type == READ_RAW) {
-        // allow raw messages up to 512 bytes
         assert(net_tag & NET_TCP_MASK);
-        in_message = O2N_MESSAGE_ALLOC(512);
-        assert(in_message && (size_t) in_message != 8);
-        n = (int) recvfrom(sock, in_message->payload, 512, 0, NULL, NULL);
         O2_DBw(hdprintf("READ_RAW read %d bytes\n", n));
-        if (n < 0) {
-            goto error_exit;
+        O2netmsg_ptr msg = O2netmsg_new(n);
+        if (!msg) {  // out of memory: the caller closes the socket
+            hdprintf("no memory for message in read_buffered\n");
+            return O2_FAIL;
         }
-        in_message->length = n;
-    } else if (read_type == READ_O2) {
-        /* first read length if it has not been read yet */
+        memcpy(msg->payload, tcp_in_buf, n);
+        deliver_message(msg);
+        return O2_SUCCESS;
+    }
+    char *data = tcp_in_buf;
+    while (n > 0) {
+        /* first get length if it has not been received yet */
         if (in_length_got < 4) {
-            // coerce to int to avoid compiler warning; requested length is
-            // int, so int is ok for n
-            n = (int) recvfrom(sock,
-                               PTR(&in_length) + in_length_got,
-                               4 - in_length_got, 0, NULL, NULL);
-            if (n <= 0) {
-                goto error_exit;
-            }
-            in_length_got += n;
-            assert(in_length_got < 5);
+            int count = 4 - in_length_got;
+            if (count > n) count = n;
+            memcpy(PTR(&in_length) + in_length_got, data, count);
+            in_length_got += count;
+            data += count;
+            n -= count;
             if (in_length_got < 4) {
-                return O2_FAIL; // length is not received yet, get more later
+                return O2_SUCCESS; // length is not received yet, get more later
             }
             // done receiving length bytes
-            in_length = htonl(in_length);
+            in_length = ntohl(in_length);
             assert(!in_message);
             // if someone grabs our IP and port from Bonjour and sends a
             // random message or even visits the URL with a browser, the
@@ -1168,158 +1953,209 @@ O2err Fds_info::read_whole_message(SOCKET sock)
             // that could crash O2. We do not have much security, but at
             // least we can shut down the connection when we get an
             // implausible message length.
-            if (in_length >= 0x10000) {
-                O2_DBo(hdprintf("bad message length in read_whole_message; "
+            if (in_length < 0 || in_length > o2n_max_msg_len) {
+                O2_DBo(hdprintf("bad message length in read_buffered; "
                                 "closing connection\n"));
-                n = 0;  // means the socket to be closed, no message to free
-                goto error_exit;
+                message_cleanup();
+                return O2_TCP_HUP;
             }
             in_message = O2netmsg_new(in_length);
-            assert(in_message && (size_t) in_message != 8);
+            if (!in_message) {  // out of memory: the caller closes the socket
+                hdprintf("no memory for message in read_buffered\n");
+                message_cleanup();
+                return O2_FAIL;
+            }
             in_msg_got = 0; // just to make sure
         }
-        
-        /* read the full message */
+        /* copy message data */
+        int count = in_length - in_msg_got;
+        if (count > n) count = n;
+        memcpy(in_message->payload + in_msg_got, data, count);
+        in_msg_got += count;
+        data += count;
+        n -= count;
         if (in_msg_got < in_length) {
-            // coerce to int to avoid compiler warning; will not overflow
-            n = (int) recvfrom(sock,
-                          in_message->payload + in_msg_got,
-                          in_length - in_msg_got, 0, NULL, NULL);
-            if (n <= 0) {
-                goto error_exit;
-            }
-            in_msg_got += n;
-            if (in_msg_got < in_length) {
-                return O2_FAIL; // message is not complete, get more later
-            }
+            return O2_SUCCESS; // message is not complete, get more later
         }
         in_message->length = in_length;
-    } // else READ_CUSTOM -- do not read here, in_message is NULL
-    return O2_SUCCESS; // we have a full message now
-  error_exit:
-    if (n == 0) { /* socket was gracefully closed */
-        O2_DBo(hdprintf("recvfrom returned 0: deleting socket\n"));
-        message_cleanup();
-        return O2_TCP_HUP;
-    } else if (n < 0) { /* error: close the socket */
-        if (TERMINATING_SOCKET_ERROR) {
-            hdprintf("recvfrom in read_whole_message: %s\n", strerror(errno));
-            if (in_message) {
-                O2_FREE(in_message);
-            }
-            message_cleanup();
-            return O2_TCP_HUP;
+        O2netmsg_ptr msg = in_message;
+        message_cleanup();  // get ready for next incoming message
+        if (!deliver_message(msg)) {
+            break;  // socket closed; drop anything else we received
         }
     }
-    return O2_FAIL; // not finished reading
+    return O2_SUCCESS;
 }
 
 
-int Fds_info::read_event_handler()
+// receive up to O2N_UDP_BATCH datagrams from a UDP server socket with
+// one recvmmsg() call and deliver each of them to the owner. Datagrams
+// land in static slots and are copied to right-sized messages, so
+// receiving does not allocate anything that is not delivered.
+//
+int Fds_info::udp_recv_batch(SOCKET sock)
 {
-    SOCKET sock = o2n_fds[fds_index].fd;
-    if (net_tag & (NET_TCP_CONNECTION | NET_TCP_CLIENT | NET_INFILE)) {
-        int n = read_whole_message(sock);
-        if (n == O2_FAIL) { // not ready to process message yet
-            return O2_SUCCESS; // not a problem, but we're done for now
-        } else if (n != O2_SUCCESS) {
-            return n; // some other error, i.e. O2_TCP_HUP
-        }
-        // fall through and send message
-    } else if (net_tag == NET_UDP_SERVER) {
-#ifdef WIN32
-        u_long len; // CAREFUL! This type not unix compatible!
-#else
-        int len;
+#ifdef O2N_MMSG
+    struct mmsghdr hdrs[O2N_UDP_BATCH];
+    struct iovec iovs[O2N_UDP_BATCH];
+    memset(hdrs, 0, sizeof hdrs);
+#ifdef O2N_RCV_STAMP
+    char control[O2N_UDP_BATCH][O2N_RCV_CONTROL_SIZE];
 #endif
-        if (ioctlsocket(sock, FIONREAD, &len) == -1) {
-            hdprintf("udp_recv_handler: %s\n", strerror(errno));
-            return O2_FAIL;
-        }
-#ifdef OLD_DEBUG_CODE
-#ifndef O2_NO_DEBUG
-        // make sure owner is not associated with some other socket --
-        // sometimes, in_message is not NULL, but it should be. How
-        // does it get set? Aliasing? Probably not - we failed the
-        // assert(!in_message) below, so we got past this loop.
-        for (int j = 0; j < o2n_fds_info.size(); j++) {
-            if (j != fds_index && o2n_fds_info[j].owner == owner) {
-                hdprintf("ALIAS!!!!!! %d %d\n", j, fds_index);
-                assert(false);
-            }
+    for (int i = 0; i < O2N_UDP_BATCH; i++) {
+        iovs[i].iov_base = udp_in_slots[i];
+        iovs[i].iov_len = O2N_UDP_SLOT_SIZE;
+        hdrs[i].msg_hdr.msg_iov = &iovs[i];
+        hdrs[i].msg_hdr.msg_iovlen = 1;
+#ifdef O2N_RCV_STAMP
+        hdrs[i].msg_hdr.msg_control = control[i];
+        hdrs[i].msg_hdr.msg_controllen = O2N_RCV_CONTROL_SIZE;
+#endif
+    }
+    int count = recvmmsg(sock, hdrs, O2N_UDP_BATCH, MSG_DONTWAIT, NULL);
+    if (count <= 0) {
+        // As with recvfrom(), udp errors are not fatal, but print them
+        if (count < 0 && TERMINATING_SOCKET_ERROR) {
+            hdprintf("recvmmsg in udp_recv_batch: %s\n", strerror(errno));
         }
-        if (in_message) {
-            hdprintf("in_message, len %d:\n", in_message->length);
-            o2_node_show((O2node *) owner, 2);
-            dbprintf("    message is ");
-            o2_message_print((O2message_ptr) in_message);
+        return O2_SUCCESS;
+    }
+    udp_batch_count(&udp_recv_counts, count);
+    for (int i = 0; i < count; i++) {
+        int n = (int) hdrs[i].msg_len;
+        if (hdrs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+            hdprintf("udp_recv_batch dropped truncated datagram\n");
+            continue;
         }
+        O2netmsg_ptr msg = O2netmsg_new(n);
+        if (!msg) return O2_FAIL;
+        memcpy(msg->payload, udp_in_slots[i], n);
+#if CLOSE_SOCKET_DEBUG
+        hdprintf("***UDP received %d bytes at %g.\n", n, o2_local_time());
 #endif
+#ifdef O2N_RCV_STAMP
+        double stamp = rcv_stamp(&hdrs[i].msg_hdr);
+#else
+        double stamp = -1;
 #endif
-        assert(!in_message);
-        in_message = O2netmsg_new(len);
-        assert((size_t) in_message != 8);
-        if (!in_message) return O2_FAIL;
-        int n;
-        // coerce to int to avoid compiler warning; ok because len is int
-        if ((n = (int) recvfrom(sock, (char *) &in_message->payload, len,
-                                0, NULL, NULL)) <= 0) {
-            // I think udp errors should be ignored. UDP is not reliable
-            // anyway. For now, though, let's at least print errors.
-            hdprintf("recvfrom in udp_recv_handler: %s\n", strerror(errno));
-            O2_FREE(in_message);
-            in_message = NULL;
-            return O2_FAIL;
+        if (!deliver_message(msg, stamp)) {
+            break;
         }
-#if CLOSE_SOCKET_DEBUG
-        hdprintf("***UDP received %d bytes at %g.\n", n, o2_local_time());
+    }
+#endif
+    return O2_SUCCESS;
+}
+
+
+int Fds_info::read_event_handler()
+{
+    SOCKET sock = o2n_fds[fds_index].fd;
+    if (net_tag & (NET_TCP_CONNECTION | NET_TCP_CLIENT | NET_INFILE)) {
+        if (read_type != READ_CUSTOM) {
+            return read_buffered(sock);
+        }
+        // READ_CUSTOM -- do not read here, in_message is NULL, and the
+        // owner's deliver method does the reading
+        // fall through and send (NULL) message
+    } else if (net_tag == NET_UDP_SERVER) {
+#ifdef O2N_MMSG
+        return udp_recv_batch(sock);
+#else
+        return udp_recv(sock);
 #endif
-        in_message->length = n;
-        // fall through and send message
     } else if (net_tag == NET_TCP_SERVER) {
-        // note that this handler does not call read_whole_message()
+        // note that this handler does not call read_buffered()
         SOCKET connection = o2_accept(sock, NULL, NULL, "read_event_handler");
         if (connection == INVALID_SOCKET) {
             O2_DBG(hdprintf("tcp_accept_handler failed to accept\n"));
             return O2_FAIL;
         }
-        int set = 1;
-#ifdef __APPLE__
-        setsockopt(connection, SOL_SOCKET, SO_NOSIGPIPE,
-                   (void *) &set, sizeof set);
-#endif
-        Fds_info *conn = new Fds_info(connection, NET_TCP_CONNECTION, 0, NULL);
-        assert(conn);
-        O2_DBdo(hdprintf("O2 server socket %ld accepts client as socket "
-                         "%ld index %d\n", (long) sock, (long) connection,
-                         conn->fds_index));
-        if (owner) owner->accepted(conn);
-        else conn->close_socket(true);  // not sure if this could happen
-        return O2_SUCCESS;
+        return add_connection(connection);
     } else {  // socket has a read error, but this could be our local proc
         // TCP server socket, so don't close it; just clean up.
         reset();
         return O2_SUCCESS;  // any error returned will close socket, so don't
     }
-    // COMMON CODE for TCP and UDP receive message:
-    // endian corrections are done in handler
+    // READ_CUSTOM: endian corrections are done in handler
     O2netmsg_ptr msg = in_message;
     message_cleanup();  // get ready for next incoming message
-    O2err err = O2_FAIL;
-    O2_DBo(hdprintf("delivering message from net_tag %s socket %ld index %d to "
-                "%p\n", tag_to_string(net_tag), (long) sock, fds_index, owner));
-    if (owner && !delete_me) {
-        // note that for READ_CUSTOM (e.g. asynchronous file read), msg is NULL
-        err = owner->deliver(msg);
-    } else {
-        O2_FREE(msg);
+    deliver_message(msg);
+    return O2_SUCCESS;
+}
+
+
+// create an Fds_info for a connection accepted by this TCP server socket
+// and give it to the owner
+//
+int Fds_info::add_connection(SOCKET connection)
+{
+    int set = 1;
+#ifdef __APPLE__
+    setsockopt(connection, SOL_SOCKET, SO_NOSIGPIPE,
+               (void *) &set, sizeof set);
+#endif
+    Fds_info *conn = new Fds_info(connection, NET_TCP_CONNECTION, 0, NULL);
+    assert(conn);
+#ifndef O2_NO_UNIXSOCK
+    conn->unix_domain = unix_domain;
+#endif
+    O2_DBdo(hdprintf("O2 server socket %ld accepts client as socket "
+                     "%ld index %d\n", (long) get_socket(), (long) connection,
+                     conn->fds_index));
+    if (owner) owner->accepted(conn);
+    else conn->close_socket(true);  // not sure if this could happen
+    return O2_SUCCESS;
+}
+
+
+// receive one UDP message with recvfrom() and deliver it
+//
+int Fds_info::udp_recv(SOCKET sock)
+{
+#ifdef WIN32
+    u_long len; // CAREFUL! This type not unix compatible!
+#else
+    int len;
+#endif
+    if (ioctlsocket(sock, FIONREAD, &len) == -1) {
+        hdprintf("udp_recv_handler: %s\n", strerror(errno));
+        return O2_FAIL;
     }
-    if (err != O2_SUCCESS &&
-        (net_tag == NET_TCP_CONNECTING ||
-         net_tag == NET_TCP_CLIENT ||
-         net_tag == NET_TCP_CONNECTION)) {
-         close_socket(true);
+    O2netmsg_ptr msg = O2netmsg_new(len);
+    if (!msg) return O2_FAIL;
+    int n;
+    double stamp = -1;
+#ifdef O2N_RCV_STAMP
+    struct iovec iov;
+    iov.iov_base = &msg->payload;
+    iov.iov_len = len;
+    char control[O2N_RCV_CONTROL_SIZE];
+    struct msghdr hdr;
+    memset(&hdr, 0, sizeof hdr);
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control;
+    hdr.msg_controllen = sizeof control;
+    if ((n = (int) recvmsg(sock, &hdr, 0)) > 0) {
+        stamp = rcv_stamp(&hdr);
     }
+#else
+    // coerce to int to avoid compiler warning; ok because len is int
+    n = (int) recvfrom(sock, (char *) &msg->payload, len, 0, NULL, NULL);
+#endif
+    if (n <= 0) {
+        // I think udp errors should be ignored. UDP is not reliable
+        // anyway. For now, though, let's at least print errors.
+        hdprintf("recvfrom in udp_recv_handler: %s\n", strerror(errno));
+        O2_FREE(msg);
+        return O2_FAIL;
+    }
+#if CLOSE_SOCKET_DEBUG
+    hdprintf("***UDP received %d bytes at %g.\n", n, o2_local_time());
+#endif
+    msg->length = n;
+    udp_batch_count(&udp_recv_counts, 1);
+    deliver_message(msg, stamp);
     return O2_SUCCESS;
 }
 
@@ -1332,6 +2168,7 @@ void Fds_info::set_description(const char *desc)
     }
     description = desc;
 }
+#endif
 
 
 const char *Fds_info::tag_to_string(int tag)
@@ -1350,8 +2187,8 @@ const char *Fds_info::tag_to_string(int tag)
     snprintf(unknown, 32, "Tag-%d(%x)", tag, tag);
     return unknown;
 }
-#endif
-    
+
+
 SOCKET Fds_info::get_socket()
 {
     return o2n_fds[fds_index].fd;
@@ -48,6 +48,18 @@ typedef SSIZE_T ssize_t;
 typedef int SOCKET;  // In O2, we'll use SOCKET to denote the type of a socket
 #define INVALID_SOCKET -1
 #endif
+#if defined(WIN32) && !defined(O2_NO_NETTHREAD)
+#define O2_NO_NETTHREAD  // the network thread uses pthreads and poll()
+#endif
+#if defined(WIN32) && !defined(O2_NO_UNIXSOCK)
+#define O2_NO_UNIXSOCK  // no Unix-domain sockets between O2 processes
+#endif
+#if defined(O2_NO_UNIXSOCK) && !defined(O2_NO_SHMRING)
+#define O2_NO_SHMRING  // shared memory rings are set up over Unix sockets
+#endif
+#ifndef O2_NO_NETTHREAD
+#include <atomic>
+#endif
 /**
  * The o2n_info structure tells us info about each socket. For Unix, there
  * is a parallel structure, fds, that contains an fds parameter for poll().
@@ -163,6 +175,11 @@ public:
     // override writeable iff WRITE_CUSTOM:
     virtual O2err writeable() { return O2_SUCCESS; };
 
+    // return true if the socket can be serviced by the network thread
+    // (see netthread.cpp). This requires that the owner only sends with
+    // Fds_info methods and never touches the message queues directly.
+    virtual bool thread_io() { return false; }
+
     // since Net_interface is a just an interface (set of methods), it is
     // always multiple-inherited along with some other class that you can
     // actually delete. This remove method converts "this" to the proper
@@ -187,6 +204,7 @@ class Fds_info : public O2obj {
                     // (note that removing array elements while scanning for 
                     // events would be very tricky, so we make a second
                     // cleanup pass).
+                    // set to 3 while the network thread closes the socket
 
     Read_type read_type;  // READ_RAW means message data is sent as is with
                     // no length count (unless it is in the message data).
@@ -222,6 +240,28 @@ class Fds_info : public O2obj {
                     // or the server port if this is a process
     Net_interface *owner;
     const char *description;  // used only in debug builds, describes the socket
+#ifndef O2_NO_UNIXSOCK
+    bool unix_domain;     // AF_UNIX socket to a process on this host; it
+                          // uses the TCP or UDP net_tag of its type
+#endif
+#ifndef O2_NO_NETTHREAD
+    bool thread_owned;    // socket I/O is done by the network thread, so
+                          // the O2 thread must not touch in_* and out_*
+    int thread_index;     // index in the network thread's socket arrays
+    std::atomic<int32_t> thread_tx;  // messages queued for the network
+                          // thread to send that are not yet completely sent
+#endif
+    // traffic statistics (see o2_socket_stats()), kept by the O2 thread:
+    int64_t msgs_in;      // messages delivered from this socket
+    int64_t bytes_in;
+    int64_t msgs_out;     // messages given to this socket to send
+    int64_t bytes_out;
+    int64_t blocked_count;  // sends and can_send() calls that were blocked
+    O2time blocked_since; // local time when the socket became blocked,
+                          // or -1 if it is not blocked
+    O2time blocked_time;  // total time blocked, not counting blocked_since
+    O2time connect_time;  // local time of creation or connection, -1
+                          // while NET_TCP_CONNECTING
 
     Fds_info(SOCKET sock, int net_tag, int port, Net_interface *own);
     ~Fds_info();
@@ -241,8 +281,25 @@ class Fds_info : public O2obj {
     static Fds_info *create_udp_server(int *port, bool reuse);
 
     static Fds_info *create_tcp_server(int *port, Net_interface *own);
+#ifndef O2_NO_UNIXSOCK
+    // create a Unix-domain stream (NET_TCP_SERVER) or datagram
+    // (NET_UDP_SERVER) server socket bound to path (see o2n_unix_path)
+    static Fds_info *create_unix_server(const char *path, bool stream,
+                                        int port, Net_interface *own);
+    // connect to a Unix-domain stream server. Returns NULL if the server
+    // does not exist. Otherwise, like create_tcp_client(), the result
+    // is NET_TCP_CONNECTING until the socket becomes writable.
+    static Fds_info *create_unix_client(const char *path,
+                                        Net_interface *own);
+#endif
     O2err connect(const char *ip, int tcp_port);
     O2err can_send();
+    // update blocked_count and blocked time given the result of a send
+    // or can_send(): O2_BLOCKED starts or continues a blocked interval,
+    // O2_SUCCESS ends it
+    void note_blocked(O2err rslt);
+    // count a message given to this socket to send
+    void count_out(O2netmsg_ptr msg) { msgs_out++; bytes_out += msg->length; }
     O2err send_tcp(bool block, O2netmsg_ptr msg);
 
     // Send a message. Named "enqueue" to emphasize that this is asynchronous.
@@ -260,13 +317,24 @@ class Fds_info : public O2obj {
     // message, the o2_send() function will call this *with* blocking
     // when a message is already pending and o2_send is called again.
     O2err send(bool block);
+    O2err write_pending(struct pollfd *pfd, bool block);
+    O2netmsg_ptr drop_expired();
 
     int read_event_handler();
-    O2err read_whole_message(SOCKET sock);
+    int add_connection(SOCKET connection);
+#ifndef O2_NO_NETTHREAD
+    void thread_closed();
+#endif
+    int udp_recv(SOCKET sock);
+    int udp_recv_batch(SOCKET sock);
+    int read_buffered(SOCKET sock);
+    bool deliver_message(O2netmsg_ptr msg, double stamp = -1);
     void message_cleanup();
     Fds_info *cleanup(const char *error, SOCKET sock);
     void reset();
     void close_socket(bool now);
+    // name of a net_tag value, also used by o2_socket_stats()
+    static const char *tag_to_string(int tag);
 
 #ifndef O2_NO_DEBUG
     void set_description(const char *desc);
@@ -275,7 +343,6 @@ class Fds_info : public O2obj {
 // individually or according to type or function. Tracing all socket
 // actions can be overwhelming.
 #define TRACE_SOCKET(obj) ((obj)->trace_socket_flag)
-    static const char *tag_to_string(int tag);
     bool trace_socket_flag;  // report when this closes
 #else
 #define TRACE_SOCKET(obj) false
@@ -294,6 +361,12 @@ O2_EXPORT char o2n_public_ip[O2N_IP_LEN];     // in 8 hex characters
 // O2_EXPORT char o2n_internal_ip[O2N_IP_LEN];   // in 8 hex characters
                                                  // declared in hostip.h
 
+// Incoming TCP messages longer than o2n_max_msg_len close the connection.
+// The default limit is O2N_DEFAULT_MAX_MSG_LEN, which every O2 process
+// accepts. Larger limits are set by o2_set_max_message_size().
+#define O2N_DEFAULT_MAX_MSG_LEN 0xFFFF
+extern int32_t o2n_max_msg_len;
+
 // initialize this module
 O2err o2n_initialize();
 
@@ -316,6 +389,11 @@ void o2n_free_deleted_sockets(void);
 // poll for messages
 O2err o2n_recv(void);
 
+// local time when the UDP message being delivered was received by the
+// kernel, or -1 if unknown (not UDP, not delivered from a socket, or
+// no kernel timestamps on this platform)
+O2time o2n_rcv_time();
+
 O2err o2n_send_udp(Net_address *ua, O2netmsg_ptr msg);
 
 O2err o2n_send_udp_via_socket(SOCKET socket, Net_address *ua,
@@ -327,11 +405,38 @@ O2err o2n_send_udp_via_socket(SOCKET socket, Net_address *ua,
 // send a UDP message to localhost
 void o2n_send_udp_local(int port, O2netmsg_ptr msg);
 
+// o2_poll() calls o2n_udp_batch_begin() at the start of each poll cycle
+// and o2n_udp_batch_flush() at the end. In between, o2n_send_udp() may
+// defer messages and send them together with one system call.
+void o2n_udp_batch_begin();
+void o2n_udp_batch_flush();
+
+// allocate (or free) receive buffers for the calling thread so that it
+// can read sockets concurrently with the O2 thread (see netthread.cpp)
+void o2n_private_buffers(bool alloc);
+
 ssize_t o2n_send_broadcast(int port, O2netmsg_ptr msg);
 
 // create a socket for UDP broadcasting messages
 SOCKET o2n_broadcast_socket_new();
 
+#ifndef O2_NO_UNIXSOCK
+// O2 processes on the same host connect with Unix-domain sockets instead
+// of TCP and UDP, unless o2n_unix_enabled is false. A process is on the
+// same host if it has the same internal IP and host id. The host id is
+// 8 hex characters derived from the host name (and boot id on Linux).
+extern bool o2n_unix_enabled;
+extern char o2n_host_id[O2N_IP_LEN];
+#define O2N_UNIX_PATH_LEN 100
+
+// write the path of the stream (or datagram) socket of the process with
+// the given TCP server port to path, which has O2N_UNIX_PATH_LEN bytes
+void o2n_unix_path(char *path, int port, bool stream);
+
+// send a message to a Unix-domain datagram socket and free the message
+O2err o2n_send_unix_udp(const char *path, O2netmsg_ptr msg);
+#endif
+
 // create a socket for sending UDP messages
 SOCKET o2n_udp_send_socket_new();
 
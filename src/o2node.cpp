@@ -444,6 +444,11 @@ O2message_ptr Proxy_info::pre_send(bool *tcp_flag)
 O2err Proxy_info::deliver(O2netmsg_ptr o2n_msg)
 {
     O2message_ptr msg = (O2message_ptr) o2n_msg;
+    if (msg->data.misc & O2_SEQ_FLAG_NET) {
+        o2_udp_seq_receive(msg);
+    }
+    // a deadline in the sender's local time means nothing here:
+    msg->data.misc &= ~O2_EXPIRE_LOCAL_FLAG_NET;
 #if IS_LITTLE_ENDIAN
     o2_msg_swap_endian(&msg->data, false);
 #endif
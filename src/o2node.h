@@ -306,6 +306,8 @@ public:
 };
 
 
+class Services_entry;
+
 // A message handler that uses a socket or other connection to
 // deliver messages remotely
 class O2_CLASS_EXPORT Proxy_info : public O2node, public Net_interface {
@@ -324,6 +326,11 @@ public:
     // is_connected is also used by MQTT_info, which is a Proxy_info, so
     // we moved is_connected here.
     bool is_connected;
+    // Services_entrys where this proxy offers a service or has a tap,
+    // one reference for each service and each tap, so that they can be
+    // removed without searching every service. Only kept for proxies
+    // other than o2_ctx->proc (see services.cpp).
+    Vec<Services_entry *> services_by;
 
     Proxy_info(const char *key, int tag) : O2node(key, tag) {
         is_connected = false;
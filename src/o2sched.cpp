@@ -158,9 +158,15 @@ O2err o2_schedule_msg(O2sched_ptr scheduler, O2message_ptr msg)
 }
 
 
-// This looks for messages <= now and delivers them
+// messages dispatched by this o2_sched_poll() from the current scheduler
+// (see O2_POLL_BUDGET_EXHAUSTED)
+static int sched_dispatched = 0;
+
+// This looks for messages <= now and delivers them. Returns false if it
+// stopped because the poll budget is used up. Then last_bin and
+// last_time are left at the next message to dispatch.
 //
-static void sched_dispatch(O2sched_ptr s, O2time run_until_time)
+static bool sched_dispatch(O2sched_ptr s, O2time run_until_time)
 {
     // examine slots between last_bin and bin, inclusive
     // this is tricky: if time has advanced more than SCHED_TABLE_LEN,
@@ -169,7 +175,9 @@ static void sched_dispatch(O2sched_ptr s, O2time run_until_time)
     // detect the wrap-around and advance time 1s at a time to avoid
     // the problem.
     while (s->last_time + 1 < run_until_time) {
-        sched_dispatch(s, s->last_time + 1);
+        if (!sched_dispatch(s, s->last_time + 1)) {
+            return false;
+        }
     }
     int64_t bin = O2_SCHED_BIN(run_until_time);
     // now we know that we have less than 1s to go to catch up, so the
@@ -177,6 +185,10 @@ static void sched_dispatch(O2sched_ptr s, O2time run_until_time)
     while (s->last_bin <= bin) {
         O2message_ptr *msg_ptr = &s->table[O2_SCHED_BIN_TO_INDEX(s->last_bin)];
         while (*msg_ptr && ((*msg_ptr)->data.timestamp <= run_until_time)) {
+            if (sched_dispatched++ > 0 && O2_POLL_BUDGET_EXHAUSTED()) {
+                return false;  // continue with this message in the next poll
+            }
+            o2_poll_msgs++;
             O2message_ptr msg = *msg_ptr;
             assert(msg->next == 0 || (uint64_t) msg->next >= 0x100000000);
             *msg_ptr = msg->next; // unlink message msg
@@ -198,15 +210,19 @@ static void sched_dispatch(O2sched_ptr s, O2time run_until_time)
     s->last_bin--; // we should revisit this bin next time
     // everything up to and including run_until_time has been scheduled:
     s->last_time = run_until_time;
+    return true;
 }
 
 
 // call this periodically
 void o2_sched_poll()
 {
+    // each scheduler dispatches at least its first due message, even
+    // if the other one used up the poll budget:
+    sched_dispatched = 0;
     sched_dispatch(&o2_ltsched, o2_local_now);
-
     if (o2_gtsched_started) {
+        sched_dispatched = 0;
         sched_dispatch(&o2_gtsched, o2_global_now);
     }
 }
@@ -256,7 +256,7 @@ void DNSSD_API zc_resolve_callback(DNSServiceRef sd_ref, DNSServiceFlags flags,
             goto no_discovery;
         }
         o2_discovered_a_remote_process_name(name, version, internal_ip,
-                                            port, udp_port, O2_DY_INFO);
+                                            port, udp_port, O2_DY_INFO, NULL);
     }   // fall through to clean up resolve_info...
   no_discovery:
     if (resolve_info) {
@@ -635,7 +635,7 @@ static void zc_resolve_callback(AvahiServiceResolver *r,
             if (name[0] && version &&
                 is_valid_proc_name(name, port, internal_ip, &udp_port)) {
                 o2_discovered_a_remote_process_name(name, version, internal_ip,
-                                                    port, udp_port, O2_DY_INFO);
+                        port, udp_port, O2_DY_INFO, NULL);
             }
         }
     }
@@ -0,0 +1,345 @@
+// peercache.cpp -- remember peers across runs to speed up discovery
+//
+// Discovery starts from scratch in every run: a restarted process
+// broadcasts /_o2/dy messages to the discovery ports one at a time,
+// so it can take seconds before it is connected to every process of a
+// running ensemble.
+//
+// After o2_peer_cache(path, max_age), the processes we were connected
+// to are written to the file at path by o2_finish(), one per line:
+//     @public:internal:port version udp_port seen ensemble
+// where version is in hex and seen is the wall-clock time (seconds
+// since 1970) when the process was last connected. Our own process is
+// included so that other processes sharing the file can find us.
+//
+// On the next run, once our name is known, every cached peer of our
+// ensemble that was seen within max_age seconds (at most
+// PEER_CACHE_CONTACT most recent ones) is contacted at once: we open a
+// temporary TCP connection and send our /_o2/dy with O2_DY_CALLBACK,
+// as a discovery server does. The peer answers as if it had received
+// our discovery broadcast, so the connection is made with fresh /_o2/dy
+// information (current version, ports, and ensemble name) rather than
+// what is cached; a process of another ensemble at the cached address
+// ignores us. Broadcast discovery runs as usual, so peers that are not
+// in the cache, or that now use another port, are still found.
+//
+// A cached peer that is gone costs one failed connection attempt. It
+// is then dropped from the file unless it connected during this run,
+// so a bad entry is tried at most once. Entries of other ensembles are
+// kept until they expire.
+//
+// Several processes may share the file. Each one writes a temporary
+// file named with its pid and renames it to path, and just before
+// writing, it reads the file again and merges in entries written by
+// other processes since it started, keeping the most recent time
+// seen for each peer. An entry that another process dropped stays
+// dropped unless this process connected to it.
+
+#ifndef O2_NO_PEERCACHE
+#include <time.h>
+#ifdef WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+#include "o2internal.h"
+#include "services.h"
+#include "message.h"
+#include "msgsend.h"
+#include "discovery.h"
+#include "peercache.h"
+
+#define PEER_CACHE_MAX 256     // most lines kept in the file
+#define PEER_CACHE_CONTACT 32  // most peers contacted at startup
+#define PEER_CACHE_AGE 86400.0 // default max_age (one day)
+#define PEER_LINE_LEN 256
+
+typedef struct Peer_entry {
+    O2string name;      // @public:internal:port (owned)
+    O2string ensemble;  // (owned)
+    int32_t version;
+    int udp_port;
+    double seen;        // wall-clock time when last connected
+    bool contacted;     // we tried to connect to it in this run
+    bool confirmed;     // it was connected in this run
+} Peer_entry;
+
+static char *cache_path = NULL;
+static double cache_max_age = PEER_CACHE_AGE;
+static Vec<Peer_entry> peers;  // most recently seen first after loading
+
+
+static void peers_free()
+{
+    for (int i = 0; i < peers.size(); i++) {
+        O2_FREE((char *) peers[i].name);
+        O2_FREE((char *) peers[i].ensemble);
+    }
+    peers.clear();
+}
+
+
+static int peer_compare(const void *a, const void *b)
+{
+    double diff = ((Peer_entry *) b)->seen - ((Peer_entry *) a)->seen;
+    return diff > 0 ? 1 : (diff < 0 ? -1 : 0);
+}
+
+
+// find or make the entry for name in our ensemble and mark it seen now
+static void peer_seen(const char *name, int32_t version, int udp_port)
+{
+    Peer_entry *peer = NULL;
+    for (int i = 0; i < peers.size(); i++) {
+        if (streql(peers[i].name, name) &&
+            streql(peers[i].ensemble, o2_ensemble_name)) {
+            peer = &peers[i];
+            break;
+        }
+    }
+    if (!peer) {
+        peer = peers.append_space(1);
+        peer->name = o2_heapify(name);
+        peer->ensemble = o2_heapify(o2_ensemble_name);
+        peer->contacted = false;
+        peer->version = 0;
+    }
+    if (version) peer->version = version;
+    peer->udp_port = udp_port;
+    peer->seen = (double) time(NULL);
+    peer->confirmed = true;
+}
+
+
+// append the unexpired entries in inf to list
+static void peers_load(FILE *inf, Vec<Peer_entry> &list)
+{
+    double oldest = (double) time(NULL) - cache_max_age;
+    char line[PEER_LINE_LEN];
+    while (fgets(line, PEER_LINE_LEN, inf)) {
+        char name[64];
+        int version, udp_port, n = 0;
+        double seen;
+        if (sscanf(line, "%63s %x %d %lf %n", name, &version, &udp_port,
+                   &seen, &n) != 4 || n == 0) {
+            continue;
+        }
+        char *ensemble = line + n;
+        ensemble[strcspn(ensemble, "\r\n")] = 0;
+        if (strlen(name) >= O2_MAX_PROCNAME_LEN || name[0] != '@' ||
+            !ensemble[0] || seen < oldest) {
+            continue;  // malformed or expired
+        }
+        Peer_entry *peer = list.append_space(1);
+        peer->name = o2_heapify(name);
+        peer->ensemble = o2_heapify(ensemble);
+        peer->version = version;
+        peer->udp_port = udp_port;
+        peer->seen = seen;
+        peer->contacted = false;
+        peer->confirmed = false;
+    }
+}
+
+
+// merge in what other processes sharing the file wrote since we
+// loaded it
+static void peers_merge()
+{
+    FILE *inf = fopen(cache_path, "r");
+    if (!inf) {
+        return;
+    }
+    Vec<Peer_entry> saved;
+    peers_load(inf, saved);
+    fclose(inf);
+    int n = peers.size();
+    Vec<bool> in_file;  // which of peers[0..n-1] are in saved
+    in_file.init(n, true);
+    for (int i = 0; i < saved.size(); i++) {
+        Peer_entry *entry = &saved[i];
+        Peer_entry *peer = NULL;
+        for (int j = 0; j < peers.size(); j++) {
+            if (streql(peers[j].name, entry->name) &&
+                streql(peers[j].ensemble, entry->ensemble)) {
+                peer = &peers[j];
+                if (j < n) in_file[j] = true;
+                break;
+            }
+        }
+        if (!peer) {  // new entry: take ownership of the strings
+            peers.push_back(*entry);
+            continue;
+        }
+        if (entry->seen > peer->seen) {  // another process connected to it
+            peer->version = entry->version;
+            peer->udp_port = entry->udp_port;
+            peer->seen = entry->seen;
+            peer->confirmed = true;
+        }
+        O2_FREE((char *) entry->name);
+        O2_FREE((char *) entry->ensemble);
+    }
+    // another process dropped or expired what we did not see ourselves:
+    for (int j = 0; j < n; j++) {
+        if (!in_file[j] && !peers[j].confirmed) {
+            peers[j].seen = 0;
+        }
+    }
+}
+
+
+static void peers_save()
+{
+    char pid[16];
+    snprintf(pid, 16, ".%d", (int) getpid());
+    Vec<char> tmp_path(strlen(cache_path) + 21);
+    tmp_path.append(cache_path, strlen(cache_path));
+    tmp_path.append(".tmp", 4);
+    tmp_path.append(pid, strlen(pid) + 1);  // including EOS
+    FILE *outf = fopen(tmp_path.get_array(), "w");
+    if (!outf) {
+        O2_DBd(dbprintf("peer cache: could not write %s\n",
+                        tmp_path.get_array()));
+        return;
+    }
+    peers_merge();
+    qsort(peers.get_array(), peers.size(), sizeof(Peer_entry), &peer_compare);
+    double oldest = (double) time(NULL) - cache_max_age;
+    int count = 0;
+    for (int i = 0; i < peers.size() && count < PEER_CACHE_MAX; i++) {
+        Peer_entry *peer = &peers[i];
+        // a peer we contacted without success is not tried again:
+        if ((peer->contacted && !peer->confirmed) || peer->seen < oldest) {
+            continue;
+        }
+        fprintf(outf, "%s %x %d %.0f %s\n", peer->name, peer->version,
+                peer->udp_port, peer->seen, peer->ensemble);
+        count++;
+    }
+    fclose(outf);
+#ifdef WIN32
+    remove(cache_path);  // rename() will not replace a file on Windows
+#endif
+    if (rename(tmp_path.get_array(), cache_path)) {
+        O2_DBd(dbprintf("peer cache: could not rename to %s\n", cache_path));
+        remove(tmp_path.get_array());
+    }
+}
+
+
+O2err o2_peer_cache(const char *path, double max_age)
+{
+    if (!o2_ensemble_name) {
+        return O2_NOT_INITIALIZED;
+    }
+    peers_free();
+    if (cache_path) {
+        O2_FREE(cache_path);
+        cache_path = NULL;
+    }
+    if (!path) {
+        return O2_SUCCESS;
+    }
+    cache_path = (char *) o2_heapify(path);
+    cache_max_age = max_age > 0 ? max_age : PEER_CACHE_AGE;
+    FILE *inf = fopen(path, "r");
+    if (inf) {  // no file is normal for the first run
+        peers_load(inf, peers);
+        fclose(inf);
+        qsort(peers.get_array(), peers.size(), sizeof(Peer_entry),
+              &peer_compare);
+    }
+    if (o2_ctx->proc && o2_ctx->proc->key) {  // past o2_init_phase2()
+        o2_peer_cache_contact();
+    }
+    return O2_SUCCESS;
+}
+
+
+void o2_peer_cache_contact()
+{
+    if (!cache_path) return;
+#ifndef O2_NO_HUB
+    if (o2_hub_addr[0] && o2_hub_addr[1]) {  // o2_hub() chooses our peers
+        return;
+    }
+#endif
+    int count = 0;
+    for (int i = 0; i < peers.size() && count < PEER_CACHE_CONTACT; i++) {
+        Peer_entry *peer = &peers[i];
+        if (peer->contacted || !streql(peer->ensemble, o2_ensemble_name) ||
+            streql(peer->name, o2_ctx->proc->key) ||
+            (peer->version & 0xFF0000) != (O2_VERSION & 0xFF0000)) {
+            continue;
+        }
+        char name[O2_MAX_PROCNAME_LEN];
+        memset(name, 0, O2_MAX_PROCNAME_LEN);  // lookup() needs zero padding
+        o2_strcpy(name, peer->name, O2_MAX_PROCNAME_LEN);
+        char public_ip[O2N_IP_LEN];
+        char internal_ip[O2N_IP_LEN];
+        int tcp_port;
+        if (o2_parse_name(name, public_ip, internal_ip, &tcp_port) ||
+            *o2_ctx->path_tree.lookup(name)) {  // malformed or discovered
+            continue;
+        }
+        peer->contacted = true;
+        count++;
+        // send /_o2/dy with O2_DY_CALLBACK by TCP as in
+        // o2_discovered_a_remote_process_name() when we are the server:
+        char ipdot[O2N_IP_LEN];
+        o2_hex_to_dot(internal_ip, ipdot);
+        Proc_info *proc = Proc_info::create_tcp_proc(O2TAG_PROC_TEMP,
+                (const char *) ipdot, &tcp_port);
+        if (!proc) {
+            continue;
+        }
+        bool host_flag = streql(internal_ip, o2n_internal_ip) &&
+                         streql(public_ip, o2n_public_ip) &&
+                         peer->version >= O2_HOST_ID_VERSION;
+        O2message_ptr msg = o2_make_dy_msg(o2_ctx->proc, true, false,
+                                           O2_DY_CALLBACK, host_flag);
+        if (!msg) {
+            proc->o2_delete();
+            continue;
+        }
+        O2_DBd(dbprintf("peer cache: contacting %s\n", name));
+        o2_prepare_to_deliver(msg);
+        if (proc->send(false) != O2_SUCCESS) {
+            proc->o2_delete();
+        }
+    }
+}
+
+
+void o2_peer_cache_removed(Proc_info *proc)
+{
+    if (cache_path && proc->key && proc->is_connected) {
+        peer_seen(proc->key, proc->version, proc->udp_address.get_port());
+    }
+}
+
+
+void o2_peer_cache_finish()
+{
+    if (!cache_path) return;
+    // record the peers that are still connected and ourself:
+    for (int i = 0; i < o2n_fds_info.size(); i++) {
+        Proxy_info *proxy = (Proxy_info *) o2n_fds_info[i]->owner;
+        if (proxy && ISA_PROC(proxy) && ISA_REMOTE_PROC(proxy)) {
+            o2_peer_cache_removed(TO_PROC_INFO(proxy));
+        }
+    }
+    if (o2_ctx->proc && o2_ctx->proc->key) {
+        peer_seen(o2_ctx->proc->key, O2_VERSION,
+                  o2_ctx->proc->udp_address.get_port());
+    }
+    peers_save();
+    peers_free();
+    peers.finish();
+    O2_FREE(cache_path);
+    cache_path = NULL;
+}
+
+#endif
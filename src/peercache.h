@@ -0,0 +1,22 @@
+// peercache.h -- remember peers across runs to speed up discovery
+//
+// See peercache.cpp for a description.
+
+#ifndef PEERCACHE_H
+#define PEERCACHE_H
+
+#ifndef O2_NO_PEERCACHE
+
+// contact the cached peers of our ensemble, called by
+// o2_discovery_init_phase2() when our name is known
+void o2_peer_cache_contact();
+
+// note that proc, which is being removed, was a live peer; called by
+// ~Proc_info()
+void o2_peer_cache_removed(Proc_info *proc);
+
+// write the cache file (if any) and free the cache, called by o2_finish()
+void o2_peer_cache_finish();
+
+#endif
+#endif
@@ -9,6 +9,16 @@
 #include "msgsend.h"
 #include "o2osc.h"
 #include "discovery.h"
+#include "message.h"
+#include "pathtree.h"
+#include "shmring.h"
+#include "rudp.h"
+#include "svdelta.h"
+#include "hubmesh.h"
+#include "peercache.h"
+#ifndef O2_NO_UNIXSOCK
+#include <unistd.h>  // unlink()
+#endif
 
 
 /*
@@ -18,6 +28,12 @@ UDP Send Socket (another socket for UDP, there is no o2n_info structure)
 UDP Receive Socket (net_tag = NET_UDP_SERVER)
     Socket is created initially and only closed by o2n_finish, used for both
     discovery messages and incoming O2 UDP messages. No proc_info for this.
+Unix-domain Stream and Datagram Servers (net_tag = NET_TCP_SERVER and
+    NET_UDP_SERVER, unix_domain = true) are created with the local process
+    and owned by it, like the UDP Receive Socket. Processes on the same host
+    connect to the stream server instead of the TCP server, and send to the
+    datagram server instead of the UDP Receive Socket. Otherwise, these
+    connections are the same as TCP connections described below.
 
 Here are all the types of proc_info structures and their life-cycles:
 
@@ -109,6 +125,23 @@ Destruction of PROC_TEMP
 
  */
 
+// addresses marked by o2_conflate() and o2_high_priority(), without
+// the leading "/": a service name matches all addresses of the
+// service, a path matches one address
+#define MARK_CONFLATE 1
+#define MARK_PRIORITY 2
+typedef struct Address_mark {
+    char *address;  // owned
+    int marks;
+} Address_mark;
+static Vec<Address_mark> addr_marks;
+static int64_t conflated_count = 0;
+
+#ifndef O2_NO_BUNDLES
+// processes with coalesced UDP messages (see Proc_info::coalesce_udp()):
+static Vec<Proc_info *> coalescing_procs;
+#endif
+
 // always called to free a proc_info_ptr, if this proc is the
 // local TCP server, freeing the proc_info does not free the
 // services. Services are only freed when this is a remote proc
@@ -124,35 +157,644 @@ Proc_info::~Proc_info()
     // circularity is taken care of by removing each service,
     // services in turn remove the back pointer in proc->services
     if (ISA_REMOTE_PROC(this)) { // not for PROC_TEMP or PROC_TCP_SERVER
+#ifndef O2_NO_SVDELTA
+        o2_svdelta_save(this);  // in case the process reconnects soon
+#endif
+#ifndef O2_NO_HUB
+        if (ISA_PROC(this)) {
+            o2_hub_mesh_removed(this);  // tell partial mesh clients
+        }
+#endif
+#ifndef O2_NO_PEERCACHE
+        if (ISA_PROC(this)) {
+            o2_peer_cache_removed(this);
+        }
+#endif
         Services_entry::remove_services_by(this);
     } else {
         O2_DBo(hdprintf("freeing local proc_info %p tag %s name %s\n",
                         this, o2_tag_to_string(tag), key));
     }
+    o2_udp_seq_removed(this);
+#ifndef O2_NO_UNIXSOCK
+    if (unix_udp_path) O2_FREE(unix_udp_path);
+#endif
+#ifndef O2_NO_SHMRING
+    if (shm_link) shm_link->detach();
+#endif
+#ifndef O2_NO_RUDP
+    if (rudp) rudp->proc = NULL;  // deleted by o2_rudp_poll()
+#endif
+#ifndef O2_NO_BUNDLES
+    o2_message_list_free(&udp_bundle);  // drop coalesced messages
+    for (int i = 0; i < coalescing_procs.size(); i++) {
+        if (coalescing_procs[i] == this) {
+            coalescing_procs.remove(i);
+            break;
+        }
+    }
+#endif
     delete_fds_info();
 }
 
 
+#ifndef O2_NO_UNIXSOCK
+Fds_info *o2_unix_stream_server = NULL;
+Fds_info *o2_unix_dgram_server = NULL;
+#endif
+
+
 O2err Proc_info::send(bool block) {
     O2err rslt;
     bool tcp_flag;
     O2message_ptr msg = pre_send(&tcp_flag);
     if (!msg) {
         rslt = O2_NO_SERVICE;
+    } else if (tcp_flag && msg->data.length > max_msg_len) {
+        // the receiver would close the connection, so drop the message
+        O2_DBn(hdprintf("Proc_info::send dropping %d-byte message, %s "
+                        "accepts at most %d\n", msg->data.length,
+                        key, max_msg_len));
+        O2_FREE(msg);
+        rslt = O2_MSG_TOO_BIG;
+    } else if (queue_marked(msg, tcp_flag)) {
+        rslt = O2_SUCCESS;  // queued without blocking
+#ifndef O2_NO_SHMRING
+    } else if (shm_link && shm_link->tx_ready) {  // TCP or UDP
+        // like UDP sockets, UDP messages do not block:
+        rslt = shm_link->send((O2netmsg_ptr) msg, block && tcp_flag);
+#endif
     } else if (tcp_flag) {
         rslt = fds_info->send_tcp(block, (O2netmsg_ptr) msg);
-    } else {  // send via UDP
-        rslt = o2n_send_udp(&udp_address, (O2netmsg_ptr) msg);
-        if (rslt != O2_SUCCESS) {
-            O2_DBn(hdprintf("Proxy_info::send error, port %d\n",
-                          udp_address.get_port()));
+#ifndef O2_NO_RUDP
+    } else if (msg->data.misc & O2_RUDP_FLAG_NET) {
+        if (!rudp) {
+            rudp = new Rudp_peer(this);
         }
+        rslt = rudp->send(msg);
+#endif
+#ifndef O2_NO_BUNDLES
+    } else if (o2_udp_coalesce_max) {
+        rslt = coalesce_udp(msg);
+#endif
+    } else {
+        rslt = send_udp(msg);
     }
     o2_message_source = NULL;  // clean up to help debugging
     return rslt;
 }
 
 
+// send msg (in network order) by UDP or its local equivalent
+O2err Proc_info::send_udp(O2message_ptr msg)
+{
+    O2err rslt;
+    if (o2_udp_sequence_enabled && !(msg = add_udp_seq(msg))) {
+        return O2_NO_MEMORY;
+    }
+#ifndef O2_NO_UNIXSOCK
+    if (unix_udp_path) {  // send via Unix-domain datagram socket
+        return o2n_send_unix_udp(unix_udp_path, (O2netmsg_ptr) msg);
+    }
+#endif
+    rslt = o2n_send_udp(&udp_address, (O2netmsg_ptr) msg);
+    if (rslt != O2_SUCCESS) {
+        O2_DBn(hdprintf("Proxy_info::send error, port %d\n",
+                      udp_address.get_port()));
+    }
+    return rslt;
+}
+
+
+/*
+Address marks: o2_conflate() and o2_high_priority() mark addresses.
+They affect messages that cannot be sent now and would wait behind
+earlier messages to this process, either in fds_info->out_message
+(TCP) or in shm_link->out_message (TCP or UDP over shared memory).
+
+Priority: system messages (addresses beginning with "_" or "@", e.g.
+/_o2/sv or /_cs/get) and messages to high-priority addresses form a
+lane at the front of the queue. A new priority message is inserted
+after the priority messages already queued, ahead of all other
+("bulk") messages, so it goes out at the next message boundary.
+System messages listed in ordered_addresses are not given priority
+because they must follow every message sent before them, e.g.
+/_o2/sh, which hands the connection over to a shared memory ring (see
+shmring.cpp).
+
+Conflation: a message to a conflatable address replaces a queued
+message with the same address, keeping its place in the queue, so
+only the latest value is sent when the connection unblocks.
+
+Queued marked messages never block the sender, and a partially sent
+message is never replaced or preceded. Queues owned by the network
+thread are left to that thread.
+*/
+
+// system addresses that keep their place in the queue (see above)
+static const char *ordered_addresses[] = { "_o2/sh", NULL };
+
+
+// does path (an address without '/' or '!') match entry, which is a
+// service name or a full path?
+static bool address_matches(const char *path, const char *entry)
+{
+    size_t len = strlen(entry);
+    return strncmp(path, entry, len) == 0 &&
+           (path[len] == 0 || (path[len] == '/' && !strchr(entry, '/')));
+}
+
+
+// return the marks (MARK_CONFLATE, MARK_PRIORITY) of address
+static int address_marks(const char *address)
+{
+    const char *path = address + 1;  // skip '/' or '!'
+    int marks = 0;
+    if (*path == '_' || *path == '@') {
+        marks = MARK_PRIORITY;
+        for (int i = 0; ordered_addresses[i]; i++) {
+            if (address_matches(path, ordered_addresses[i])) {
+                marks = 0;
+                break;
+            }
+        }
+    }
+    for (int i = 0; i < addr_marks.size(); i++) {
+        if (address_matches(path, addr_marks[i].address)) {
+            marks |= addr_marks[i].marks;
+        }
+    }
+    return marks;
+}
+
+
+// replace the message in *queue with the same address as msg. sent is
+// the number of bytes of the first message already written. Returns
+// true if msg took the place of a queued message.
+static bool conflate_queued(O2netmsg_ptr *queue, uint32_t sent,
+                            O2message_ptr msg)
+{
+    const char *path = msg->data.address + 1;
+    if (*queue && sent > 0) {  // first message is partially sent
+        queue = &(*queue)->next;
+    }
+    for (; *queue; queue = &(*queue)->next) {
+        O2message_ptr queued = (O2message_ptr) *queue;
+        if (streql(queued->data.address + 1, path)) {
+            msg->next = queued->next;
+            *queue = (O2netmsg_ptr) msg;
+            O2_FREE(queued);
+            conflated_count++;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+// if msg (in network order) is marked and cannot be sent now, queue it
+// as described above. Returns true if msg was taken.
+bool Proc_info::queue_marked(O2message_ptr msg, bool tcp_flag)
+{
+    O2netmsg_ptr *queue = NULL;
+    uint32_t sent = 0;
+#ifndef O2_NO_SHMRING
+    if (shm_link && shm_link->tx_ready) {
+        queue = &shm_link->out_message;
+        sent = shm_link->out_msg_sent;
+    } else
+#endif
+    if (tcp_flag
+#ifndef O2_NO_NETTHREAD
+        && !fds_info->thread_owned
+#endif
+        ) {
+        queue = &fds_info->out_message;
+        sent = fds_info->out_msg_sent;
+    }
+    if (!queue || !*queue) {
+        return false;  // nothing to wait for, send normally
+    }
+    int marks = address_marks(msg->data.address);
+    if (!marks) {
+        return false;
+    }
+    if ((marks & MARK_CONFLATE) && conflate_queued(queue, sent, msg)) {
+        return true;
+    }
+    if (marks & MARK_PRIORITY) {
+        if (sent > 0) {  // first message is partially sent
+            queue = &(*queue)->next;
+        }
+        while (*queue && (address_marks(((O2message_ptr) *queue)->
+                                        data.address) & MARK_PRIORITY)) {
+            queue = &(*queue)->next;
+        }
+    } else {  // append
+        while (*queue) queue = &(*queue)->next;
+    }
+    msg->next = (O2message_ptr) *queue;
+    *queue = (O2netmsg_ptr) msg;
+    return true;
+}
+
+
+// set or clear mark for address
+static O2err address_mark(const char *address, int mark, bool enable)
+{
+    if (!o2_ensemble_name) {
+        return O2_NOT_INITIALIZED;
+    }
+    if (!address || !*address) {
+        return O2_BAD_ARGS;
+    }
+    if (address[0] == '/' || address[0] == '!') {
+        address++;
+    }
+    int i;
+    for (i = 0; i < addr_marks.size(); i++) {
+        if (streql(addr_marks[i].address, address)) {
+            break;
+        }
+    }
+    if (!enable) {
+        if (i >= addr_marks.size() || !(addr_marks[i].marks & mark)) {
+            return O2_FAIL;
+        }
+        addr_marks[i].marks &= ~mark;
+        if (!addr_marks[i].marks) {
+            O2_FREE(addr_marks[i].address);
+            addr_marks.remove(i);
+        }
+    } else if (i < addr_marks.size()) {
+        addr_marks[i].marks |= mark;
+    } else {
+        Address_mark *am = addr_marks.append_space(1);
+        am->address = (char *) o2_heapify(address);
+        am->marks = mark;
+    }
+    return O2_SUCCESS;
+}
+
+
+O2err o2_conflate(const char *address, bool enable)
+{
+    return address_mark(address, MARK_CONFLATE, enable);
+}
+
+
+O2err o2_high_priority(const char *address, bool enable)
+{
+    return address_mark(address, MARK_PRIORITY, enable);
+}
+
+
+int64_t o2_conflated(bool reset)
+{
+    int64_t count = conflated_count;
+    if (reset) {
+        conflated_count = 0;
+    }
+    return count;
+}
+
+
+void o2_address_marks_finish()
+{
+    for (int i = 0; i < addr_marks.size(); i++) {
+        O2_FREE(addr_marks[i].address);
+    }
+    addr_marks.finish();
+}
+
+
+/*
+UDP sequence numbers: after o2_udp_sequence(true), every datagram sent
+to a process (including bundles and reliable UDP envelopes) is copied
+with an 8-byte trailer: a hash of the sender's process name and a
+sequence number counting datagrams sent to that receiver, both in
+network order, and O2_SEQ_FLAG is set in misc. There is no handshake:
+the receiver finds the sending Proc_info by the name hash in
+o2_ctx->udp_senders, where each remote process is entered when it gets
+its name (o2_udp_seq_named()) and removed when it is deleted. Then the
+receiver removes the trailer before the message is delivered, and
+counts received, lost and reordered datagrams in udp_stats. A gap in
+the sequence is counted as lost, and a late datagram that fills a gap
+is counted as reordered (and no longer lost). udp_seq_missing tells
+which of the 64 sequence numbers before udp_seq_max are gaps, so a
+duplicate is only counted as received. A datagram more than 64 behind
+is counted as reordered, but not subtracted from lost. Since the
+trailer is only understood by receivers with this code, all processes
+in the ensemble must be compatible.
+*/
+
+bool o2_udp_sequence_enabled = false;
+
+// FNV-1a hash of a process name, never 0
+static uint32_t proc_key_hash(const char *key)
+{
+    uint32_t h = 2166136261u;
+    for (const char *p = key; *p; p++) {
+        h = (h ^ (uint8_t) *p) * 16777619u;
+    }
+    return h ? h : 1;
+}
+
+
+// an entry in o2_ctx->udp_senders. The key is the name hash in hex.
+class Udp_sender : public O2node {
+public:
+    Proc_info *proc;
+    Udp_sender(const char *key, Proc_info *proc_) :
+            O2node(key, O2TAG_EMPTY) { proc = proc_; }
+};
+
+#define UDP_SENDER_KEY_LEN 12  // 8 hex digits, zero padded
+
+// find the udp_senders entry for hash; key receives the padded key
+static O2node **udp_sender_find(uint32_t hash, char *key)
+{
+    memset(key, 0, UDP_SENDER_KEY_LEN);  // lookup() needs zero padding
+    snprintf(key, UDP_SENDER_KEY_LEN, "%08x", hash);
+    return o2_ctx->udp_senders.lookup(key);
+}
+
+
+void o2_udp_seq_named(Proc_info *proc)
+{
+    if (!proc->key_hash) {
+        proc->key_hash = proc_key_hash(proc->key);
+    }
+    char key[UDP_SENDER_KEY_LEN];
+    O2node **ptr = udp_sender_find(proc->key_hash, key);
+    if (!*ptr) {  // if two names have the same hash, keep the first
+        o2_ctx->udp_senders.entry_insert_at(ptr, new Udp_sender(key, proc));
+    }
+}
+
+
+void o2_udp_seq_removed(Proc_info *proc)
+{
+    // when finishing, the whole table is freed anyway:
+    if (!proc->key_hash || o2_ctx->finishing) {
+        return;
+    }
+    char key[UDP_SENDER_KEY_LEN];
+    O2node **ptr = udp_sender_find(proc->key_hash, key);
+    if (*ptr && ((Udp_sender *) *ptr)->proc == proc) {
+        o2_ctx->udp_senders.entry_remove(ptr, true);
+    }
+}
+
+
+// copy msg (in network order) with a sequence number trailer
+O2message_ptr Proc_info::add_udp_seq(O2message_ptr msg)
+{
+    int32_t len = msg->data.length;
+    O2message_ptr copy = o2_message_new(len + 2 * sizeof(uint32_t));
+    if (copy) {
+        if (!o2_ctx->proc->key_hash) {
+            o2_ctx->proc->key_hash = proc_key_hash(o2_ctx->proc->key);
+        }
+        memcpy(O2_MSG_PAYLOAD(copy), O2_MSG_PAYLOAD(msg), len);
+        uint32_t trailer[2] = { htonl(o2_ctx->proc->key_hash),
+                                htonl((uint32_t) ++udp_seq_sent) };
+        memcpy(O2_MSG_PAYLOAD(copy) + len, trailer, sizeof trailer);
+        copy->next = NULL;
+        copy->data.misc |= O2_SEQ_FLAG_NET;
+    }
+    O2_FREE(msg);
+    return copy;
+}
+
+
+void o2_udp_seq_receive(O2message_ptr msg)
+{
+    uint32_t trailer[2];
+    msg->data.length -= sizeof trailer;
+    msg->data.misc &= ~O2_SEQ_FLAG_NET;
+    if (msg->data.length < (int32_t) sizeof msg->data.misc) {
+        msg->data.length += sizeof trailer;  // malformed, do not count
+        return;
+    }
+    memcpy(trailer, O2_MSG_PAYLOAD(msg) + msg->data.length, sizeof trailer);
+    uint32_t hash = ntohl(trailer[0]);
+    int32_t seq = (int32_t) ntohl(trailer[1]);
+    char key[UDP_SENDER_KEY_LEN];
+    Udp_sender *sender = (Udp_sender *) *udp_sender_find(hash, key);
+    if (!sender) {
+        return;  // not connected yet, so not counted
+    }
+    Proc_info *proc = sender->proc;
+    O2udp_peer_stats *stats = &proc->udp_stats;
+    if (stats->received == 0) {
+        proc->udp_seq_max = seq;
+        proc->udp_seq_missing = 0;
+    } else if (seq - proc->udp_seq_max > 0) {
+        int32_t gap = seq - proc->udp_seq_max - 1;
+        stats->lost += gap;
+        // the old bits move up by gap + 1 and the gap is missing:
+        proc->udp_seq_missing = (gap >= 63 ? 0 :
+                                 proc->udp_seq_missing << (gap + 1)) |
+                                (gap >= 64 ? ~(uint64_t) 0 :
+                                 ((uint64_t) 1 << gap) - 1);
+        proc->udp_seq_max = seq;
+    } else {  // late or duplicate datagram
+        int32_t behind = proc->udp_seq_max - seq - 1;
+        if (behind >= 64) {  // too late to know if it fills a gap
+            stats->reordered++;
+        } else if (behind >= 0 &&
+                   (proc->udp_seq_missing & ((uint64_t) 1 << behind))) {
+            proc->udp_seq_missing &= ~((uint64_t) 1 << behind);
+            stats->reordered++;  // fills a gap
+            stats->lost--;
+        }  // otherwise it is a duplicate
+    }
+    stats->received++;
+}
+
+
+static Proc_info *remote_proc(const char *process)
+{
+    Services_entry *services;
+    O2node *proc = Services_entry::service_find(process, &services);
+    return (proc && ISA_PROC(proc) && proc != o2_ctx->proc) ?
+           (Proc_info *) proc : NULL;
+}
+
+
+O2err o2_udp_peer_stats(const char *process, O2udp_peer_stats *stats,
+                        bool reset)
+{
+    if (!o2_ensemble_name) {
+        return O2_NOT_INITIALIZED;
+    }
+    Proc_info *proc = remote_proc(process);
+    if (!proc) {
+        return O2_FAIL;
+    }
+    if (stats) {
+        *stats = proc->udp_stats;
+    }
+    if (reset) {
+        memset(&proc->udp_stats, 0, sizeof proc->udp_stats);
+    }
+    return O2_SUCCESS;
+}
+
+
+// handler for /_o2/us "s": reply to the given address with the UDP
+// stats for each process that sent sequenced datagrams
+//
+static void udp_stats_handler(O2msg_data_ptr msg, const char *types,
+                              O2arg_ptr *argv, int argc,
+                              const void *user_data)
+{
+    const char *replyto = argv[0]->s;
+    for (int i = 0; i < o2n_fds_info.size(); i++) {
+        Proxy_info *owner = (Proxy_info *) o2n_fds_info[i]->owner;
+        if (owner && ISA_PROC(owner) && owner != o2_ctx->proc &&
+            owner->key && owner->fds_info == o2n_fds_info[i]) {
+            O2udp_peer_stats *stats = &((Proc_info *) owner)->udp_stats;
+            if (stats->received > 0) {
+                o2_send(replyto, 0, "sshhh", o2_ctx->proc->key, owner->key,
+                        stats->received, stats->lost, stats->reordered);
+            }
+        }
+    }
+}
+
+
+// handler for /_o2/ss "s": reply to the given address with the
+// statistics for each socket (see o2_socket_stats())
+//
+static void socket_stats_handler(O2msg_data_ptr msg, const char *types,
+                                 O2arg_ptr *argv, int argc,
+                                 const void *user_data)
+{
+    const char *replyto = argv[0]->s;
+    int n = o2n_fds_info.size();  // replies could add a socket
+    O2socket_stats stats;
+    for (int i = 0; i < n && o2_socket_stats(i, &stats, false) == O2_SUCCESS;
+         i++) {
+        o2_send(replyto, 0, "sisshhhhihhdd", o2_ctx->proc->key, i,
+                stats.kind, stats.peer ? stats.peer : "", stats.messages_in,
+                stats.bytes_in, stats.messages_out, stats.bytes_out,
+                stats.queued_messages, stats.queued_bytes, stats.blocked,
+                stats.blocked_time, stats.connect_time);
+    }
+}
+
+
+#ifndef O2_NO_BUNDLES
+/*
+UDP coalescing: after o2_udp_coalesce(max_size), UDP messages to a
+process are not sent immediately. They are appended to udp_bundle and
+sent by o2_poll() (or when the next one would make the bundle larger
+than max_size) as one datagram containing a bundle addressed to "#_o2".
+The receiver delivers the bundle to its _o2 service, which simply
+sends each embedded message (see o2_embedded_msgs_deliver()), so
+messages are delivered as if they were sent separately. A single
+message is sent as is. Messages are in network order when they are
+coalesced, so the bundle is built in network order.
+*/
+
+int o2_udp_coalesce_max = 0;
+
+// size of the bundle message data before the embedded messages:
+#define UDP_BUNDLE_HEAD (offsetof(O2msg_data, address) + 8)  // "#_o2"
+
+O2err Proc_info::coalesce_udp(O2message_ptr msg)
+{
+    int32_t size = (int32_t) sizeof(int32_t) + msg->data.length;
+    bool listed = (udp_bundle != NULL);  // this is in coalescing_procs
+    if (listed && (int) UDP_BUNDLE_HEAD + udp_bundle_len + size >
+                  o2_udp_coalesce_max) {
+        flush_udp();  // this stays in coalescing_procs
+    }
+    if ((int) UDP_BUNDLE_HEAD + size > o2_udp_coalesce_max) {
+        return send_udp(msg);  // too big to coalesce
+    }
+    msg->next = NULL;
+    if (udp_bundle) {
+        O2message_ptr last = udp_bundle;
+        while (last->next) last = last->next;
+        last->next = msg;
+    } else {
+        udp_bundle = msg;
+        if (!listed) {
+            coalescing_procs.push_back(this);
+        }
+    }
+    udp_bundle_len += size;
+    return O2_SUCCESS;
+}
+
+
+// send the coalesced messages. Does not remove this from
+// coalescing_procs (see o2_udp_coalesce_flush())
+void Proc_info::flush_udp()
+{
+    O2message_ptr msgs = udp_bundle;
+    int32_t len = udp_bundle_len;
+    udp_bundle = NULL;
+    udp_bundle_len = 0;
+    if (!msgs) {
+        return;
+    }
+    if (!msgs->next) {
+        send_udp(msgs);
+        return;
+    }
+    O2message_ptr bundle = o2_message_new(UDP_BUNDLE_HEAD -
+                                          sizeof(int32_t) + len);
+    if (!bundle) {
+        o2_message_list_free(&msgs);
+        return;
+    }
+    bundle->next = NULL;
+    int32_t misc = O2_UDP_FLAG;
+#if IS_LITTLE_ENDIAN
+    misc = swap32(misc);
+#endif
+    bundle->data.misc = misc;
+    bundle->data.timestamp = 0.0;  // the same in either byte order
+    memcpy(bundle->data.address, "#_o2\0\0\0\0", 8);
+    char *dst = PTR(&bundle->data) + UDP_BUNDLE_HEAD;
+    while (msgs) {
+        O2message_ptr next = msgs->next;
+        int32_t mlen = msgs->data.length;
+        int32_t netlen = mlen;
+#if IS_LITTLE_ENDIAN
+        netlen = swap32(netlen);
+#endif
+        memcpy(dst, &netlen, sizeof netlen);
+        memcpy(dst + sizeof netlen, &msgs->data.misc, mlen);
+        dst += sizeof netlen + mlen;
+        O2_FREE(msgs);
+        msgs = next;
+    }
+    send_udp(bundle);
+}
+
+
+void o2_udp_coalesce_flush()
+{
+    // flush_udp() can send but cannot coalesce, so the list is stable:
+    for (int i = 0; i < coalescing_procs.size(); i++) {
+        coalescing_procs[i]->flush_udp();
+    }
+    coalescing_procs.clear();
+}
+
+
+void o2_udp_coalesce_finish()
+{
+    coalescing_procs.finish();
+}
+#endif
+
+
 #ifndef O2_NO_DEBUG
 void o2_show_sockets()
 {
@@ -265,6 +907,60 @@ Proc_info *Proc_info::create_tcp_proc(int tag, const char *ip, int *port)
 }
 
 
+#ifndef O2_NO_UNIXSOCK
+Proc_info *Proc_info::create_unix_proc(int tag, int port)
+{
+    assert(tag == O2TAG_PROC || tag == O2TAG_PROC_TEMP);
+    if (!o2_unix_stream_server) {
+        return NULL;
+    }
+    char path[O2N_UNIX_PATH_LEN];
+    o2n_unix_path(path, port, true);
+    Proc_info *proc = new Proc_info();
+    proc->tag = tag;
+    proc->fds_info = Fds_info::create_unix_client(path, proc);
+    if (!proc->fds_info) {
+        proc->o2_delete();
+        return NULL;
+    }
+#ifndef O2_NO_DEBUG
+    proc->fds_info->set_description(o2_heapify(tag == O2TAG_PROC ?
+                                    "unix_remote_proc" : "unix_proc_temp"));
+#endif
+    return proc;
+}
+
+
+// send UDP messages for this process, which is on this host and has
+// TCP server port port, to its Unix-domain datagram socket
+void Proc_info::set_unix_udp(int port)
+{
+    if (!unix_udp_path) {
+        unix_udp_path = O2_MALLOCNT(O2N_UNIX_PATH_LEN, char);
+    }
+    o2n_unix_path(unix_udp_path, port, false);
+}
+
+
+void o2_unix_finish()
+{
+    // like o2_udp_server, these are owned by o2_ctx->proc, but only
+    // the TCP server socket deletes it:
+    char path[O2N_UNIX_PATH_LEN];
+    Fds_info **servers[2] = {&o2_unix_stream_server, &o2_unix_dgram_server};
+    for (int i = 0; i < 2; i++) {
+        Fds_info *server = *servers[i];
+        if (server) {
+            server->owner = NULL;
+            o2n_unix_path(path, server->port, i == 0);
+            unlink(path);  // the socket is closed with all others
+            *servers[i] = NULL;
+        }
+    }
+}
+#endif
+
+
 // - initialize network module
 // - create UDP broadcast socket
 // - create UDP send socket
@@ -296,6 +992,39 @@ void o2_processes_initialize()
     // incoming UDP messages:
     o2_udp_server->owner = o2_ctx->proc;
     o2_ctx->proc->udp_address.set_port(o2_udp_server->port);
+#ifndef O2_NO_UNIXSOCK
+    // processes on this host connect to Unix-domain sockets named by
+    // our TCP server port (see o2n_unix_path()). Use both or neither.
+    if (o2n_unix_enabled) {
+        char path[O2N_UNIX_PATH_LEN];
+        o2n_unix_path(path, port, true);
+        o2_unix_stream_server = Fds_info::create_unix_server(path, true,
+                                                     port, o2_ctx->proc);
+        o2n_unix_path(path, port, false);
+        o2_unix_dgram_server = Fds_info::create_unix_server(path, false,
+                                                     port, o2_ctx->proc);
+        if (!o2_unix_stream_server || !o2_unix_dgram_server) {
+            O2_DBo(hdprintf("Unix-domain sockets not available\n"));
+            Fds_info *stream = o2_unix_stream_server;
+            Fds_info *dgram = o2_unix_dgram_server;
+            o2_unix_finish();
+            if (stream) stream->close_socket(true);
+            if (dgram) dgram->close_socket(true);
+        }
+#ifndef O2_NO_DEBUG
+        else {
+            o2_unix_stream_server->set_description(
+                    o2_heapify("unix_stream_server"));
+            o2_unix_dgram_server->set_description(
+                    o2_heapify("unix_dgram_server"));
+        }
+#endif
+    }
+#endif
+    o2_method_new_internal("/_o2/us", "s", &udp_stats_handler,
+                           NULL, false, true);
+    o2_method_new_internal("/_o2/ss", "s", &socket_stats_handler,
+                           NULL, false, true);
 }
 
 
@@ -17,6 +17,10 @@ typedef enum hub_type {
 } hub_type;
 #endif
 
+class Shm_link;
+class Rudp_peer;
+struct Sv_cache;
+
 class Proc_info : public Proxy_info {
 public:
     // store process name in key, e.g. "@128.2.1.100:55765". This is used
@@ -29,23 +33,92 @@ public:
     // i_am_hub means this remote process treats local process as hub
     // no_hub means neither case is true
     hub_type uses_hub;
+    bool hub_partial;     // (at the hub) this process asked for a partial
+                          // mesh (see hubmesh.cpp)
 #endif
+    int32_t version;      // O2 version of the remote process, 0 if unknown
     Net_address udp_address;
+    int32_t max_msg_len;  // largest TCP message the remote process accepts
+                          // (see /_o2/mx in discovery.cpp)
+#ifndef O2_NO_UNIXSOCK
+    char *unix_udp_path;  // if the remote process is on this host, its
+                          // Unix-domain datagram socket, used instead of
+                          // udp_address (owned)
+#endif
+#ifndef O2_NO_SHMRING
+    Shm_link *shm_link;   // shared memory rings to a process on this host
+                          // (see shmring.cpp)
+#endif
+#ifndef O2_NO_RUDP
+    Rudp_peer *rudp;      // reliable UDP state (see rudp.cpp)
+#endif
+#ifndef O2_NO_SVDELTA
+    int32_t sv_epoch;     // epoch and version of the remote process's
+    int32_t sv_version;   // services we have (see svdelta.cpp), 0 if unknown
+    Sv_cache *sv_cache;   // services saved from an earlier connection,
+                          // waiting for /_o2/sr (owned)
+#endif
+#ifndef O2_NO_BUNDLES
+    O2message_ptr udp_bundle;  // UDP messages (in network order) to be
+                               // sent together as a bundle (owned)
+    int32_t udp_bundle_len;    // bytes they will occupy in the bundle
+#endif
+    // UDP sequence numbers (see o2_udp_sequence()):
+    uint32_t key_hash;      // hash of key identifying the sender (0 if
+                            // not computed yet)
+    int32_t udp_seq_sent;   // sequence number of last datagram sent
+    int32_t udp_seq_max;    // highest sequence number received
+    uint64_t udp_seq_missing;  // bit i: udp_seq_max - 1 - i not received
+    O2udp_peer_stats udp_stats;  // datagrams received from this process
 
     Proc_info() : Proxy_info(NULL, O2TAG_PROC) {
 #ifndef O2_NO_HUB
         uses_hub = O2_NOT_HUB;
+        hub_partial = false;
 #endif
+        version = 0;
         memset(&udp_address, 0, sizeof udp_address);
+        max_msg_len = O2N_DEFAULT_MAX_MSG_LEN;
+#ifndef O2_NO_UNIXSOCK
+        unix_udp_path = NULL;
+#endif
+#ifndef O2_NO_SHMRING
+        shm_link = NULL;
+#endif
+#ifndef O2_NO_RUDP
+        rudp = NULL;
+#endif
+#ifndef O2_NO_SVDELTA
+        sv_epoch = 0;
+        sv_version = 0;
+        sv_cache = NULL;
+#endif
+#ifndef O2_NO_BUNDLES
+        udp_bundle = NULL;
+        udp_bundle_len = 0;
+#endif
+        key_hash = 0;
+        udp_seq_sent = 0;
+        udp_seq_max = 0;
+        udp_seq_missing = 0;
+        memset(&udp_stats, 0, sizeof udp_stats);
     }
     virtual ~Proc_info();
 
     O2err send(bool block);
+    O2err send_udp(O2message_ptr msg);
+    O2message_ptr add_udp_seq(O2message_ptr msg);
+    bool queue_marked(O2message_ptr msg, bool tcp_flag);
+#ifndef O2_NO_BUNDLES
+    O2err coalesce_udp(O2message_ptr msg);
+    void flush_udp();
+#endif
 
     // Implement the Net_interface:
     O2err accepted(Fds_info *conn);
     O2err connected();
     // O2err deliver(); is inherited from Proxy_info
+    bool thread_io() { return true; }  // only sends with Fds_info methods
 
     bool local_is_synchronized() { o2_send_clocksync_proc(this);
                                    return IS_SYNCED(this); }
@@ -76,6 +149,12 @@ public:
 #endif
 
     static Proc_info *create_tcp_proc(int tag, const char *ip, int *port);
+#ifndef O2_NO_UNIXSOCK
+    // connect to the process on this host with TCP server port port
+    // using a Unix-domain socket. Returns NULL if that fails.
+    static Proc_info *create_unix_proc(int tag, int port);
+    void set_unix_udp(int port);
+#endif
 
 };
 
@@ -91,3 +170,43 @@ void o2_show_sockets(void);
 
 
 void o2_processes_initialize(void);
+
+// free the address marks (see o2_conflate(), o2_high_priority()),
+// called by o2_finish()
+void o2_address_marks_finish();
+
+// true if UDP datagrams carry sequence numbers (see o2_udp_sequence())
+extern bool o2_udp_sequence_enabled;
+
+// enter proc in o2_ctx->udp_senders when it gets its name, called by
+// o2_discovered_a_remote_process_name()
+void o2_udp_seq_named(Proc_info *proc);
+
+// remove proc from o2_ctx->udp_senders, called by ~Proc_info()
+void o2_udp_seq_removed(Proc_info *proc);
+
+// remove the sequence number trailer from a datagram (in network order
+// except data.length) and count it in the stats of the sending process,
+// called by Proxy_info::deliver()
+void o2_udp_seq_receive(O2message_ptr msg);
+
+#ifndef O2_NO_BUNDLES
+// largest UDP bundle built by Proc_info::coalesce_udp(), 0 if disabled
+extern int o2_udp_coalesce_max;
+
+// send the UDP bundles of all processes, called by o2_poll()
+void o2_udp_coalesce_flush();
+
+// free the list of processes with UDP bundles, called by o2_finish()
+void o2_udp_coalesce_finish();
+#endif
+
+#ifndef O2_NO_UNIXSOCK
+// Unix-domain servers for connections from processes on this host, or
+// NULL if o2n_unix_enabled is false or they could not be created:
+extern Fds_info *o2_unix_stream_server;
+extern Fds_info *o2_unix_dgram_server;
+
+// detach and remove the Unix-domain servers; called by o2_finish()
+void o2_unix_finish();
+#endif
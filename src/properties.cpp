@@ -255,6 +255,138 @@ static void encode_value_to(char *p, const char *v)
 }
 
 
+/*
+Property index
+--------------
+o2_service_search() scans a snapshot of all services made by
+o2_services_list(). To find services with a given property without a
+snapshot, o2_ctx->prop_index maps each "attr:value" (with the value
+escaped as in properties strings) to a Prop_entry that lists the
+Services_entrys whose active provider (services[0]) has that
+property. Each Services_entry keeps a copy of the properties it
+entered into the index in indexed_properties, so after any change to
+providers or properties, o2_prop_index_update() compares the copy
+with the current properties and updates the index only if they
+differ. Callers need not know what changed.
+
+To remove a Services_entry from a Prop_entry without searching, each
+reference also records that the attr:value is the nth property of the
+Services_entry, whose prop_slots[n] is the index of the reference.
+Removal moves the last reference into the freed slot and updates the
+prop_slots of the Services_entry it refers to.
+*/
+
+typedef struct Prop_ref {
+    Services_entry *ss;
+    int n;  // attr:value is the nth in ss->indexed_properties
+} Prop_ref;
+
+class Prop_entry : public O2node {
+public:
+    Vec<Prop_ref> services;  // in no particular order
+    Prop_entry(const char *key) : O2node(key, O2TAG_EMPTY) { }
+};
+
+
+// add ss to (or remove ss from) the entry for each attr:value in
+// properties (which begins with ';')
+static void prop_index_apply(Services_entry *ss, const char *properties,
+                             bool add)
+{
+    Hash_node *index = &o2_ctx->prop_index;
+    // key holds one "attr:value", padded for lookup():
+    Vec<char> key((int) strlen(properties) + 4);
+    const char *p = properties + 1;
+    for (int n = 0; *p; n++) {
+        const char *colon = strchr(p, ':');
+        if (!colon) break;  // malformed properties
+        int len = (int) (colon + 1 - p) + value_len(colon + 1);
+        key.clear();
+        key.append(p, len);
+        key.append("\0\0\0\0", 4 - (len & 3));  // pad to word boundary
+        O2node **ptr = index->lookup(key.get_array());
+        Prop_entry *pe = (Prop_entry *) *ptr;
+        if (add) {
+            if (!pe) {
+                pe = new Prop_entry(key.get_array());
+                index->entry_insert_at(ptr, pe);
+            }
+            ss->prop_slots.push_back(pe->services.size());
+            Prop_ref *ref = pe->services.append_space(1);
+            ref->ss = ss;
+            ref->n = n;
+        } else if (pe) {
+            int slot = ss->prop_slots[n];
+            assert(pe->services[slot].ss == ss && pe->services[slot].n == n);
+            pe->services.remove(slot);  // moves the last reference to slot
+            if (slot < pe->services.size()) {
+                Prop_ref *moved = &pe->services[slot];
+                moved->ss->prop_slots[moved->n] = slot;
+            } else if (pe->services.size() == 0) {
+                index->entry_remove(ptr, true);
+            }
+        }
+        p += len;
+        if (*p == ';') p++;
+    }
+}
+
+
+void o2_prop_index_remove(Services_entry *ss)
+{
+    if (ss->indexed_properties) {
+        // when finishing, the whole index is freed anyway:
+        if (!o2_ctx->finishing) {
+            prop_index_apply(ss, ss->indexed_properties, false);
+        }
+        O2_FREE(ss->indexed_properties);
+        ss->indexed_properties = NULL;
+        ss->prop_slots.clear();
+    }
+}
+
+
+void o2_prop_index_update(Services_entry *ss)
+{
+    const char *properties = (ss->services.size() > 0 ?
+                              ss->services[0].properties : NULL);
+    const char *indexed = ss->indexed_properties;
+    if (indexed == properties ||
+        (indexed && properties && streql(indexed, properties))) {
+        return;  // no change
+    }
+    o2_prop_index_remove(ss);
+    if (properties) {
+        prop_index_apply(ss, properties, true);
+        ss->indexed_properties = (char *) o2_heapify(properties);
+    }
+}
+
+
+const char *o2_service_with_property(const char *attr, const char *value,
+                                     int i)
+{
+    if (!o2_ensemble_name || !attr || !value || i < 0) {
+        return NULL;
+    }
+    // form the key "attr:value" with value escaped:
+    size_t attr_len = strlen(attr);
+    int len = (int) (attr_len + 1 + value_encoded_len(value));
+    Vec<char> key(len + 4);
+    key.append(attr, (int) attr_len);
+    char *v = key.append_space(len + 4 - (int) attr_len);
+    memset(v, 0, len + 4 - attr_len);
+    *v++ = ':';
+    encode_value_to(v, value);
+    Prop_entry *pe = (Prop_entry *) *o2_ctx->prop_index.lookup(
+                                            key.get_array());
+    if (pe && i < pe->services.size()) {
+        return pe->services[i].ss->key;
+    }
+    return NULL;
+}
+
+
 // returns true if properties string has changed
 //
 static bool service_property_free(Service_provider *spp, const char *attr)
@@ -283,6 +415,10 @@ O2err o2_set_service_properties(Service_provider *spp, const char *service,
     if (spp->properties) O2_FREE(spp->properties);
     spp->properties = properties;
     assert(!properties || properties[0] == ';');
+    Services_entry *ss = *Services_entry::find(service);
+    if (ss) {
+        o2_prop_index_update(ss);
+    }
     o2_notify_others(service, true, NULL, properties, 0);
     if (o2_ctx->proc->key) {  // no notice until we have a name
         o2_send_cmd("!_o2/si", 0.0, "siss", service, o2_status(service),
@@ -11,3 +11,10 @@ O2err o2_service_provider_set_property(Service_provider *spp,
 // set properties of this service to a new value
 O2err o2_set_service_properties(Service_provider *spp, const char *service,
                                char *properties);
+
+// make o2_ctx->prop_index agree with the properties of the active
+// provider of ss; call after providers or their properties change
+void o2_prop_index_update(Services_entry *ss);
+
+// remove ss from o2_ctx->prop_index, called by ~Services_entry()
+void o2_prop_index_remove(Services_entry *ss);
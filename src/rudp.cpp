@@ -0,0 +1,335 @@
+// rudp.cpp -- reliable delivery over UDP
+//
+// Messages sent with O2_RELIABLE_UDP (see o2_send_reliable()) to a
+// process reached by UDP are delivered reliably without the
+// head-of-line blocking of TCP. Each such message is wrapped in an
+// envelope, !_o2/ru "siib", with the sender's process name, a sequence
+// number, the sequence number of the previous message in the same
+// lane, and the message itself (in network order) as a blob. Envelopes
+// are sent over the normal UDP socket.
+//
+// Ordering: the address of each message selects one of RUDP_LANES
+// lanes (by hash). Messages in a lane are delivered in the order they
+// were sent: the receiver holds a message until the previous message
+// in its lane (known from the envelope) has been delivered. A lost
+// message only delays later messages in its own lane, so messages to
+// unrelated addresses are not delayed (unless their addresses hash to
+// the same lane).
+//
+// Acknowledgement: the receiver remembers which sequence numbers it
+// has received as rcv_base (all before it were received) and a bitmap
+// of the RUDP_WINDOW sequence numbers starting at rcv_base. Once per
+// o2_poll() after receiving envelopes, it sends !<sender>/ra "sih"
+// (i.e. /_o2/ra at the sender) with its name, rcv_base and the bitmap.
+// This acknowledges every received message, so it is a selective
+// acknowledgement. Duplicates are detected with the same information
+// and dropped.
+//
+// Retransmission: the sender keeps each envelope until it is
+// acknowledged and sends it again when it is not acknowledged within
+// rto, which starts at RUDP_RTO and doubles up to RUDP_MAX_RTO. At most
+// RUDP_WINDOW messages are in flight; later messages wait in pending
+// and are sent as acknowledgements arrive. Messages are retransmitted
+// until they are acknowledged or the process is removed.
+//
+// Reliable UDP is only used between processes connected by sockets.
+// Messages sent through shared memory rings are already reliable and
+// ordered, and messages to other destinations (OSC, bridges, MQTT) are
+// sent as with o2_send().
+
+#ifndef O2_NO_RUDP
+#include "o2internal.h"
+#include "services.h"
+#include "message.h"
+#include "msgsend.h"
+#include "pathtree.h"
+#include "rudp.h"
+
+#define RUDP_RTO 0.05      // initial retransmission timeout
+#define RUDP_MAX_RTO 1.0   // longest retransmission timeout
+
+static Vec<Rudp_peer *> rudp_peers;
+int o2_rudp_drop_every = 0;
+static int rudp_envelopes = 0;  // envelopes received (see o2_rudp_drop_every)
+
+
+Rudp_peer::Rudp_peer(Proc_info *proc_)
+{
+    proc = proc_;
+    next_seq = 1;
+    acked_base = 1;
+    rcv_base = 1;
+    rcv_bits = 0;
+    for (int i = 0; i < RUDP_LANES; i++) {
+        lane_sent[i] = 0;
+        lane_rcvd[i] = 0;
+    }
+    ack_needed = false;
+    retransmits = 0;
+    rudp_peers.push_back(this);
+}
+
+
+Rudp_peer::~Rudp_peer()
+{
+    for (int i = 0; i < pending.size(); i++) {
+        O2_FREE(pending[i].msg);
+    }
+    for (int i = 0; i < held.size(); i++) {
+        O2_FREE(held[i].msg);
+    }
+    if (proc && proc->rudp == this) {
+        proc->rudp = NULL;
+    }
+}
+
+
+// lane of a message is a hash of its address without the '/' or '!'
+static int rudp_lane(const char *address)
+{
+    uint32_t h = 2166136261u;  // FNV-1a hash
+    for (const char *p = address + 1; *p; p++) {
+        h = (h ^ (uint8_t) *p) * 16777619u;
+    }
+    return h % RUDP_LANES;
+}
+
+
+// send a copy of an envelope
+static void rudp_transmit(Proc_info *proc, Rudp_pending *p, O2time now)
+{
+    int32_t len = p->msg->data.length;
+    O2message_ptr copy = o2_message_new(len);
+    if (!copy) {  // not sent, so try again in the next poll
+        return;
+    }
+    memcpy(O2_MSG_PAYLOAD(copy), O2_MSG_PAYLOAD(p->msg), len);
+    copy->next = NULL;
+    proc->send_udp(copy);
+    p->sent_at = now;
+}
+
+
+O2err Rudp_peer::send(O2message_ptr msg)
+{
+    int lane = rudp_lane(msg->data.address);
+    // o2_send_start() fails only if a message is being built, e.g. if
+    // a handler sends while building another message. Then use TCP:
+    if (o2_send_start()) {
+        return proc->fds_info->send_tcp(false, (O2netmsg_ptr) msg);
+    }
+    o2_add_string(o2_ctx->proc->key);
+    o2_add_int32(next_seq);
+    o2_add_int32(lane_sent[lane]);
+    o2_add_blob_data(msg->data.length, O2_MSG_PAYLOAD(msg));
+    O2_FREE(msg);
+    O2message_ptr env = o2_message_finish(0.0, "/_o2/ru", false);
+    if (!env) {
+        return O2_FAIL;
+    }
+#if IS_LITTLE_ENDIAN
+    o2_msg_swap_endian(&env->data, true);
+#endif
+    lane_sent[lane] = next_seq;
+    Rudp_pending *p = pending.append_space(1);
+    p->seq = next_seq++;
+    p->sent_at = -1;
+    p->rto = RUDP_RTO;
+    p->msg = env;
+    if (p->seq - acked_base < RUDP_WINDOW) {
+        rudp_transmit(proc, p, o2_local_time());
+    }
+    return O2_SUCCESS;
+}
+
+
+void Rudp_peer::poll(O2time now)
+{
+    for (int i = 0; i < pending.size(); i++) {
+        Rudp_pending *p = &pending[i];
+        if (p->seq - acked_base >= RUDP_WINDOW) {
+            break;  // the rest wait for acknowledgements
+        }
+        if (p->sent_at < 0) {
+            rudp_transmit(proc, p, now);
+        } else if (now - p->sent_at >= p->rto) {
+            rudp_transmit(proc, p, now);
+            retransmits++;
+            p->rto *= 2;
+            if (p->rto > RUDP_MAX_RTO) {
+                p->rto = RUDP_MAX_RTO;
+            }
+        }
+    }
+    if (ack_needed) {
+        char address[O2_MAX_PROCNAME_LEN + 8];
+        snprintf(address, O2_MAX_PROCNAME_LEN + 8, "!%s/ra", proc->key);
+        o2_send(address, 0, "sih", o2_ctx->proc->key, rcv_base,
+                (int64_t) rcv_bits);
+        ack_needed = false;
+    }
+}
+
+
+void Rudp_peer::acknowledged(int32_t base, uint64_t bits)
+{
+    if (base - acked_base > 0) {
+        acked_base = base;
+    }
+    int j = 0;  // remove acknowledged messages, keeping the order
+    for (int i = 0; i < pending.size(); i++) {
+        int32_t offset = pending[i].seq - base;
+        if (offset < 0 || (offset < RUDP_WINDOW && ((bits >> offset) & 1))) {
+            O2_FREE(pending[i].msg);
+        } else {
+            pending[j++] = pending[i];
+        }
+    }
+    pending.erase(j, pending.size());
+}
+
+
+// deliver msg (which may be NULL if it was malformed), then any held
+// messages that were waiting for it
+void Rudp_peer::deliver(int lane, O2message_ptr msg, int32_t seq)
+{
+    while (true) {
+        lane_rcvd[lane] = seq;
+        if (msg) {
+            o2_message_send(msg);
+        }
+        int i;
+        for (i = 0; i < held.size(); i++) {
+            if (held[i].lane == lane && held[i].prev == seq) {
+                break;
+            }
+        }
+        if (i >= held.size()) {
+            return;
+        }
+        msg = held[i].msg;
+        seq = held[i].seq;
+        held.remove(i);
+    }
+}
+
+
+// takes ownership of msg, which is in network order
+void Rudp_peer::receive(int32_t seq, int32_t prev, O2message_ptr msg)
+{
+    ack_needed = true;
+    int32_t offset = seq - rcv_base;
+    if (offset < 0 || offset >= RUDP_WINDOW || ((rcv_bits >> offset) & 1)) {
+        O2_FREE(msg);  // duplicate, or beyond the window (will be resent)
+        return;
+    }
+    rcv_bits |= ((uint64_t) 1) << offset;
+    while (rcv_bits & 1) {
+        rcv_bits >>= 1;
+        rcv_base++;
+    }
+    int lane = rudp_lane(msg->data.address);
+#if IS_LITTLE_ENDIAN
+    if (o2_msg_swap_endian(&msg->data, false) != O2_SUCCESS) {
+        O2_FREE(msg);  // malformed, but keep the lane going
+        msg = NULL;
+    }
+#endif
+    if (prev == lane_rcvd[lane]) {
+        deliver(lane, msg, seq);
+    } else {
+        Rudp_held *h = held.append_space(1);
+        h->prev = prev;
+        h->seq = seq;
+        h->lane = lane;
+        h->msg = msg;
+    }
+}
+
+
+static Proc_info *rudp_proc(const char *key)
+{
+    Services_entry *services;
+    O2node *proc = Services_entry::service_find(key, &services);
+    return (proc && ISA_PROC(proc)) ? (Proc_info *) proc : NULL;
+}
+
+
+// Handler for !_o2/ru: an envelope from another process
+//
+static void rudp_envelope_handler(O2msg_data_ptr msgdata, const char *types,
+                                  O2arg_ptr *argv, int argc,
+                                  const void *user_data)
+{
+    Proc_info *proc = rudp_proc(argv[0]->s);
+    O2blob_ptr blob = &argv[3]->b;
+    if (!proc || blob->size < (int) (offsetof(O2msg_data, address) -
+                                     sizeof(int32_t) + 4)) {
+        return;  // unknown sender (not connected yet), it will resend
+    }
+    if (o2_rudp_drop_every && ++rudp_envelopes % o2_rudp_drop_every == 0) {
+        return;  // simulate a lost envelope (for testing)
+    }
+    if (!proc->rudp) {
+        proc->rudp = new Rudp_peer(proc);
+    }
+    O2message_ptr msg = o2_message_new(blob->size);
+    if (!msg) {  // drop it without acknowledgement, so it is resent
+        return;
+    }
+    memcpy(O2_MSG_PAYLOAD(msg), blob->data, blob->size);
+    msg->next = NULL;
+    proc->rudp->receive(argv[1]->i32, argv[2]->i32, msg);
+}
+
+
+// Handler for !_o2/ra: an acknowledgement from another process
+//
+static void rudp_ack_handler(O2msg_data_ptr msgdata, const char *types,
+                             O2arg_ptr *argv, int argc, const void *user_data)
+{
+    Proc_info *proc = rudp_proc(argv[0]->s);
+    if (proc && proc->rudp) {
+        proc->rudp->acknowledged(argv[1]->i32, (uint64_t) argv[2]->h);
+    }
+}
+
+
+void o2_rudp_initialize()
+{
+    o2_method_new_internal("/_o2/ru", "siib", &rudp_envelope_handler,
+                           NULL, false, true);
+    o2_method_new_internal("/_o2/ra", "sih", &rudp_ack_handler,
+                           NULL, false, true);
+}
+
+
+void o2_rudp_poll()
+{
+    if (rudp_peers.size() == 0) {
+        return;
+    }
+    O2time now = o2_local_time();
+    int i = 0;
+    while (i < rudp_peers.size()) {
+        Rudp_peer *peer = rudp_peers[i];
+        if (peer->proc) {
+            peer->poll(now);
+            i++;
+        } else {  // proc was deleted
+            rudp_peers.remove(i);
+            delete peer;
+        }
+    }
+}
+
+
+void o2_rudp_finish()
+{
+    for (int i = 0; i < rudp_peers.size(); i++) {
+        delete rudp_peers[i];
+    }
+    rudp_peers.finish();
+}
+
+#endif
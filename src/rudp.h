@@ -0,0 +1,81 @@
+// rudp.h -- reliable delivery over UDP
+//
+// See rudp.cpp for a description.
+
+#ifndef RUDP_H
+#define RUDP_H
+
+#ifndef O2_NO_RUDP
+
+// messages to one process are ordered within each of RUDP_LANES lanes
+// selected by a hash of the address:
+#define RUDP_LANES 32
+// most messages that can be sent and not acknowledged (must be <= 64,
+// the number of bits in an acknowledgement):
+#define RUDP_WINDOW 64
+
+// a message (envelope) sent and not yet acknowledged, or not yet sent
+// because the window is full
+typedef struct Rudp_pending {
+    int32_t seq;
+    O2time sent_at;  // local time of last transmission, -1 if not sent
+    O2time rto;      // time to wait for acknowledgement before resending
+    O2message_ptr msg;  // envelope in network order (owned)
+} Rudp_pending;
+
+// a received message held until the previous message in its lane is
+// delivered
+typedef struct Rudp_held {
+    int32_t prev;  // sequence number of previous message in lane
+    int32_t seq;
+    int lane;
+    O2message_ptr msg;  // in host order (owned)
+} Rudp_held;
+
+
+class Rudp_peer : public O2obj {
+public:
+    Proc_info *proc;
+
+    // sending to proc:
+    int32_t next_seq;  // sequence number of next message to send
+    int32_t lane_sent[RUDP_LANES];  // last sequence number sent in lane
+    int32_t acked_base;  // every message before this is acknowledged
+    Vec<Rudp_pending> pending;  // in sequence number order
+
+    // receiving from proc:
+    int32_t rcv_base;   // every message before this was received
+    uint64_t rcv_bits;  // bit i is set if rcv_base + i was received
+    int32_t lane_rcvd[RUDP_LANES];  // last sequence number delivered
+    Vec<Rudp_held> held;
+    bool ack_needed;
+
+    int64_t retransmits;  // count of messages sent again
+
+    Rudp_peer(Proc_info *proc);
+    ~Rudp_peer();
+
+    // take ownership of msg (in network order) and send it reliably
+    O2err send(O2message_ptr msg);
+    // send what is due (new messages in window, retransmissions, acks)
+    void poll(O2time now);
+    void acknowledged(int32_t base, uint64_t bits);
+    void receive(int32_t seq, int32_t prev, O2message_ptr msg);
+    void deliver(int lane, O2message_ptr msg, int32_t seq);
+};
+
+// for testing: if nonzero, every o2_rudp_drop_every-th envelope received
+// is dropped as if it were lost
+extern int o2_rudp_drop_every;
+
+// install the /_o2/ru and /_o2/ra handlers
+void o2_rudp_initialize();
+
+// retransmit and acknowledge, called by o2_poll()
+void o2_rudp_poll();
+
+// free all Rudp_peers, called by o2_finish()
+void o2_rudp_finish();
+
+#endif
+#endif
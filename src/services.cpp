@@ -9,6 +9,7 @@
 #include "message.h"
 #include "msgsend.h"
 #include "o2osc.h"
+#include "properties.h"
 #include "ctype.h"
 
 /*
@@ -39,9 +40,43 @@ Services entry is destroyed when:
     - o2_services_handler() (discovery message with service or tap deletion)
     - o2_service_free()
     - o2_remove_services_by() called when process ends
+
+Each Proxy_info other than o2_ctx->proc keeps services_by, a list
+of the Services_entrys where it offers a service or has a tap (one
+reference for each). service_provider_new() and insert_tap() add
+references and remove_service() and remove_tap() remove them, so when
+a remote process disconnects, remove_services_by() visits only its
+own services and taps rather than every service. Since an entry with
+a service or tap is never removed from the path_tree, the references
+are always valid.
 */
 
 
+// remember that proc offers a service or has a tap in ss
+static void services_ref(Proxy_info *proc, Services_entry *ss)
+{
+    if (proc && proc != o2_ctx->proc) {
+        proc->services_by.push_back(ss);
+    }
+}
+
+
+// forget one reference from proc to ss. The first reference is
+// removed, so if proc->services_by[i] is the reference to ss, the
+// next reference to examine is now at index i.
+static void services_unref(Proxy_info *proc, Services_entry *ss)
+{
+    if (proc && proc != o2_ctx->proc) {
+        for (int i = 0; i < proc->services_by.size(); i++) {
+            if (proc->services_by[i] == ss) {
+                proc->services_by.erase(i);  // keep the order
+                return;
+            }
+        }
+    }
+}
+
+
 // internal implementation of o2_service_new, assumes valid
 // service name with zero padding. The assumption is there will
 // be methods with paths on this service, so the service is
@@ -145,6 +180,7 @@ O2err Services_entry::service_provider_new(O2string service_name,
         // means that discovery is running, and that can only happen after we
         // have a full pip:iip:port name. If proc is MQTT, it has no
         // fds_net_info, but it ISA_MQTT
+        services_ref(proc, ss);
         active = ss->add_service(proc->key, service, (char *) properties) &&
                   ((proc->fds_info && (proc->fds_info->net_tag &
                      (NET_TCP_SERVER | NET_TCP_CLIENT | NET_TCP_CONNECTION))) ||
@@ -169,6 +205,7 @@ O2err Services_entry::service_provider_new(O2string service_name,
             o2_start_cs_pings();
         }
     }
+    o2_prop_index_update(ss);
     return O2_SUCCESS;
 }
 
@@ -255,6 +292,7 @@ O2err Services_entry::insert_tap(O2string tapper, Proxy_info *proc,
     tap->tapper = tapper;  // name of the tapper
     tap->proc = proc;  // owner (process) providing the tapper service
     tap->send_mode = send_mode;
+    services_ref(proc, this);
     // if we are the tapper, notify everyone we are asserting a tap:
     if (proc == o2_ctx->proc) {
         O2_DBp(hdprintf("insert_tap from %s to %s: we are the tapper "
@@ -421,6 +459,7 @@ O2err Services_entry::remove_service(const char *srv_name,
     // starts. (See O2_node::o2_delete()).
     O2node *service = spp->service;
     services.remove(index);
+    services_unref(proc, this);
 
     // service_name might actually be ss->key, in which case is could
     // be freed, so keep a copy so we can send notification below
@@ -467,6 +506,7 @@ O2err Services_entry::remove_service(const char *srv_name,
         }
     }
 
+    o2_prop_index_update(this);  // services[0] may have changed
     // if no more services or taps, remove the whole services_entry:
     remove_if_empty();
 
@@ -480,8 +520,23 @@ O2err Services_entry::remove_service(const char *srv_name,
         o2_notify_others(name, false, NULL, NULL, 0);
     }
     o2_do_not_reenter--;
-    // what if this service was a tapper? We have no direct access to
-    // services being tapped, so we have to search all taps for a match.
+    // what if this service was a tapper? A remote proc lists the
+    // services it taps in services_by. Removing a tap removes the first
+    // reference to that Services_entry, so the next reference to
+    // examine is at the same index:
+    if (proc != o2_ctx->proc) {
+        int j = 0;
+        while (j < proc->services_by.size()) {
+            Services_entry *services = proc->services_by[j];
+            if (services->taps.size() == 0 ||
+                services->remove_tap(proc, name) == O2_FAIL) {
+                j++;
+            }
+        }
+        return O2_SUCCESS;
+    }
+    // For the local process, we have no direct access to services being
+    // tapped, so we have to search all taps for a match.
     // since this might cause us to rehash services, first make a list
     Vec<Services_entry *> services_list;
     
@@ -494,7 +549,7 @@ O2err Services_entry::remove_service(const char *srv_name,
         // Free tap using remove_tap. To speed up search, we test for
         // zero taps before calling the search function:
         if (services->taps.size() > 0) {
-            services->remove_tap(proc, srv_name);
+            services->remove_tap(proc, name);
         }
     }
     return O2_SUCCESS;
@@ -557,12 +612,14 @@ O2err Services_entry::remove_tap(Proxy_info *proc, const char *tapper)
         if (tap->proc == proc && (!tapper || streql(tap->tapper, tapper))) {
             O2_FREE((char *) tap->tapper);
             taps.remove(i);
+            services_unref(proc, this);
             // if we are the tapper, inform everyone to remove our tap:
             if (proc == o2_ctx->proc) {
                 o2_notify_others(tapper, false, key, NULL, 0);
             }
             result = O2_SUCCESS;
             if (tapper) break; // only removing one tap, so we're done now
+            i--;  // the last tap moved to index i, so examine it next
         }
     }
     // if we removed something, see if services has become empty and needs to
@@ -616,33 +673,49 @@ void Services_entry::list_services(Vec<Services_entry *> &list)
 }
 
 
-// for each services_entry:
+static int services_by_compare(const void *a, const void *b)
+{
+    uintptr_t pa = (uintptr_t) *(Services_entry * const *) a;
+    uintptr_t pb = (uintptr_t) *(Services_entry * const *) b;
+    return (pa < pb) ? -1 : (pa > pb);
+}
+
+
+// for each services_entry in proc->services_by:
 //     find the service offered by this process and remove it
+//     remove the taps by this process
 //     if a service is the last service in services, remove the 
 //         services_entry as well
 //
 O2err Services_entry::remove_services_by(Proxy_info *proc)
 {
-    // This is pretty messy. We cannot remove a service without
-    // possibly rehashing the services hash table, so we have to
-    // first make a list of services. Then iterate over that list
-    // to remove services.
-    Vec<Services_entry *> services_list;
     assert(proc != o2_ctx->proc); // assumes remote proc
-    list_services(services_list);
     O2err result = O2_SUCCESS;
-    for (int i = 0; i < services_list.size(); i++) {
-        Services_entry *services = services_list[i];
+    // Take all of proc->services_by at once, so that removing each
+    // service and tap does not search it for the reference to drop
+    // (services_unref() finds an empty list). Sort the references to
+    // visit each Services_entry once: its service and taps by proc are
+    // all removed, so if the entry is freed, it is not visited again.
+    Vec<Services_entry *> entries(proc->services_by.size());
+    entries.append(proc->services_by.get_array(), proc->services_by.size());
+    proc->services_by.clear();
+    qsort(entries.get_array(), entries.size(), sizeof(Services_entry *),
+          &services_by_compare);
+    for (int i = 0; i < entries.size(); i++) {
+        if (i > 0 && entries[i] == entries[i - 1]) {
+            continue;
+        }
+        Services_entry *services = entries[i];
         // if there are no taps, services could be deleted before we
         // even try to remove taps by proc, but it won't be deleted
         // if there are any taps to begin with.
         bool has_taps = services->taps.size() > 0;
         int j = services->proc_service_index(proc);
-        if (!services->remove_service(services->key, j, proc)) {
+        if (j >= 0 && services->remove_service(services->key, j, proc)) {
             result = O2_FAIL; // this should never happen
         }
-        if (has_taps && services->remove_tap(proc, NULL) == O2_FAIL) {
-            result = O2_FAIL;
+        if (has_taps) {
+            services->remove_tap(proc, NULL);
         }
     }
     return result;
@@ -651,6 +724,7 @@ O2err Services_entry::remove_services_by(Proxy_info *proc)
 
 Services_entry::~Services_entry()
 {
+    o2_prop_index_remove(this);
     for (int i = 0; i < services.size(); i++) {
         Service_provider *spp = &services[i];
         O2node *prvdr = spp->service;
@@ -38,8 +38,14 @@ class O2_CLASS_EXPORT Services_entry : public O2node {
     Vec<Service_tap> taps; // the "taps" on this service -- these are of type
             // service_tap and indicate services that should get copies
             // of messages sent to the service named by key.
+    char *indexed_properties;  // copy of the properties of services[0]
+            // as entered in o2_ctx->prop_index, or NULL (see properties.cpp)
+    Vec<int> prop_slots;  // for the nth attr:value of indexed_properties,
+            // the index of this entry in that Prop_entry's services
     Services_entry(const char *service_name) :
-            O2node(service_name, O2TAG_SERVICES), services(1), taps(0) { }
+            O2node(service_name, O2TAG_SERVICES), services(1), taps(0),
+            prop_slots(0) {
+        indexed_properties = NULL; }
     virtual ~Services_entry();
 #ifndef O2_NO_DEBUG
     void show(int indent);
@@ -510,6 +510,10 @@ int o2sm_dispatch(O2message_ptr msg)
     // printf("o2sm_dispatch %s\n", msg->data.address);
     assert(msg->data.address[0] == '/' || msg->data.address[0] == '!');
     O2_DBB(o2_dbg_msg("o2sm_dispatch", msg, &msg->data, NULL, NULL));
+    if (O2_MSG_EXPIRED(&msg->data)) {
+        O2_FREE(msg);  // not counted: o2_expired_drop() is not thread-safe
+        return O2_SUCCESS;
+    }
 #ifdef O2SM_PATTERNS
     O2node *service = o2_msg_service(&msg->data, &services);
     if (service) {
@@ -11,13 +11,22 @@ O2message_ptr get_messages_reversed(O2queue *head);
 
 class O2sm_protocol : public Bridge_protocol {
 public:
-    O2sm_protocol() : Bridge_protocol("O2sm") { }
+    // messages from o2sm_incoming left for the next poll by the poll
+    // budget (see o2_poll_budget()), in order:
+    O2message_ptr held;
+
+    O2sm_protocol() : Bridge_protocol("O2sm") { held = NULL; }
     virtual ~O2sm_protocol() {
         O2_DBb(dbprintf("deleting O2sm_protocol@%p\n", this));
         o2_method_free("/_o2/o2sm");  // remove all o2sm support handlers
 
         // free all messages arriving from shared memory instances:
         o2sm_incoming.free();
+        while (held) {
+            O2message_ptr next = held->next;
+            O2_FREE(held);
+            held = next;
+        }
         o2sm_protocol = NULL;
 
     /* THIS IS SLIGHTLY DIFFERENT FROM Bridge_protocol::remove_services(),
@@ -59,7 +68,20 @@ public:
     virtual O2err bridge_poll() {
         O2err rslt = O2_SUCCESS;
         O2message_ptr msgs = get_messages_reversed(&o2sm_incoming);
+        if (held) {  // held messages go first
+            O2message_ptr last = held;
+            while (last->next) last = last->next;
+            last->next = msgs;
+            msgs = held;
+            held = NULL;
+        }
+        int sent = 0;
         while (msgs) {
+            if (sent++ > 0 && O2_POLL_BUDGET_EXHAUSTED()) {
+                held = msgs;  // send the rest in the next poll
+                break;
+            }
+            o2_poll_msgs++;
             O2message_ptr next = msgs->next;
             msgs->next = NULL; // remove pointer before it becomes dangling
             // printf("O2sm_protocol::bridge_poll sending %s\n",
@@ -0,0 +1,478 @@
+// shmring.cpp -- shared memory rings between processes on one host
+//
+// Processes on the same host are connected with Unix-domain sockets
+// (see processes.cpp). Over that connection, they also set up a shared
+// memory segment with two single-producer, single-consumer byte rings,
+// one per direction. Then all messages to the remote process, TCP and
+// UDP, are copied into a ring, and messages from the remote process are
+// read from the other ring in o2_poll(), so there are no system calls
+// per message. The socket stays open: it carries the setup messages,
+// and when it closes, the remote process is removed as usual.
+//
+// A ring carries the same byte stream as a TCP connection: a 4-byte
+// length (in host order, since both processes are on one host) followed
+// by the message in network order, so messages of any size can be sent
+// in pieces, and Proc_info::deliver() receives them as from a socket.
+// The ring head and tail are free-running 32-bit byte counts; head is
+// only written by the sender and tail only by the receiver.
+//
+// Since o2_poll() never blocks in poll(), rings are simply checked on
+// every call (like o2sm_incoming in sharedmem.cpp), and no wake-up
+// (e.g. eventfd) is needed.
+//
+// Setup (A is the process that connected, B accepted the connection):
+// 1. A creates and maps the segment with shm_open() and sends
+//    !_o2/sh (name, 0) over the socket.
+// 2. B maps the segment, removes the name, and replies !_o2/sh (name, 1)
+//    over the socket. Then B sends with the ring. (If B cannot map the
+//    segment, it replies with -1 and A gives up.)
+// 3. When A receives the reply, all of B's messages sent by socket
+//    have been received, so A can receive from the ring. A sends
+//    !_o2/sh (name, 2) over the socket, then sends with the ring.
+// 4. When B receives (name, 2), it can receive from the ring.
+// Thus, messages are received in the order they were sent.
+//
+// When a Proc_info is deleted, complete messages still in its ring are
+// delivered later (through o2_pending_anywhere) as if they had been
+// received before the socket closed. A Shm_link is deleted by
+// o2_shmring_poll() after its Proc_info is deleted.
+
+#ifndef O2_NO_SHMRING
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "o2internal.h"
+#include "services.h"
+#include "message.h"
+#include "msgsend.h"
+#include "pathtree.h"
+#include "shmring.h"
+
+bool o2_shmring_enabled = true;
+
+static Vec<Shm_link *> shm_links;
+
+#define SHM_NAME_LEN 32
+#define SHM_SEG_SIZE (2 * (sizeof(Shm_ring_hdr) + O2_SHM_RING_SIZE))
+
+
+Shm_link::Shm_link(Proc_info *proc_)
+{
+    proc = proc_;
+    name = NULL;
+    segment = NULL;
+    seg_size = 0;
+    tx = rx = NULL;
+    tx_data = rx_data = NULL;
+    tx_ready = false;
+    rx_ready = false;
+    out_message = NULL;
+    out_msg_sent = 0;
+    in_message = NULL;
+    in_length = 0;
+    in_length_got = 0;
+    in_msg_got = 0;
+}
+
+
+Shm_link::~Shm_link()
+{
+    O2_DBc(hdprintf("deleting Shm_link %p\n", this));
+    if (proc && proc->shm_link == this) {
+        proc->shm_link = NULL;
+    }
+    while (out_message) {
+        O2netmsg_ptr next = out_message->next;
+        O2_FREE(out_message);
+        out_message = next;
+    }
+    if (in_message) {
+        O2_FREE(in_message);
+    }
+    if (segment) {
+        munmap(segment, seg_size);
+    }
+    unlink_name();
+}
+
+
+// map the segment open as fd; the creator's tx ring is first
+static void *map_segment(int fd, Shm_link *link, bool creator)
+{
+    void *seg = mmap(NULL, SHM_SEG_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_SHARED, fd, 0);
+    close(fd);
+    if (seg == MAP_FAILED) {
+        return NULL;
+    }
+    link->segment = seg;
+    link->seg_size = SHM_SEG_SIZE;
+    Shm_ring_hdr *hdrs = (Shm_ring_hdr *) seg;
+    char *data = (char *) (hdrs + 2);
+    link->tx = hdrs + (creator ? 0 : 1);
+    link->tx_data = data + (creator ? 0 : O2_SHM_RING_SIZE);
+    link->rx = hdrs + (creator ? 1 : 0);
+    link->rx_data = data + (creator ? O2_SHM_RING_SIZE : 0);
+    return seg;
+}
+
+
+static void send_sh(Proc_info *proc, const char *name, int phase)
+{
+    if (o2_send_start()) return;
+    o2_add_string(name);
+    o2_add_int32(phase);
+    O2message_ptr msg = o2_message_finish(0.0, "!_o2/sh", true);
+    if (!msg) return;
+    o2_prepare_to_deliver(msg);
+    proc->send(false);
+}
+
+
+O2err Shm_link::offer(Proc_info *proc)
+{
+    if (!o2_shmring_enabled || proc->shm_link) {
+        return O2_SUCCESS;
+    }
+    static int seq = 0;
+    char name[SHM_NAME_LEN];
+    snprintf(name, SHM_NAME_LEN, "/o2-%s-%d-%d", o2n_host_id,
+             (int) getpid(), seq++);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        O2_DBc(hdprintf("Shm_link::offer shm_open %s: %s\n", name,
+                        strerror(errno)));
+        return O2_FAIL;
+    }
+    // ftruncate fills with zeros, so rings start empty
+    if (ftruncate(fd, SHM_SEG_SIZE) < 0) {
+        close(fd);
+        shm_unlink(name);
+        return O2_FAIL;
+    }
+    Shm_link *link = new Shm_link(proc);
+    if (!map_segment(fd, link, true)) {
+        shm_unlink(name);
+        delete link;
+        return O2_FAIL;
+    }
+    link->name = (char *) o2_heapify(name);
+    proc->shm_link = link;
+    shm_links.push_back(link);
+    O2_DBc(hdprintf("Shm_link %p offers %s to %s\n", link, name, proc->key));
+    send_sh(proc, name, 0);
+    return O2_SUCCESS;
+}
+
+
+Shm_link *Shm_link::attach(Proc_info *proc, const char *name)
+{
+    int fd = shm_open(name, O_RDWR, 0600);
+    if (fd < 0) {
+        O2_DBc(hdprintf("Shm_link::attach shm_open %s: %s\n", name,
+                        strerror(errno)));
+        return NULL;
+    }
+    shm_unlink(name);  // only the two of us use it
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size != (off_t) SHM_SEG_SIZE) {
+        close(fd);
+        return NULL;
+    }
+    Shm_link *link = new Shm_link(proc);
+    if (!map_segment(fd, link, false)) {
+        delete link;
+        return NULL;
+    }
+    proc->shm_link = link;
+    shm_links.push_back(link);
+    O2_DBc(hdprintf("Shm_link %p attached %s from %s\n", link, name,
+                    proc->key));
+    return link;
+}
+
+
+// copy up to len bytes into ring; returns the number copied
+static uint32_t ring_write(Shm_ring_hdr *ring, char *data,
+                           const char *src, uint32_t len)
+{
+    uint32_t head = ring->head.load(std::memory_order_relaxed);
+    uint32_t tail = ring->tail.load(std::memory_order_acquire);
+    uint32_t space = O2_SHM_RING_SIZE - (head - tail);
+    if (len > space) len = space;
+    uint32_t index = head & (O2_SHM_RING_SIZE - 1);
+    uint32_t first = O2_SHM_RING_SIZE - index;
+    if (first > len) first = len;
+    memcpy(data + index, src, first);
+    memcpy(data, src + first, len - first);
+    ring->head.store(head + len, std::memory_order_release);
+    return len;
+}
+
+
+// copy up to len bytes from ring; returns the number copied
+static uint32_t ring_read(Shm_ring_hdr *ring, const char *data,
+                          char *dst, uint32_t len)
+{
+    uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+    uint32_t head = ring->head.load(std::memory_order_acquire);
+    uint32_t avail = head - tail;
+    if (len > avail) len = avail;
+    uint32_t index = tail & (O2_SHM_RING_SIZE - 1);
+    uint32_t first = O2_SHM_RING_SIZE - index;
+    if (first > len) first = len;
+    memcpy(dst, data + index, first);
+    memcpy(dst + first, data, len - first);
+    ring->tail.store(tail + len, std::memory_order_release);
+    return len;
+}
+
+
+// This function takes ownership of msg. As in Fds_info::send_tcp(), if
+// block is true, first wait until earlier messages are written to the
+// ring, so the queue cannot grow without limit. Then msg is written or,
+// if the ring is full, queued, in which case a non-blocking send
+// returns O2_BLOCKED.
+O2err Shm_link::send(O2netmsg_ptr msg, bool block)
+{
+    if (out_message && block) {
+        O2err rslt = flush_blocking();
+        if (rslt != O2_SUCCESS) {  // process is dead and removed
+            O2_FREE(msg);  // we drop the message
+            return rslt;
+        }
+    }
+    msg->next = NULL;
+    O2netmsg_ptr *pending = &out_message;
+    while (*pending) pending = &(*pending)->next;
+    *pending = msg;
+    flush();
+    return (out_message && !block) ? O2_BLOCKED : O2_SUCCESS;
+}
+
+
+// the ring is full until the remote process reads from it in o2_poll(),
+// so wait for room, checking every millisecond whether the remote process
+// closed the socket (e.g. it exited), in which case it is removed as
+// after a socket error in Fds_info::send().
+O2err Shm_link::flush_blocking()
+{
+    flush();
+    while (out_message) {
+        if (!proc || !proc->fds_info) {
+            return O2_FAIL;
+        }
+        struct pollfd pfd;
+        pfd.fd = proc->fds_info->get_socket();
+        pfd.events = 0;  // POLLHUP and POLLERR are always reported
+        pfd.revents = 0;
+        if (poll(&pfd, 1, 1) > 0 && (pfd.revents & (POLLHUP | POLLERR))) {
+            O2_DBo(hdprintf("Shm_link::flush_blocking: %s closed\n",
+                            proc->key));
+            proc->fds_info->close_socket(true);
+            return O2_FAIL;
+        }
+        flush();
+    }
+    return O2_SUCCESS;
+}
+
+
+// write as much of the queued output as fits
+void Shm_link::flush()
+{
+    while (out_message) {
+        if (out_msg_sent == 0 && O2_NETMSG_EXPIRED(out_message)) {
+            O2netmsg_ptr next = out_message->next;
+            o2_expired_drop((O2message_ptr) out_message);
+            out_message = next;
+            continue;
+        }
+        uint32_t total = sizeof out_message->length + out_message->length;
+        const char *src = ((const char *) &out_message->length) + out_msg_sent;
+        out_msg_sent += ring_write(tx, tx_data, src, total - out_msg_sent);
+        if (out_msg_sent < total) {
+            return;  // ring is full
+        }
+        O2netmsg_ptr next = out_message->next;
+        O2_FREE(out_message);
+        out_message = next;
+        out_msg_sent = 0;
+    }
+}
+
+
+// messages received by this o2_shmring_poll() (see
+// O2_POLL_BUDGET_EXHAUSTED)
+static int shm_received = 0;
+
+bool Shm_link::receive(bool pend)
+{
+    while (rx_ready) {
+        if (in_length_got < sizeof in_length) {
+            if (!pend && in_length_got == 0 && shm_received > 0 &&
+                O2_POLL_BUDGET_EXHAUSTED()) {
+                return false;  // leave the rest in the ring
+            }
+            in_length_got += ring_read(rx, rx_data,
+                                       ((char *) &in_length) + in_length_got,
+                                       sizeof in_length - in_length_got);
+            if (in_length_got < sizeof in_length) {
+                return true;
+            }
+            if (in_length <= 0 || in_length > o2n_max_msg_len) {
+                hdprintf("Shm_link::receive bad message length %d from %s\n",
+                         in_length, proc->key);
+                rx_ready = false;
+                proc->fds_info->close_socket(true);
+                return true;
+            }
+            in_message = O2N_MESSAGE_ALLOC(in_length);
+            in_message->length = in_length;
+            in_msg_got = 0;
+        }
+        in_msg_got += ring_read(rx, rx_data, in_message->payload + in_msg_got,
+                                in_length - in_msg_got);
+        if (in_msg_got < (uint32_t) in_length) {
+            return true;
+        }
+        O2netmsg_ptr msg = in_message;
+        in_message = NULL;
+        in_length_got = 0;
+        if (pend) {
+            O2message_ptr m = (O2message_ptr) msg;
+#if IS_LITTLE_ENDIAN
+            o2_msg_swap_endian(&m->data, false);
+#endif
+            o2_pending_anywhere.enqueue(m);
+        } else {
+            shm_received++;
+            o2_poll_msgs++;
+            proc->deliver(msg);
+            // the handler may have called o2_finish() or removed proc:
+            if (!o2_ensemble_name || !proc) {
+                return true;
+            }
+        }
+    }
+    return true;
+}
+
+
+void Shm_link::detach()
+{
+    receive(true);
+    proc = NULL;
+    unlink_name();
+}
+
+
+void Shm_link::unlink_name()
+{
+    if (name) {
+        shm_unlink(name);
+        O2_FREE(name);
+        name = NULL;
+    }
+}
+
+
+// Handler for !_o2/sh messages, parameters are segment name and the
+// setup phase (see the description at the top of this file).
+//
+static void o2_shm_handler(O2msg_data_ptr msgdata, const char *types,
+                           O2arg_ptr *argv, int argc, const void *user_data)
+{
+    O2_DBc(o2_dbg_msg("o2_shm_handler gets", NULL, msgdata, NULL, NULL));
+    const char *name = argv[0]->s;
+    int phase = argv[1]->i32;
+    if (!o2_message_source || !ISA_PROC(o2_message_source)) {
+        return;
+    }
+    Proc_info *proc = TO_PROC_INFO(o2_message_source);
+    Shm_link *link = proc->shm_link;
+    if (phase == 0) {
+        if (link || !proc->fds_info || !proc->fds_info->unix_domain) {
+            return;
+        }
+        link = o2_shmring_enabled ? Shm_link::attach(proc, name) : NULL;
+        send_sh(proc, name, link ? 1 : -1);  // sent by socket
+        if (link) {
+            link->tx_ready = true;
+        }
+    } else if (!link) {
+        return;
+    } else if (phase == 1) {
+        link->unlink_name();
+        link->rx_ready = true;
+        send_sh(proc, name, 2);  // sent by socket
+        link->tx_ready = true;
+        link->flush();
+    } else if (phase == 2) {
+        link->rx_ready = true;
+    } else {  // remote process could not map the segment
+        O2_DBc(hdprintf("Shm_link %p refused by %s\n", link, proc->key));
+        proc->shm_link = NULL;
+        link->proc = NULL;  // deleted by o2_shmring_poll()
+    }
+}
+
+
+void o2_shmring_initialize()
+{
+    o2_method_new_internal("/_o2/sh", "si", &o2_shm_handler,
+                           NULL, false, true);
+}
+
+
+// index of the first link for o2_shmring_poll() to receive from (see
+// o2_poll_budget())
+static int shm_next = 0;
+
+void o2_shmring_poll()
+{
+    // visit links round-robin, starting where the poll budget (if any)
+    // stopped the previous call:
+    int n = shm_links.size();
+    int start = (shm_next < n ? shm_next : 0);
+    bool receiving = true;
+    shm_received = 0;
+    for (int k = 0; k < n; k++) {
+        int i = (start + k) % n;
+        Shm_link *link = shm_links[i];
+        if (link->proc) {
+            link->flush();
+        }
+        if (link->proc && receiving && !link->receive(false)) {
+            shm_next = i;  // start here in the next poll
+            receiving = false;
+        }
+        if (!o2_ensemble_name) {  // a handler called o2_finish()
+            return;
+        }
+    }
+    int i = 0;
+    while (i < shm_links.size()) {
+        Shm_link *link = shm_links[i];
+        if (link->proc) {
+            i++;
+        } else {
+            shm_links.remove(i);
+            delete link;
+        }
+    }
+}
+
+
+void o2_shmring_finish()
+{
+    for (int i = 0; i < shm_links.size(); i++) {
+        delete shm_links[i];
+    }
+    shm_links.finish();
+}
+
+#endif
@@ -0,0 +1,82 @@
+// shmring.h -- shared memory rings between processes on one host
+//
+// See shmring.cpp for a description.
+
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#ifndef O2_NO_SHMRING
+#include <atomic>
+
+// bytes in each ring (one per direction), must be a power of 2:
+#define O2_SHM_RING_SIZE (1 << 20)
+
+extern bool o2_shmring_enabled;
+
+// the write and read positions of one ring. Each is written by only
+// one process, and they are in separate cache lines.
+typedef struct Shm_ring_hdr {
+    std::atomic<uint32_t> head;  // bytes written (mod 2^32), by writer
+    char pad1[60];
+    std::atomic<uint32_t> tail;  // bytes read (mod 2^32), by reader
+    char pad2[60];
+} Shm_ring_hdr;
+
+
+class Shm_link : public O2obj {
+public:
+    Proc_info *proc;  // the remote process, NULL after it is deleted
+    char *name;       // segment name until it is unlinked (owned)
+    void *segment;    // the mapped segment
+    size_t seg_size;
+    Shm_ring_hdr *tx;  // ring to the remote process
+    char *tx_data;
+    Shm_ring_hdr *rx;  // ring from the remote process
+    char *rx_data;
+    bool tx_ready;     // send to proc with tx ring (not the socket)
+    bool rx_ready;     // receive from proc with rx ring
+
+    // messages waiting for space in tx, linked by next:
+    O2netmsg_ptr out_message;
+    uint32_t out_msg_sent;  // bytes of out_message (with length) written
+
+    // partially received message as in Fds_info:
+    O2netmsg_ptr in_message;
+    int32_t in_length;
+    uint32_t in_length_got;
+    uint32_t in_msg_got;
+
+    Shm_link(Proc_info *proc);
+    ~Shm_link();
+
+    // create a segment and offer it to proc
+    static O2err offer(Proc_info *proc);
+    // map the segment offered by proc
+    static Shm_link *attach(Proc_info *proc, const char *name);
+
+    O2err send(O2netmsg_ptr msg, bool block);
+    void flush();
+    // flush until the queued output is written or the connection closes
+    O2err flush_blocking();
+    O2err can_send() { return out_message ? O2_BLOCKED : O2_SUCCESS; }
+    // deliver messages from rx. If pend, append them to the
+    // pending queue instead of delivering them now. Returns false if
+    // it stopped because the poll budget is used up.
+    bool receive(bool pend);
+    // called when proc is deleted
+    void detach();
+    void unlink_name();
+};
+
+
+// initialize Shm_link support: install the /_o2/sh handler
+void o2_shmring_initialize();
+
+// send and receive with Shm_links, called by o2_poll()
+void o2_shmring_poll();
+
+// free all Shm_links, called by o2_finish()
+void o2_shmring_finish();
+
+#endif
+#endif
@@ -0,0 +1,351 @@
+// svdelta.cpp -- incremental service list updates
+//
+// Originally, each newly connected process was sent a complete list of
+// our services and taps in one !_o2/sv message (see o2_send_services()),
+// and each later change was sent as a one-change !_o2/sv message. With
+// many processes and services, every join (or reconnect after a short
+// network outage) resends every service list in the ensemble.
+//
+// Now each process numbers the changes to its service list: sv_epoch
+// is a random nonzero number chosen at initialization, and sv_version
+// counts the changes (calls to o2_notify_others()) since then. The
+// last SVDELTA_LOG_MAX or so changes are kept in sv_log.
+//
+// Each process also counts the /_o2/sv messages it receives from a
+// peer, so it knows the peer's epoch and version. When a peer
+// disconnects, its services and taps are saved (up to SVDELTA_CACHE_MAX
+// processes for SVDELTA_CACHE_AGE seconds) along with its epoch and
+// version.
+//
+// When two processes with version O2_SVDELTA_VERSION or later connect,
+// instead of sending !_o2/sv, each sends !_o2/sd "sii" with its name
+// and the epoch and version of the peer's services it has in its cache
+// (or 0, 0). The peer replies with !_o2/sr "siib..." with its name,
+// epoch, version, a reset flag, and service descriptions as in
+// /_o2/sv. If the epoch matches and the change log still holds every
+// change after the cached version, the reply holds only those changes
+// (reset is false) and the receiver first restores its cached
+// services. Otherwise the reply holds the full service list (reset is
+// true). Processes with older versions are sent !_o2/sv as before.
+//
+// Changes sent with /_o2/sv before the /_o2/sr reply are changes that
+// are also in the reply, and applying a change again has no effect, so
+// no synchronization is needed beyond the ordering of messages on the
+// connection.
+
+#ifndef O2_NO_SVDELTA
+#include "o2internal.h"
+#include "services.h"
+#include "message.h"
+#include "msgsend.h"
+#include "discovery.h"
+#include "pathtree.h"
+#include "svdelta.h"
+#include "hubmesh.h"
+
+#define SVDELTA_LOG_MAX 512    // changes kept in sv_log
+#define SVDELTA_CACHE_MAX 64   // most disconnected processes remembered
+#define SVDELTA_CACHE_AGE 60.0 // how long (s) they are remembered
+
+static bool sv_active = false;
+static int32_t sv_epoch = 0;
+static int32_t sv_version = 0;
+static int32_t sv_log_base = 0;  // version before sv_log[0]
+static Vec<Sv_change> sv_log;
+static Vec<Sv_cache *> sv_caches;  // oldest first
+int o2_svdelta_delta_count = 0;
+int o2_svdelta_reset_count = 0;
+
+
+static void sv_change_init(Sv_change *change, const char *name, bool added,
+                           bool is_service, const char *prop_tap,
+                           int send_mode)
+{
+    change->name = o2_heapify(name);
+    change->added = added;
+    change->is_service = is_service;
+    change->prop_tap = o2_heapify(prop_tap);
+    change->send_mode = send_mode;
+}
+
+
+static void sv_changes_free(Vec<Sv_change> &changes, int n)
+{
+    for (int i = 0; i < n; i++) {
+        O2_FREE((char *) changes[i].name);
+        O2_FREE((char *) changes[i].prop_tap);
+    }
+}
+
+
+static void sv_cache_free(Sv_cache *cache)
+{
+    sv_changes_free(cache->items, cache->items.size());
+    cache->items.finish();
+    O2_FREE((char *) cache->name);
+    O2_FREE(cache);
+}
+
+
+static void sv_add_change(Sv_change *change)
+{
+    o2_add_string(change->name);
+    o2_add_tf(change->added);
+    o2_add_tf(change->is_service);
+    o2_add_string(change->prop_tap);
+    o2_add_int32(change->send_mode);
+}
+
+
+// find a remote process from the name at the start of a message
+static Proc_info *sv_find_proc(const char *name)
+{
+    Services_entry *services;
+    O2node *proc = Services_entry::service_find(name, &services);
+    if (!proc || !ISA_PROC(proc) || !ISA_REMOTE_PROC(proc)) {
+        O2_DBd(hdprintf("svdelta: no process %s\n", name));
+        return NULL;
+    }
+    return TO_PROC_INFO(proc);
+}
+
+
+void o2_svdelta_log(const char *service_name, bool added, const char *tappee,
+                    const char *properties, int send_mode)
+{
+    // until we have a name, no process can know our services, so
+    // there is nothing to log:
+    if (!sv_active || !o2_ctx->proc->key) {
+        return;
+    }
+    if (sv_log.size() >= SVDELTA_LOG_MAX) {  // drop the older half
+        int n = SVDELTA_LOG_MAX / 2;
+        sv_changes_free(sv_log, n);
+        sv_log.drop_front(n);
+        sv_log_base += n;
+    }
+    bool is_service = (*tappee == 0);
+    sv_change_init(sv_log.append_space(1), service_name, added, is_service,
+                   is_service ? (added ? properties : "") : tappee,
+                   send_mode);
+    sv_version++;
+}
+
+
+O2err o2_svdelta_connected(Proc_info *proc, int version)
+{
+    if (!sv_active || version < O2_SVDELTA_VERSION) {
+        return o2_send_services(proc);
+    }
+    // look for the services of proc from an earlier connection:
+    assert(!proc->sv_cache);
+    int32_t epoch = 0;
+    int32_t cached_version = 0;
+    for (int i = 0; i < sv_caches.size(); i++) {
+        if (streql(sv_caches[i]->name, proc->key)) {
+            proc->sv_cache = sv_caches[i];
+            sv_caches.remove(i);
+            epoch = proc->sv_cache->epoch;
+            cached_version = proc->sv_cache->version;
+            break;
+        }
+    }
+    o2_send_start();
+    o2_add_string(o2_ctx->proc->key);
+    o2_add_int32(epoch);
+    o2_add_int32(cached_version);
+    O2message_ptr msg = o2_message_finish(0.0, "!_o2/sd", true);
+    if (!msg) return O2_FAIL;
+    O2_DBd(hdprintf("svdelta: asking %s for services since %d:%d\n",
+                    proc->key, epoch, cached_version));
+    o2_prepare_to_deliver(msg);
+    return proc->send(false);
+}
+
+
+void o2_svdelta_received(Proc_info *proc)
+{
+    if (proc->sv_epoch) {
+        proc->sv_version++;
+    }
+}
+
+
+// handler for /_o2/sd "sii": send the changes since the given epoch
+// and version, or else all of our services, in an /_o2/sr message
+//
+static void sv_digest_handler(O2msg_data_ptr msg, const char *types,
+                              O2arg_ptr *argv, int argc, const void *user_data)
+{
+    Proc_info *proc = sv_find_proc(argv[0]->s);
+    if (!proc) return;
+    int32_t epoch = argv[1]->i32;
+    int32_t version = argv[2]->i32;
+    bool reset = !(epoch == sv_epoch && version >= sv_log_base &&
+                   version <= sv_version);
+    o2_send_start();
+    o2_add_string(o2_ctx->proc->key);
+    o2_add_int32(sv_epoch);
+    o2_add_int32(sv_version);
+    o2_add_tf(reset);
+    if (reset) {
+        o2_add_services(proc->key);
+    } else {
+        for (int i = version - sv_log_base; i < sv_log.size(); i++) {
+            sv_add_change(&sv_log[i]);
+        }
+    }
+    O2message_ptr reply = o2_message_finish(0.0, "!_o2/sr", true);
+    if (!reply) return;
+    O2_DBd(hdprintf("svdelta: sending %s to %s, %d:%d to %d\n",
+                    reset ? "all services" : "changes", proc->key,
+                    epoch, version, sv_version));
+    o2_prepare_to_deliver(reply);
+    proc->send(false);
+}
+
+
+// handler for /_o2/sr "siib...": restore cached services if reset is
+// false, then apply the service descriptions as in /_o2/sv
+//
+static void sv_reply_handler(O2msg_data_ptr msg, const char *types,
+                             O2arg_ptr *argv, int argc, const void *user_data)
+{
+    o2_extract_start(msg);
+    O2arg_ptr name_arg = o2_get_next(O2_STRING);
+    O2arg_ptr epoch_arg = o2_get_next(O2_INT32);
+    O2arg_ptr version_arg = o2_get_next(O2_INT32);
+    O2arg_ptr reset_arg = o2_get_next(O2_BOOL);
+    if (!name_arg || !epoch_arg || !version_arg || !reset_arg) return;
+    Proc_info *proc = sv_find_proc(name_arg->s);
+    if (!proc) return;
+    // like /_o2/sv, this confirms that the remote process exists:
+    proc->is_connected = true;
+    if (reset_arg->B) {
+        o2_svdelta_reset_count++;
+    }
+    Sv_cache *cache = proc->sv_cache;
+    if (cache) {
+        if (!reset_arg->B && cache->epoch == epoch_arg->i32) {
+            o2_svdelta_delta_count++;
+            O2_DBd(hdprintf("svdelta: restoring %d services of %s\n",
+                            cache->items.size(), proc->key));
+            for (int i = 0; i < cache->items.size(); i++) {
+                Sv_change *item = &cache->items[i];
+                if (item->is_service) {
+                    Services_entry::service_provider_new(item->name,
+                            item->prop_tap, proc, proc);
+#ifndef O2_NO_HUB
+                    o2_hub_mesh_note(proc, item->name, true);
+#endif
+                } else {
+                    o2_tap_new(item->name, proc, item->prop_tap,
+                               (O2tap_send_mode) item->send_mode);
+                }
+            }
+#ifndef O2_NO_HUB
+            // relay now: the notes refer to names owned by cache
+            o2_hub_mesh_flush(proc);
+#endif
+        }
+        proc->sv_cache = NULL;
+        sv_cache_free(cache);
+    }
+    o2_services_apply(proc);
+    proc->sv_epoch = epoch_arg->i32;
+    proc->sv_version = version_arg->i32;
+}
+
+
+static int sv_entry_compare(const void *a, const void *b)
+{
+    uintptr_t x = (uintptr_t) *(Services_entry **) a;
+    uintptr_t y = (uintptr_t) *(Services_entry **) b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+
+void o2_svdelta_save(Proc_info *proc)
+{
+    if (proc->sv_cache) {  // removed before /_o2/sr arrived
+        sv_cache_free(proc->sv_cache);
+        proc->sv_cache = NULL;
+    }
+    if (!sv_active || !proc->sv_epoch || !proc->key) {
+        return;
+    }
+    Sv_cache *cache = O2_MALLOCT(Sv_cache);
+    cache->name = o2_heapify(proc->key);
+    cache->epoch = proc->sv_epoch;
+    cache->version = proc->sv_version;
+    cache->saved = o2_local_time();
+    cache->items.init(0);
+    // visit each Services_entry in proc->services_by once:
+    Vec<Services_entry *> entries(proc->services_by.size());
+    entries.append(proc->services_by.get_array(), proc->services_by.size());
+    qsort(entries.get_array(), entries.size(), sizeof(Services_entry *),
+          &sv_entry_compare);
+    for (int j = 0; j < entries.size(); j++) {
+        if (j > 0 && entries[j] == entries[j - 1]) {
+            continue;
+        }
+        Services_entry *services = entries[j];
+        Service_provider *spp = services->proc_service_find(proc);
+        if (spp && services->key[0] != '@') {  // skip the process itself
+            sv_change_init(cache->items.append_space(1), services->key, true,
+                           true, spp->properties ? spp->properties : "", 0);
+        }
+        for (int i = 0; i < services->taps.size(); i++) {
+            Service_tap *stp = &services->taps[i];
+            if (stp->proc == proc) {
+                sv_change_init(cache->items.append_space(1), stp->tapper,
+                               true, false, services->key, stp->send_mode);
+            }
+        }
+    }
+    // forget processes that left long ago or if there are too many:
+    while (sv_caches.size() > 0 &&
+           (sv_caches.size() >= SVDELTA_CACHE_MAX ||
+            sv_caches[0]->saved < cache->saved - SVDELTA_CACHE_AGE)) {
+        sv_cache_free(sv_caches[0]);
+        sv_caches.erase(0);
+    }
+    O2_DBd(hdprintf("svdelta: saved %d services of %s at %d:%d\n",
+                    cache->items.size(), cache->name, cache->epoch,
+                    cache->version));
+    sv_caches.push_back(cache);
+}
+
+
+void o2_svdelta_initialize()
+{
+    // the epoch only needs to differ from that of an earlier process
+    // with the same name:
+    int32_t stack_var;
+    sv_epoch = (int32_t) ((int64_t) (o2_native_time() * 1000000) ^
+                          (int64_t) (intptr_t) &stack_var);
+    if (sv_epoch == 0) sv_epoch = 1;
+    sv_version = 0;
+    sv_log_base = 0;
+    o2_svdelta_delta_count = 0;
+    o2_svdelta_reset_count = 0;
+    sv_active = true;
+    o2_method_new_internal("/_o2/sd", "sii", &sv_digest_handler,
+                           NULL, false, true);
+    o2_method_new_internal("/_o2/sr", NULL, &sv_reply_handler,
+                           NULL, false, false);
+}
+
+
+void o2_svdelta_finish()
+{
+    sv_active = false;
+    sv_changes_free(sv_log, sv_log.size());
+    sv_log.finish();
+    for (int i = 0; i < sv_caches.size(); i++) {
+        sv_cache_free(sv_caches[i]);
+    }
+    sv_caches.finish();
+}
+
+#endif
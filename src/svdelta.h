@@ -0,0 +1,60 @@
+// svdelta.h -- incremental service list updates
+//
+// See svdelta.cpp for a description.
+
+#ifndef SVDELTA_H
+#define SVDELTA_H
+
+#ifndef O2_NO_SVDELTA
+
+// peers with at least this version exchange service deltas on connect:
+#define O2_SVDELTA_VERSION 0x020100
+
+// one service or tap of a process, or one change to them
+typedef struct Sv_change {
+    O2string name;      // service or tapper (owned)
+    bool added;
+    bool is_service;
+    O2string prop_tap;  // properties or tappee (owned)
+    int send_mode;
+} Sv_change;
+
+// services and taps of a disconnected process, kept in case the
+// process reconnects
+typedef struct Sv_cache {
+    O2string name;   // process name (owned)
+    int32_t epoch;   // service list epoch and version of the process
+    int32_t version;
+    O2time saved;    // local time when the process was removed
+    Vec<Sv_change> items;  // added is always true
+} Sv_cache;
+
+// /_o2/sr replies received since initialization that restored cached
+// services, and that held the full service list (for testing)
+extern int o2_svdelta_delta_count;
+extern int o2_svdelta_reset_count;
+
+// install the /_o2/sd and /_o2/sr handlers, called by o2_init_phase2()
+void o2_svdelta_initialize();
+
+// record a change to local services, called by o2_notify_others()
+void o2_svdelta_log(const char *service_name, bool added, const char *tappee,
+                    const char *properties, int send_mode);
+
+// send our services to a newly connected proc, either as a full /_o2/sv
+// message or by asking for a delta (see svdelta.cpp). version is the
+// O2 version of proc.
+O2err o2_svdelta_connected(Proc_info *proc, int version);
+
+// count one /_o2/sv change message from proc
+void o2_svdelta_received(Proc_info *proc);
+
+// remember the services of proc, which is being removed, and free
+// proc->sv_cache; called by ~Proc_info()
+void o2_svdelta_save(Proc_info *proc);
+
+// free the change log and caches, called by o2_finish()
+void o2_svdelta_finish();
+
+#endif
+#endif
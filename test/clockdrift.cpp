@@ -0,0 +1,86 @@
+//  clockdrift.c - test clock drift estimation and the adaptive ping
+//  interval
+//
+// use with clockdriftref.c, whose reference clock runs DRIFT (200 ppm)
+// faster than the local system clock.
+//
+// Algorithm for test:
+// - offer service "client" and wait for clock synchronization
+// - every 0.5s, get o2_clock_stats() until the estimated drift is
+//   within DRIFT_TOLERANCE of DRIFT and the ping interval has grown
+//   beyond its starting value of 1s, which means that the clock was
+//   found to be stable. Fail if this takes more than 40s.
+// - send !server/done and finish
+
+#include "o2.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "math.h"
+#include "testassert.h"
+
+#define DRIFT 200e-6
+#define DRIFT_TOLERANCE 50e-6
+#define PING_START 1.0  // CLOCK_PING_START in clock.cpp
+
+
+void delay_for(double delay)
+{
+    O2time done = o2_local_time() + delay;
+    while (o2_local_time() < done) {
+        o2_poll();
+        o2_sleep(2);
+    }
+}
+
+
+int main(int argc, const char *argv[])
+{
+    printf("Usage: clockdrift [debugflags]\n"
+           "    see o2.h for flags, use a for (almost) all, - for none\n");
+    if (argc >= 2) {
+        o2_debug_flags(argv[1]);
+        printf("debug flags are: %s\n", argv[1]);
+    }
+    if (argc > 2) {
+        printf("WARNING: clockdrift ignoring extra command line argments\n");
+    }
+    o2_initialize("test");
+    o2_service_new("client");
+
+    O2time timeout = o2_local_time() + 30;
+    while (!o2_clock_is_synchronized) {
+        o2_poll();
+        o2_sleep(2);
+        if (o2_local_time() > timeout) {
+            printf("FAILURE -- timed out waiting for clock sync\n");
+            o2assert(false);
+        }
+    }
+    printf("# clock is synchronized\n");
+
+    timeout = o2_local_time() + 40;
+    O2clock_stats st;
+    while (true) {
+        delay_for(0.5);
+        o2assert(o2_clock_stats(&st, false) == O2_SUCCESS);
+        printf("# drift %g jitter %g ping_interval %g\n", st.drift,
+               st.jitter, st.ping_interval);
+        if (fabs(st.drift - DRIFT) < DRIFT_TOLERANCE &&
+            st.ping_interval > PING_START) {
+            break;
+        }
+        if (o2_local_time() > timeout) {
+            printf("FAILURE -- drift estimate did not converge or ping "
+                   "interval did not grow\n");
+            o2assert(false);
+        }
+    }
+    o2assert(st.synchronized && !st.reference);
+
+    o2_send_cmd("!server/done", 0, "");
+    delay_for(0.5);
+    o2_finish();
+    printf("CLOCKDRIFT DONE\n");
+    return 0;
+}
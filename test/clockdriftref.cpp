@@ -0,0 +1,71 @@
+//  clockdriftref.c - reference clock for clockdrift.c
+//
+// This process provides the reference clock, which runs DRIFT (200
+// ppm) faster than the local system clock, so that clockdrift.c can
+// check that its drift estimate converges and that its clock sync
+// ping interval backs off once its clock is stable.
+//
+// Algorithm for test:
+// - offer service "server" and become the reference with
+//   o2_clock_set(fast_time)
+// - wait for !server/done from clockdrift, wait 0.5s and finish
+
+#include "o2.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "testassert.h"
+
+#define DRIFT 200e-6
+
+bool got_done = false;
+
+
+O2time fast_time(void *rock)
+{
+    return o2_native_time() * (1.0 + DRIFT);
+}
+
+
+void done_handler(O2msg_data_ptr data, const char *types,
+                  O2arg_ptr *argv, int argc, const void *user_data)
+{
+    got_done = true;
+}
+
+
+int main(int argc, const char *argv[])
+{
+    printf("Usage: clockdriftref [debugflags]\n"
+           "    see o2.h for flags, use a for (almost) all, - for none\n");
+    if (argc >= 2) {
+        o2_debug_flags(argv[1]);
+        printf("debug flags are: %s\n", argv[1]);
+    }
+    if (argc > 2) {
+        printf("WARNING: clockdriftref ignoring extra command line "
+               "argments\n");
+    }
+    o2_initialize("test");
+    o2_service_new("server");
+    o2_method_new("/server/done", "", &done_handler, NULL, false, true);
+    o2_clock_set(&fast_time, NULL);
+
+    O2time timeout = o2_local_time() + 90;
+    while (!got_done) {
+        o2_poll();
+        o2_sleep(2);
+        if (o2_local_time() > timeout) {
+            printf("FAILURE -- timed out waiting for done\n");
+            o2assert(false);
+        }
+    }
+    O2time done = o2_local_time() + 0.5;
+    while (o2_local_time() < done) {
+        o2_poll();
+        o2_sleep(2);
+    }
+    o2_finish();
+    printf("CLOCKDRIFTREF DONE\n");
+    return 0;
+}
@@ -5,8 +5,10 @@
 //    - check status of server and client services.
 //    - when server is found, record time as cs_time
 //    - after 2 sec, stop
-// Note that there really are no tests other than
-// termination requires a server service in test ensemble.
+// - check that o2_clock_stats() reports a synchronized clock with
+//   plausible values, and that a reset clears the counts
+// - send !_o2/cs/st and check the reply
+// Terminating requires a server service in the test ensemble.
 
 #include "o2.h"
 #include <stdio.h>
@@ -18,6 +20,22 @@
 int keep_alive = false;
 int polling_rate = 100;
 O2time cs_time = 1000000.0;
+bool got_stats = false;
+
+
+// reply to !_o2/cs/st, see o2_clock_stats()
+void clock_stats(O2msg_data_ptr msg, const char *types,
+                 O2arg_ptr *argv, int argc, const void *user_data)
+{
+    printf("clockmirror: clock stats offset %g drift %g jitter %g "
+           "since_good %g ping_interval %g samples %lld delayed %lld\n",
+           argv[3]->d, argv[4]->d, argv[9]->d, argv[10]->d, argv[13]->d,
+           (long long) argv[14]->h, (long long) argv[15]->h);
+    o2assert(argv[1]->i32 == 1);  // synchronized
+    o2assert(argv[2]->i32 == 0);  // not the reference
+    o2assert(argv[10]->d >= 0);   // had a good sample
+    got_stats = true;
+}
 
 void clockmirror(O2msg_data_ptr msg, const char *types,
                  O2arg_ptr *argv, int argc, const void *user_data)
@@ -87,6 +105,24 @@ int main(int argc, const char * argv[])
     // start polling and reporting status
     clockmirror(NULL, NULL, NULL, 0, NULL);
     o2_run(polling_rate);
+
+    O2clock_stats st;
+    o2assert(o2_clock_stats(&st, true) == O2_SUCCESS);
+    o2assert(st.synchronized && !st.reference);
+    o2assert(st.samples >= st.delayed && st.samples > 0);
+    o2assert(st.since_good >= 0 && st.since_good < 10);
+    o2assert(st.jitter >= 0 && st.ping_interval > 0);
+    o2assert(st.rate > 0.8 && st.rate < 1.2);
+    o2assert(o2_clock_stats(&st, false) == O2_SUCCESS);
+    o2assert(st.samples == 0 && st.jumps == 0 && st.slews == 0);
+    o2_method_new("/client/st", "siiddddhhdddddhh", &clock_stats,
+                  NULL, false, true);
+    o2_send_cmd("!_o2/cs/st", 0, "s", "!client/st");
+    for (int i = 0; i < 100 && !got_stats; i++) {  // samples come in
+        o2_poll();                                  // while we wait
+        o2_sleep(10);
+    }
+    o2assert(got_stats);
     o2_finish();
     o2_sleep(1000);
     printf("CLOCKMIRROR DONE\n");
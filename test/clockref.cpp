@@ -34,6 +34,7 @@
 
 bool keep_alive = false;
 bool timing_info = false;
+bool use_beacons = false;
 int polling_rate = 100;
 O2time cs_time = 1000000.0;
 
@@ -160,12 +161,13 @@ int main(int argc, const char * argv[])
     setvbuf (stdout, NULL, _IONBF, BUFSIZ);
     setvbuf (stderr, NULL, _IONBF, BUFSIZ);
 
-    printf("Usage: clockref [debugflags] [zd]\n"
+    printf("Usage: clockref [debugflags] [zdb]\n"
            "    see o2.h for flags, use a for (almost) all, - for none\n"
            "    1000 (or another number) specifies O2 polling rate (optional, "
            "default 100)\n"
            "    use optional z flag to stay running for long-term tests\n"
-           "    use optional d flag to print details of local clock time and polling\n");
+           "    use optional d flag to print details of local clock time and polling\n"
+           "    use optional b flag to send clock sync beacons\n");
     if (argc >= 2 && strcmp(argv[1], "-") != 0) {
         o2_debug_flags(argv[1]);
         printf("debug flags are: %s\n", argv[1]);
@@ -183,6 +185,10 @@ int main(int argc, const char * argv[])
             printf("d flag found - printing extra clock and polling info\n\n");
             timing_info = true;
         }
+        if (strchr(argv[2], 'b') != NULL) {
+            printf("b flag found - sending clock sync beacons\n\n");
+            use_beacons = true;
+        }
     }
     if (argc > 3) {
         printf("WARNING: clockref ignoring extra command line argments\n");
@@ -196,6 +202,10 @@ int main(int argc, const char * argv[])
     o2_method_new("/server/clockref", "", &clockref, NULL, false, false);
     o2_method_new("/_o2/si", "siss", &service_info, NULL, false, true);
     o2_method_new("/server/rtt/ans", "sff", &rtt_reply, NULL, false, true);
+    if (use_beacons) {
+        o2assert(o2_clock_beacons(-1) == O2_BAD_ARGS);
+        o2assert(o2_clock_beacons(0.5) == O2_SUCCESS);
+    }
     // we are the ref clock
     o2_clock_set(NULL, NULL);
     o2_send("!server/clockref", 0.0, ""); // start polling
@@ -0,0 +1,126 @@
+// conflaterecv.cpp - receiving end for check of conflation
+//
+// See conflatesend.cpp for how the test works.
+//
+// The server sleeps for 3s when the first /server/fill message arrives
+// so that the sender blocks. At the end, at most a few /server/level
+// messages should have been received, the last with the latest value,
+// and /server/urgent should have been received before it. No
+// /server/stale message should arrive (they expire in the sender's
+// queue), but /server/fresh should.
+
+#include "o2.h"
+#include "stdio.h"
+#include "string.h"
+#include "testassert.h"
+
+#define N_LEVELS 1000  // must match conflatesend.cpp
+int fill_count = 0;
+int level_count = 0;
+int last_level = -1;
+bool got_urgent = false;
+bool got_fresh = false;
+bool running = true;
+
+
+void server_fill(O2msg_data_ptr msg, const char *types,
+                 O2arg_ptr *argv, int argc, const void *user_data)
+{
+    o2assert(strlen(argv[0]->s) == 1023);
+    if (fill_count++ == 0) {
+        printf("Got first fill message, not receiving for 3s.\n");
+        o2_sleep(3000);
+    }
+}
+
+
+void server_level(O2msg_data_ptr msg, const char *types,
+                  O2arg_ptr *argv, int argc, const void *user_data)
+{
+    o2assert(argv[0]->i32 > last_level);  // in order
+    last_level = argv[0]->i32;
+    level_count++;
+}
+
+
+void server_urgent(O2msg_data_ptr msg, const char *types,
+                   O2arg_ptr *argv, int argc, const void *user_data)
+{
+    printf("Got urgent message after %d fill and %d level messages.\n",
+           fill_count, level_count);
+    o2assert(level_count == 0);  // it was sent after level messages
+    got_urgent = true;
+}
+
+
+void server_stale(O2msg_data_ptr msg, const char *types,
+                  O2arg_ptr *argv, int argc, const void *user_data)
+{
+    printf("Got /server/stale %d after its deadline\n", argv[0]->i32);
+    o2assert(false);
+}
+
+
+void server_fresh(O2msg_data_ptr msg, const char *types,
+                  O2arg_ptr *argv, int argc, const void *user_data)
+{
+    got_fresh = true;
+}
+
+
+void server_done(O2msg_data_ptr msg, const char *types,
+                 O2arg_ptr *argv, int argc, const void *user_data)
+{
+    running = false;
+}
+
+
+int main(int argc, const char * argv[])
+{
+    printf("Usage: conflaterecv [flags] "
+           "(see o2.h for flags, use a for (almost) all)\n");
+    if (argc >= 2) {
+        o2_debug_flags(argv[1]);
+        printf("debug flags are: %s\n", argv[1]);
+    }
+    if (argc > 2) {
+        printf("WARNING: conflaterecv ignoring extra command line arguments\n");
+    }
+    o2_initialize("test");
+    o2_service_new("server");
+    o2_method_new("/server/fill", "s", &server_fill, NULL, false, true);
+    o2_method_new("/server/level", "i", &server_level, NULL, false, true);
+    o2_method_new("/server/urgent", "", &server_urgent, NULL, false, true);
+    o2_method_new("/server/stale", "i", &server_stale, NULL, false, true);
+    o2_method_new("/server/fresh", "", &server_fresh, NULL, false, true);
+    o2_method_new("/server/done", "", &server_done, NULL, false, true);
+
+    // we are the master clock
+    o2_clock_set(NULL, NULL);
+
+    while (running) {
+        o2_poll();
+        o2_sleep(2);
+    }
+    printf("Received %d fill and %d level messages, last level %d.\n",
+           fill_count, level_count, last_level);
+    o2assert(last_level == N_LEVELS - 1);
+    o2assert(level_count == 1);
+    o2assert(got_urgent);
+    o2assert(got_fresh);
+
+    // report messages that expired here (see conflatesend.cpp):
+    o2_send_cmd("!sender/done", 0, "i",
+                (int32_t) o2_expired("server", false));
+    printf("Poll for 1s to make sure done message is received\n");
+    for (int i = 0; i < 500; i++) {
+        o2_poll();
+        o2_sleep(2);
+    }
+
+    printf("Finish at O2 clock time %g\n", o2_time_get());
+    o2_finish();
+    o2_sleep(1000); // finish cleaning up sockets
+    printf("SERVER DONE\n");
+    return 0;
+}
@@ -0,0 +1,146 @@
+// conflatesend.cpp - check conflation and priority of queued messages
+//
+// How the test works: Wait until we have "server" as a service.
+// Send big /server/fill messages until the send would block. The
+// receiver (conflaterecv.cpp) sleeps for 3s when it gets the first
+// one, so the connection stays blocked. Then send N_LEVELS messages
+// to the conflatable address /server/level. These must not block,
+// and all but the first should replace the one queued message.
+// Then send /server/urgent, a high-priority address, which must be
+// delivered before the queued /server/level. Then send N_STALE
+// messages to /server/stale with a 0.5s deadline, which must expire in
+// the queue (here, or at the receiver if they are written to the
+// connection before they expire), and /server/fresh with a 60s
+// deadline, which must not. These are also high-priority addresses so
+// that they are queued without blocking. Then send /server/done, which
+// the receiver acknowledges with /sender/done after checking that only
+// the latest value(s) arrived. /sender/done carries the receiver's count
+// of expired messages.
+//
+// Messages:
+//    Filler messages to block TCP:    /server/fill "s" bigstring
+//    Conflatable messages:            /server/level "i" value
+//    High-priority message:           /server/urgent ""
+//    Messages with deadlines:         /server/stale "i" i, /server/fresh ""
+//    End of sequence:                 /server/done ""
+//    Acknowledgement:                 /sender/done "i" expired count
+
+#include "o2.h"
+#include "stdio.h"
+#include "string.h"
+#include "testassert.h"
+
+#define N_LEVELS 1000
+#define N_STALE 10
+#define BIG_STRING_LEN 1024
+char bigstring[BIG_STRING_LEN];
+bool running = true;
+int64_t receiver_expired = -1;
+
+
+// at the end, we get a message to /sender/done
+void sender_done(O2msg_data_ptr msg, const char *types,
+                 O2arg_ptr *argv, int argc, const void *user_data)
+{
+    o2assert(argc == 1);
+    receiver_expired = argv[0]->i32;
+    running = false;
+}
+
+
+int main(int argc, const char * argv[])
+{
+    for (int i = 0; i < BIG_STRING_LEN; i++) {
+        bigstring[i] = 'a' + (i % 26);
+    }
+    bigstring[BIG_STRING_LEN - 1] = 0;  // end of string
+
+    printf("Usage: conflatesend [flags] "
+           "(see o2.h for flags, use a for (almost) all)\n");
+    if (argc >= 2) {
+        o2_debug_flags(argv[1]);
+        printf("debug flags are: %s\n", argv[1]);
+    }
+    if (argc > 2) {
+        printf("WARNING: conflatesend ignoring extra command line arguments\n");
+    }
+    o2assert(o2_conflate("/server/level", true) == O2_NOT_INITIALIZED);
+    o2_initialize("test");
+    o2_service_new("sender"); // that's us
+    o2_method_new("/sender/done", "i", &sender_done, NULL, false, true);
+
+    o2assert(o2_conflate("", true) == O2_BAD_ARGS);
+    o2assert(o2_conflate("server", false) == O2_FAIL);  // not marked
+    o2assert(o2_conflate("server", true) == O2_SUCCESS);
+    o2assert(o2_conflate("server", false) == O2_SUCCESS);
+    o2assert(o2_conflate("/server/level", true) == O2_SUCCESS);
+    o2assert(o2_high_priority("/server/level", false) == O2_FAIL);
+    o2assert(o2_high_priority("/server/urgent", true) == O2_SUCCESS);
+    o2assert(o2_high_priority("/server/stale", true) == O2_SUCCESS);
+    o2assert(o2_high_priority("/server/fresh", true) == O2_SUCCESS);
+
+    while (o2_status("server") < O2_LOCAL) {
+        o2_poll();
+        o2_sleep(2); // 2ms
+    }
+    printf("We discovered the server.\ntime is %g.\n", o2_time_get());
+
+    double now = o2_time_get();
+    while (o2_time_get() < now + 1) {
+        o2_poll();
+        o2_sleep(2);
+    }
+
+    printf("Here we go! ...\ntime is %g.\n", o2_time_get());
+    int fill_count = 0;
+    while (o2_can_send("server") == O2_SUCCESS) {
+        o2_send_cmd("!server/fill", 0, "s", bigstring);
+        fill_count++;
+        o2_poll();
+    }
+    printf("Blocked after %d fill messages.\n", fill_count);
+
+    // server is not receiving, so these should not block and should
+    // be conflated:
+    now = o2_time_get();
+    for (int i = 0; i < N_LEVELS; i++) {
+        o2_send_cmd("!server/level", 0, "i", i);
+    }
+    int64_t conflated = o2_conflated(true);
+    printf("Sent %d level messages in %g s, %lld conflated.\n", N_LEVELS,
+           o2_time_get() - now, (long long) conflated);
+    o2assert(o2_time_get() < now + 1);  // did not block
+    o2assert(conflated == N_LEVELS - 1);
+    o2assert(o2_conflated(false) == 0);  // was reset
+    o2_send_cmd("!server/urgent", 0, "");  // goes ahead of /server/level
+
+    o2assert(o2_add_deadline(0.5, true) == O2_FAIL);  // no message started
+    for (int i = 0; i < N_STALE; i++) {  // these expire in the queue
+        o2_send_start();
+        o2_add_int32(i);
+        o2assert(o2_add_deadline(0.5, true) == O2_SUCCESS);
+        o2_send_finish(0, "!server/stale", true);
+    }
+    o2_send_start();
+    o2assert(o2_add_deadline(o2_time_get() + 60, false) == O2_SUCCESS);
+    o2_send_finish(0, "!server/fresh", true);
+
+    o2_send_cmd("!server/done", 0, "");
+    while (running) {
+        o2_poll();
+        o2_sleep(2); // 2ms
+    }
+
+    printf("%lld messages expired, %lld at the receiver\n",
+           (long long) o2_expired(NULL, false), (long long) receiver_expired);
+    o2assert(o2_expired("server", false) + receiver_expired == N_STALE);
+    o2assert(o2_expired("sender", false) == 0);
+    o2assert(o2_expired(NULL, true) == N_STALE - receiver_expired);
+    o2assert(o2_expired(NULL, false) == 0);  // was reset
+
+    printf("Finish at O2 clock time %g\n", o2_time_get());
+    o2_finish();
+    o2_sleep(1000); // finish cleaning up sockets
+    printf("CLIENT DONE\n");
+    return 0;
+}
@@ -41,6 +41,20 @@ void service_two(O2msg_data_ptr data, const char *types,
     w++;
 }
 
+int lt_count = 0;
+int gt_count = 0;
+
+void service_sched(O2msg_data_ptr data, const char *types,
+                   O2arg_ptr *argv, int argc, const void *user_data)
+{
+    if (argv[0]->i32) {
+        gt_count++;
+    } else {
+        lt_count++;
+    }
+}
+
+
 int main(int argc, const char * argv[])
 {
     printf("Usage: dispatchtest [debugflags] "
@@ -69,6 +83,29 @@ int main(int argc, const char * argv[])
     while (s < MAX_MESSAGES) {
         o2_poll();
     }
+
+    // with a budget of one message per poll, the local and global time
+    // schedulers each still dispatch their first due message:
+    o2_clock_set(NULL, NULL);  // start the global time scheduler
+    o2_poll();
+    o2_method_new("/one/sched", "i", &service_sched, NULL, false, true);
+    O2time when = o2_local_time() + 0.01;
+    for (int i = 0; i < 3; i++) {
+        o2_send_start();
+        o2_add_int32(0);
+        O2message_ptr msg = o2_message_finish(when, "/one/sched", false);
+        o2assert(o2_schedule_msg(&o2_ltsched, msg) == O2_SUCCESS);
+        o2_send("/one/sched", o2_time_get() + 0.01, "i", 1);
+    }
+    o2_sleep(50);
+    o2assert(o2_poll_budget(1, 0) == O2_SUCCESS);
+    o2_poll();
+    printf("one poll dispatched %d local and %d global time messages\n",
+           lt_count, gt_count);
+    o2assert(lt_count == 1 && gt_count == 1);
+    o2assert(o2_poll_budget(0, 0) == O2_SUCCESS);
+    o2_poll();
+    o2assert(lt_count == 3 && gt_count == 3);
     o2_finish();
     printf("after finish, s is %d, w is %d\n", s, w);
     o2assert(s == 5000);
@@ -0,0 +1,216 @@
+//  meshclient.c - test o2_hub_partial_mesh()
+//
+// see meshhub.c for details. Run three copies of this program.
+//
+// Algorithm for test:
+// - start O2 and wait to discover service "hub" (the hub does not
+//   broadcast, so the clients discover it)
+// - shut down, restart, call o2_hub_partial_mesh(true) and o2_hub()
+//   with the hub's address, and offer service "c<tcp port>"
+// - wait for !<me>/peers "sss" from the hub, which lists every client
+//   service. No other client should have connected to us yet, since
+//   the hub does not introduce partial mesh clients to each other.
+// - wait 0.5s so that the other clients have also checked this
+// - look up (o2_status()) each other client service until it is
+//   available, which connects to the client through the hub's
+//   directory, then send it !<other>/hi
+// - wait for hi from every other client, send !hub/done and wait
+//   for !<me>/bye from the hub
+
+#include "o2.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "testassert.h"
+
+#define N_CLIENTS 3
+
+char hub_pip[O2N_IP_LEN];
+char hub_iip[O2N_IP_LEN];
+int hub_port = -1;
+
+char my_name[8];
+char peer_names[N_CLIENTS][8];
+bool got_peers = false;
+bool early_client = false;  // did another client connect before lookup?
+int hi_count = 0;
+bool got_bye = false;
+
+
+void service_info_handler(O2msg_data_ptr data, const char *types,
+                          O2arg_ptr *argv, int argc, const void *user_data)
+{
+    const char *service_name = argv[0]->s;
+    int status = argv[1]->i32;
+    const char *process = argv[2]->s;
+    printf("# service_info_handler called: %s at %s status %d\n",
+           service_name, process, status);
+    if (status < O2_REMOTE_NOTIME) {
+        return;
+    }
+    if (streql(service_name, "hub")) {
+        o2_parse_name(process, hub_pip, hub_iip, &hub_port);
+    } else if (service_name[0] == 'c' && !got_peers &&
+               !streql(service_name, my_name)) {
+        early_client = true;
+    }
+}
+
+
+void peers_handler(O2msg_data_ptr data, const char *types,
+                   O2arg_ptr *argv, int argc, const void *user_data)
+{
+    for (int i = 0; i < N_CLIENTS; i++) {
+        o2assert(strlen(argv[i]->s) < 8);
+        strcpy(peer_names[i], argv[i]->s);
+    }
+    printf("# got peers %s %s %s\n", peer_names[0], peer_names[1],
+           peer_names[2]);
+    got_peers = true;
+}
+
+
+void hi_handler(O2msg_data_ptr data, const char *types,
+                O2arg_ptr *argv, int argc, const void *user_data)
+{
+    printf("# got hi from %s\n", argv[0]->s);
+    hi_count++;
+}
+
+
+void bye_handler(O2msg_data_ptr data, const char *types,
+                 O2arg_ptr *argv, int argc, const void *user_data)
+{
+    got_bye = true;
+}
+
+
+void delay_for(double delay)
+{
+    O2time done = o2_local_time() + delay;
+    while (o2_local_time() < done) {
+        o2_poll();
+        o2_sleep(2);
+    }
+}
+
+
+// poll until *flag is set, fail after 30s
+void wait_for(bool *flag, const char *what)
+{
+    O2time timeout = o2_local_time() + 30;
+    while (!*flag) {
+        o2_poll();
+        o2_sleep(2);
+        if (o2_local_time() > timeout) {
+            printf("FAILURE -- timed out waiting for %s\n", what);
+            o2assert(false);
+        }
+    }
+}
+
+
+#ifndef O2_NO_HUB
+void find_hub()
+{
+    o2_initialize("test");
+    o2_method_new("/_o2/si", "siss", &service_info_handler, NULL,
+                  false, true);
+    O2time timeout = o2_local_time() + 30;
+    while (o2_status("hub") < O2_REMOTE_NOTIME) {
+        o2_poll();
+        o2_sleep(2);
+        o2assert(o2_local_time() < timeout);
+    }
+    o2assert(hub_port >= 0);
+    printf("# found hub at %s:%s:%04x\n", hub_pip, hub_iip, hub_port);
+    o2_finish();
+}
+
+
+void join_partial_mesh()
+{
+    char pip_dot[O2N_IP_LEN];
+    char iip_dot[O2N_IP_LEN];
+    o2_hex_to_dot(hub_pip, pip_dot);
+    o2_hex_to_dot(hub_iip, iip_dot);
+    o2_initialize("test");
+    o2assert(o2_hub_partial_mesh(true) == O2_SUCCESS);
+    o2assert(o2_hub(O2_VERSION, pip_dot, iip_dot, hub_port, hub_port) ==
+             O2_SUCCESS);
+    const char *pip;
+    const char *iip;
+    int my_port;
+    o2assert(o2_get_addresses(&pip, &iip, &my_port) == O2_SUCCESS);
+    snprintf(my_name, 8, "c%04x", my_port);
+    printf("# my service is %s\n", my_name);
+    o2_service_new(my_name);
+    char path[32];
+    snprintf(path, 32, "/%s/peers", my_name);
+    o2_method_new(path, "sss", &peers_handler, NULL, false, true);
+    snprintf(path, 32, "/%s/hi", my_name);
+    o2_method_new(path, "s", &hi_handler, NULL, false, true);
+    snprintf(path, 32, "/%s/bye", my_name);
+    o2_method_new(path, "", &bye_handler, NULL, false, true);
+    o2_method_new("/_o2/si", "siss", &service_info_handler, NULL,
+                  false, true);
+}
+#endif
+
+
+int main(int argc, const char *argv[])
+{
+    printf("Usage: meshclient [debugflags]\n"
+           "    see o2.h for flags, use a for (almost) all, - for none\n");
+    if (argc >= 2) {
+        o2_debug_flags(argv[1]);
+        printf("debug flags are: %s\n", argv[1]);
+    }
+    if (argc > 2) {
+        printf("WARNING: meshclient ignoring extra command line argments\n");
+    }
+#ifndef O2_NO_HUB
+    find_hub();
+    join_partial_mesh();
+
+    wait_for(&got_peers, "peers from hub");
+    // the hub waited before sending peers, so a full mesh would be
+    // connected by now:
+    o2assert(!early_client);
+    delay_for(0.5);
+
+    O2time timeout = o2_local_time() + 30;
+    for (int i = 0; i < N_CLIENTS; i++) {
+        if (streql(peer_names[i], my_name)) {
+            continue;
+        }
+        // each o2_status() call asks the directory for a connection:
+        while (o2_status(peer_names[i]) < O2_REMOTE_NOTIME) {
+            o2_poll();
+            o2_sleep(2);
+            if (o2_local_time() > timeout) {
+                printf("FAILURE -- could not connect to %s\n",
+                       peer_names[i]);
+                o2assert(false);
+            }
+        }
+        printf("# connected to %s\n", peer_names[i]);
+        char address[32];
+        snprintf(address, 32, "!%s/hi", peer_names[i]);
+        o2_send_cmd(address, 0, "s", my_name);
+    }
+
+    while (hi_count < N_CLIENTS - 1) {
+        o2_poll();
+        o2_sleep(2);
+        o2assert(o2_local_time() < timeout);
+    }
+    o2_send_cmd("!hub/done", 0, "");
+    wait_for(&got_bye, "bye from hub");
+    o2_finish();
+#else
+    printf("O2_NO_HUB defined, so there are no tests that can fail\n");
+#endif
+    printf("MESHCLIENT DONE\n");
+    return 0;
+}
@@ -0,0 +1,136 @@
+//  meshhub.c - test o2_hub_partial_mesh()
+//
+// use with three copies of meshclient.c. This process is the hub.
+// Each client finds the hub with ordinary discovery, restarts, and
+// calls o2_hub_partial_mesh(true) and o2_hub() to use this process as
+// its hub. Each client offers a service named "c" followed by its TCP
+// port in hex.
+//
+// Algorithm for test:
+// - disable broadcasting with o2_hub(NULL) so that clients that have
+//   restarted only learn about other processes from the hub
+// - offer service "hub"
+// - wait for all N_CLIENTS client services (reported to /_o2/si, since
+//   every client is connected to the hub)
+// - wait 0.5s so that full mesh introductions, if any, would complete
+// - send !<client>/peers "sss" with the client service names to
+//   each client
+// - wait for !hub/done from every client
+// - send !<client>/bye to every client, wait 0.5s and finish
+
+#include "o2.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "testassert.h"
+
+#define N_CLIENTS 3
+
+char client_names[N_CLIENTS][8];
+int client_count = 0;
+int done_count = 0;
+
+
+// a client service is "c" followed by 4 hex digits
+bool is_client_service(const char *name)
+{
+    return name[0] == 'c' && strlen(name) == 5;
+}
+
+
+void service_info_handler(O2msg_data_ptr data, const char *types,
+                          O2arg_ptr *argv, int argc, const void *user_data)
+{
+    const char *service_name = argv[0]->s;
+    int status = argv[1]->i32;
+    printf("# service_info_handler called: %s at %s status %d\n",
+           service_name, argv[2]->s, status);
+    if (status < O2_REMOTE_NOTIME || !is_client_service(service_name)) {
+        return;
+    }
+    for (int i = 0; i < client_count; i++) {
+        if (streql(client_names[i], service_name)) {
+            return;
+        }
+    }
+    o2assert(client_count < N_CLIENTS);
+    strcpy(client_names[client_count++], service_name);
+}
+
+
+void hub_done(O2msg_data_ptr data, const char *types,
+              O2arg_ptr *argv, int argc, const void *user_data)
+{
+    done_count++;
+    printf("# got done from a client, done_count %d\n", done_count);
+}
+
+
+void delay_for(double delay)
+{
+    O2time done = o2_local_time() + delay;
+    while (o2_local_time() < done) {
+        o2_poll();
+        o2_sleep(2);
+    }
+}
+
+
+// poll until *count reaches n, fail after 30s
+void wait_for_count(int *count, int n, const char *what)
+{
+    O2time timeout = o2_local_time() + 30;
+    while (*count < n) {
+        o2_poll();
+        o2_sleep(2);
+        if (o2_local_time() > timeout) {
+            printf("FAILURE -- timed out waiting for %s\n", what);
+            o2assert(false);
+        }
+    }
+}
+
+
+int main(int argc, const char *argv[])
+{
+    printf("Usage: meshhub [debugflags]\n"
+           "    see o2.h for flags, use a for (almost) all, - for none\n");
+    if (argc >= 2) {
+        o2_debug_flags(argv[1]);
+        printf("debug flags are: %s\n", argv[1]);
+    }
+    if (argc > 2) {
+        printf("WARNING: meshhub ignoring extra command line argments\n");
+    }
+#ifndef O2_NO_HUB
+    o2_initialize("test");
+    o2_hub(0, NULL, NULL, 0, 0);
+    o2_service_new("hub");
+    o2_method_new("/hub/done", "", &hub_done, NULL, false, true);
+    o2_method_new("/_o2/si", "siss", &service_info_handler, NULL,
+                  false, true);
+
+    wait_for_count(&client_count, N_CLIENTS, "client services");
+    printf("# found %d clients\n", client_count);
+    delay_for(0.5);
+    for (int i = 0; i < N_CLIENTS; i++) {
+        char address[32];
+        snprintf(address, 32, "!%s/peers", client_names[i]);
+        o2_send_cmd(address, 0, "sss", client_names[0], client_names[1],
+                    client_names[2]);
+    }
+
+    wait_for_count(&done_count, N_CLIENTS, "done from clients");
+    for (int i = 0; i < N_CLIENTS; i++) {
+        char address[32];
+        snprintf(address, 32, "!%s/bye", client_names[i]);
+        o2_send_cmd(address, 0, "");
+    }
+    delay_for(0.5);
+    o2_finish();
+#else
+    printf("O2_NO_HUB defined, so there are no tests that can fail\n");
+#endif
+    printf("MESHHUB DONE\n");
+    return 0;
+}
@@ -13,6 +13,11 @@ int max_msg_count = 1000;
 char **server_addresses;
 int n_addrs = 20;
 int use_tcp = false;
+bool use_thread = false;
+bool use_inet = false;
+bool use_coalesce = false;
+bool use_reliable = false;
+bool use_sequence = false;
 
 int msg_count = 0;
 bool running = true;
@@ -30,7 +35,12 @@ void client_test(O2msg_data_ptr data, const char *types,
         i = -1;
         running = false;
     }
+    if (use_coalesce) {  // extra message to go in the same bundle
+        o2_send("!server/extra", 0, "i", i);
+    }
     if (use_tcp) o2_send_cmd(server_addresses[msg_count % n_addrs], 0, "i", i);
+    else if (use_reliable)
+        o2_send_reliable(server_addresses[msg_count % n_addrs], 0, "i", i);
     else o2_send(server_addresses[msg_count % n_addrs], 0, "i", i);
     if (msg_count % 10000 == 0) {
         printf("client received %d messages\n", msg_count);
@@ -48,7 +58,12 @@ int main(int argc, const char *argv[])
            "    see o2.h for flags, use a for (almost) all, - for none\n"
            "    n_addrs is number of addresses to use, default 20\n"
            "    n_addrs must match the number used by o2server\n"
-           "    end maxmsgs with t, e.g. 10000t, to test with TCP\n");
+           "    end maxmsgs with t, e.g. 10000t, to test with TCP\n"
+           "    add n, e.g. 10000tn, to use the network thread\n"
+           "    add i, e.g. 10000ti, to use TCP/UDP for local processes\n"
+           "    add b, e.g. 10000ib, to coalesce UDP messages in bundles\n"
+           "    add r, e.g. 10000ir, to use reliable UDP\n"
+           "    add q, e.g. 10000iq, to count UDP loss with sequence numbers\n");
     if (argc >= 2) {
         max_msg_count = atoi(argv[1]);
         printf("max_msg_count set to %d\n", max_msg_count);
@@ -56,6 +71,26 @@ int main(int argc, const char *argv[])
             use_tcp = true;
             printf("Using TCP\n");
         }
+        if (strchr(argv[1], 'n')) {
+            use_thread = true;
+            printf("Using network thread\n");
+        }
+        if (strchr(argv[1], 'i')) {
+            use_inet = true;
+            printf("Not using Unix-domain sockets\n");
+        }
+        if (strchr(argv[1], 'b')) {
+            use_coalesce = true;
+            printf("Coalescing UDP messages\n");
+        }
+        if (strchr(argv[1], 'r')) {
+            use_reliable = true;
+            printf("Using reliable UDP\n");
+        }
+        if (strchr(argv[1], 'q')) {
+            use_sequence = true;
+            printf("Using UDP sequence numbers\n");
+        }
     }
     if (argc >= 3) {
         if (argv[1][0] != '-') {
@@ -71,7 +106,25 @@ int main(int argc, const char *argv[])
         printf("WARNING: o2client ignoring extra command line argments\n");
     }
 
+#ifndef O2_NO_UNIXSOCK
+    if (use_inet) {
+        o2_unix_sockets_enable(false);
+    }
+#endif
     o2_initialize("test");
+#ifndef O2_NO_BUNDLES
+    if (use_coalesce) {
+        o2assert(o2_udp_coalesce(1400) == O2_SUCCESS);
+    }
+#endif
+    if (use_sequence) {
+        o2assert(o2_udp_sequence(true) == O2_SUCCESS);
+    }
+#ifndef O2_NO_NETTHREAD
+    if (use_thread) {
+        o2assert(o2_network_thread(true) == O2_SUCCESS);
+    }
+#endif
 #ifndef O2_NO_BRIDGES
     o2lite_initialize(); // enable o2lite - this test is used with o2litedisc
 #endif
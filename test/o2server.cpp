@@ -17,10 +17,17 @@
 char **client_addresses;
 int n_addrs = 20;
 int use_tcp = false;
+bool use_thread = false;
+bool use_inet = false;
+bool use_coalesce = false;
+bool use_reliable = false;
+bool use_sequence = false;
+bool use_budget = false;
 
 #define MAX_MSG_COUNT 1000
 
 int msg_count = 0;
+int extra_count = 0;
 bool running = true;
 
 // this is a handler for incoming messages. It simply sends a message
@@ -33,6 +40,9 @@ void server_test(O2msg_data_ptr msg, const char *types,
     msg_count++;
     if (use_tcp) 
         o2_send_cmd(client_addresses[msg_count % n_addrs], 0, "i", msg_count);
+    else if (use_reliable)
+        o2_send_reliable(client_addresses[msg_count % n_addrs], 0, "i",
+                         msg_count);
     else
         o2_send(client_addresses[msg_count % n_addrs], 0, "i", msg_count);
     if (msg_count % 10000 == 0) {
@@ -49,12 +59,57 @@ void server_test(O2msg_data_ptr msg, const char *types,
 }
 
 
+// handler for extra messages the client sends when coalescing
+//
+void server_extra(O2msg_data_ptr msg, const char *types,
+                  O2arg_ptr *argv, int argc, const void *user_data)
+{
+    extra_count++;
+}
+
+
+// handler for replies to !_o2/ss with socket stats
+//
+int ss_replies = 0;
+int64_t ss_max_in = 0;
+void server_socket_stats(O2msg_data_ptr msg, const char *types,
+                         O2arg_ptr *argv, int argc, const void *user_data)
+{
+    o2assert(argc == 13);
+    ss_replies++;
+    if (argv[4]->h > ss_max_in) ss_max_in = argv[4]->h;
+}
+
+
+// handler for replies to !_o2/us with UDP stats for the client
+//
+char us_client[64];
+int64_t us_received = -1;
+int64_t us_lost = -1;
+void server_udp_stats(O2msg_data_ptr msg, const char *types,
+                      O2arg_ptr *argv, int argc, const void *user_data)
+{
+    printf("UDP from %s to %s: received %lld lost %lld reordered %lld\n",
+           argv[1]->s, argv[0]->s, (long long) argv[2]->h,
+           (long long) argv[3]->h, (long long) argv[4]->h);
+    strncpy(us_client, argv[1]->s, 63);
+    us_received = argv[2]->h;
+    us_lost = argv[3]->h;
+}
+
+
 int main(int argc, const char *argv[])
 {
     printf("Usage: o2server [debugflags] [n_addrs]\n"
            "    see o2.h for flags, use a for (almost) all, - for none\n"
            "    n_addrs is number of addresses to use, default 20\n"
-           "    end n_addrs with t, e.g. 20t to use TCP\n");
+           "    end n_addrs with t, e.g. 20t to use TCP\n"
+           "    add n, e.g. 20tn, to use the network thread\n"
+           "    add i, e.g. 20ti, to use TCP/UDP for local processes\n"
+           "    add b, e.g. 20ib, to coalesce UDP messages in bundles\n"
+           "    add r, e.g. 20ir, to use reliable UDP\n"
+           "    add q, e.g. 20iq, to count UDP loss with sequence numbers\n"
+           "    add g, e.g. 20ig, to limit the work per o2_poll()\n");
     if (argc >= 2) {
         if (argv[1][0] != '-') {
             o2_debug_flags(argv[1]);
@@ -69,12 +124,58 @@ int main(int argc, const char *argv[])
             use_tcp = true;
             printf("Using TCP\n");
         }
+        if (strchr(argv[2], 'n')) {
+            use_thread = true;
+            printf("Using network thread\n");
+        }
+        if (strchr(argv[2], 'i')) {
+            use_inet = true;
+            printf("Not using Unix-domain sockets\n");
+        }
+        if (strchr(argv[2], 'b')) {
+            use_coalesce = true;
+            printf("Coalescing UDP messages\n");
+        }
+        if (strchr(argv[2], 'r')) {
+            use_reliable = true;
+            printf("Using reliable UDP\n");
+        }
+        if (strchr(argv[2], 'q')) {
+            use_sequence = true;
+            printf("Using UDP sequence numbers\n");
+        }
+        if (strchr(argv[2], 'g')) {
+            use_budget = true;
+            printf("Using a poll budget\n");
+        }
     }
     if (argc > 3) {
         printf("WARNING: o2server ignoring extra command line argments\n");
     }
 
+#ifndef O2_NO_UNIXSOCK
+    if (use_inet) {
+        o2_unix_sockets_enable(false);
+    }
+#endif
     o2_initialize("test");
+#ifndef O2_NO_BUNDLES
+    if (use_coalesce) {
+        o2assert(o2_udp_coalesce(1400) == O2_SUCCESS);
+    }
+#endif
+    if (use_sequence) {
+        o2assert(o2_udp_sequence(true) == O2_SUCCESS);
+    }
+    if (use_budget) {
+        o2assert(o2_poll_budget(-1, 0) == O2_BAD_ARGS);
+        o2assert(o2_poll_budget(1, 0) == O2_SUCCESS);
+    }
+#ifndef O2_NO_NETTHREAD
+    if (use_thread) {
+        o2assert(o2_network_thread(true) == O2_SUCCESS);
+    }
+#endif
     o2_service_new("server");
     
     // add our handler for incoming messages to each server address
@@ -83,6 +184,11 @@ int main(int argc, const char *argv[])
         sprintf(path, "/server/benchmark/%d", i);
         o2_method_new(path, "i", &server_test, NULL, false, true);
     }
+    o2_method_new("/server/extra", "i", &server_extra, NULL, false, true);
+    o2_method_new("/server/us", "sshhh", &server_udp_stats, NULL,
+                  false, true);
+    o2_method_new("/server/ss", "sisshhhhihhdd", &server_socket_stats, NULL,
+                  false, true);
     
     // create an address for each destination so we do not have to
     // do string manipulation to send a message
@@ -119,6 +225,56 @@ int main(int argc, const char *argv[])
         o2_sleep(2); // 2ms // as fast as possible
     }
 
+    if (use_sequence) {  // check stats while the client is connected
+        o2_send_cmd("!_o2/us", 0, "s", "!server/us");
+        for (int i = 0; i < 100 && us_received < 0; i++) {
+            o2_poll();
+        }
+        O2udp_peer_stats stats;
+        o2assert(us_received > 0);  // one reply (from the client)
+        o2assert(o2_udp_peer_stats(us_client, &stats, false) == O2_SUCCESS);
+        // more datagrams may have arrived since the reply:
+        o2assert(stats.received >= us_received && stats.lost == us_lost);
+        o2assert(stats.received >= msg_count && stats.lost == 0);
+    }
+
+    // check socket stats while the client is connected (without i, the
+    // client may use a shared memory ring instead of a socket):
+    if (use_tcp && use_inet) {
+        O2socket_stats stats;
+        int64_t max_in = 0, max_out = 0;
+        int n = 0;
+        while (o2_socket_stats(n, &stats, false) == O2_SUCCESS) {
+            o2assert(stats.kind);
+            if (stats.messages_in > max_in) max_in = stats.messages_in;
+            if (stats.messages_out > max_out) max_out = stats.messages_out;
+            o2assert(stats.bytes_in >= stats.messages_in);
+            o2assert(stats.queued_messages >= 0 && stats.blocked_time >= 0);
+            n++;
+        }
+        printf("%d sockets, at most %lld messages in and %lld out\n", n,
+               (long long) max_in, (long long) max_out);
+        o2assert(max_in >= msg_count && max_out >= msg_count);
+        o2_send_cmd("!_o2/ss", 0, "s", "!server/ss");
+        for (int i = 0; i < 100 && ss_replies < n; i++) {
+            o2_poll();
+        }
+        o2assert(ss_replies >= n && ss_max_in >= max_in);
+    }
+
+    if (use_budget) {
+        O2poll_budget_stats stats;
+        o2assert(o2_poll_budget_stats(&stats, true) == O2_SUCCESS);
+        printf("poll budget: %lld polls, %lld exhausted, %lld messages, "
+               "at most %d in one poll\n", (long long) stats.polls,
+               (long long) stats.exhausted, (long long) stats.messages,
+               stats.max_messages);
+        o2assert(stats.polls > 0 && stats.messages >= msg_count);
+        o2assert(stats.max_messages >= 1);
+        o2assert(o2_poll_budget_stats(&stats, false) == O2_SUCCESS);
+        o2assert(stats.polls == 0 && stats.messages == 0);
+    }
+
     // o2client.htm waits 1s before closing socket, so give it time
     now = o2_time_get();
     while (o2_time_get() < now + 2) {
@@ -130,6 +286,10 @@ int main(int argc, const char *argv[])
         O2_FREE(client_addresses[i]);
     }
     O2_FREE(client_addresses);
+    if (use_coalesce) {  // client sends an extra message with all but one
+        printf("server received %d extra messages\n", extra_count);
+        o2assert(extra_count == msg_count - 1);
+    }
 
     o2_finish();
     printf("SERVER DONE\n");
@@ -0,0 +1,189 @@
+//  peercacheclient.c - test o2_peer_cache()
+//
+// use with peercacheserver.c, which offers service "server".
+//
+// Algorithm for test:
+// - remove the cache file, start O2 with o2_peer_cache() and wait to
+//   discover service "server", send !server/hi and finish, which
+//   writes the cache file
+// - check that the file lists the server and this process
+// - add entries to the file: a bad one (the server's IP addresses
+//   with port 1, where nothing listens), an expired one (port 2) and
+//   one of another ensemble (port 3)
+// - restart with broadcasting disabled (the server has disabled it
+//   too), so the server can only be found through the cache, and wait
+//   for service "server"
+// - add an entry (port 4) to the file as another process sharing the
+//   file would, send !server/hi and finish
+// - check that the file lists the server and the entries with ports 3
+//   and 4, but not the bad and expired entries
+
+#include "o2.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "time.h"
+#include "testassert.h"
+
+#define CACHE_FILE "peercache.txt"
+#define MAX_AGE 100.0
+
+char server_name[O2_MAX_PROCNAME_LEN];
+char server_pip[O2N_IP_LEN];
+char server_iip[O2N_IP_LEN];
+char my_name[O2_MAX_PROCNAME_LEN];
+
+
+void service_info_handler(O2msg_data_ptr data, const char *types,
+                          O2arg_ptr *argv, int argc, const void *user_data)
+{
+    const char *service_name = argv[0]->s;
+    int status = argv[1]->i32;
+    const char *process = argv[2]->s;
+    printf("# service_info_handler called: %s at %s status %d\n",
+           service_name, process, status);
+    if (status >= O2_REMOTE_NOTIME && streql(service_name, "server")) {
+        strncpy(server_name, process, O2_MAX_PROCNAME_LEN - 1);
+    }
+}
+
+
+void delay_for(double delay)
+{
+    O2time done = o2_local_time() + delay;
+    while (o2_local_time() < done) {
+        o2_poll();
+        o2_sleep(2);
+    }
+}
+
+
+#ifndef O2_NO_PEERCACHE
+// start O2 with the peer cache and wait for the server
+void run_start(bool broadcast)
+{
+    o2_initialize("test");
+#ifndef O2_NO_HUB
+    if (!broadcast) {
+        o2_hub(0, NULL, NULL, 0, 0);
+    }
+#endif
+    o2assert(o2_peer_cache(CACHE_FILE, MAX_AGE) == O2_SUCCESS);
+    o2_method_new("/_o2/si", "siss", &service_info_handler, NULL,
+                  false, true);
+    server_name[0] = 0;
+    O2time timeout = o2_local_time() + 30;
+    while (o2_status("server") < O2_REMOTE_NOTIME) {
+        o2_poll();
+        o2_sleep(2);
+        if (o2_local_time() > timeout) {
+            printf("FAILURE -- timed out waiting for server\n");
+            o2assert(false);
+        }
+    }
+    o2assert(server_name[0]);
+    printf("# found server %s\n", server_name);
+    const char *pip;
+    const char *iip;
+    int my_port;
+    o2assert(o2_get_addresses(&pip, &iip, &my_port) == O2_SUCCESS);
+    snprintf(my_name, O2_MAX_PROCNAME_LEN, "@%s:%s:%04x", pip, iip, my_port);
+}
+
+
+// say hi to the server and finish, which writes the cache file
+void run_finish()
+{
+    o2_send_cmd("!server/hi", 0, "s", my_name);
+    delay_for(0.5);
+    o2_finish();
+}
+
+
+// name of an entry with the server's IP addresses and port
+const char *entry_name(int port)
+{
+    static char name[O2_MAX_PROCNAME_LEN];
+    snprintf(name, O2_MAX_PROCNAME_LEN, "@%s:%s:%04x", server_pip,
+             server_iip, port);
+    return name;
+}
+
+
+void add_entry(int port, double seen, const char *ensemble)
+{
+    FILE *outf = fopen(CACHE_FILE, "a");
+    o2assert(outf);
+    fprintf(outf, "%s %x 0 %.0f %s\n", entry_name(port), O2_VERSION,
+            seen, ensemble);
+    fclose(outf);
+}
+
+
+// is there a line for name in ensemble in the cache file?
+bool has_entry(const char *name, const char *ensemble)
+{
+    FILE *inf = fopen(CACHE_FILE, "r");
+    o2assert(inf);
+    char line[256];
+    bool found = false;
+    while (!found && fgets(line, 256, inf)) {
+        char entry[64];
+        char ens[64];
+        int version, udp_port;
+        double seen;
+        if (sscanf(line, "%63s %x %d %lf %63s", entry, &version, &udp_port,
+                   &seen, ens) == 5) {
+            found = streql(entry, name) && streql(ens, ensemble);
+        }
+    }
+    fclose(inf);
+    printf("# %s %s in %s\n", name, found ? "is" : "is not", CACHE_FILE);
+    return found;
+}
+#endif
+
+
+int main(int argc, const char *argv[])
+{
+    printf("Usage: peercacheclient [debugflags]\n"
+           "    see o2.h for flags, use a for (almost) all, - for none\n");
+    if (argc >= 2) {
+        o2_debug_flags(argv[1]);
+        printf("debug flags are: %s\n", argv[1]);
+    }
+    if (argc > 2) {
+        printf("WARNING: peercacheclient ignoring extra command line "
+               "argments\n");
+    }
+#ifndef O2_NO_PEERCACHE
+    remove(CACHE_FILE);
+    run_start(true);
+    int server_port;
+    o2assert(o2_parse_name(server_name, server_pip, server_iip,
+                           &server_port) == O2_SUCCESS);
+    run_finish();
+    o2assert(has_entry(server_name, "test"));
+    o2assert(has_entry(my_name, "test"));
+
+    double now = (double) time(NULL);
+    add_entry(1, now, "test");
+    add_entry(2, now - 2 * MAX_AGE, "test");
+    add_entry(3, now, "other");
+
+    run_start(false);
+    add_entry(4, now, "test");
+    run_finish();
+    o2assert(has_entry(server_name, "test"));
+    o2assert(has_entry(my_name, "test"));
+    o2assert(!has_entry(entry_name(1), "test"));
+    o2assert(!has_entry(entry_name(2), "test"));
+    o2assert(has_entry(entry_name(3), "other"));
+    o2assert(has_entry(entry_name(4), "test"));
+    remove(CACHE_FILE);
+#else
+    printf("O2_NO_PEERCACHE defined, so there are no tests that can fail\n");
+#endif
+    printf("PEERCACHECLIENT DONE\n");
+    return 0;
+}
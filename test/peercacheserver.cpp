@@ -0,0 +1,68 @@
+//  peercacheserver.c - test o2_peer_cache()
+//
+// use with peercacheclient.c, which runs O2 twice with a peer cache.
+// This process offers service "server" and waits for /server/hi from
+// each run. After the first one, it disables broadcasting with
+// o2_hub(NULL) so that the second run can only find this process
+// through the cache.
+
+#include "o2.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "testassert.h"
+
+int hi_count = 0;
+
+
+void hi_handler(O2msg_data_ptr data, const char *types,
+                O2arg_ptr *argv, int argc, const void *user_data)
+{
+    printf("# got hi from %s\n", argv[0]->s);
+    hi_count++;
+#ifndef O2_NO_HUB
+    if (hi_count == 1) {
+        o2_hub(0, NULL, NULL, 0, 0);
+    }
+#endif
+}
+
+
+int main(int argc, const char *argv[])
+{
+    printf("Usage: peercacheserver [debugflags]\n"
+           "    see o2.h for flags, use a for (almost) all, - for none\n");
+    if (argc >= 2) {
+        o2_debug_flags(argv[1]);
+        printf("debug flags are: %s\n", argv[1]);
+    }
+    if (argc > 2) {
+        printf("WARNING: peercacheserver ignoring extra command line "
+               "argments\n");
+    }
+#ifndef O2_NO_PEERCACHE
+    o2_initialize("test");
+    o2_service_new("server");
+    o2_method_new("/server/hi", "s", &hi_handler, NULL, false, true);
+
+    O2time timeout = o2_local_time() + 60;
+    while (hi_count < 2) {
+        o2_poll();
+        o2_sleep(2);
+        if (o2_local_time() > timeout) {
+            printf("FAILURE -- timed out waiting for hi\n");
+            o2assert(false);
+        }
+    }
+    O2time done = o2_local_time() + 0.5;
+    while (o2_local_time() < done) {
+        o2_poll();
+        o2_sleep(2);
+    }
+    o2_finish();
+#else
+    printf("O2_NO_PEERCACHE defined, so there are no tests that can fail\n");
+#endif
+    printf("PEERCACHESERVER DONE\n");
+    return 0;
+}
@@ -11,6 +11,7 @@
 //    search for services with attr and value pattern with :
 //    search for services with attr and value pattern with ;
 //    search for services with attr and value pattern within
+//    find services with attr and exact value using the property index
 //    change value
 //    get the changed value
 //    remove the value
@@ -18,6 +19,7 @@
 //    add several new attr/values 2 3 4 5 6
 //    remove attrs 3 5
 //    get and check full properties string
+//    find services with escaped values and with shared values
 
 
 #include <stdio.h>
@@ -136,6 +138,14 @@ int main(int argc, const char * argv[])
     o2assert(o2_service_search(0, "attr1", ":twovalue1two;") == two);
     o2assert(o2_service_search(0, "attr1", ":value1two;") == -1);
 
+    // find services with attr and exact value using the property index
+    o2assert(streql(o2_service_with_property("attr0", "value0", 0), "one"));
+    o2assert(o2_service_with_property("attr0", "value0", 1) == NULL);
+    o2assert(streql(o2_service_with_property("attr1", "twovalue1two", 0),
+                    "two"));
+    o2assert(o2_service_with_property("attr1", "value1", 0) == NULL);
+    o2assert(o2_service_with_property("attr0", "value1", 0) == NULL);
+
     // change value
     o2assert(o2_service_set_property("one", "attr1", "newvalue1") == O2_SUCCESS);
     o2assert(o2_services_list_free() == O2_SUCCESS);
@@ -144,6 +154,8 @@ int main(int argc, const char * argv[])
     gp = o2_service_getprop(one, "attr1");
     o2assert(streql(gp, "newvalue1"));
     O2_FREE((char *) gp);
+    o2assert(streql(o2_service_with_property("attr1", "newvalue1", 0),
+                    "one"));
 
     // remove the value
     o2assert(o2_service_property_free("one", "attr1") == O2_SUCCESS);
@@ -152,6 +164,7 @@ int main(int argc, const char * argv[])
     lookup();
     gp = o2_service_getprop(one, "attr1");
     o2assert(gp == NULL);
+    o2assert(o2_service_with_property("attr1", "newvalue1", 0) == NULL);
     gp = o2_service_properties(one);
     o2assert(streql(gp, "attr0:value0;"));
     // add several new attr/values 2 3 4 5 6
@@ -228,6 +241,30 @@ int main(int argc, const char * argv[])
     O2_FREE((char *) gp);
     o2assert(o2_services_list_free() == O2_SUCCESS);
 
+    // find services with escaped values and with shared values
+    o2assert(streql(o2_service_with_property("attr1", "\\;\\:\\\\", 0),
+                    "one"));
+    o2assert(o2_service_with_property("attr1", ";:\\", 0) == NULL);
+    o2assert(o2_service_set_property("two", "attr5", "shared") ==
+             O2_SUCCESS);
+    o2assert(o2_service_set_property("one", "attr5", "shared") ==
+             O2_SUCCESS);
+    const char *s0 = o2_service_with_property("attr5", "shared", 0);
+    const char *s1 = o2_service_with_property("attr5", "shared", 1);
+    o2assert(s0 && s1 && !streql(s0, s1));
+    o2assert(streql(s0, "one") || streql(s0, "two"));
+    o2assert(streql(s1, "one") || streql(s1, "two"));
+    o2assert(o2_service_with_property("attr5", "shared", 2) == NULL);
+    o2assert(o2_service_free("two") == O2_SUCCESS);
+    o2assert(streql(o2_service_with_property("attr5", "shared", 0), "one"));
+    o2assert(o2_service_with_property("attr5", "shared", 1) == NULL);
+    // "one" moved to the slot freed by "two", where changing it must
+    // find and remove it:
+    o2assert(o2_service_set_property("one", "attr5", "other") ==
+             O2_SUCCESS);
+    o2assert(o2_service_with_property("attr5", "shared", 0) == NULL);
+    o2assert(streql(o2_service_with_property("attr5", "other", 0), "one"));
+
     o2_finish();
     printf("\nDONE\n");  // leading newline is required by rt.py to find success
     return 0;
@@ -0,0 +1,23 @@
+#!/bin/sh
+
+# regression_run_four program1 program2
+# runs program1 and three copies of program2 in parallel, saves output
+# of each in output.txt, output2.txt, output3.txt and output4.txt, and
+# waits for them to terminate. program1 is started first. See
+# regression_run_two.sh for why we use a script.
+
+$1 > output.txt &
+PID1=$!
+sleep 0.5
+$2 > output2.txt &
+PID2=$!
+sleep 0.5
+$2 > output3.txt &
+PID3=$!
+sleep 0.5
+$2 > output4.txt
+PID4=$!
+wait $PID1
+wait $PID2
+wait $PID3
+wait $PID4
@@ -75,6 +75,23 @@ rundouble(){
 }
 
 
+# runfour prog1 done1 prog2 done2 - runs prog1 and three copies of
+#    prog2, which must all print their done lines
+runfour(){
+    printf "%30s: "  "$1+3*$3"
+    ./regression_run_four.sh "$BIN/$1" "$BIN/$3" &>misc.txt 2>&1
+    if grep -Fxq "$2" output.txt && grep -Fxq "$4" output2.txt &&
+       grep -Fxq "$4" output3.txt && grep -Fxq "$4" output4.txt
+    then
+        echo "PASS"
+        status=0
+    else
+        echo "FAIL"
+        status=-1
+    fi
+}
+
+
 runwstest(){
     printf "%30s: "  "$1+$3"
     ./regression_run_wstest.sh "$BIN/$1" "$BIN" "$3" &>misc.txt 2>&1
@@ -123,6 +140,9 @@ while true; do
     runtest "arraytest"
     if [ $status == -1 ]; then break; fi
 
+    runtest "timebench"
+    if [ $status == -1 ]; then break; fi
+
     runtest "bridgeapi"
     if [ $status == -1 ]; then break; fi
 
@@ -183,6 +203,10 @@ while true; do
 
     rundouble "clockref" "CLOCKREF DONE" "clockmirror" "CLOCKMIRROR DONE"
     if [ $status == -1 ]; then break; fi
+    rundouble "clockref - b" "CLOCKREF DONE" "clockmirror" "CLOCKMIRROR DONE"
+    if [ $status == -1 ]; then break; fi
+    rundouble "clockdriftref" "CLOCKDRIFTREF DONE" "clockdrift" "CLOCKDRIFT DONE"
+    if [ $status == -1 ]; then break; fi
 
     rundouble "applead" "APPLEAD DONE" "appfollow" "APPFOLLOW DONE"
     if [ $status == -1 ]; then break; fi
@@ -193,9 +217,29 @@ while true; do
     rundouble "o2client 1000t" "CLIENT DONE" "o2server - 20t" "SERVER DONE"
     if [ $status == -1 ]; then break; fi
 
+    rundouble "o2client 1000tn" "CLIENT DONE" "o2server - 20tn" "SERVER DONE"
+    if [ $status == -1 ]; then break; fi
+
+    rundouble "o2client 1000ti" "CLIENT DONE" "o2server - 20ti" "SERVER DONE"
+    if [ $status == -1 ]; then break; fi
+
+    rundouble "o2client 1000ib" "CLIENT DONE" "o2server - 20ib" "SERVER DONE"
+    if [ $status == -1 ]; then break; fi
+
+    rundouble "o2client 1000ir" "CLIENT DONE" "o2server - 20ir" "SERVER DONE"
+    if [ $status == -1 ]; then break; fi
+    rundouble "o2client 1000iq" "CLIENT DONE" "o2server - 20iq" "SERVER DONE"
+    if [ $status == -1 ]; then break; fi
+
+    rundouble "o2client 1000tg" "CLIENT DONE" "o2server - 20tg" "SERVER DONE"
+    if [ $status == -1 ]; then break; fi
+
     rundouble "nonblocksend" "CLIENT DONE" "nonblockrecv" "SERVER DONE"
     if [ $status == -1 ]; then break; fi
 
+    rundouble "conflatesend" "CLIENT DONE" "conflaterecv" "SERVER DONE"
+    if [ $status == -1 ]; then break; fi
+
     rundouble "o2unblock" "CLIENT DONE" "o2block" "SERVER DONE"
     if [ $status == -1 ]; then break; fi
 
@@ -211,9 +255,15 @@ while true; do
     rundouble "tcpclient" "CLIENT DONE" "tcpserver" "SERVER DONE"
     if [ $status == -1 ]; then break; fi
 
+    rundouble "streamsend" "CLIENT DONE" "streamrecv" "SERVER DONE"
+    if [ $status == -1 ]; then break; fi
+
     rundouble "hubclient" "HUBCLIENT DONE" "hubserver" "HUBSERVER DONE"
     if [ $status == -1 ]; then break; fi
 
+    runfour "meshhub" "MESHHUB DONE" "meshclient" "MESHCLIENT DONE"
+    if [ $status == -1 ]; then break; fi
+
     rundouble "propsend" "DONE" "proprecv" "DONE"
     if [ $status == -1 ]; then break; fi
 
@@ -226,6 +276,15 @@ while true; do
     rundouble "dropclient" "DROPCLIENT DONE" "dropserver" "DROPSERVER DONE"
     if [ $status == -1 ]; then break; fi
 
+    rundouble "peercacheclient" "PEERCACHECLIENT DONE" "peercacheserver" "PEERCACHESERVER DONE"
+    if [ $status == -1 ]; then break; fi
+
+    rundouble "svdeltaclient" "SVDELTACLIENT DONE" "svdeltaserver" "SVDELTASERVER DONE"
+    if [ $status == -1 ]; then break; fi
+
+    rundouble "rudpsend" "RUDPSEND DONE" "rudprecv" "RUDPRECV DONE"
+    if [ $status == -1 ]; then break; fi
+
     rundouble "o2client 1000t" "CLIENT DONE" "shmemserv u" "SERVER DONE"
     if [ $status == -1 ]; then break; fi
 
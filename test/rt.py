@@ -497,6 +497,8 @@ def runAllTests():
                      "clockmirror", "CLOCKMIRROR DONE"): return
     if not runDouble("clockref", "CLOCKREF DONE",
                      "clockmirror", "CLOCKMIRROR DONE"): return
+    if not runDouble("clockdriftref", "CLOCKDRIFTREF DONE",
+                     "clockdrift", "CLOCKDRIFT DONE"): return
     if not runDouble("applead", "APPLEAD DONE",
                      "appfollow", "APPFOLLOW DONE"): return
     if not runDouble("o2client", "CLIENT DONE",
@@ -520,12 +522,22 @@ def runAllTests():
     if have_hub_tests:
         if not runDouble("hubclient", "HUBCLIENT DONE",
                          "hubserver", "HUBSERVER DONE", True): return
+        if not runFour("meshhub", "MESHHUB DONE",
+                       "meshclient", "MESHCLIENT DONE",
+                       "meshclient", "MESHCLIENT DONE",
+                       "meshclient", "MESHCLIENT DONE"): return
     else:
         print("hubclient or hubserver not found, skipping hub test.")
     if not runDouble("propsend", "DONE",
                      "proprecv", "DONE"): return
     if not runDouble("dropclient", "DROPCLIENT DONE",
                      "dropserver", "DROPSERVER DONE"): return
+    if not runDouble("peercacheclient", "PEERCACHECLIENT DONE",
+                     "peercacheserver", "PEERCACHESERVER DONE"): return
+    if not runDouble("svdeltaclient", "SVDELTACLIENT DONE",
+                     "svdeltaserver", "SVDELTASERVER DONE"): return
+    if not runDouble("rudpsend", "RUDPSEND DONE",
+                     "rudprecv", "RUDPRECV DONE"): return
     if not runDouble("o2client 1000t", "CLIENT DONE",
                      "shmemserv u", "SERVER DONE"): return
 
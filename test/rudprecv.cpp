@@ -0,0 +1,88 @@
+//  rudprecv.c - test reliable UDP with lost messages
+//
+// use with rudpsend.c, which sends N_MSGS messages with
+// o2_send_reliable() to each of N_ADDRS addresses of service
+// "server", interleaved. Shared memory rings are disabled so that the
+// messages go through the socket, and o2_rudp_drop_every makes this
+// process drop every DROP_EVERY-th envelope as if it were lost. Each
+// address must still receive 0, 1, 2, ... N_MSGS - 1 in order. Then
+// this process sends !client/done.
+
+#include "o2internal.h"
+#include "rudp.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "testassert.h"
+
+#define N_ADDRS 4
+#define N_MSGS 200
+#define DROP_EVERY 7
+
+int expected[N_ADDRS];
+
+
+void server_handler(O2msg_data_ptr data, const char *types,
+                    O2arg_ptr *argv, int argc, const void *user_data)
+{
+    int k = (int) (intptr_t) user_data;
+    if (argv[0]->i32 != expected[k]) {
+        printf("FAILURE -- %s got %d, expected %d\n", data->address,
+               argv[0]->i32, expected[k]);
+        o2assert(false);
+    }
+    expected[k]++;
+}
+
+
+int main(int argc, const char *argv[])
+{
+    printf("Usage: rudprecv [debugflags]\n"
+           "    see o2.h for flags, use a for (almost) all, - for none\n");
+    if (argc >= 2) {
+        o2_debug_flags(argv[1]);
+        printf("debug flags are: %s\n", argv[1]);
+    }
+    if (argc > 2) {
+        printf("WARNING: rudprecv ignoring extra command line argments\n");
+    }
+#ifndef O2_NO_RUDP
+#ifndef O2_NO_SHMRING
+    o2_shm_rings_enable(false);
+#endif
+    o2_initialize("test");
+    o2_rudp_drop_every = DROP_EVERY;
+    o2_service_new("server");
+    for (int k = 0; k < N_ADDRS; k++) {
+        char path[32];
+        snprintf(path, 32, "/server/%c", 'a' + k);
+        o2_method_new(path, "i", &server_handler, (void *) (intptr_t) k,
+                      false, true);
+    }
+
+    O2time timeout = o2_local_time() + 60;
+    for (int k = 0; k < N_ADDRS; k++) {
+        while (expected[k] < N_MSGS) {
+            o2_poll();
+            o2_sleep(2);
+            if (o2_local_time() > timeout) {
+                printf("FAILURE -- timed out, /server/%c got %d messages\n",
+                       'a' + k, expected[k]);
+                o2assert(false);
+            }
+        }
+    }
+    printf("# received %d messages in order on each address\n", N_MSGS);
+    o2_send_cmd("!client/done", 0, "");
+    O2time done = o2_local_time() + 0.5;
+    while (o2_local_time() < done) {
+        o2_poll();
+        o2_sleep(2);
+    }
+    o2_finish();
+#else
+    printf("O2_NO_RUDP defined, so there are no tests that can fail\n");
+#endif
+    printf("RUDPRECV DONE\n");
+    return 0;
+}
@@ -0,0 +1,87 @@
+//  rudpsend.c - test reliable UDP with lost messages
+//
+// see rudprecv.c for details. This process offers service "client",
+// waits for service "server", sends the messages, waits for
+// !client/done, and checks that lost messages were retransmitted.
+
+#include "o2internal.h"
+#include "services.h"
+#include "rudp.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "testassert.h"
+
+#define N_ADDRS 4
+#define N_MSGS 200
+
+bool got_done = false;
+
+
+void done_handler(O2msg_data_ptr data, const char *types,
+                  O2arg_ptr *argv, int argc, const void *user_data)
+{
+    got_done = true;
+}
+
+
+int main(int argc, const char *argv[])
+{
+    printf("Usage: rudpsend [debugflags]\n"
+           "    see o2.h for flags, use a for (almost) all, - for none\n");
+    if (argc >= 2) {
+        o2_debug_flags(argv[1]);
+        printf("debug flags are: %s\n", argv[1]);
+    }
+    if (argc > 2) {
+        printf("WARNING: rudpsend ignoring extra command line argments\n");
+    }
+#ifndef O2_NO_RUDP
+#ifndef O2_NO_SHMRING
+    o2_shm_rings_enable(false);
+#endif
+    o2_initialize("test");
+    o2_service_new("client");
+    o2_method_new("/client/done", "", &done_handler, NULL, false, true);
+
+    O2time timeout = o2_local_time() + 30;
+    while (o2_status("server") < O2_REMOTE_NOTIME) {
+        o2_poll();
+        o2_sleep(2);
+        if (o2_local_time() > timeout) {
+            printf("FAILURE -- timed out waiting for server\n");
+            o2assert(false);
+        }
+    }
+
+    for (int i = 0; i < N_MSGS; i++) {
+        for (int k = 0; k < N_ADDRS; k++) {
+            char address[32];
+            snprintf(address, 32, "/server/%c", 'a' + k);
+            o2assert(o2_send_reliable(address, 0, "i", i) == O2_SUCCESS);
+        }
+        o2_poll();
+    }
+
+    timeout = o2_local_time() + 60;
+    while (!got_done) {
+        o2_poll();
+        o2_sleep(2);
+        if (o2_local_time() > timeout) {
+            printf("FAILURE -- timed out waiting for done\n");
+            o2assert(false);
+        }
+    }
+    Services_entry *services;
+    O2node *proc = Services_entry::service_find("server", &services);
+    o2assert(proc && ISA_PROC(proc) && TO_PROC_INFO(proc)->rudp);
+    int64_t retransmits = TO_PROC_INFO(proc)->rudp->retransmits;
+    printf("# %lld messages were retransmitted\n", (long long) retransmits);
+    o2assert(retransmits > 0);
+    o2_finish();
+#else
+    printf("O2_NO_RUDP defined, so there are no tests that can fail\n");
+#endif
+    printf("RUDPSEND DONE\n");
+    return 0;
+}
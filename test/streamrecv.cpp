@@ -0,0 +1,92 @@
+//  streamrecv.cpp - test for large messages and o2_blob_stream()
+//
+//  This program works with streamsend.cpp. It raises the maximum
+//  message size, receives one large blob as a single message, then
+//  receives a blob sent as a stream of chunks, checks the data, and
+//  tells streamsend that it is done.
+
+#include "o2.h"
+#include <stdio.h>
+#include <string.h>
+#include "testassert.h"
+
+#define BIG_SIZE 200000
+#define STREAM_SIZE 1000003
+
+char stream_data[STREAM_SIZE];
+int64_t stream_received = 0;
+bool got_big = false;
+bool running = true;
+
+
+void big_handler(O2msg_data_ptr msg, const char *types,
+                 O2arg_ptr *argv, int argc, const void *user_data)
+{
+    O2blob_ptr blob = &argv[0]->b;
+    o2assert(blob->size == BIG_SIZE);
+    for (int i = 0; i < BIG_SIZE; i++) {
+        o2assert(blob->data[i] == (char) (i * 7));
+    }
+    printf("streamrecv got %d byte message\n", blob->size);
+    got_big = true;
+}
+
+
+void chunk_handler(O2msg_data_ptr msg, const char *types,
+                   O2arg_ptr *argv, int argc, const void *user_data)
+{
+    int64_t offset = argv[1]->h;
+    int64_t total = argv[2]->h;
+    O2blob_ptr blob = &argv[3]->b;
+    o2assert(total == STREAM_SIZE);
+    o2assert(offset == stream_received);  // chunks arrive in order
+    o2assert(offset + blob->size <= STREAM_SIZE);
+    memcpy(stream_data + offset, blob->data, blob->size);
+    stream_received += blob->size;
+    if (stream_received == STREAM_SIZE) {
+        for (int i = 0; i < STREAM_SIZE; i++) {
+            o2assert(stream_data[i] == (char) (i * 3));
+        }
+        printf("streamrecv got %d byte stream\n", STREAM_SIZE);
+        o2assert(got_big);
+        o2_send_cmd("!streamsend/done", 0, "");
+        running = false;
+    }
+}
+
+
+int main(int argc, const char * argv[])
+{
+    printf("Usage: streamrecv [debugflags] "
+           "(see o2.h for flags, use a for (almost) all)\n");
+    if (argc == 2) {
+        o2_debug_flags(argv[1]);
+        printf("debug flags are: %s\n", argv[1]);
+    }
+    if (argc > 2) {
+        printf("WARNING: streamrecv ignoring extra command line argments\n");
+    }
+
+    o2_initialize("test");
+    o2assert(o2_set_max_message_size(100) == O2_BAD_ARGS);
+    o2assert(o2_set_max_message_size(1 << 20) == O2_SUCCESS);
+    o2_service_new("streamrecv");
+    o2_method_new("/streamrecv/big", "b", &big_handler, NULL, false, true);
+    o2_method_new("/streamrecv/chunk", "ihhb", &chunk_handler,
+                  NULL, false, true);
+    o2_clock_set(NULL, NULL);
+
+    while (running) {
+        o2_poll();
+        o2_sleep(2);
+    }
+    // poll some more to make sure last message goes out
+    for (int i = 0; i < 100; i++) {
+        o2_poll();
+        o2_sleep(2);
+    }
+    o2_finish();
+    o2_sleep(1000); // clean up sockets
+    printf("SERVER DONE\n");
+    return 0;
+}
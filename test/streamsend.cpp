@@ -0,0 +1,96 @@
+//  streamsend.cpp - test for large messages and o2_blob_stream()
+//
+//  see streamrecv.cpp for details
+
+#include "o2.h"
+#include <stdio.h>
+#include <string.h>
+#include "testassert.h"
+
+#define BIG_SIZE 200000
+#define STREAM_SIZE 1000003
+
+char big_data[BIG_SIZE];
+char stream_data[STREAM_SIZE];
+int stream_id = 0;
+O2err stream_status = O2_NO_SERVICE;  // anything but success
+bool running = true;
+
+
+void done_handler(O2msg_data_ptr msg, const char *types,
+                  O2arg_ptr *argv, int argc, const void *user_data)
+{
+    running = false;
+}
+
+
+void stream_callback(int id, O2err status, void *rock)
+{
+    o2assert(id == stream_id);
+    o2assert(rock == (void *) stream_data);
+    stream_status = status;
+    printf("streamsend stream %d finished with %s\n", id,
+           o2_error_to_string(status));
+}
+
+
+int main(int argc, const char * argv[])
+{
+    printf("Usage: streamsend [debugflags] "
+           "(see o2.h for flags, use a for (almost) all)\n");
+    if (argc == 2) {
+        o2_debug_flags(argv[1]);
+        printf("debug flags are: %s\n", argv[1]);
+    }
+    if (argc > 2) {
+        printf("WARNING: streamsend ignoring extra command line argments\n");
+    }
+
+    o2_initialize("test");
+    o2_service_new("streamsend");
+    o2_method_new("/streamsend/done", "", &done_handler, NULL, false, true);
+    for (int i = 0; i < BIG_SIZE; i++) big_data[i] = (char) (i * 7);
+    for (int i = 0; i < STREAM_SIZE; i++) stream_data[i] = (char) (i * 3);
+
+    while (o2_status("streamrecv") < O2_REMOTE) {
+        o2_poll();
+        o2_sleep(2); // 2ms
+    }
+    printf("We discovered streamrecv at time %g.\n", o2_time_get());
+
+    // the large message is refused until streamrecv announces that it
+    // accepts large messages, which happens right after discovery
+    O2err err;
+    while (true) {
+        o2_send_start();
+        o2_add_blob_data(BIG_SIZE, big_data);
+        err = o2_send_finish(0, "!streamrecv/big", true);
+        if (err != O2_MSG_TOO_BIG) break;
+        o2_poll();
+        o2_sleep(2);
+    }
+    o2assert(err == O2_SUCCESS);
+
+    // canceling a stream calls the callback with O2_FAIL
+    int id = o2_blob_stream("!streamrecv/chunk", stream_data, STREAM_SIZE,
+                            1000, &stream_callback, stream_data);
+    o2assert(id > 0);
+    stream_id = id;
+    o2assert(o2_blob_stream_cancel(id) == O2_SUCCESS);
+    o2assert(stream_status == O2_FAIL);
+    o2assert(o2_blob_stream_cancel(id) == O2_FAIL);
+
+    stream_id = o2_blob_stream("!streamrecv/chunk", stream_data, STREAM_SIZE,
+                               50000, &stream_callback, stream_data);
+    o2assert(stream_id > id);
+    while (running) {
+        o2_poll();
+        o2_sleep(1);
+    }
+    o2assert(stream_status == O2_SUCCESS);
+
+    o2_finish();
+    o2_sleep(1000); // clean up sockets
+    printf("CLIENT DONE\n");
+    return 0;
+}
@@ -0,0 +1,163 @@
+//  svdeltaclient.c - test service list deltas (see svdelta.cpp)
+//
+// see svdeltaserver.c for details. This process offers services
+// "client" and "c1".
+//
+// Algorithm for test:
+// - wait for services "server", "s1" and "stap", which arrive in a
+//   full service list (o2_svdelta_reset_count is 1)
+// - send !client/data 1, which is tapped by "stap", and wait for
+//   !client/tapped 1 from the server
+// - close the connection to the server (the server then removes "s1")
+//   and wait until "server" is gone
+// - wait for "server" to come back through discovery. The server's
+//   services and taps are restored from our cache and the server
+//   sends only its changes (o2_svdelta_delta_count is 1): "s1" must
+//   be gone, and !client/data 2 must still be tapped
+// - restart O2, which gives us a new epoch, offer "client" and "c2",
+//   and wait for !client/done from the server, which checks that it
+//   got our full service list
+
+#include "o2internal.h"
+#include "services.h"
+#include "svdelta.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "testassert.h"
+
+int tapped = 0;
+bool got_done = false;
+
+
+void data_handler(O2msg_data_ptr data, const char *types,
+                  O2arg_ptr *argv, int argc, const void *user_data)
+{
+    printf("# got /client/data %d\n", argv[0]->i32);
+}
+
+
+void tapped_handler(O2msg_data_ptr data, const char *types,
+                    O2arg_ptr *argv, int argc, const void *user_data)
+{
+    printf("# server tapped /client/data %d\n", argv[0]->i32);
+    tapped = argv[0]->i32;
+}
+
+
+void done_handler(O2msg_data_ptr data, const char *types,
+                  O2arg_ptr *argv, int argc, const void *user_data)
+{
+    got_done = true;
+}
+
+
+// poll until service is available or, if available is false, gone
+// (fail after 30s)
+void wait_for_status(const char *service, bool available)
+{
+    O2time timeout = o2_local_time() + 30;
+    while (available ? o2_status(service) < O2_REMOTE_NOTIME :
+                       o2_status(service) >= 0) {
+        o2_poll();
+        o2_sleep(2);
+        if (o2_local_time() > timeout) {
+            printf("FAILURE -- timed out waiting for %s to %s\n", service,
+                   available ? "appear" : "go away");
+            o2assert(false);
+        }
+    }
+    printf("# %s is %s\n", service, available ? "available" : "gone");
+}
+
+
+// send /client/data n and wait for the server to report the tap
+void check_tap(int n)
+{
+    o2_send_cmd("!client/data", 0, "i", n);
+    O2time timeout = o2_local_time() + 30;
+    while (tapped != n) {
+        o2_poll();
+        o2_sleep(2);
+        if (o2_local_time() > timeout) {
+            printf("FAILURE -- timed out waiting for tapped %d\n", n);
+            o2assert(false);
+        }
+    }
+}
+
+
+#ifndef O2_NO_SVDELTA
+void start(const char *service)
+{
+    o2_initialize("test");
+#ifndef O2_NO_O2DISCOVERY
+    o2_set_discovery_period(0.5);  // reconnect quickly
+#endif
+    o2_service_new("client");
+    o2_method_new("/client/data", "i", &data_handler, NULL, false, true);
+    o2_method_new("/client/tapped", "i", &tapped_handler, NULL, false, true);
+    o2_method_new("/client/done", "", &done_handler, NULL, false, true);
+    o2_service_new(service);
+}
+
+
+// close the connection to the process offering service, as if the
+// network failed
+void disconnect_from(const char *service)
+{
+    Services_entry *services;
+    O2node *proc = Services_entry::service_find(service, &services);
+    o2assert(proc && ISA_PROC(proc));
+    TO_PROC_INFO(proc)->fds_info->close_socket(true);
+}
+#endif
+
+
+int main(int argc, const char *argv[])
+{
+    printf("Usage: svdeltaclient [debugflags]\n"
+           "    see o2.h for flags, use a for (almost) all, - for none\n");
+    if (argc >= 2) {
+        o2_debug_flags(argv[1]);
+        printf("debug flags are: %s\n", argv[1]);
+    }
+    if (argc > 2) {
+        printf("WARNING: svdeltaclient ignoring extra command line "
+               "argments\n");
+    }
+#ifndef O2_NO_SVDELTA
+    start("c1");
+    wait_for_status("server", true);
+    wait_for_status("s1", true);
+    wait_for_status("stap", true);
+    o2assert(o2_svdelta_reset_count == 1 && o2_svdelta_delta_count == 0);
+    check_tap(1);
+
+    disconnect_from("server");
+    wait_for_status("server", false);
+    wait_for_status("server", true);
+    o2assert(o2_svdelta_delta_count == 1 && o2_svdelta_reset_count == 1);
+    o2assert(o2_status("s1") == O2_UNKNOWN);
+    o2assert(o2_status("stap") >= O2_REMOTE_NOTIME);
+    check_tap(2);
+    o2_finish();
+
+    start("c2");
+    O2time timeout = o2_local_time() + 30;
+    while (!got_done) {
+        o2_poll();
+        o2_sleep(2);
+        if (o2_local_time() > timeout) {
+            printf("FAILURE -- timed out waiting for done\n");
+            o2assert(false);
+        }
+    }
+    o2assert(o2_svdelta_reset_count == 1 && o2_svdelta_delta_count == 0);
+    o2_finish();
+#else
+    printf("O2_NO_SVDELTA defined, so there are no tests that can fail\n");
+#endif
+    printf("SVDELTACLIENT DONE\n");
+    return 0;
+}
@@ -0,0 +1,107 @@
+//  svdeltaserver.c - test service list deltas (see svdelta.cpp)
+//
+// use with svdeltaclient.c. This process offers services "server",
+// "s1" and "stap", and "stap" taps the client's service "client".
+//
+// Algorithm for test:
+// - wait for service "client", which arrives in a full service list
+//   (o2_svdelta_reset_count is 1)
+// - the client closes its connection to us: wait until "client" is
+//   gone, then remove "s1", so the client only learns about it from
+//   the delta when it reconnects
+// - wait for "client" to come back. The client's services and taps
+//   are restored from our cache (o2_svdelta_delta_count is 1)
+// - the client restarts O2, which gives it a new epoch, and offers
+//   "c2" instead of "c1": wait until "client" is gone and "c2" is
+//   available. The client sent its full service list
+//   (o2_svdelta_reset_count is 2), so "c1" must be gone.
+// - send !client/done, wait 0.5s and finish
+// - the "stap" handler replies to each tapped /client/data message
+//   with !client/tapped
+
+#include "o2internal.h"
+#include "svdelta.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "testassert.h"
+
+
+void stap_handler(O2msg_data_ptr data, const char *types,
+                  O2arg_ptr *argv, int argc, const void *user_data)
+{
+    printf("# tapped /client/data %d\n", argv[0]->i32);
+    o2_send_cmd("!client/tapped", 0, "i", argv[0]->i32);
+}
+
+
+// poll until service is available or, if available is false, gone
+// (fail after 30s)
+void wait_for_status(const char *service, bool available)
+{
+    O2time timeout = o2_local_time() + 30;
+    while (available ? o2_status(service) < O2_REMOTE_NOTIME :
+                       o2_status(service) >= 0) {
+        o2_poll();
+        o2_sleep(2);
+        if (o2_local_time() > timeout) {
+            printf("FAILURE -- timed out waiting for %s to %s\n", service,
+                   available ? "appear" : "go away");
+            o2assert(false);
+        }
+    }
+    printf("# %s is %s\n", service, available ? "available" : "gone");
+}
+
+
+int main(int argc, const char *argv[])
+{
+    printf("Usage: svdeltaserver [debugflags]\n"
+           "    see o2.h for flags, use a for (almost) all, - for none\n");
+    if (argc >= 2) {
+        o2_debug_flags(argv[1]);
+        printf("debug flags are: %s\n", argv[1]);
+    }
+    if (argc > 2) {
+        printf("WARNING: svdeltaserver ignoring extra command line "
+               "argments\n");
+    }
+#ifndef O2_NO_SVDELTA
+    o2_initialize("test");
+#ifndef O2_NO_O2DISCOVERY
+    o2_set_discovery_period(0.5);  // reconnect quickly
+#endif
+    o2_service_new("server");
+    o2_service_new("s1");
+    o2_service_new("stap");
+    o2_method_new("/stap/data", "i", &stap_handler, NULL, false, true);
+    o2_tap("client", "stap", TAP_KEEP);
+
+    wait_for_status("client", true);
+    o2assert(o2_svdelta_reset_count == 1 && o2_svdelta_delta_count == 0);
+
+    wait_for_status("client", false);
+    o2_service_free("s1");
+    wait_for_status("client", true);
+    o2assert(o2_svdelta_delta_count == 1 && o2_svdelta_reset_count == 1);
+    o2assert(o2_status("c1") >= O2_REMOTE_NOTIME);
+
+    wait_for_status("client", false);
+    wait_for_status("c2", true);
+    o2assert(o2_svdelta_reset_count == 2 && o2_svdelta_delta_count == 1);
+    o2assert(o2_status("client") >= O2_REMOTE_NOTIME);
+    o2assert(o2_status("c1") == O2_UNKNOWN);
+
+    o2_send_cmd("!client/done", 0, "");
+    O2time done = o2_local_time() + 0.5;
+    while (o2_local_time() < done) {
+        o2_poll();
+        o2_sleep(2);
+    }
+    o2_finish();
+#else
+    printf("O2_NO_SVDELTA defined, so there are no tests that can fail\n");
+#endif
+    printf("SVDELTASERVER DONE\n");
+    return 0;
+}
@@ -0,0 +1,85 @@
+// timebench.cpp -- benchmark and test time sources (see o2_time_source())
+//
+// For each time source: check that o2_local_time() continues smoothly
+// when the source is selected, check its accuracy against
+// o2_native_time() over 200 ms, and report nanoseconds per call of
+// o2_local_time() and o2_time_get(). Sources that are not available
+// on this system are reported and skipped.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "o2.h"
+#include "testassert.h"
+
+#define CALLS 2000000
+
+const char *source_names[] = {"O2_TIME_NATIVE", "O2_TIME_POLL",
+                              "O2_TIME_COARSE", "O2_TIME_TSC"};
+// allowed error over 200 ms (the coarse clock is off by up to a tick):
+double tolerance[] = {0.001, 0.001, 0.011, 0.001};
+
+
+// nanoseconds per call of o2_local_time() (or o2_time_get() if global)
+double bench(bool global)
+{
+    volatile O2time sum = 0;
+    O2time start = o2_native_time();
+    for (int i = 0; i < CALLS; i++) {
+        sum = sum + (global ? o2_time_get() : o2_local_time());
+    }
+    return (o2_native_time() - start) * 1e9 / CALLS;
+}
+
+
+int main(int argc, const char *argv[])
+{
+    printf("Usage: timebench [debugflags]\n"
+           "    see o2.h for flags, use a for (almost) all, - for none\n");
+    if (argc == 2 && argv[1][0] != '-') {
+        o2_debug_flags(argv[1]);
+        printf("debug flags are: %s\n", argv[1]);
+    }
+    o2assert(o2_time_source(O2_TIME_POLL) == O2_NOT_INITIALIZED);
+    o2_initialize("test");
+    o2_clock_set(NULL, NULL);  // so o2_time_get() has a time to get
+    o2assert(o2_time_source((O2time_source) 99) == O2_BAD_ARGS);
+
+    for (int s = O2_TIME_NATIVE; s <= O2_TIME_TSC; s++) {
+        o2_poll();
+        O2time before = o2_local_time();
+        O2err err = o2_time_source((O2time_source) s);
+        O2time after = o2_local_time();
+        if (err == O2_FAIL) {
+            printf("%-15s not available, using O2_TIME_NATIVE\n",
+                   source_names[s]);
+            continue;
+        }
+        o2assert(err == O2_SUCCESS);
+        // continuous up to rounding (TSC takes 10 ms to calibrate):
+        o2assert(after > before - 1e-9 && after - before < 0.05);
+
+        if (s == O2_TIME_POLL) {  // time advances only in o2_poll()
+            O2time t = o2_local_time();
+            o2_sleep(2);
+            o2assert(o2_local_time() == t);
+            o2_poll();
+            o2assert(o2_local_time() > t);
+        }
+
+        o2_poll();
+        O2time native = o2_native_time();
+        O2time local = o2_local_time();
+        o2_sleep(200);
+        o2_poll();
+        O2time error = (o2_local_time() - local) -
+                       (o2_native_time() - native);
+        printf("%-15s error over 200ms %8.1f us, o2_local_time %6.1f "
+               "ns, o2_time_get %6.1f ns\n", source_names[s], error * 1e6,
+               bench(false), bench(true));
+        o2assert(error > -tolerance[s] && error < tolerance[s]);
+    }
+    o2assert(o2_time_source(O2_TIME_NATIVE) == O2_SUCCESS);
+    o2_finish();
+    printf("DONE\n");
+    return 0;
+}